@@ -29,6 +29,62 @@ typedef struct _LDRP_TLS_DATA
     IMAGE_TLS_DIRECTORY TlsDirectory;
 } LDRP_TLS_DATA, *PLDRP_TLS_DATA;
 
+/* Export tables with fewer names are binary searched without an index */
+#define LDRP_EXPORT_INDEX_THRESHOLD 64
+
+/* Hashed name lookup over an export directory, built on first use */
+typedef struct _LDRP_EXPORT_INDEX_SLOT
+{
+    ULONG Hash;
+    ULONG NameIndex;
+} LDRP_EXPORT_INDEX_SLOT, *PLDRP_EXPORT_INDEX_SLOT;
+
+typedef struct _LDRP_EXPORT_INDEX
+{
+    ULONG Mask;
+    LDRP_EXPORT_INDEX_SLOT Slots[ANYSIZE_ARRAY];
+} LDRP_EXPORT_INDEX, *PLDRP_EXPORT_INDEX;
+
+/* What LdrpAllocateDataTableEntry really hands out */
+typedef struct _LDRP_DATA_TABLE_ENTRY
+{
+    LDR_DATA_TABLE_ENTRY LdrEntry;
+    PLDRP_EXPORT_INDEX ExportIndex;
+} LDRP_DATA_TABLE_ENTRY, *PLDRP_DATA_TABLE_ENTRY;
+
+#define LdrpGetPrivateEntry(Entry) \
+    CONTAINING_RECORD(Entry, LDRP_DATA_TABLE_ENTRY, LdrEntry)
+
+/* Recently resolved forwarders, flushed whenever a DLL goes away */
+#define LDRP_FORWARDER_CACHE_SIZE 64
+
+typedef struct _LDRP_FORWARDER_CACHE_ENTRY
+{
+    PVOID Forwarder;
+    PVOID Address;
+    PLDR_DATA_TABLE_ENTRY LdrEntry;
+} LDRP_FORWARDER_CACHE_ENTRY, *PLDRP_FORWARDER_CACHE_ENTRY;
+
+/* Upper bound for the MaxLoaderThreads image option */
+#define LDRP_MAX_LOADER_THREADS 8
+
+/* An import whose section a loader worker creates ahead of LdrpMapDll */
+typedef struct _LDRP_PREFETCH_ENTRY
+{
+    UNICODE_STRING DllName;
+    UNICODE_STRING FullDllName;
+    HANDLE SectionHandle;
+} LDRP_PREFETCH_ENTRY, *PLDRP_PREFETCH_ENTRY;
+
+typedef struct _LDRP_IMPORT_PREFETCH
+{
+    struct _LDRP_IMPORT_PREFETCH *Previous;
+    PWSTR DllPath;
+    LONG NextEntry;
+    ULONG EntryCount;
+    LDRP_PREFETCH_ENTRY Entries[ANYSIZE_ARRAY];
+} LDRP_IMPORT_PREFETCH, *PLDRP_IMPORT_PREFETCH;
+
 /* Global data */
 extern RTL_CRITICAL_SECTION LdrpLoaderLock;
 extern BOOLEAN LdrpInLdrInit;
@@ -47,6 +103,8 @@ extern BOOLEAN LdrpShutdownInProgress;
 extern UNICODE_STRING LdrpKnownDllPath;
 extern PLDR_DATA_TABLE_ENTRY LdrpGetModuleHandleCache, LdrpLoadedDllHandleCache;
 extern ULONG RtlpDphGlobalFlags;
+extern ULONG LdrpMaxLoaderThreads;
+extern LDRP_FORWARDER_CACHE_ENTRY LdrpForwarderCache[LDRP_FORWARDER_CACHE_SIZE];
 
 /* ldrinit.c */
 NTSTATUS NTAPI LdrpRunInitializeRoutines(IN PCONTEXT Context OPTIONAL);
@@ -63,7 +121,7 @@ VOID NTAPI LdrpValidateImageForMp(IN PLDR_DATA_TABLE_ENTRY LdrDataTableEntry);
 /* ldrpe.c */
 NTSTATUS
 NTAPI
-LdrpSnapThunk(IN PVOID ExportBase,
+LdrpSnapThunk(IN PLDR_DATA_TABLE_ENTRY ExportLdrEntry,
               IN PVOID ImportBase,
               IN PIMAGE_THUNK_DATA OriginalThunk,
               IN OUT PIMAGE_THUNK_DATA Thunk,
@@ -76,6 +134,12 @@ NTSTATUS NTAPI
 LdrpWalkImportDescriptor(IN LPWSTR DllPath OPTIONAL,
                          IN PLDR_DATA_TABLE_ENTRY LdrEntry);
 
+BOOLEAN NTAPI
+LdrpIsLoaderWorkerThread(VOID);
+
+HANDLE NTAPI
+LdrpTakePrefetchedSection(IN PUNICODE_STRING FullDllName);
+
 
 /* ldrutils.c */
 NTSTATUS NTAPI
@@ -123,6 +187,12 @@ LdrpCheckForLoadedDll(IN PWSTR DllPath,
                       IN BOOLEAN RedirectedDll,
                       OUT PLDR_DATA_TABLE_ENTRY *LdrEntry);
 
+BOOLEAN NTAPI
+LdrpResolveDllName(PWSTR DllPath,
+                   PWSTR DllName,
+                   PUNICODE_STRING FullDllName,
+                   PUNICODE_STRING BaseDllName);
+
 NTSTATUS NTAPI
 LdrpMapDll(IN PWSTR SearchPath OPTIONAL,
            IN PWSTR DllPath2,
@@ -1407,6 +1407,13 @@ LdrpInitializeExecutionOptions(PUNICODE_STRING ImagePathName, PPEB Peb, PHKEY Op
                                    sizeof(MinimumStackCommit),
                                    NULL);
 
+        LdrQueryImageFileKeyOption(KeyHandle,
+                                   L"MaxLoaderThreads",
+                                   REG_DWORD,
+                                   &LdrpMaxLoaderThreads,
+                                   sizeof(LdrpMaxLoaderThreads),
+                                   NULL);
+
         /* Update PEB's minimum stack commit if it's lower */
         if (Peb->MinimumStackCommit < MinimumStackCommit)
             Peb->MinimumStackCommit = MinimumStackCommit;
@@ -2184,6 +2191,10 @@ LdrpInit(PCONTEXT Context,
         Teb->DeallocationStack = MemoryBasicInfo.AllocationBase;
     }
 
+    /* Loader workers run while the process is initializing and never
+       attach to any DLL, so send them straight to their start routine */
+    if (LdrpIsLoaderWorkerThread()) return;
+
     /* Now check if the process is already being initialized */
     while (_InterlockedCompareExchange(&LdrpProcessInitialized,
                                       1,
@@ -16,6 +16,10 @@
 
 PVOID LdrpManifestProberRoutine;
 ULONG LdrpNormalSnap;
+ULONG LdrpMaxLoaderThreads;
+PLDRP_IMPORT_PREFETCH LdrpActivePrefetch;
+HANDLE LdrpLoaderWorkerThreadIds[LDRP_MAX_LOADER_THREADS];
+LDRP_FORWARDER_CACHE_ENTRY LdrpForwarderCache[LDRP_FORWARDER_CACHE_SIZE];
 
 /* FUNCTIONS *****************************************************************/
 
@@ -171,7 +175,7 @@ LdrpSnapIAT(IN PLDR_DATA_TABLE_ENTRY ExportLdrEntry,
             /* Snap the thunk */
             _SEH2_TRY
             {
-                Status = LdrpSnapThunk(ExportLdrEntry->DllBase,
+                Status = LdrpSnapThunk(ExportLdrEntry,
                                        ImportLdrEntry->DllBase,
                                        OriginalThunk,
                                        FirstThunk,
@@ -227,7 +231,7 @@ LdrpSnapIAT(IN PLDR_DATA_TABLE_ENTRY ExportLdrEntry,
             /* Snap the Thunk */
             _SEH2_TRY
             {
-                Status = LdrpSnapThunk(ExportLdrEntry->DllBase,
+                Status = LdrpSnapThunk(ExportLdrEntry,
                                        ImportLdrEntry->DllBase,
                                        OriginalThunk,
                                        FirstThunk,
@@ -678,6 +682,421 @@ LdrpNameToOrdinal(IN LPSTR ImportName,
     return OrdinalTable[Next];
 }
 
+ULONG
+NTAPI
+LdrpHashExportName(IN LPSTR Name)
+{
+    ULONG Hash = 0;
+
+    /* Export names are case sensitive, hash them as they are */
+    while (*Name) Hash = (Hash * 37) + (UCHAR)*Name++;
+    return Hash;
+}
+
+PLDRP_EXPORT_INDEX
+NTAPI
+LdrpBuildExportIndex(IN PVOID ExportBase,
+                     IN PIMAGE_EXPORT_DIRECTORY ExportEntry)
+{
+    PLDRP_EXPORT_INDEX Index;
+    PULONG NameTable;
+    ULONG Size, Slot, Hash, i;
+
+    /* Don't trust absurd name counts */
+    if (ExportEntry->NumberOfNames > 0x100000) return NULL;
+
+    /* Keep the table at most half full */
+    for (Size = 16; Size < (ExportEntry->NumberOfNames * 2); Size <<= 1);
+
+    /* Allocate it */
+    Index = RtlAllocateHeap(RtlGetProcessHeap(),
+                            HEAP_ZERO_MEMORY,
+                            FIELD_OFFSET(LDRP_EXPORT_INDEX, Slots[Size]));
+    if (!Index) return NULL;
+    Index->Mask = Size - 1;
+
+    /* Hash every name, the names themselves stay in the image */
+    NameTable = (PULONG)((ULONG_PTR)ExportBase +
+                         (ULONG_PTR)ExportEntry->AddressOfNames);
+    _SEH2_TRY
+    {
+        for (i = 0; i < ExportEntry->NumberOfNames; i++)
+        {
+            Hash = LdrpHashExportName((LPSTR)((ULONG_PTR)ExportBase + NameTable[i]));
+
+            /* Find a free slot, slot numbers are stored one-based */
+            for (Slot = Hash & Index->Mask;
+                 Index->Slots[Slot].NameIndex;
+                 Slot = (Slot + 1) & Index->Mask);
+
+            Index->Slots[Slot].Hash = Hash;
+            Index->Slots[Slot].NameIndex = i + 1;
+        }
+    }
+    _SEH2_EXCEPT(EXCEPTION_EXECUTE_HANDLER)
+    {
+        /* Broken export table, leave it to the binary search */
+        RtlFreeHeap(RtlGetProcessHeap(), 0, Index);
+        Index = NULL;
+    }
+    _SEH2_END;
+
+    return Index;
+}
+
+USHORT
+NTAPI
+LdrpLookupExportName(IN PLDR_DATA_TABLE_ENTRY ExportLdrEntry,
+                     IN LPSTR ImportName,
+                     IN PIMAGE_EXPORT_DIRECTORY ExportEntry,
+                     IN PULONG NameTable,
+                     IN PUSHORT OrdinalTable)
+{
+    PLDRP_DATA_TABLE_ENTRY PrivateEntry = LdrpGetPrivateEntry(ExportLdrEntry);
+    PLDRP_EXPORT_INDEX Index;
+    PVOID ExportBase = ExportLdrEntry->DllBase;
+    ULONG Hash, Slot, NameIndex;
+
+    /* Build the index the first time a large table is searched */
+    Index = PrivateEntry->ExportIndex;
+    if ((!Index) && (ExportEntry->NumberOfNames >= LDRP_EXPORT_INDEX_THRESHOLD))
+    {
+        Index = LdrpBuildExportIndex(ExportBase, ExportEntry);
+        PrivateEntry->ExportIndex = Index;
+    }
+
+    /* Without one, use the binary search */
+    if (!Index)
+    {
+        return LdrpNameToOrdinal(ImportName,
+                                 ExportEntry->NumberOfNames,
+                                 ExportBase,
+                                 NameTable,
+                                 OrdinalTable);
+    }
+
+    /* Probe until we hit an empty slot */
+    Hash = LdrpHashExportName(ImportName);
+    for (Slot = Hash & Index->Mask;
+         (NameIndex = Index->Slots[Slot].NameIndex);
+         Slot = (Slot + 1) & Index->Mask)
+    {
+        /* Only compare the names when the hashes match */
+        if ((Index->Slots[Slot].Hash == Hash) &&
+            !(strcmp(ImportName,
+                     (LPSTR)((ULONG_PTR)ExportBase + NameTable[NameIndex - 1]))))
+        {
+            return OrdinalTable[NameIndex - 1];
+        }
+    }
+
+    /* Not exported */
+    return -1;
+}
+
+BOOLEAN
+NTAPI
+LdrpIsLoaderWorkerThread(VOID)
+{
+    HANDLE ThreadId = NtCurrentTeb()->ClientId.UniqueThread;
+    ULONG i;
+
+    /* Check if we were started by LdrpStartImportPrefetch */
+    for (i = 0; i < LDRP_MAX_LOADER_THREADS; i++)
+    {
+        if (LdrpLoaderWorkerThreadIds[i] == ThreadId) return TRUE;
+    }
+
+    return FALSE;
+}
+
+VOID
+NTAPI
+LdrpPrepareImportSection(IN PWSTR DllPath OPTIONAL,
+                         IN PLDRP_PREFETCH_ENTRY Entry)
+{
+    OBJECT_ATTRIBUTES ObjectAttributes;
+    IO_STATUS_BLOCK IoStatusBlock;
+    UNICODE_STRING BaseDllName, NtPathDllName;
+    HANDLE FileHandle, SectionHandle;
+    NTSTATUS Status;
+    PWCHAR p;
+
+    /* Check if this could be a Known DLL */
+    if (LdrpKnownDllObjectDirectory)
+    {
+        /* Not if it has a path */
+        for (p = Entry->DllName.Buffer; *p; p++)
+        {
+            if ((*p == L'\\') || (*p == L'/')) break;
+        }
+
+        if (!*p)
+        {
+            /* Known DLLs already have a section, leave those to LdrpMapDll */
+            InitializeObjectAttributes(&ObjectAttributes,
+                                       &Entry->DllName,
+                                       OBJ_CASE_INSENSITIVE,
+                                       LdrpKnownDllObjectDirectory,
+                                       NULL);
+            Status = NtOpenSection(&SectionHandle,
+                                   SECTION_QUERY,
+                                   &ObjectAttributes);
+            if (NT_SUCCESS(Status))
+            {
+                NtClose(SectionHandle);
+                return;
+            }
+        }
+    }
+
+    /* Resolve the name the same way LdrpMapDll will */
+    if (!LdrpResolveDllName(DllPath,
+                            Entry->DllName.Buffer,
+                            &Entry->FullDllName,
+                            &BaseDllName))
+    {
+        /* LdrpMapDll will report this one */
+        RtlInitEmptyUnicodeString(&Entry->FullDllName, NULL, 0);
+        return;
+    }
+    RtlFreeUnicodeString(&BaseDllName);
+
+    /* Convert to NT Name */
+    if (!RtlDosPathNameToNtPathName_U(Entry->FullDllName.Buffer,
+                                      &NtPathDllName,
+                                      NULL,
+                                      NULL))
+    {
+        return;
+    }
+
+    /* Open the DLL */
+    InitializeObjectAttributes(&ObjectAttributes,
+                               &NtPathDllName,
+                               OBJ_CASE_INSENSITIVE,
+                               NULL,
+                               NULL);
+    Status = NtOpenFile(&FileHandle,
+                        SYNCHRONIZE | FILE_EXECUTE | FILE_READ_DATA,
+                        &ObjectAttributes,
+                        &IoStatusBlock,
+                        FILE_SHARE_READ | FILE_SHARE_DELETE,
+                        FILE_NON_DIRECTORY_FILE | FILE_SYNCHRONOUS_IO_NONALERT);
+    RtlFreeHeap(RtlGetProcessHeap(), 0, NtPathDllName.Buffer);
+
+    /* Any failure is left for LdrpCreateDllSection to report */
+    if (!NT_SUCCESS(Status)) return;
+
+    /* Create the image section, this is what reads in the headers */
+    Status = NtCreateSection(&SectionHandle,
+                             SECTION_MAP_READ | SECTION_MAP_EXECUTE |
+                             SECTION_MAP_WRITE | SECTION_QUERY,
+                             NULL,
+                             NULL,
+                             PAGE_EXECUTE,
+                             SEC_IMAGE,
+                             FileHandle);
+    NtClose(FileHandle);
+    if (NT_SUCCESS(Status)) Entry->SectionHandle = SectionHandle;
+}
+
+VOID
+NTAPI
+LdrpPrefetchImportSections(IN PLDRP_IMPORT_PREFETCH Prefetch)
+{
+    ULONG i;
+
+    /* Keep taking entries until they are all handed out */
+    while ((i = _InterlockedIncrement(&Prefetch->NextEntry) - 1) < Prefetch->EntryCount)
+    {
+        LdrpPrepareImportSection(Prefetch->DllPath, &Prefetch->Entries[i]);
+    }
+}
+
+ULONG
+NTAPI
+LdrpLoaderWorkerThread(IN PVOID Parameter)
+{
+    /* Do our share of the work */
+    LdrpPrefetchImportSections(Parameter);
+
+    /* We never attached to any DLL, so just go away */
+    NtCurrentTeb()->FreeStackOnTermination = TRUE;
+    NtTerminateThread(NtCurrentThread(), STATUS_SUCCESS);
+    return 0;
+}
+
+PLDRP_IMPORT_PREFETCH
+NTAPI
+LdrpStartImportPrefetch(IN LPWSTR DllPath OPTIONAL,
+                        IN PLDR_DATA_TABLE_ENTRY LdrEntry,
+                        IN PIMAGE_IMPORT_DESCRIPTOR ImportEntry)
+{
+    PIMAGE_IMPORT_DESCRIPTOR Entry;
+    PIMAGE_THUNK_DATA FirstThunk;
+    PLDRP_IMPORT_PREFETCH Prefetch;
+    PLDRP_PREFETCH_ENTRY PrefetchEntry;
+    PLDR_DATA_TABLE_ENTRY DllLdrEntry;
+    ANSI_STRING AnsiString;
+    HANDLE Threads[LDRP_MAX_LOADER_THREADS];
+    CLIENT_ID ClientId;
+    ULONG Count, ThreadCount, i;
+    NTSTATUS Status;
+
+    /* Count the imports */
+    for (Count = 0, Entry = ImportEntry;
+         (Entry->Name) && (Entry->FirstThunk);
+         Entry++)
+    {
+        Count++;
+    }
+
+    /* With a single import there is nothing to overlap */
+    if (Count < 2) return NULL;
+
+    /* Allocate the work list */
+    Prefetch = RtlAllocateHeap(RtlGetProcessHeap(),
+                               HEAP_ZERO_MEMORY,
+                               FIELD_OFFSET(LDRP_IMPORT_PREFETCH, Entries[Count]));
+    if (!Prefetch) return NULL;
+    Prefetch->DllPath = DllPath;
+
+    /* Queue every import that isn't loaded yet */
+    for (Entry = ImportEntry; (Entry->Name) && (Entry->FirstThunk); Entry++)
+    {
+        /* Skip empty thunks like LdrpHandleOneOldFormatImportDescriptor */
+        FirstThunk = (PIMAGE_THUNK_DATA)((ULONG_PTR)LdrEntry->DllBase +
+                                         Entry->FirstThunk);
+        if (!FirstThunk->u1.Function) continue;
+
+        /* Get the name as unicode */
+        PrefetchEntry = &Prefetch->Entries[Prefetch->EntryCount];
+        RtlInitAnsiString(&AnsiString,
+                          (LPSTR)((ULONG_PTR)LdrEntry->DllBase + Entry->Name));
+        Status = RtlAnsiStringToUnicodeString(&PrefetchEntry->DllName,
+                                              &AnsiString,
+                                              TRUE);
+        if (!NT_SUCCESS(Status)) continue;
+
+        /* Check if it's loaded */
+        if (LdrpCheckForLoadedDll(DllPath,
+                                  &PrefetchEntry->DllName,
+                                  TRUE,
+                                  FALSE,
+                                  &DllLdrEntry))
+        {
+            RtlFreeUnicodeString(&PrefetchEntry->DllName);
+            continue;
+        }
+
+        Prefetch->EntryCount++;
+    }
+
+    /* Use as many workers as it makes sense, we are one of them */
+    ThreadCount = LdrpMaxLoaderThreads;
+    if (ThreadCount > LDRP_MAX_LOADER_THREADS) ThreadCount = LDRP_MAX_LOADER_THREADS;
+    if (ThreadCount > LdrpNumberOfProcessors) ThreadCount = LdrpNumberOfProcessors;
+    if (ThreadCount > Prefetch->EntryCount) ThreadCount = Prefetch->EntryCount;
+
+    /* Start the helpers suspended so LdrpInit knows them when they run */
+    for (i = 0; i + 1 < ThreadCount; i++)
+    {
+        Status = RtlCreateUserThread(NtCurrentProcess(),
+                                     NULL,
+                                     TRUE,
+                                     0,
+                                     0,
+                                     0,
+                                     LdrpLoaderWorkerThread,
+                                     Prefetch,
+                                     &Threads[i],
+                                     &ClientId);
+        if (!NT_SUCCESS(Status)) break;
+
+        LdrpLoaderWorkerThreadIds[i] = ClientId.UniqueThread;
+        NtResumeThread(Threads[i], NULL);
+    }
+    ThreadCount = i;
+
+    if (ShowSnaps)
+    {
+        DPRINT1("LDR: Creating %lu import sections of %wZ on %lu workers\n",
+                Prefetch->EntryCount,
+                &LdrEntry->BaseDllName,
+                ThreadCount + 1);
+    }
+
+    /* Work along and wait for the helpers to finish */
+    LdrpPrefetchImportSections(Prefetch);
+    if (ThreadCount)
+    {
+        NtWaitForMultipleObjects(ThreadCount, Threads, WaitAll, FALSE, NULL);
+        for (i = 0; i < ThreadCount; i++)
+        {
+            LdrpLoaderWorkerThreadIds[i] = NULL;
+            NtClose(Threads[i]);
+        }
+    }
+
+    /* Make the sections visible to LdrpMapDll */
+    Prefetch->Previous = LdrpActivePrefetch;
+    LdrpActivePrefetch = Prefetch;
+    return Prefetch;
+}
+
+VOID
+NTAPI
+LdrpEndImportPrefetch(IN PLDRP_IMPORT_PREFETCH Prefetch)
+{
+    PLDRP_PREFETCH_ENTRY Entry;
+    ULONG i;
+
+    /* Nested walks end first */
+    ASSERT(LdrpActivePrefetch == Prefetch);
+    LdrpActivePrefetch = Prefetch->Previous;
+
+    /* Drop whatever LdrpMapDll didn't use */
+    for (i = 0; i < Prefetch->EntryCount; i++)
+    {
+        Entry = &Prefetch->Entries[i];
+        if (Entry->SectionHandle) NtClose(Entry->SectionHandle);
+        RtlFreeUnicodeString(&Entry->FullDllName);
+        RtlFreeUnicodeString(&Entry->DllName);
+    }
+
+    RtlFreeHeap(RtlGetProcessHeap(), 0, Prefetch);
+}
+
+HANDLE
+NTAPI
+LdrpTakePrefetchedSection(IN PUNICODE_STRING FullDllName)
+{
+    PLDRP_IMPORT_PREFETCH Prefetch;
+    PLDRP_PREFETCH_ENTRY Entry;
+    HANDLE SectionHandle;
+    ULONG i;
+
+    /* Look through the import walks in progress */
+    for (Prefetch = LdrpActivePrefetch; Prefetch; Prefetch = Prefetch->Previous)
+    {
+        for (i = 0; i < Prefetch->EntryCount; i++)
+        {
+            Entry = &Prefetch->Entries[i];
+            if ((Entry->SectionHandle) &&
+                (RtlEqualUnicodeString(FullDllName, &Entry->FullDllName, TRUE)))
+            {
+                /* The caller owns it now */
+                SectionHandle = Entry->SectionHandle;
+                Entry->SectionHandle = NULL;
+                return SectionHandle;
+            }
+        }
+    }
+
+    return NULL;
+}
+
 NTSTATUS
 NTAPI
 LdrpWalkImportDescriptor(IN LPWSTR DllPath OPTIONAL,
@@ -688,6 +1107,7 @@ LdrpWalkImportDescriptor(IN LPWSTR DllPath OPTIONAL,
     NTSTATUS Status = STATUS_SUCCESS;
     PIMAGE_BOUND_IMPORT_DESCRIPTOR BoundEntry = NULL;
     PIMAGE_IMPORT_DESCRIPTOR ImportEntry;
+    PLDRP_IMPORT_PREFETCH Prefetch = NULL;
     ULONG BoundSize, IatSize;
     DPRINT("LdrpWalkImportDescriptor('%S' %x)\n", DllPath, LdrEntry);
 
@@ -738,6 +1158,12 @@ LdrpWalkImportDescriptor(IN LPWSTR DllPath OPTIONAL,
                                                IMAGE_DIRECTORY_ENTRY_IMPORT,
                                                &IatSize);
 
+    /* Let loader workers create the import sections in parallel */
+    if ((ImportEntry) && (LdrpMaxLoaderThreads > 1))
+    {
+        Prefetch = LdrpStartImportPrefetch(DllPath, LdrEntry, ImportEntry);
+    }
+
     /* Check if we got at least one */
     if ((BoundEntry) || (ImportEntry))
     {
@@ -786,6 +1212,9 @@ LdrpWalkImportDescriptor(IN LPWSTR DllPath OPTIONAL,
         }
     }
 
+    /* Close the sections that went unused */
+    if (Prefetch) LdrpEndImportPrefetch(Prefetch);
+
     /* Release the activation context */
     RtlDeactivateActivationContextUnsafeFast(&ActCtx);
 
@@ -857,7 +1286,7 @@ LdrpLoadImportModule(IN PWSTR DllPath OPTIONAL,
 
 NTSTATUS
 NTAPI
-LdrpSnapThunk(IN PVOID ExportBase,
+LdrpSnapThunk(IN PLDR_DATA_TABLE_ENTRY ExportLdrEntry,
               IN PVOID ImportBase,
               IN PIMAGE_THUNK_DATA OriginalThunk,
               IN OUT PIMAGE_THUNK_DATA Thunk,
@@ -886,6 +1315,9 @@ LdrpSnapThunk(IN PVOID ExportBase,
     PANSI_STRING ForwardName;
     PVOID ForwarderHandle;
     ULONG ForwardOrdinal;
+    PVOID ExportBase = ExportLdrEntry->DllBase;
+    PLDRP_FORWARDER_CACHE_ENTRY CacheEntry;
+    PLDR_DATA_TABLE_ENTRY ForwarderLdrEntry;
 
     /* Check if the snap is by ordinal */
     if ((IsOrdinal = IMAGE_SNAP_BY_ORDINAL(OriginalThunk->u1.Ordinal)))
@@ -923,11 +1355,11 @@ LdrpSnapThunk(IN PVOID ExportBase,
         else
         {
             /* Well bummer, hint didn't work, do it the long way */
-            Ordinal = LdrpNameToOrdinal(ImportName,
-                                        ExportEntry->NumberOfNames,
-                                        ExportBase,
-                                        NameTable,
-                                        OrdinalTable);
+            Ordinal = LdrpLookupExportName(ExportLdrEntry,
+                                           ImportName,
+                                           ExportEntry,
+                                           NameTable,
+                                           OrdinalTable);
         }
     }
 
@@ -1027,6 +1459,30 @@ FailurePath:
         {
             /* Get the Import and Forwarder Names */
             ImportName = (LPSTR)Thunk->u1.Function;
+
+            /* Check if this forwarder was resolved recently */
+            CacheEntry = &LdrpForwarderCache[((ULONG_PTR)ImportName >> 4) &
+                                             (LDRP_FORWARDER_CACHE_SIZE - 1)];
+            if (CacheEntry->Forwarder == ImportName)
+            {
+                /* It was, so the target DLL is already loaded */
+                ForwarderLdrEntry = CacheEntry->LdrEntry;
+
+                /* Reference it just like LdrpLoadDll would have */
+                if (ForwarderLdrEntry->LoadCount != 0xFFFF)
+                {
+                    ForwarderLdrEntry->LoadCount++;
+                    if (ForwarderLdrEntry->Flags & LDRP_IMAGE_DLL)
+                    {
+                        LdrpUpdateLoadCount2(ForwarderLdrEntry, LDRP_UPDATE_REFCOUNT);
+                        LdrpClearLoadInProgress();
+                    }
+                }
+
+                Thunk->u1.Function = (ULONG_PTR)CacheEntry->Address;
+                return STATUS_SUCCESS;
+            }
+
             ForwarderName.Buffer = ImportName;
             ForwarderName.Length = (USHORT)(strchr(ImportName, '.') - ImportName);
             ForwarderName.MaximumLength = ForwarderName.Length;
@@ -1082,6 +1538,14 @@ FailurePath:
                                              FALSE);
             /* If this fails, then error out */
             if (!NT_SUCCESS(Status)) goto FailurePath;
+
+            /* Remember it for the next import of this forwarder */
+            if (LdrpCheckForLoadedDllHandle(ForwarderHandle, &ForwarderLdrEntry))
+            {
+                CacheEntry->Forwarder = ImportName;
+                CacheEntry->Address = (PVOID)Thunk->u1.Function;
+                CacheEntry->LdrEntry = ForwarderLdrEntry;
+            }
         }
         else
         {
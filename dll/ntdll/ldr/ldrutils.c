@@ -917,32 +917,39 @@ SkipCheck:
                         &FullDllName);
             }
 
-            /* Convert to NT Name */
-            if (!RtlDosPathNameToNtPathName_U(FullDllName.Buffer,
-                                              &NtPathDllName,
-                                              NULL,
-                                              NULL))
+            /* Check if a loader worker already created the section */
+            if (!DllCharacteristics)
+                SectionHandle = LdrpTakePrefetchedSection(&FullDllName);
+
+            if (!SectionHandle)
             {
-                /* Path was invalid */
-                return STATUS_OBJECT_PATH_SYNTAX_BAD;
-            }
+                /* Convert to NT Name */
+                if (!RtlDosPathNameToNtPathName_U(FullDllName.Buffer,
+                                                  &NtPathDllName,
+                                                  NULL,
+                                                  NULL))
+                {
+                    /* Path was invalid */
+                    return STATUS_OBJECT_PATH_SYNTAX_BAD;
+                }
 
-            /* Create a section for this dLL */
-            Status = LdrpCreateDllSection(&NtPathDllName,
-                                          DllHandle,
-                                          DllCharacteristics,
-                                          &SectionHandle);
+                /* Create a section for this dLL */
+                Status = LdrpCreateDllSection(&NtPathDllName,
+                                              DllHandle,
+                                              DllCharacteristics,
+                                              &SectionHandle);
 
-            /* Free the NT Name */
-            RtlFreeHeap(RtlGetProcessHeap(), 0, NtPathDllName.Buffer);
+                /* Free the NT Name */
+                RtlFreeHeap(RtlGetProcessHeap(), 0, NtPathDllName.Buffer);
 
-            /* If we failed */
-            if (!NT_SUCCESS(Status))
-            {
-                /* Free the name strings and return */
-                RtlFreeUnicodeString(&FullDllName);
-                RtlFreeUnicodeString(&BaseDllName);
-                return Status;
+                /* If we failed */
+                if (!NT_SUCCESS(Status))
+                {
+                    /* Free the name strings and return */
+                    RtlFreeUnicodeString(&FullDllName);
+                    RtlFreeUnicodeString(&BaseDllName);
+                    return Status;
+                }
             }
         }
         else
@@ -1355,10 +1362,10 @@ LdrpAllocateDataTableEntry(IN PVOID BaseAddress)
 
     if (NtHeader)
     {
-        /* Allocate an entry */
+        /* Allocate an entry, with room for our private data */
         LdrEntry = RtlAllocateHeap(RtlGetProcessHeap(),
                                    HEAP_ZERO_MEMORY,
-                                   sizeof(LDR_DATA_TABLE_ENTRY));
+                                   sizeof(LDRP_DATA_TABLE_ENTRY));
 
         /* Make sure we got one */
         if (LdrEntry)
@@ -1410,6 +1417,15 @@ LdrpFinalizeAndDeallocateDataTableEntry(IN PLDR_DATA_TABLE_ENTRY Entry)
     /* Release the full dll name string */
     if (Entry->FullDllName.Buffer) LdrpFreeUnicodeString(&Entry->FullDllName);
 
+    /* Release the export index */
+    if (LdrpGetPrivateEntry(Entry)->ExportIndex)
+    {
+        RtlFreeHeap(RtlGetProcessHeap(), 0, LdrpGetPrivateEntry(Entry)->ExportIndex);
+    }
+
+    /* Forwarders may have pointed into this DLL, forget them all */
+    RtlZeroMemory(LdrpForwarderCache, sizeof(LdrpForwarderCache));
+
     /* Finally free the entry's memory */
     RtlFreeHeap(RtlGetProcessHeap(), 0, Entry);
 }
@@ -2146,7 +2162,7 @@ LdrpGetProcedureAddress(IN PVOID BaseAddress,
         }
 
         /* Now get the thunk */
-        Status = LdrpSnapThunk(LdrEntry->DllBase,
+        Status = LdrpSnapThunk(LdrEntry,
                                ImageBase,
                                &Thunk,
                                &Thunk,
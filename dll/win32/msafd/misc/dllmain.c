@@ -2190,6 +2190,51 @@ WSPSetSockOpt(
                             sizeof(struct linger));
               return 0;
 
+           case SO_RCVBUF:
+           case SO_SNDBUF:
+              if (optlen < sizeof(INT))
+              {
+                  *lpErrno = WSAEFAULT;
+                  return SOCKET_ERROR;
+              }
+              if (*(PINT)optval < 0)
+              {
+                  *lpErrno = WSAEINVAL;
+                  return SOCKET_ERROR;
+              }
+              /* AFD always needs a buffer to stage data in, so asking for
+                 no buffering keeps the one we have */
+              if (*(PINT)optval == 0)
+                  return 0;
+
+              if (optname == SO_RCVBUF)
+              {
+                  if (SetSocketInformation(Socket,
+                                           AFD_INFO_RECEIVE_WINDOW_SIZE,
+                                           NULL,
+                                           (PULONG)optval,
+                                           NULL) != 0)
+                  {
+                      *lpErrno = WSAENOBUFS;
+                      return SOCKET_ERROR;
+                  }
+                  Socket->SharedData.SizeOfRecvBuffer = *(PULONG)optval;
+              }
+              else
+              {
+                  if (SetSocketInformation(Socket,
+                                           AFD_INFO_SEND_WINDOW_SIZE,
+                                           NULL,
+                                           (PULONG)optval,
+                                           NULL) != 0)
+                  {
+                      *lpErrno = WSAENOBUFS;
+                      return SOCKET_ERROR;
+                  }
+                  Socket->SharedData.SizeOfSendBuffer = *(PULONG)optval;
+              }
+              return 0;
+
            default:
               break;
         }
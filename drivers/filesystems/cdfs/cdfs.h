@@ -148,6 +148,9 @@ typedef struct _CDINFO
 } CDINFO, *PCDINFO;
 
 
+/* Buckets of the FCB table, must be a power of two */
+#define CDFS_FCB_HASH_BUCKETS   256
+
 typedef struct
 {
   ERESOURCE VcbResource;
@@ -155,6 +158,7 @@ typedef struct
 
   KSPIN_LOCK FcbListLock;
   LIST_ENTRY FcbListHead;
+  LIST_ENTRY FcbHashTable[CDFS_FCB_HASH_BUCKETS];	/* FCBs by path name */
 
   PVPB Vpb;
   PDEVICE_OBJECT VolumeDevice;
@@ -179,6 +183,34 @@ typedef struct _CDFS_SHORT_NAME
     WCHAR NameBuffer[13];
 } CDFS_SHORT_NAME, *PCDFS_SHORT_NAME;
 
+/* One record of a directory, as kept in the name index of its FCB */
+typedef struct _CDFS_INDEXED_NAME
+{
+    LIST_ENTRY LongNameEntry;	/* bucket of the long name */
+    LIST_ENTRY ShortNameEntry;	/* bucket of the short name */
+    ULONG DirIndex;		/* position of the record in the directory */
+    ULONG Offset;		/* record offset in the directory file */
+    DIR_RECORD Record;
+    UNICODE_STRING ShortName;
+    WCHAR ShortNameBuffer[13];
+    UNICODE_STRING LongName;
+    WCHAR LongNameBuffer[1];
+} CDFS_INDEXED_NAME, *PCDFS_INDEXED_NAME;
+
+/*
+ * Built on the first lookup in a directory and never changed afterwards,
+ * the media being read-only. Names[] holds the records in directory order,
+ * so a record's position in it is its DirIndex.
+ */
+typedef struct _CDFS_NAME_INDEX
+{
+    ULONG Count;
+    ULONG HashMask;		/* bucket count - 1 */
+    PLIST_ENTRY LongNameHash;
+    PLIST_ENTRY ShortNameHash;
+    PCDFS_INDEXED_NAME Names[1];
+} CDFS_NAME_INDEX, *PCDFS_NAME_INDEX;
+
 typedef struct _FCB
 {
   FSRTL_COMMON_FCB_HEADER RFCB;
@@ -196,6 +228,8 @@ typedef struct _FCB
   WCHAR ShortNameBuffer[13];
 
   LIST_ENTRY FcbListEntry;
+  LIST_ENTRY FcbHashEntry;
+  ULONG PathHash;
   struct _FCB* ParentFcb;
 
   ULONG DirIndex;
@@ -210,6 +244,7 @@ typedef struct _FCB
 
   ERESOURCE  NameListResource;
   LIST_ENTRY ShortNameList;
+  PCDFS_NAME_INDEX NameIndex;	/* directories only, under NameListResource */
 } FCB, *PFCB;
 
 
@@ -351,6 +386,17 @@ CdfsAttachFCBToFileObject(PDEVICE_EXTENSION Vcb,
 			  PFCB Fcb,
 			  PFILE_OBJECT FileObject);
 
+NTSTATUS
+CdfsGetNameIndex(PDEVICE_EXTENSION DeviceExt,
+		 PFCB DirectoryFcb,
+		 PCDFS_NAME_INDEX *NameIndex);
+
+NTSTATUS
+CdfsFindIndexedName(PCDFS_NAME_INDEX NameIndex,
+		    PUNICODE_STRING FileToFind,
+		    PULONG pDirIndex,
+		    PCDFS_INDEXED_NAME *IndexedName);
+
 NTSTATUS
 CdfsDirFindFile(PDEVICE_EXTENSION DeviceExt,
 		PFCB DirectoryFcb,
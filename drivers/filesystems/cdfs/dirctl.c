@@ -41,115 +41,6 @@
 
 /* FUNCTIONS ****************************************************************/
 
-/*
-* FUNCTION: Retrieves the file name, be it in short or long file name format
-*/
-static NTSTATUS
-CdfsGetEntryName(PDEVICE_EXTENSION DeviceExt,
-                 PVOID *Context,
-                 PVOID *Block,
-                 PLARGE_INTEGER StreamOffset,
-                 ULONG DirLength,
-                 PVOID *Ptr,
-                 PWSTR Name,
-                 PULONG pIndex,
-                 PULONG CurrentOffset)
-{
-    PDIR_RECORD Record = *Ptr;
-    ULONG Index;
-
-    if (*CurrentOffset >= DirLength)
-        return(STATUS_NO_MORE_ENTRIES);
-
-    if (*CurrentOffset == 0)
-    {
-        Index = 0;
-        Record = (PDIR_RECORD)*Block;
-        while (Index < *pIndex)
-        {
-            (*Ptr) = (PVOID)((ULONG_PTR)(*Ptr) + Record->RecordLength);
-            (*CurrentOffset) += Record->RecordLength;
-            Record = *Ptr;
-            if ((ULONG_PTR)(*Ptr) - (ULONG_PTR)(*Block) >= BLOCKSIZE || Record->RecordLength == 0)
-            {
-                DPRINT("Map next sector\n");
-                CcUnpinData(*Context);
-                StreamOffset->QuadPart += BLOCKSIZE;
-                *CurrentOffset = ROUND_UP(*CurrentOffset, BLOCKSIZE);
-                if (!CcMapData(DeviceExt->StreamFileObject,
-                    StreamOffset,
-                    BLOCKSIZE, TRUE,
-                    Context, Block))
-                {
-                    DPRINT("CcMapData() failed\n");
-                    return(STATUS_UNSUCCESSFUL);
-                }
-                *Ptr = *Block;
-                Record = (PDIR_RECORD)*Ptr;
-            }
-            if (*CurrentOffset >= DirLength)
-                return(STATUS_NO_MORE_ENTRIES);
-
-            Index++;
-        }
-    }
-
-    if ((ULONG_PTR)(*Ptr) - (ULONG_PTR)(*Block) >= BLOCKSIZE || Record->RecordLength == 0)
-    {
-        DPRINT("Map next sector\n");
-        CcUnpinData(*Context);
-        StreamOffset->QuadPart += BLOCKSIZE;
-        *CurrentOffset = ROUND_UP(*CurrentOffset, BLOCKSIZE);
-        if (!CcMapData(DeviceExt->StreamFileObject,
-            StreamOffset,
-            BLOCKSIZE, TRUE,
-            Context, Block))
-        {
-            DPRINT("CcMapData() failed\n");
-            return(STATUS_UNSUCCESSFUL);
-        }
-        *Ptr = *Block;
-        Record = (PDIR_RECORD)*Ptr;
-    }
-
-    if (*CurrentOffset >= DirLength)
-        return STATUS_NO_MORE_ENTRIES;
-
-    DPRINT("Index %lu  RecordLength %lu  Offset %lu\n",
-        *pIndex, Record->RecordLength, *CurrentOffset);
-
-    if (Record->FileIdLength == 1 && Record->FileId[0] == 0)
-    {
-        wcscpy(Name, L".");
-    }
-    else if (Record->FileIdLength == 1 && Record->FileId[0] == 1)
-    {
-        wcscpy(Name, L"..");
-    }
-    else
-    {
-        if (DeviceExt->CdInfo.JolietLevel == 0)
-        {
-            ULONG i;
-
-            for (i = 0; i < Record->FileIdLength && Record->FileId[i] != ';'; i++)
-                Name[i] = (WCHAR)Record->FileId[i];
-            Name[i] = 0;
-        }
-        else
-        {
-            CdfsSwapString(Name, Record->FileId, Record->FileIdLength);
-        }
-    }
-
-    DPRINT("Name '%S'\n", Name);
-
-    *Ptr = Record;
-
-    return(STATUS_SUCCESS);
-}
-
-
 /*
 * FUNCTION: Find a file
 */
@@ -161,22 +52,13 @@ CdfsFindFile(PDEVICE_EXTENSION DeviceExt,
              PULONG pDirIndex,
              PULONG pOffset)
 {
-    WCHAR name[256];
-    WCHAR ShortNameBuffer[13];
     UNICODE_STRING TempString;
-    UNICODE_STRING ShortName;
-    UNICODE_STRING LongName;
-    UNICODE_STRING FileToFindUpcase;
-    PVOID Block;
+    PCDFS_NAME_INDEX NameIndex;
+    PCDFS_INDEXED_NAME IndexedName;
     NTSTATUS Status;
     ULONG len;
     ULONG DirIndex;
-    ULONG Offset = 0;
     BOOLEAN IsRoot;
-    PVOID Context = NULL;
-    ULONG DirSize;
-    PDIR_RECORD Record;
-    LARGE_INTEGER StreamOffset, OffsetOfEntry;
 
     DPRINT("FindFile(Parent %x, FileToFind '%wZ', DirIndex: %d)\n",
         Parent, FileToFind, pDirIndex ? *pDirIndex : 0);
@@ -206,10 +88,6 @@ CdfsFindFile(PDEVICE_EXTENSION DeviceExt,
 
     if (IsRoot == TRUE)
     {
-        StreamOffset.QuadPart = (LONGLONG)DeviceExt->CdInfo.RootStart * (LONGLONG)BLOCKSIZE;
-        DirSize = DeviceExt->CdInfo.RootSize;
-
-
         if (FileToFind->Buffer[0] == 0 ||
             (FileToFind->Buffer[0] == '\\' && FileToFind->Buffer[1] == 0) ||
             (FileToFind->Buffer[0] == '.' && FileToFind->Buffer[1] == 0))
@@ -231,137 +109,56 @@ CdfsFindFile(PDEVICE_EXTENSION DeviceExt,
             return STATUS_SUCCESS;
         }
     }
-    else
-    {
-        StreamOffset.QuadPart = (LONGLONG)Parent->Entry.ExtentLocationL * (LONGLONG)BLOCKSIZE;
-        DirSize = Parent->Entry.DataLengthL;
-    }
 
-    DPRINT("StreamOffset %I64u  DirSize %lu\n", StreamOffset.QuadPart, DirSize);
+    ASSERT(Parent);
 
+    /* Resume at the record index, the index holds the names in directory order */
     if (pDirIndex && (*pDirIndex))
         DirIndex = *pDirIndex;
 
-    if (pOffset && (*pOffset))
+    Status = CdfsGetNameIndex(DeviceExt, Parent, &NameIndex);
+    if (!NT_SUCCESS(Status))
     {
-        Offset = *pOffset;
-        StreamOffset.QuadPart += ROUND_DOWN(Offset, BLOCKSIZE);
+        return Status;
     }
 
-    if (!CcMapData(DeviceExt->StreamFileObject, &StreamOffset,
-        BLOCKSIZE, TRUE, &Context, &Block))
+    Status = CdfsFindIndexedName(NameIndex, FileToFind, &DirIndex, &IndexedName);
+    if (!NT_SUCCESS(Status))
     {
-        DPRINT("CcMapData() failed\n");
+        if (pDirIndex)
+            *pDirIndex = NameIndex->Count;
         return STATUS_UNSUCCESSFUL;
     }
 
-    Record = (PDIR_RECORD) ((ULONG_PTR)Block + Offset % BLOCKSIZE);
-    if (Offset)
-    {
-        Offset += Record->RecordLength;
-        Record = (PDIR_RECORD)((ULONG_PTR)Record + Record->RecordLength);
-    }
-
-    /* Upper case the expression for FsRtlIsNameInExpression */
-    Status = RtlUpcaseUnicodeString(&FileToFindUpcase, FileToFind, TRUE);
-    if (!NT_SUCCESS(Status))
+    len = wcslen(Parent->PathName);
+    memcpy(Fcb->PathName, Parent->PathName, len*sizeof(WCHAR));
+    Fcb->ObjectName=&Fcb->PathName[len];
+    if (len != 1 || Fcb->PathName[0] != '\\')
     {
-        return Status;
+        Fcb->ObjectName[0] = '\\';
+        Fcb->ObjectName = &Fcb->ObjectName[1];
     }
 
-    while(TRUE)
-    {
-        DPRINT("RecordLength %u  ExtAttrRecordLength %u  NameLength %u\n",
-            Record->RecordLength, Record->ExtAttrRecordLength, Record->FileIdLength);
-
-        Status = CdfsGetEntryName
-            (DeviceExt, &Context, &Block, &StreamOffset,
-            DirSize, (PVOID*)&Record, name, &DirIndex, &Offset);
-
-        if (Status == STATUS_NO_MORE_ENTRIES)
-        {
-            break;
-        }
-        else if (Status == STATUS_UNSUCCESSFUL)
-        {
-            /* Note: the directory cache has already been unpinned */
-            RtlFreeUnicodeString(&FileToFindUpcase);
-            return Status;
-        }
-
-        DPRINT("Name '%S'\n", name);
-
-        RtlInitUnicodeString(&LongName, name);
-        ShortName.Length = 0;
-        ShortName.MaximumLength = 26;
-        ShortName.Buffer = ShortNameBuffer;
-
-        OffsetOfEntry.QuadPart = StreamOffset.QuadPart + Offset;
-        CdfsShortNameCacheGet(Parent, &OffsetOfEntry, &LongName, &ShortName);
-
-        DPRINT("ShortName '%wZ'\n", &ShortName);
-
-        if (FsRtlIsNameInExpression(&FileToFindUpcase, &LongName, TRUE, NULL) ||
-            FsRtlIsNameInExpression(&FileToFindUpcase, &ShortName, TRUE, NULL))
-        {
-            if (Parent && Parent->PathName)
-            {
-                len = wcslen(Parent->PathName);
-                memcpy(Fcb->PathName, Parent->PathName, len*sizeof(WCHAR));
-                Fcb->ObjectName=&Fcb->PathName[len];
-                if (len != 1 || Fcb->PathName[0] != '\\')
-                {
-                    Fcb->ObjectName[0] = '\\';
-                    Fcb->ObjectName = &Fcb->ObjectName[1];
-                }
-            }
-            else
-            {
-                Fcb->ObjectName=Fcb->PathName;
-                Fcb->ObjectName[0]='\\';
-                Fcb->ObjectName=&Fcb->ObjectName[1];
-            }
-
-            DPRINT("PathName '%S'  ObjectName '%S'\n", Fcb->PathName, Fcb->ObjectName);
+    DPRINT("PathName '%S'  ObjectName '%S'\n", Fcb->PathName, Fcb->ObjectName);
 
-            memcpy(&Fcb->Entry, Record, sizeof(DIR_RECORD));
-            wcsncpy(Fcb->ObjectName, name, MAX_PATH);
+    memcpy(&Fcb->Entry, &IndexedName->Record, sizeof(DIR_RECORD));
+    wcsncpy(Fcb->ObjectName, IndexedName->LongNameBuffer, MAX_PATH - (Fcb->ObjectName - Fcb->PathName));
 
-            /* Copy short name */
-            Fcb->ShortNameU.Length = ShortName.Length;
-            Fcb->ShortNameU.MaximumLength = ShortName.Length;
-            Fcb->ShortNameU.Buffer = Fcb->ShortNameBuffer;
-            memcpy(Fcb->ShortNameBuffer, ShortName.Buffer, ShortName.Length);
-
-            if (pDirIndex)
-                *pDirIndex = DirIndex;
-            if (pOffset)
-                *pOffset = Offset;
-
-            DPRINT("FindFile: new Pathname %S, new Objectname %S, DirIndex %d\n",
-                Fcb->PathName, Fcb->ObjectName, DirIndex);
-
-            RtlFreeUnicodeString(&FileToFindUpcase);
-            CcUnpinData(Context);
-
-            return STATUS_SUCCESS;
-        }
-
-        Offset += Record->RecordLength;
-        Record = (PDIR_RECORD)((ULONG_PTR)Record + Record->RecordLength);
-        DirIndex++;
-    }
-
-    RtlFreeUnicodeString(&FileToFindUpcase);
-    CcUnpinData(Context);
+    /* Copy short name */
+    Fcb->ShortNameU.Length = IndexedName->ShortName.Length;
+    Fcb->ShortNameU.MaximumLength = IndexedName->ShortName.Length;
+    Fcb->ShortNameU.Buffer = Fcb->ShortNameBuffer;
+    memcpy(Fcb->ShortNameBuffer, IndexedName->ShortName.Buffer, IndexedName->ShortName.Length);
 
     if (pDirIndex)
         *pDirIndex = DirIndex;
-
     if (pOffset)
-        *pOffset = Offset;
+        *pOffset = IndexedName->Offset;
+
+    DPRINT("FindFile: new Pathname %S, new Objectname %S, DirIndex %d\n",
+        Fcb->PathName, Fcb->ObjectName, DirIndex);
 
-    return STATUS_UNSUCCESSFUL;
+    return STATUS_SUCCESS;
 }
 
 
@@ -57,6 +57,51 @@ CdfsGetNextPathElement(PWCHAR FileName)
 }
 
 
+static ULONG
+CdfsHashPathName(PCWSTR PathName)
+{
+    ULONG Hash = 0;
+
+    /* Fold the case the way _wcsicmp does, so equal paths share a bucket */
+    while (*PathName != L'\0')
+    {
+        Hash = Hash * 31 + towlower(*PathName);
+        PathName++;
+    }
+
+    return(Hash);
+}
+
+
+static ULONG
+CdfsHashName(PUNICODE_STRING Name)
+{
+    ULONG Hash = 0;
+    ULONG i;
+
+    for (i = 0; i < Name->Length / sizeof(WCHAR); i++)
+    {
+        Hash = Hash * 31 + RtlUpcaseUnicodeChar(Name->Buffer[i]);
+    }
+
+    return(Hash);
+}
+
+
+static VOID
+CdfsFreeNameIndex(PCDFS_NAME_INDEX NameIndex)
+{
+    ULONG i;
+
+    for (i = 0; i < NameIndex->Count; i++)
+    {
+        ExFreePoolWithTag(NameIndex->Names[i], TAG_FCB);
+    }
+
+    ExFreePoolWithTag(NameIndex, TAG_FCB);
+}
+
+
 static VOID
 CdfsWSubString(PWCHAR pTarget, const PWCHAR pSource, size_t pLength)
 {
@@ -115,6 +160,11 @@ CdfsDestroyFCB(PFCB Fcb)
         ExFreePoolWithTag(Entry, TAG_FCB);
     }
 
+    if (Fcb->NameIndex != NULL)
+    {
+        CdfsFreeNameIndex(Fcb->NameIndex);
+    }
+
     ExDeleteResourceLite(&Fcb->NameListResource);
     ExFreePoolWithTag(Fcb, TAG_FCB);
 }
@@ -167,6 +217,7 @@ CdfsReleaseFCB(PDEVICE_EXTENSION Vcb,
     if (Fcb->RefCount <= 0 && !CdfsFCBIsDirectory(Fcb))
     {
         RemoveEntryList(&Fcb->FcbListEntry);
+        RemoveEntryList(&Fcb->FcbHashEntry);
         CdfsDestroyFCB(Fcb);
     }
     KeReleaseSpinLock(&Vcb->FcbListLock, oldIrql);
@@ -179,9 +230,13 @@ CdfsAddFCBToTable(PDEVICE_EXTENSION Vcb,
 {
     KIRQL  oldIrql;
 
+    Fcb->PathHash = CdfsHashPathName(Fcb->PathName);
+
     KeAcquireSpinLock(&Vcb->FcbListLock, &oldIrql);
     Fcb->DevExt = Vcb;
     InsertTailList(&Vcb->FcbListHead, &Fcb->FcbListEntry);
+    InsertTailList(&Vcb->FcbHashTable[Fcb->PathHash & (CDFS_FCB_HASH_BUCKETS - 1)],
+                   &Fcb->FcbHashEntry);
     KeReleaseSpinLock(&Vcb->FcbListLock, oldIrql);
 }
 
@@ -193,25 +248,32 @@ CdfsGrabFCBFromTable(PDEVICE_EXTENSION Vcb,
     KIRQL  oldIrql;
     PFCB Fcb;
     PLIST_ENTRY  current_entry;
-
-    KeAcquireSpinLock(&Vcb->FcbListLock, &oldIrql);
+    PLIST_ENTRY  bucket;
+    ULONG Hash;
 
     if (FileName == NULL || FileName->Length == 0 || FileName->Buffer[0] == 0)
     {
         DPRINT("Return FCB for stream file object\n");
+        KeAcquireSpinLock(&Vcb->FcbListLock, &oldIrql);
         Fcb = Vcb->StreamFileObject->FsContext;
         Fcb->RefCount++;
         KeReleaseSpinLock(&Vcb->FcbListLock, oldIrql);
         return(Fcb);
     }
 
-    current_entry = Vcb->FcbListHead.Flink;
-    while (current_entry != &Vcb->FcbListHead)
+    Hash = CdfsHashPathName(FileName->Buffer);
+    bucket = &Vcb->FcbHashTable[Hash & (CDFS_FCB_HASH_BUCKETS - 1)];
+
+    KeAcquireSpinLock(&Vcb->FcbListLock, &oldIrql);
+
+    current_entry = bucket->Flink;
+    while (current_entry != bucket)
     {
-        Fcb = CONTAINING_RECORD(current_entry, FCB, FcbListEntry);
+        Fcb = CONTAINING_RECORD(current_entry, FCB, FcbHashEntry);
 
         DPRINT("Comparing '%wZ' and '%S'\n", FileName, Fcb->PathName);
-        if (_wcsicmp(FileName->Buffer, Fcb->PathName) == 0)
+        if (Fcb->PathHash == Hash &&
+            _wcsicmp(FileName->Buffer, Fcb->PathName) == 0)
         {
             Fcb->RefCount++;
             KeReleaseSpinLock(&Vcb->FcbListLock, oldIrql);
@@ -457,45 +519,38 @@ CdfsAttachFCBToFileObject(PDEVICE_EXTENSION Vcb,
 }
 
 
-NTSTATUS
-CdfsDirFindFile(PDEVICE_EXTENSION DeviceExt,
-                PFCB DirectoryFcb,
-                PUNICODE_STRING FileToFind,
-                PFCB *FoundFCB)
+static NTSTATUS
+CdfsBuildNameIndex(PDEVICE_EXTENSION DeviceExt,
+                   PFCB DirectoryFcb,
+                   PCDFS_NAME_INDEX *pNameIndex)
+                   /*
+                   * FUNCTION: Reads all records of a directory once and
+                   * indexes them by their long and short names.
+                   */
 {
-    UNICODE_STRING TempName;
+    LIST_ENTRY NameList;
+    PLIST_ENTRY Entry;
+    PCDFS_INDEXED_NAME IndexedName;
+    PCDFS_NAME_INDEX NameIndex;
     WCHAR Name[256];
+    UNICODE_STRING LongName;
     PVOID Block;
-    ULONG DirSize;
+    PVOID Context;
     PDIR_RECORD Record;
+    ULONG DirSize;
     ULONG Offset;
     ULONG BlockOffset;
-    NTSTATUS Status;
-
+    ULONG Count;
+    ULONG Buckets;
+    ULONG Bucket;
+    ULONG i;
     LARGE_INTEGER StreamOffset, OffsetOfEntry;
-    PVOID Context;
-
-    WCHAR ShortNameBuffer[13];
-    UNICODE_STRING ShortName;
-    UNICODE_STRING LongName;
-    UNICODE_STRING FileToFindUpcase;
-
-    ASSERT(DeviceExt);
-    ASSERT(DirectoryFcb);
-    ASSERT(FileToFind);
+    NTSTATUS Status = STATUS_SUCCESS;
 
-    DPRINT("CdfsDirFindFile(VCB:%p, dirFCB:%p, File:%wZ)\n",
-        DeviceExt,
-        DirectoryFcb,
-        FileToFind);
-    DPRINT("Dir Path:%S\n", DirectoryFcb->PathName);
+    DPRINT("CdfsBuildNameIndex(%S)\n", DirectoryFcb->PathName);
 
-    /* default to '.' if no filename specified */
-    if (FileToFind->Length == 0)
-    {
-        RtlInitUnicodeString(&TempName, L".");
-        FileToFind = &TempName;
-    }
+    InitializeListHead(&NameList);
+    Count = 0;
 
     DirSize = DirectoryFcb->Entry.DataLengthL;
     StreamOffset.QuadPart = (LONGLONG)DirectoryFcb->Entry.ExtentLocationL * (LONGLONG)BLOCKSIZE;
@@ -515,68 +570,66 @@ CdfsDirFindFile(PDEVICE_EXTENSION DeviceExt,
     BlockOffset = 0;
     Record = (PDIR_RECORD)Block;
 
-    /* Upper case the expression for FsRtlIsNameInExpression */
-    Status = RtlUpcaseUnicodeString(&FileToFindUpcase, FileToFind, TRUE);
-    if (!NT_SUCCESS(Status))
+    while (Offset < DirSize)
     {
-        return Status;
-    }
+        /* A record too short for its name ends the directory */
+        if (Record->RecordLength < FIELD_OFFSET(DIR_RECORD, FileId) + Record->FileIdLength)
+        {
+            DPRINT("RecordLength %u  Stopped!\n", Record->RecordLength);
+            break;
+        }
 
-    while(TRUE)
-    {
-        if (Record->RecordLength == 0)
+        CdfsGetDirEntryName(DeviceExt, Record, Name);
+        RtlInitUnicodeString(&LongName, Name);
+
+        IndexedName = ExAllocatePoolWithTag(PagedPool,
+            FIELD_OFFSET(CDFS_INDEXED_NAME, LongNameBuffer) + LongName.Length + sizeof(WCHAR),
+            TAG_FCB);
+        if (IndexedName == NULL)
         {
-            DPRINT("RecordLength == 0  Stopped!\n");
+            Status = STATUS_INSUFFICIENT_RESOURCES;
             break;
         }
 
-        DPRINT("RecordLength %u  ExtAttrRecordLength %u  NameLength %u\n",
-            Record->RecordLength, Record->ExtAttrRecordLength, Record->FileIdLength);
+        IndexedName->DirIndex = Count;
+        IndexedName->Offset = Offset;
+        memcpy(&IndexedName->Record, Record, sizeof(DIR_RECORD));
 
-        CdfsGetDirEntryName(DeviceExt, Record, Name);
-        DPRINT ("Name '%S'\n", Name);
-        DPRINT ("Sector %lu\n", DirectoryFcb->Entry.ExtentLocationL);
-        DPRINT ("Offset %lu\n", Offset);
+        IndexedName->LongName.Length = LongName.Length;
+        IndexedName->LongName.MaximumLength = LongName.Length + sizeof(WCHAR);
+        IndexedName->LongName.Buffer = IndexedName->LongNameBuffer;
+        memcpy(IndexedName->LongNameBuffer, Name, LongName.Length + sizeof(WCHAR));
 
-        RtlInitUnicodeString(&LongName, Name);
-        ShortName.Length = 0;
-        ShortName.MaximumLength = 26;
-        ShortName.Buffer = ShortNameBuffer;
-        memset(ShortNameBuffer, 0, 26);
+        /* Short names are made unique in directory order, as they always were */
+        IndexedName->ShortName.Length = 0;
+        IndexedName->ShortName.MaximumLength = sizeof(IndexedName->ShortNameBuffer);
+        IndexedName->ShortName.Buffer = IndexedName->ShortNameBuffer;
+        RtlZeroMemory(IndexedName->ShortNameBuffer, sizeof(IndexedName->ShortNameBuffer));
 
         OffsetOfEntry.QuadPart = StreamOffset.QuadPart + Offset;
-        CdfsShortNameCacheGet(DirectoryFcb, &OffsetOfEntry, &LongName, &ShortName);
+        CdfsShortNameCacheGet(DirectoryFcb, &OffsetOfEntry,
+            &IndexedName->LongName, &IndexedName->ShortName);
 
-        DPRINT("ShortName '%wZ'\n", &ShortName);
+        DPRINT("Name '%S'  ShortName '%wZ'  Offset %lu\n",
+            Name, &IndexedName->ShortName, Offset);
 
-        if (FsRtlIsNameInExpression(&FileToFindUpcase, &LongName, TRUE, NULL) ||
-            FsRtlIsNameInExpression(&FileToFindUpcase, &ShortName, TRUE, NULL))
-        {
-            DPRINT("Match found, %S\n", Name);
-            Status = CdfsMakeFCBFromDirEntry(DeviceExt,
-                DirectoryFcb,
-                Name,
-                ShortNameBuffer,
-                Record,
-                DirectoryFcb->Entry.ExtentLocationL,
-                Offset,
-                FoundFCB);
-
-            RtlFreeUnicodeString(&FileToFindUpcase);
-            CcUnpinData(Context);
-
-            return(Status);
-        }
+        /* Chained through the long name link until the index is allocated */
+        InsertTailList(&NameList, &IndexedName->LongNameEntry);
+        Count++;
 
         Offset += Record->RecordLength;
         BlockOffset += Record->RecordLength;
         Record = (PDIR_RECORD)((ULONG_PTR)Block + BlockOffset);
         if (BlockOffset >= BLOCKSIZE || Record->RecordLength == 0)
         {
+            /* The rest of this sector is padding */
+            Offset = ROUND_UP(Offset, BLOCKSIZE);
+            if (Offset >= DirSize)
+                break;
+
             DPRINT("Map next sector\n");
             CcUnpinData(Context);
             StreamOffset.QuadPart += BLOCKSIZE;
-            Offset = ROUND_UP(Offset, BLOCKSIZE);
             BlockOffset = 0;
 
             if (!CcMapData(DeviceExt->StreamFileObject,
@@ -585,20 +638,260 @@ CdfsDirFindFile(PDEVICE_EXTENSION DeviceExt,
                 &Context, &Block))
             {
                 DPRINT("CcMapData() failed\n");
-                RtlFreeUnicodeString(&FileToFindUpcase);
-                return(STATUS_UNSUCCESSFUL);
+                Context = NULL;
+                Status = STATUS_UNSUCCESSFUL;
+                break;
             }
-            Record = (PDIR_RECORD)((ULONG_PTR)Block + BlockOffset);
+            Record = (PDIR_RECORD)Block;
+        }
+    }
+
+    if (Context != NULL)
+    {
+        CcUnpinData(Context);
+    }
+
+    /* About one name per bucket */
+    Buckets = 16;
+    while (Buckets < Count)
+        Buckets <<= 1;
+
+    NameIndex = NULL;
+    if (NT_SUCCESS(Status))
+    {
+        NameIndex = ExAllocatePoolWithTag(PagedPool,
+            FIELD_OFFSET(CDFS_NAME_INDEX, Names) +
+            Count * sizeof(PCDFS_INDEXED_NAME) +
+            2 * Buckets * sizeof(LIST_ENTRY),
+            TAG_FCB);
+        if (NameIndex == NULL)
+        {
+            Status = STATUS_INSUFFICIENT_RESOURCES;
         }
+    }
 
-        if (Offset >= DirSize)
+    if (!NT_SUCCESS(Status))
+    {
+        while (!IsListEmpty(&NameList))
+        {
+            Entry = RemoveHeadList(&NameList);
+            ExFreePoolWithTag(CONTAINING_RECORD(Entry, CDFS_INDEXED_NAME, LongNameEntry), TAG_FCB);
+        }
+        return Status;
+    }
+
+    NameIndex->Count = Count;
+    NameIndex->HashMask = Buckets - 1;
+    NameIndex->LongNameHash = (PLIST_ENTRY)&NameIndex->Names[Count];
+    NameIndex->ShortNameHash = NameIndex->LongNameHash + Buckets;
+    for (i = 0; i < Buckets; i++)
+    {
+        InitializeListHead(&NameIndex->LongNameHash[i]);
+        InitializeListHead(&NameIndex->ShortNameHash[i]);
+    }
+
+    /* Buckets keep directory order, so the first hit is the first record */
+    for (i = 0; i < Count; i++)
+    {
+        Entry = RemoveHeadList(&NameList);
+        IndexedName = CONTAINING_RECORD(Entry, CDFS_INDEXED_NAME, LongNameEntry);
+        NameIndex->Names[i] = IndexedName;
+
+        Bucket = CdfsHashName(&IndexedName->LongName) & NameIndex->HashMask;
+        InsertTailList(&NameIndex->LongNameHash[Bucket], &IndexedName->LongNameEntry);
+
+        Bucket = CdfsHashName(&IndexedName->ShortName) & NameIndex->HashMask;
+        InsertTailList(&NameIndex->ShortNameHash[Bucket], &IndexedName->ShortNameEntry);
+    }
+
+    DPRINT("Indexed %lu names in %lu buckets\n", Count, Buckets);
+
+    *pNameIndex = NameIndex;
+
+    return STATUS_SUCCESS;
+}
+
+
+NTSTATUS
+CdfsGetNameIndex(PDEVICE_EXTENSION DeviceExt,
+                 PFCB DirectoryFcb,
+                 PCDFS_NAME_INDEX *NameIndex)
+                 /*
+                 * FUNCTION: Returns the name index of a directory, building
+                 * it on first use. The index stays valid as long as the
+                 * caller holds a reference on the directory FCB.
+                 */
+{
+    NTSTATUS Status = STATUS_SUCCESS;
+
+    ExAcquireResourceSharedLite(&DirectoryFcb->NameListResource, TRUE);
+    *NameIndex = DirectoryFcb->NameIndex;
+    ExReleaseResourceLite(&DirectoryFcb->NameListResource);
+
+    if (*NameIndex != NULL)
+    {
+        return STATUS_SUCCESS;
+    }
+
+    /* Whoever gets the resource first builds it, the others find it done */
+    ExAcquireResourceExclusiveLite(&DirectoryFcb->NameListResource, TRUE);
+    if (DirectoryFcb->NameIndex == NULL)
+    {
+        Status = CdfsBuildNameIndex(DeviceExt,
+            DirectoryFcb,
+            &DirectoryFcb->NameIndex);
+    }
+    *NameIndex = DirectoryFcb->NameIndex;
+    ExReleaseResourceLite(&DirectoryFcb->NameListResource);
+
+    return Status;
+}
+
+
+NTSTATUS
+CdfsFindIndexedName(PCDFS_NAME_INDEX NameIndex,
+                    PUNICODE_STRING FileToFind,
+                    PULONG pDirIndex,
+                    PCDFS_INDEXED_NAME *IndexedName)
+                    /*
+                    * FUNCTION: Finds the first record at or after *pDirIndex
+                    * whose long or short name matches FileToFind, which may
+                    * contain wildcards.
+                    */
+{
+    UNICODE_STRING FileToFindUpcase;
+    PCDFS_INDEXED_NAME Current;
+    PCDFS_INDEXED_NAME Match;
+    PLIST_ENTRY Bucket;
+    PLIST_ENTRY Entry;
+    ULONG DirIndex;
+    NTSTATUS Status;
+
+    DirIndex = (pDirIndex != NULL) ? *pDirIndex : 0;
+
+    if (!FsRtlDoesNameContainWildCards(FileToFind))
+    {
+        Match = NULL;
+
+        /* Look in both buckets and take whichever record comes first */
+        Bucket = &NameIndex->LongNameHash[CdfsHashName(FileToFind) & NameIndex->HashMask];
+        for (Entry = Bucket->Flink; Entry != Bucket; Entry = Entry->Flink)
+        {
+            Current = CONTAINING_RECORD(Entry, CDFS_INDEXED_NAME, LongNameEntry);
+            if (Current->DirIndex >= DirIndex &&
+                RtlEqualUnicodeString(FileToFind, &Current->LongName, TRUE))
+            {
+                Match = Current;
+                break;
+            }
+        }
+
+        Bucket = &NameIndex->ShortNameHash[CdfsHashName(FileToFind) & NameIndex->HashMask];
+        for (Entry = Bucket->Flink; Entry != Bucket; Entry = Entry->Flink)
+        {
+            Current = CONTAINING_RECORD(Entry, CDFS_INDEXED_NAME, ShortNameEntry);
+            if (Match != NULL && Current->DirIndex >= Match->DirIndex)
+                break;
+
+            if (Current->DirIndex >= DirIndex &&
+                RtlEqualUnicodeString(FileToFind, &Current->ShortName, TRUE))
+            {
+                Match = Current;
+                break;
+            }
+        }
+
+        if (Match == NULL)
+        {
+            return STATUS_OBJECT_NAME_NOT_FOUND;
+        }
+
+        if (pDirIndex != NULL)
+            *pDirIndex = Match->DirIndex;
+        *IndexedName = Match;
+
+        return STATUS_SUCCESS;
+    }
+
+    /* Upper case the expression for FsRtlIsNameInExpression */
+    Status = RtlUpcaseUnicodeString(&FileToFindUpcase, FileToFind, TRUE);
+    if (!NT_SUCCESS(Status))
+    {
+        return Status;
+    }
+
+    Status = STATUS_OBJECT_NAME_NOT_FOUND;
+    for (; DirIndex < NameIndex->Count; DirIndex++)
+    {
+        Current = NameIndex->Names[DirIndex];
+        if (FsRtlIsNameInExpression(&FileToFindUpcase, &Current->LongName, TRUE, NULL) ||
+            FsRtlIsNameInExpression(&FileToFindUpcase, &Current->ShortName, TRUE, NULL))
+        {
+            *IndexedName = Current;
+            Status = STATUS_SUCCESS;
             break;
+        }
     }
 
+    if (pDirIndex != NULL)
+        *pDirIndex = DirIndex;
+
     RtlFreeUnicodeString(&FileToFindUpcase);
-    CcUnpinData(Context);
 
-    return(STATUS_OBJECT_NAME_NOT_FOUND);
+    return Status;
+}
+
+
+NTSTATUS
+CdfsDirFindFile(PDEVICE_EXTENSION DeviceExt,
+                PFCB DirectoryFcb,
+                PUNICODE_STRING FileToFind,
+                PFCB *FoundFCB)
+{
+    UNICODE_STRING TempName;
+    PCDFS_NAME_INDEX NameIndex;
+    PCDFS_INDEXED_NAME IndexedName;
+    NTSTATUS Status;
+
+    ASSERT(DeviceExt);
+    ASSERT(DirectoryFcb);
+    ASSERT(FileToFind);
+
+    DPRINT("CdfsDirFindFile(VCB:%p, dirFCB:%p, File:%wZ)\n",
+        DeviceExt,
+        DirectoryFcb,
+        FileToFind);
+    DPRINT("Dir Path:%S\n", DirectoryFcb->PathName);
+
+    /* default to '.' if no filename specified */
+    if (FileToFind->Length == 0)
+    {
+        RtlInitUnicodeString(&TempName, L".");
+        FileToFind = &TempName;
+    }
+
+    Status = CdfsGetNameIndex(DeviceExt, DirectoryFcb, &NameIndex);
+    if (!NT_SUCCESS(Status))
+    {
+        return Status;
+    }
+
+    Status = CdfsFindIndexedName(NameIndex, FileToFind, NULL, &IndexedName);
+    if (!NT_SUCCESS(Status))
+    {
+        return Status;
+    }
+
+    DPRINT("Match found, %wZ\n", &IndexedName->LongName);
+
+    return CdfsMakeFCBFromDirEntry(DeviceExt,
+        DirectoryFcb,
+        IndexedName->LongNameBuffer,
+        IndexedName->ShortNameBuffer,
+        &IndexedName->Record,
+        DirectoryFcb->Entry.ExtentLocationL,
+        IndexedName->Offset,
+        FoundFCB);
 }
 
 
@@ -322,6 +322,7 @@ CdfsMountVolume(PDEVICE_OBJECT DeviceObject,
     PVPB Vpb;
     NTSTATUS Status;
     CDINFO CdInfo;
+    ULONG i;
 
     DPRINT("CdfsMountVolume() called\n");
 
@@ -428,6 +429,10 @@ CdfsMountVolume(PDEVICE_OBJECT DeviceObject,
 
     KeInitializeSpinLock(&DeviceExt->FcbListLock);
     InitializeListHead(&DeviceExt->FcbListHead);
+    for (i = 0; i < CDFS_FCB_HASH_BUCKETS; i++)
+    {
+        InitializeListHead(&DeviceExt->FcbHashTable[i]);
+    }
 
     Status = STATUS_SUCCESS;
 
@@ -25,6 +25,7 @@ NpfsDeleteFcb(PNPFS_FCB Fcb)
 
     KeLockMutex(&Vcb->PipeListLock);
     RemoveEntryList(&Fcb->PipeListEntry);
+    RemoveEntryList(&Fcb->PipeHashEntry);
     KeUnlockMutex(&Vcb->PipeListLock);
     RtlFreeUnicodeString(&Fcb->PipeName);
     ExFreePoolWithTag(Fcb, TAG_NPFS_FCB);
@@ -52,7 +53,6 @@ NpfsAllocateCcb(CCB_TYPE Type, PNPFS_FCB Fcb)
     return Ccb;
 }
 
-static
 VOID
 NpfsReferenceCcb(PNPFS_CCB Ccb)
 {
@@ -60,7 +60,6 @@ NpfsReferenceCcb(PNPFS_CCB Ccb)
     InterlockedIncrement((PLONG)&Ccb->RefCount);
 }
 
-static
 VOID
 NpfsDereferenceCcb(PNPFS_CCB Ccb)
 {
@@ -91,14 +90,26 @@ PNPFS_FCB
 NpfsFindPipe(PNPFS_VCB Vcb,
              PUNICODE_STRING PipeName)
 {
+    PLIST_ENTRY Bucket;
     PLIST_ENTRY CurrentEntry;
     PNPFS_FCB Fcb;
+    ULONG Hash;
+
+    if (!NT_SUCCESS(RtlHashUnicodeString(PipeName,
+                                         TRUE,
+                                         HASH_STRING_ALGORITHM_DEFAULT,
+                                         &Hash)))
+    {
+        return NULL;
+    }
 
-    CurrentEntry = Vcb->PipeListHead.Flink;
-    while (CurrentEntry != &Vcb->PipeListHead)
+    Bucket = &Vcb->PipeHashTable[Hash & (NPFS_PIPE_HASH_BUCKETS - 1)];
+    CurrentEntry = Bucket->Flink;
+    while (CurrentEntry != Bucket)
     {
-        Fcb = CONTAINING_RECORD(CurrentEntry, NPFS_FCB, PipeListEntry);
-        if (RtlCompareUnicodeString(PipeName,
+        Fcb = CONTAINING_RECORD(CurrentEntry, NPFS_FCB, PipeHashEntry);
+        if (Fcb->PipeNameHash == Hash &&
+            RtlCompareUnicodeString(PipeName,
             &Fcb->PipeName,
             TRUE) == 0)
         {
@@ -344,6 +355,7 @@ NpfsCreate(PDEVICE_OBJECT DeviceObject,
     ClientCcb->PipeState = FILE_PIPE_DISCONNECTED_STATE;
 #endif
     InitializeListHead(&ClientCcb->ReadRequestListHead);
+    InitializeListHead(&ClientCcb->WriteRequestListHead);
 
     DPRINT("CCB: %p\n", ClientCcb);
 
@@ -375,8 +387,6 @@ NpfsCreate(PDEVICE_OBJECT DeviceObject,
     ClientCcb->MaxDataLength = Fcb->OutboundQuota;
     ExInitializeFastMutex(&ClientCcb->DataListLock);
     KeInitializeEvent(&ClientCcb->ConnectEvent, SynchronizationEvent, FALSE);
-    KeInitializeEvent(&ClientCcb->ReadEvent, NotificationEvent, FALSE);
-    KeInitializeEvent(&ClientCcb->WriteEvent, NotificationEvent, FALSE);
 
 
     /*
@@ -664,7 +674,14 @@ NpfsCreateNamedPipe(PDEVICE_OBJECT DeviceObject,
             Fcb->OutboundQuota = 0;
         }
 
+        RtlHashUnicodeString(&Fcb->PipeName,
+                             TRUE,
+                             HASH_STRING_ALGORITHM_DEFAULT,
+                             &Fcb->PipeNameHash);
+
         InsertTailList(&Vcb->PipeListHead, &Fcb->PipeListEntry);
+        InsertTailList(&Vcb->PipeHashTable[Fcb->PipeNameHash & (NPFS_PIPE_HASH_BUCKETS - 1)],
+                       &Fcb->PipeHashEntry);
         KeUnlockMutex(&Vcb->PipeListLock);
     }
 
@@ -713,6 +730,7 @@ NpfsCreateNamedPipe(PDEVICE_OBJECT DeviceObject,
     Ccb->WriteQuotaAvailable = Fcb->InboundQuota;
     Ccb->MaxDataLength = Fcb->InboundQuota;
     InitializeListHead(&Ccb->ReadRequestListHead);
+    InitializeListHead(&Ccb->WriteRequestListHead);
     ExInitializeFastMutex(&Ccb->DataListLock);
 
     Fcb->CurrentInstances++;
@@ -724,8 +742,6 @@ NpfsCreateNamedPipe(PDEVICE_OBJECT DeviceObject,
     DPRINT("CCB: %p\n", Ccb);
 
     KeInitializeEvent(&Ccb->ConnectEvent, SynchronizationEvent, FALSE);
-    KeInitializeEvent(&Ccb->ReadEvent, NotificationEvent, FALSE);
-    KeInitializeEvent(&Ccb->WriteEvent, NotificationEvent, FALSE);
 
     KeLockMutex(&Fcb->CcbListLock);
     InsertTailList(&Fcb->ServerCcbListHead, &Ccb->CcbListEntry);
@@ -824,16 +840,17 @@ NpfsCleanup(PDEVICE_OBJECT DeviceObject,
             ExAcquireFastMutex(&Ccb->DataListLock);
         }
 
+        /*
+        * Fail the reads and writes pending on either end, nothing
+        * will move through this connection anymore.
+        */
+        NpfsCompletePendingRequests(Ccb, STATUS_PIPE_BROKEN);
+        NpfsCompletePendingRequests(OtherSide, STATUS_PIPE_BROKEN);
+
         /* Unlink FCBs */
         NpfsCcbSetOtherSide(OtherSide, NULL);
         NpfsCcbSetOtherSide(Ccb, NULL);
 
-        /*
-        * Signaling the write event. If is possible that an other
-        * thread waits for an empty buffer.
-        */
-        KeSetEvent(&OtherSide->ReadEvent, IO_NO_INCREMENT, FALSE);
-        KeSetEvent(&OtherSide->WriteEvent, IO_NO_INCREMENT, FALSE);
         if (Server)
         {
             ExReleaseFastMutex(&OtherSide->DataListLock);
@@ -885,6 +902,7 @@ NpfsCleanup(PDEVICE_OBJECT DeviceObject,
     KeUnlockMutex(&Fcb->CcbListLock);
 
     ExAcquireFastMutex(&Ccb->DataListLock);
+    NpfsCompletePendingRequests(Ccb, STATUS_PIPE_BROKEN);
     if (Ccb->Data)
     {
         ExFreePoolWithTag(Ccb->Data, TAG_NPFS_CCB_DATA);
@@ -254,12 +254,9 @@ NpfsDisconnectPipe(PNPFS_CCB Ccb)
         }
         OtherSide->PipeState = FILE_PIPE_DISCONNECTED_STATE;
         //OtherSide->OtherSide = NULL;
-        /*
-        * Signaling the write event. If is possible that an other
-        * thread waits for an empty buffer.
-        */
-        KeSetEvent(&OtherSide->ReadEvent, IO_NO_INCREMENT, FALSE);
-        KeSetEvent(&OtherSide->WriteEvent, IO_NO_INCREMENT, FALSE);
+        /* Fail the reads and writes pending on either end */
+        NpfsCompletePendingRequests(Ccb, STATUS_PIPE_DISCONNECTED);
+        NpfsCompletePendingRequests(OtherSide, STATUS_PIPE_DISCONNECTED);
         if (Server)
         {
             ExReleaseFastMutex(&OtherSide->DataListLock);
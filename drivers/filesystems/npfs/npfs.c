@@ -24,6 +24,7 @@ DriverEntry(PDRIVER_OBJECT DriverObject,
     PNPFS_VCB Vcb;
     PNPFS_FCB Fcb;
     NTSTATUS Status;
+    ULONG i;
 
     DPRINT("Named Pipe FSD 0.0.2\n");
 
@@ -76,9 +77,11 @@ DriverEntry(PDRIVER_OBJECT DriverObject,
     /* Initialize the Volume Control Block (VCB) */
     Vcb = (PNPFS_VCB)DeviceObject->DeviceExtension;
     InitializeListHead(&Vcb->PipeListHead);
-    InitializeListHead(&Vcb->ThreadListHead);
+    for (i = 0; i < NPFS_PIPE_HASH_BUCKETS; i++)
+    {
+        InitializeListHead(&Vcb->PipeHashTable[i]);
+    }
     KeInitializeMutex(&Vcb->PipeListLock, 0);
-    Vcb->EmptyWaiterCount = 0;
 
     /* set the size quotas */
     Vcb->MinQuota = PAGE_SIZE;
@@ -9,7 +9,9 @@
 #define TAG_NPFS_CCB_DATA 'iFpN' /* correct? */
 #define TAG_NPFS_FCB 'FFpN'
 #define TAG_NPFS_NAMEBLOCK 'nFpN'
-#define TAG_NPFS_THREAD_CONTEXT 'tFpN'
+
+/* Buckets of the pipe name table, must be a power of two */
+#define NPFS_PIPE_HASH_BUCKETS 64
 
 #define ROUND_DOWN(n, align) \
     (((ULONG)n) & ~((align) - 1l))
@@ -37,9 +39,8 @@ typedef enum _CCB_TYPE
 typedef struct _NPFS_VCB
 {
     LIST_ENTRY PipeListHead;
-    LIST_ENTRY ThreadListHead;
+    LIST_ENTRY PipeHashTable[NPFS_PIPE_HASH_BUCKETS];  /* FCBs by pipe name */
     KMUTEX PipeListLock;
-    ULONG EmptyWaiterCount;
     ULONG MinQuota;
     ULONG DefaultQuota;
     ULONG MaxQuota;
@@ -53,6 +54,8 @@ typedef struct _NPFS_FCB
     PNPFS_VCB Vcb;
     UNICODE_STRING PipeName;
     LIST_ENTRY PipeListEntry;
+    LIST_ENTRY PipeHashEntry;
+    ULONG PipeNameHash;
     KMUTEX CcbListLock;
     LIST_ENTRY ServerCcbListHead;
     LIST_ENTRY ClientCcbListHead;
@@ -87,15 +90,15 @@ typedef struct _NPFS_CCB
     struct _NPFS_CCB* OtherSide;
     struct ETHREAD *Thread;
     KEVENT ConnectEvent;
-    KEVENT ReadEvent;
-    KEVENT WriteEvent;
     ULONG PipeEnd;
     ULONG PipeState;
     ULONG ReadDataAvailable;
     ULONG WriteQuotaAvailable;
     ULONG RefCount;
 
-    LIST_ENTRY ReadRequestListHead;
+    /* Pending IRPs, both under DataListLock */
+    LIST_ENTRY ReadRequestListHead;     /* reads of this end */
+    LIST_ENTRY WriteRequestListHead;    /* writes of the other end into Data */
 
     PVOID Data;
     PVOID ReadPtr;
@@ -111,23 +114,13 @@ typedef struct _NPFS_CCB
 
 } NPFS_CCB, *PNPFS_CCB;
 
+/* Kept in the DriverContext of a pending read or write IRP */
 typedef struct _NPFS_CONTEXT
 {
     LIST_ENTRY ListEntry;
-    PKEVENT WaitEvent;
+    PNPFS_CCB Ccb;              /* CCB whose queue holds the IRP, referenced */
 } NPFS_CONTEXT, *PNPFS_CONTEXT;
 
-typedef struct _NPFS_THREAD_CONTEXT
-{
-    ULONG Count;
-    KEVENT Event;
-    PNPFS_VCB Vcb;
-    LIST_ENTRY ListEntry;
-    PVOID WaitObjectArray[MAXIMUM_WAIT_OBJECTS];
-    KWAIT_BLOCK WaitBlockArray[MAXIMUM_WAIT_OBJECTS];
-    PIRP WaitIrpArray[MAXIMUM_WAIT_OBJECTS];
-} NPFS_THREAD_CONTEXT, *PNPFS_THREAD_CONTEXT;
-
 typedef struct _NPFS_WAITER_ENTRY
 {
     LIST_ENTRY Entry;
@@ -192,6 +185,16 @@ PNPFS_FCB
 NpfsFindPipe(PNPFS_VCB Vcb,
              PUNICODE_STRING PipeName);
 
+VOID
+NpfsReferenceCcb(PNPFS_CCB Ccb);
+
+VOID
+NpfsDereferenceCcb(PNPFS_CCB Ccb);
+
+VOID
+NpfsCompletePendingRequests(PNPFS_CCB Ccb,
+                            NTSTATUS Status);
+
 FCB_TYPE
 NpfsGetFcb(PFILE_OBJECT FileObject,
            PNPFS_FCB *Fcb);
@@ -48,245 +48,486 @@ NpfsReadWriteCancelRoutine(IN PDEVICE_OBJECT DeviceObject,
                            IN PIRP Irp)
 {
     PNPFS_CONTEXT Context;
-    PIO_STACK_LOCATION IoStack;
-    PNPFS_VCB Vcb;
     PNPFS_CCB Ccb;
-    PLIST_ENTRY ListEntry;
-    PNPFS_THREAD_CONTEXT ThreadContext;
-    ULONG i;
 
     DPRINT("NpfsReadWriteCancelRoutine(DeviceObject %p, Irp %p)\n", DeviceObject, Irp);
 
     IoReleaseCancelSpinLock(Irp->CancelIrql);
 
     Context = (PNPFS_CONTEXT)&Irp->Tail.Overlay.DriverContext;
-    Vcb = (PNPFS_VCB)DeviceObject->DeviceExtension;
-    IoStack = IoGetCurrentIrpStackLocation(Irp);
-    Ccb = IoStack->FileObject->FsContext2;
+    Ccb = Context->Ccb;
 
-    KeLockMutex(&Vcb->PipeListLock);
     ExAcquireFastMutex(&Ccb->DataListLock);
-    switch(IoStack->MajorFunction)
+    RemoveEntryList(&Context->ListEntry);
+    ExReleaseFastMutex(&Ccb->DataListLock);
+
+    NpfsDereferenceCcb(Ccb);
+
+    /* Information keeps what a write already put into the pipe */
+    Irp->IoStatus.Status = STATUS_CANCELLED;
+    IoCompleteRequest(Irp, IO_NO_INCREMENT);
+}
+
+/*
+ * Queues a read or write IRP on a list of Ccb until data or buffer space
+ * turns up. The caller holds Ccb->DataListLock.
+ */
+static NTSTATUS
+NpfsQueueRequest(PNPFS_CCB Ccb,
+                 PLIST_ENTRY ListHead,
+                 PIRP Irp)
+{
+    PNPFS_CONTEXT Context = (PNPFS_CONTEXT)&Irp->Tail.Overlay.DriverContext;
+
+    IoMarkIrpPending(Irp);
+
+    Context->Ccb = Ccb;
+    NpfsReferenceCcb(Ccb);
+    InsertTailList(ListHead, &Context->ListEntry);
+
+    (void)IoSetCancelRoutine(Irp, NpfsReadWriteCancelRoutine);
+    if (Irp->Cancel && IoSetCancelRoutine(Irp, NULL) != NULL)
+    {
+        /* Cancelled before the cancel routine was set */
+        RemoveEntryList(&Context->ListEntry);
+        NpfsDereferenceCcb(Ccb);
+        Irp->IoStatus.Status = STATUS_CANCELLED;
+        IoCompleteRequest(Irp, IO_NO_INCREMENT);
+    }
+
+    return STATUS_PENDING;
+}
+
+/*
+ * Completes a queued IRP that has been taken from its cancel routine.
+ * The caller holds the DataListLock of the queue.
+ */
+static VOID
+NpfsCompleteQueuedRequest(PIRP Irp,
+                          NTSTATUS Status)
+{
+    PNPFS_CONTEXT Context = (PNPFS_CONTEXT)&Irp->Tail.Overlay.DriverContext;
+
+    RemoveEntryList(&Context->ListEntry);
+
+    /* The caller got to the CCB through a reference of its own */
+    NpfsDereferenceCcb(Context->Ccb);
+
+    Irp->IoStatus.Status = Status;
+    IoCompleteRequest(Irp, IO_NO_INCREMENT);
+}
+
+/*
+ * Hands a queued IRP that could not be completed back to its cancel
+ * routine, or completes it if it was cancelled in between.
+ */
+static VOID
+NpfsRequeueRequest(PIRP Irp)
+{
+    (void)IoSetCancelRoutine(Irp, NpfsReadWriteCancelRoutine);
+    if (Irp->Cancel && IoSetCancelRoutine(Irp, NULL) != NULL)
+    {
+        NpfsCompleteQueuedRequest(Irp, STATUS_CANCELLED);
+    }
+}
+
+static VOID
+NpfsCompleteRequestList(PLIST_ENTRY ListHead,
+                        NTSTATUS Status)
+{
+    PLIST_ENTRY Entry;
+    PIRP Irp;
+
+    Entry = ListHead->Flink;
+    while (Entry != ListHead)
+    {
+        Irp = CONTAINING_RECORD(Entry, IRP, Tail.Overlay.DriverContext);
+        Entry = Entry->Flink;
+
+        /* Requests that are being cancelled are left to the cancel routine */
+        if (IoSetCancelRoutine(Irp, NULL) != NULL)
+        {
+            NpfsCompleteQueuedRequest(Irp, Status);
+        }
+    }
+}
+
+/*
+ * Completes all reads and writes pending on Ccb with Status. The caller
+ * holds Ccb->DataListLock.
+ */
+VOID
+NpfsCompletePendingRequests(PNPFS_CCB Ccb,
+                            NTSTATUS Status)
+{
+    NpfsCompleteRequestList(&Ccb->ReadRequestListHead, Status);
+    NpfsCompleteRequestList(&Ccb->WriteRequestListHead, Status);
+}
+
+/*
+ * Moves data from the buffer of Ccb into a read IRP. Returns TRUE once
+ * the read can be completed.
+ */
+static BOOLEAN
+NpfsReadFromBuffer(PNPFS_CCB Ccb,
+                   PIRP Irp)
+{
+    PUCHAR Buffer;
+    ULONG Length;
+    ULONG Information;
+    ULONG CopyLength;
+    ULONG TempLength;
+    ULONG ReadMode;
+    ULONG MessageLength;
+
+    Information = (ULONG)Irp->IoStatus.Information;
+    Length = IoGetCurrentIrpStackLocation(Irp)->Parameters.Read.Length;
+    ASSERT(Information <= Length);
+
+    /* Zero length reads do not wait for data */
+    if (Length == 0)
+        return TRUE;
+
+    Buffer = (PUCHAR)MmGetSystemAddressForMdl(Irp->MdlAddress) + Information;
+    Length -= Information;
+
+    if (Ccb->Fcb->PipeType == FILE_PIPE_BYTE_STREAM_TYPE)
     {
-    case IRP_MJ_READ:
-        ListEntry = Vcb->ThreadListHead.Flink;
-        while (ListEntry != &Vcb->ThreadListHead)
+        DPRINT("Byte stream mode: Ccb->Data %x\n", Ccb->Data);
+        while (Length > 0 && Ccb->ReadDataAvailable > 0)
         {
-            ThreadContext = CONTAINING_RECORD(ListEntry, NPFS_THREAD_CONTEXT, ListEntry);
-            /* Real events start at index 1 */
-            for (i = 1; i < ThreadContext->Count; i++)
+            CopyLength = min(Ccb->ReadDataAvailable, Length);
+            if ((ULONG_PTR)Ccb->ReadPtr + CopyLength <= (ULONG_PTR)Ccb->Data + Ccb->MaxDataLength)
             {
-                if (ThreadContext->WaitIrpArray[i] == Irp)
+                memcpy(Buffer, Ccb->ReadPtr, CopyLength);
+                Ccb->ReadPtr = (PVOID)((ULONG_PTR)Ccb->ReadPtr + CopyLength);
+                if (Ccb->ReadPtr == (PVOID)((ULONG_PTR)Ccb->Data + Ccb->MaxDataLength))
                 {
-                    ASSERT(ThreadContext->WaitObjectArray[i] == Context->WaitEvent);
+                    Ccb->ReadPtr = Ccb->Data;
+                }
+            }
+            else
+            {
+                TempLength = (ULONG)((ULONG_PTR)Ccb->Data + Ccb->MaxDataLength - (ULONG_PTR)Ccb->ReadPtr);
+                memcpy(Buffer, Ccb->ReadPtr, TempLength);
+                memcpy(Buffer + TempLength, Ccb->Data, CopyLength - TempLength);
+                Ccb->ReadPtr = (PVOID)((ULONG_PTR)Ccb->Data + CopyLength - TempLength);
+            }
 
-                    ThreadContext->WaitIrpArray[i] = NULL;
+            Buffer += CopyLength;
+            Length -= CopyLength;
+            Information += CopyLength;
 
-                    RemoveEntryList(&Context->ListEntry);
+            Ccb->ReadDataAvailable -= CopyLength;
+            Ccb->WriteQuotaAvailable += CopyLength;
+        }
+    }
+    else if (Ccb->Fcb->PipeType == FILE_PIPE_MESSAGE_TYPE)
+    {
+        DPRINT("Message mode: Ccb>Data %x\n", Ccb->Data);
 
-                    Irp->IoStatus.Status = STATUS_CANCELLED;
-                    Irp->IoStatus.Information = 0;
+        if (Ccb->PipeEnd == FILE_PIPE_CLIENT_END) ReadMode = Ccb->Fcb->ClientReadMode;
+        else ReadMode = Ccb->Fcb->ServerReadMode;
 
-                    IoCompleteRequest(Irp, IO_NO_INCREMENT);
+        /* For Message mode, the Message length is stored in the buffer preceeding the Message. */
+        while (Length > 0 && Ccb->ReadDataAvailable > 0)
+        {
+            memcpy(&MessageLength, Ccb->ReadPtr, sizeof(MessageLength));
 
-                    KeSetEvent(&ThreadContext->Event, IO_NO_INCREMENT, FALSE);
+            if ((MessageLength == 0) || (MessageLength > Ccb->ReadDataAvailable))
+            {
+                DPRINT1("Possible memory corruption.\n");
+                HexDump(Ccb->Data, (ULONG)((ULONG_PTR)Ccb->WritePtr - (ULONG_PTR)Ccb->Data));
+                ASSERT(FALSE);
+            }
 
-                    ExReleaseFastMutex(&Ccb->DataListLock);
-                    KeUnlockMutex(&Vcb->PipeListLock);
+            /* Use the smaller value */
+            CopyLength = min(MessageLength, Length);
+            memcpy(Buffer, (PVOID)((ULONG_PTR)Ccb->ReadPtr + sizeof(MessageLength)), CopyLength);
 
-                    return;
+            if (Ccb->ReadDataAvailable > CopyLength)
+            {
+                if (CopyLength < MessageLength)
+                {
+                    /* Only part of the message was requested, the rest stays a message */
+                    MessageLength -= CopyLength;
+                    Ccb->ReadPtr = (PVOID)((ULONG_PTR)Ccb->ReadPtr + CopyLength);
+                    memcpy(Ccb->ReadPtr, &MessageLength, sizeof(MessageLength));
+                }
+                else
+                {
+                    Ccb->ReadPtr = (PVOID)((ULONG_PTR)Ccb->ReadPtr + sizeof(MessageLength) + CopyLength);
                 }
             }
-            ListEntry = ListEntry->Flink;
-        }
+            else
+            {
+                /* That was the last message, start over at the beginning of the buffer */
+                Ccb->WriteQuotaAvailable = Ccb->MaxDataLength;
+                Ccb->WritePtr = Ccb->Data;
+                Ccb->ReadPtr = Ccb->Data;
+            }
 
-        RemoveEntryList(&Context->ListEntry);
+#ifndef NDEBUG
+            DPRINT("Length %d Buffer %x\n", CopyLength, Buffer);
+            HexDump(Buffer, CopyLength);
+#endif
 
-        ExReleaseFastMutex(&Ccb->DataListLock);
-        KeUnlockMutex(&Vcb->PipeListLock);
+            Buffer += CopyLength;
+            Length -= CopyLength;
+            Information += CopyLength;
 
-        Irp->IoStatus.Status = STATUS_CANCELLED;
-        Irp->IoStatus.Information = 0;
+            Ccb->ReadDataAvailable -= CopyLength;
 
-        IoCompleteRequest(Irp, IO_NO_INCREMENT);
-        break;
-    default:
+            /* Only a byte stream read runs on into the next message */
+            if (ReadMode != FILE_PIPE_BYTE_STREAM_MODE)
+                break;
+        }
+    }
+    else
+    {
+        DPRINT1("Unhandled Pipe Mode!\n");
         ASSERT(FALSE);
     }
+
+    Irp->IoStatus.Information = Information;
+
+    /* A read is done as soon as it got anything */
+    return (Information > 0);
 }
 
-static VOID NTAPI
-NpfsWaiterThread(PVOID InitContext)
+/*
+ * Moves data from a write IRP into the buffer of ReaderCcb. Returns TRUE
+ * once all of the write went in.
+ */
+static BOOLEAN
+NpfsWriteToBuffer(PNPFS_CCB ReaderCcb,
+                  PIRP Irp)
 {
-    PNPFS_THREAD_CONTEXT ThreadContext = (PNPFS_THREAD_CONTEXT) InitContext;
-    ULONG CurrentCount;
-    ULONG Count = 0, i;
-    PIRP Irp = NULL;
-    NTSTATUS Status;
-    PIO_STACK_LOCATION IoStack = NULL;
-    KIRQL OldIrql;
+    PUCHAR Buffer;
+    ULONG Length;
+    ULONG Information;
+    ULONG CopyLength;
+    ULONG TempLength;
+    ULONG Consumed;
 
-    KeLockMutex(&ThreadContext->Vcb->PipeListLock);
+    Information = (ULONG)Irp->IoStatus.Information;
+    Length = IoGetCurrentIrpStackLocation(Irp)->Parameters.Write.Length;
+    ASSERT(Information <= Length);
+    Buffer = (PUCHAR)MmGetSystemAddressForMdl(Irp->MdlAddress) + Information;
+    Length -= Information;
 
-    while (1)
+    if (Length == 0)
+        return TRUE;
+
+    if (ReaderCcb->Fcb->PipeType == FILE_PIPE_BYTE_STREAM_TYPE)
     {
-        CurrentCount = ThreadContext->Count;
-        KeUnlockMutex(&ThreadContext->Vcb->PipeListLock);
-        IoAcquireCancelSpinLock(&OldIrql);
-        if (Irp && IoSetCancelRoutine(Irp, NULL) != NULL)
-        {
-            IoReleaseCancelSpinLock(OldIrql);
-            IoStack = IoGetCurrentIrpStackLocation(Irp);
-            switch (IoStack->MajorFunction)
-            {
-                case IRP_MJ_READ:
-                    NpfsRead(IoStack->DeviceObject, Irp);
-                    break;
-                default:
-                    ASSERT(FALSE);
-            }
-        }
-        else
-        {
-            IoReleaseCancelSpinLock(OldIrql);
-        }
-        Status = KeWaitForMultipleObjects(CurrentCount,
-            ThreadContext->WaitObjectArray,
-            WaitAny,
-            Executive,
-            KernelMode,
-            FALSE,
-            NULL,
-            ThreadContext->WaitBlockArray);
-        if (!NT_SUCCESS(Status))
-        {
-            ASSERT(FALSE);
-        }
-        KeLockMutex(&ThreadContext->Vcb->PipeListLock);
-        Count = Status - STATUS_WAIT_0;
-        ASSERT (Count < CurrentCount);
-        if (Count > 0)
-        {
-            Irp = ThreadContext->WaitIrpArray[Count];
-            ThreadContext->Count--;
-            ThreadContext->Vcb->EmptyWaiterCount++;
-            ThreadContext->WaitObjectArray[Count] = ThreadContext->WaitObjectArray[ThreadContext->Count];
-            ThreadContext->WaitIrpArray[Count] = ThreadContext->WaitIrpArray[ThreadContext->Count];
-        }
-        else
+        DPRINT("Byte stream mode: Ccb->Data %x, Ccb->WritePtr %x\n", ReaderCcb->Data, ReaderCcb->WritePtr);
+
+        while (Length > 0 && ReaderCcb->WriteQuotaAvailable > 0)
         {
-            /* someone has add a new wait request or cancelled an old one */
-            Irp = NULL;
+            CopyLength = min(Length, ReaderCcb->WriteQuotaAvailable);
 
-            /* Look for cancelled requests */
-            for (i = 1; i < ThreadContext->Count; i++)
+            if ((ULONG_PTR)ReaderCcb->WritePtr + CopyLength <= (ULONG_PTR)ReaderCcb->Data + ReaderCcb->MaxDataLength)
             {
-                if (ThreadContext->WaitIrpArray[i] == NULL)
+                memcpy(ReaderCcb->WritePtr, Buffer, CopyLength);
+                ReaderCcb->WritePtr = (PVOID)((ULONG_PTR)ReaderCcb->WritePtr + CopyLength);
+                if ((ULONG_PTR)ReaderCcb->WritePtr == (ULONG_PTR)ReaderCcb->Data + ReaderCcb->MaxDataLength)
                 {
-                   ThreadContext->Count--;
-                   ThreadContext->Vcb->EmptyWaiterCount++;
-                   ThreadContext->WaitObjectArray[i] = ThreadContext->WaitObjectArray[ThreadContext->Count];
-                   ThreadContext->WaitIrpArray[i] = ThreadContext->WaitIrpArray[ThreadContext->Count];
+                    ReaderCcb->WritePtr = ReaderCcb->Data;
                 }
             }
+            else
+            {
+                TempLength = (ULONG)((ULONG_PTR)ReaderCcb->Data + ReaderCcb->MaxDataLength -
+                        (ULONG_PTR)ReaderCcb->WritePtr);
+
+                memcpy(ReaderCcb->WritePtr, Buffer, TempLength);
+                memcpy(ReaderCcb->Data, Buffer + TempLength, CopyLength - TempLength);
+                ReaderCcb->WritePtr = (PVOID)((ULONG_PTR)ReaderCcb->Data + CopyLength - TempLength);
+            }
+
+            Buffer += CopyLength;
+            Length -= CopyLength;
+            Information += CopyLength;
+
+            ReaderCcb->ReadDataAvailable += CopyLength;
+            ReaderCcb->WriteQuotaAvailable -= CopyLength;
         }
-        if (ThreadContext->Count == 1 && ThreadContext->Vcb->EmptyWaiterCount >= MAXIMUM_WAIT_OBJECTS)
+    }
+    else if (ReaderCcb->Fcb->PipeType == FILE_PIPE_MESSAGE_TYPE)
+    {
+        /* For Message Type Pipe, the Pipes memory will be used to store the size of each message */
+        DPRINT("Message mode: Ccb->Data %x, Ccb->WritePtr %x\n", ReaderCcb->Data, ReaderCcb->WritePtr);
+
+        /* A message that could never fit is cut to the buffer size */
+        CopyLength = min(Length, ReaderCcb->MaxDataLength - sizeof(ULONG));
+
+        /* Messages are stored linearly, reclaim the space already read */
+        if (ReaderCcb->WriteQuotaAvailable < CopyLength + sizeof(ULONG) &&
+            ReaderCcb->ReadPtr > ReaderCcb->Data)
         {
-            /* it exist an other thread with empty wait slots, we can remove our thread from the list */
-            RemoveEntryList(&ThreadContext->ListEntry);
-            ExFreePoolWithTag(ThreadContext, TAG_NPFS_THREAD_CONTEXT);
-            KeUnlockMutex(&ThreadContext->Vcb->PipeListLock);
-            break;
+            Consumed = (ULONG)((ULONG_PTR)ReaderCcb->ReadPtr - (ULONG_PTR)ReaderCcb->Data);
+            RtlMoveMemory(ReaderCcb->Data,
+                          ReaderCcb->ReadPtr,
+                          (ULONG_PTR)ReaderCcb->WritePtr - (ULONG_PTR)ReaderCcb->ReadPtr);
+            ReaderCcb->WritePtr = (PVOID)((ULONG_PTR)ReaderCcb->WritePtr - Consumed);
+            ReaderCcb->ReadPtr = ReaderCcb->Data;
+            ReaderCcb->WriteQuotaAvailable += Consumed;
         }
+
+        if (ReaderCcb->WriteQuotaAvailable < CopyLength + sizeof(ULONG))
+            return FALSE;
+
+        /* First Copy the Length of the message into the pipes buffer */
+        memcpy(ReaderCcb->WritePtr, &CopyLength, sizeof(CopyLength));
+
+        /* Now the user buffer itself */
+        memcpy((PVOID)((ULONG_PTR)ReaderCcb->WritePtr + sizeof(CopyLength)), Buffer, CopyLength);
+
+        ReaderCcb->WritePtr = (PVOID)((ULONG_PTR)ReaderCcb->WritePtr + sizeof(CopyLength) + CopyLength);
+        ReaderCcb->ReadDataAvailable += CopyLength;
+        ReaderCcb->WriteQuotaAvailable -= CopyLength + sizeof(ULONG);
+
+        /* Whatever was cut off is gone, so the write is done */
+        Information += CopyLength;
+        Length = 0;
     }
+    else
+    {
+        DPRINT1("Unhandled Pipe Type Mode and Read Write Mode!\n");
+        ASSERT(FALSE);
+    }
+
+    Irp->IoStatus.Information = Information;
+
+    return (Length == 0);
 }
 
-static NTSTATUS
-NpfsAddWaitingReadWriteRequest(IN PDEVICE_OBJECT DeviceObject,
-                               IN PIRP Irp)
+/*
+ * Copies a write straight into the reads waiting on an empty pipe, so the
+ * data does not go through the buffer. The caller holds the DataListLock
+ * of ReaderCcb.
+ */
+static VOID
+NpfsHandOffToReaders(PNPFS_CCB ReaderCcb,
+                     PIRP WriteIrp)
 {
-    PLIST_ENTRY ListEntry;
-    PNPFS_THREAD_CONTEXT ThreadContext = NULL;
-    PNPFS_CONTEXT Context;
-    HANDLE hThread;
-    PNPFS_VCB Vcb;
-    KIRQL oldIrql;
-    NTSTATUS Status;
+    PLIST_ENTRY Entry;
+    PIRP ReadIrp;
+    PUCHAR Source;
+    ULONG Length;
+    ULONG ReadLength;
+    ULONG CopyLength;
 
-    Context = (PNPFS_CONTEXT)&Irp->Tail.Overlay.DriverContext;
-    Vcb = (PNPFS_VCB)DeviceObject->DeviceExtension;
+    ASSERT(ReaderCcb->ReadDataAvailable == 0);
+
+    Entry = ReaderCcb->ReadRequestListHead.Flink;
+    while (Entry != &ReaderCcb->ReadRequestListHead)
+    {
+        Length = IoGetCurrentIrpStackLocation(WriteIrp)->Parameters.Write.Length -
+                 (ULONG)WriteIrp->IoStatus.Information;
+        if (Length == 0)
+            break;
 
-    DPRINT("NpfsAddWaitingReadWriteRequest(DeviceObject %p, Irp %p)\n", DeviceObject, Irp);
+        ReadIrp = CONTAINING_RECORD(Entry, IRP, Tail.Overlay.DriverContext);
+        Entry = Entry->Flink;
 
-    KeLockMutex(&Vcb->PipeListLock);
+        if (IoSetCancelRoutine(ReadIrp, NULL) == NULL)
+            continue;
 
-    ListEntry = Vcb->ThreadListHead.Flink;
-    while (ListEntry != &Vcb->ThreadListHead)
-    {
-        ThreadContext = CONTAINING_RECORD(ListEntry, NPFS_THREAD_CONTEXT, ListEntry);
-        if (ThreadContext->Count < MAXIMUM_WAIT_OBJECTS)
+        /* Waiting reads never hold data yet */
+        ASSERT(ReadIrp->IoStatus.Information == 0);
+        ReadLength = IoGetCurrentIrpStackLocation(ReadIrp)->Parameters.Read.Length;
+
+        /* A message must arrive whole, a partial read goes through the buffer */
+        if (ReaderCcb->Fcb->PipeType == FILE_PIPE_MESSAGE_TYPE && Length > ReadLength)
         {
+            NpfsRequeueRequest(ReadIrp);
             break;
         }
-        ListEntry = ListEntry->Flink;
-    }
 
-    if (ListEntry == &Vcb->ThreadListHead)
-    {
-        ThreadContext = ExAllocatePoolWithTag(NonPagedPool,
-                                              sizeof(NPFS_THREAD_CONTEXT),
-                                              TAG_NPFS_THREAD_CONTEXT);
-        if (ThreadContext == NULL)
-        {
-            KeUnlockMutex(&Vcb->PipeListLock);
-            return STATUS_NO_MEMORY;
-        }
+        CopyLength = min(Length, ReadLength);
+        Source = (PUCHAR)MmGetSystemAddressForMdl(WriteIrp->MdlAddress) +
+                 WriteIrp->IoStatus.Information;
+        memcpy(MmGetSystemAddressForMdl(ReadIrp->MdlAddress), Source, CopyLength);
 
-        ThreadContext->Vcb = Vcb;
-        KeInitializeEvent(&ThreadContext->Event, SynchronizationEvent, FALSE);
-        ThreadContext->Count = 1;
-        ThreadContext->WaitObjectArray[0] = &ThreadContext->Event;
-
-        DPRINT("Creating a new system thread for waiting read/write requests\n");
-
-        Status = PsCreateSystemThread(&hThread,
-            THREAD_ALL_ACCESS,
-            NULL,
-            NULL,
-            NULL,
-            NpfsWaiterThread,
-            (PVOID)ThreadContext);
-        if (!NT_SUCCESS(Status))
-        {
-            ExFreePoolWithTag(ThreadContext, TAG_NPFS_THREAD_CONTEXT);
-            KeUnlockMutex(&Vcb->PipeListLock);
-            return Status;
-        }
+        ReadIrp->IoStatus.Information = CopyLength;
+        WriteIrp->IoStatus.Information += CopyLength;
 
-        InsertHeadList(&Vcb->ThreadListHead, &ThreadContext->ListEntry);
-        Vcb->EmptyWaiterCount += MAXIMUM_WAIT_OBJECTS - 1;
+        NpfsCompleteQueuedRequest(ReadIrp, STATUS_SUCCESS);
+
+        /* One message per read */
+        if (ReaderCcb->Fcb->PipeType == FILE_PIPE_MESSAGE_TYPE)
+            break;
     }
-    IoMarkIrpPending(Irp);
+}
+
+/*
+ * Completes the reads waiting on Ccb from its buffer, in order. The
+ * caller holds Ccb->DataListLock.
+ */
+static VOID
+NpfsServiceReadRequests(PNPFS_CCB Ccb)
+{
+    PLIST_ENTRY Entry;
+    PIRP Irp;
 
-    IoAcquireCancelSpinLock(&oldIrql);
-    if (Irp->Cancel)
+    Entry = Ccb->ReadRequestListHead.Flink;
+    while (Entry != &Ccb->ReadRequestListHead && Ccb->ReadDataAvailable > 0)
     {
-        IoReleaseCancelSpinLock(oldIrql);
-        Status = STATUS_CANCELLED;
+        Irp = CONTAINING_RECORD(Entry, IRP, Tail.Overlay.DriverContext);
+        Entry = Entry->Flink;
+
+        if (IoSetCancelRoutine(Irp, NULL) == NULL)
+            continue;
+
+        if (NpfsReadFromBuffer(Ccb, Irp))
+            NpfsCompleteQueuedRequest(Irp, STATUS_SUCCESS);
+        else
+            NpfsRequeueRequest(Irp);
     }
-    else
+}
+
+/*
+ * Lets the writes waiting for space in the buffer of Ccb move in, in
+ * order, and passes the data on to waiting reads. The caller holds
+ * Ccb->DataListLock.
+ */
+static VOID
+NpfsServiceWriteRequests(PNPFS_CCB Ccb)
+{
+    PLIST_ENTRY Entry;
+    PIRP Irp;
+    ULONG Available;
+
+    do
     {
-        (void)IoSetCancelRoutine(Irp, NpfsReadWriteCancelRoutine);
-        IoReleaseCancelSpinLock(oldIrql);
-        ThreadContext->WaitObjectArray[ThreadContext->Count] = Context->WaitEvent;
-        ThreadContext->WaitIrpArray[ThreadContext->Count] = Irp;
-        ThreadContext->Count++;
-        Vcb->EmptyWaiterCount--;
-        KeSetEvent(&ThreadContext->Event, IO_NO_INCREMENT, FALSE);
-        Status = STATUS_SUCCESS;
-    }
-    KeUnlockMutex(&Vcb->PipeListLock);
-    return Status;
+        Available = Ccb->ReadDataAvailable;
+
+        Entry = Ccb->WriteRequestListHead.Flink;
+        while (Entry != &Ccb->WriteRequestListHead)
+        {
+            Irp = CONTAINING_RECORD(Entry, IRP, Tail.Overlay.DriverContext);
+            Entry = Entry->Flink;
+
+            if (IoSetCancelRoutine(Irp, NULL) == NULL)
+                continue;
+
+            if (!NpfsWriteToBuffer(Ccb, Irp))
+            {
+                /* The buffer is full, later writes have to wait too */
+                NpfsRequeueRequest(Irp);
+                break;
+            }
+
+            NpfsCompleteQueuedRequest(Irp, STATUS_SUCCESS);
+        }
+
+        NpfsServiceReadRequests(Ccb);
+
+        /* Go on while waiting reads make room for waiting writes */
+    } while (Ccb->ReadDataAvailable < Available &&
+             !IsListEmpty(&Ccb->WriteRequestListHead));
 }
 
 NTSTATUS NTAPI
@@ -295,16 +536,7 @@ NpfsRead(IN PDEVICE_OBJECT DeviceObject,
 {
     PFILE_OBJECT FileObject;
     NTSTATUS Status;
-    NTSTATUS OriginalStatus = STATUS_SUCCESS;
     PNPFS_CCB Ccb;
-    PNPFS_CONTEXT Context;
-    KEVENT Event;
-    ULONG Length;
-    ULONG Information = 0;
-    ULONG CopyLength = 0;
-    ULONG TempLength;
-    BOOLEAN IsOriginalRequest = TRUE;
-    PVOID Buffer;
 
     DPRINT("NpfsRead(DeviceObject %p, Irp %p)\n", DeviceObject, Irp);
 
@@ -313,12 +545,13 @@ NpfsRead(IN PDEVICE_OBJECT DeviceObject,
     DPRINT("Pipe name %wZ\n", &FileObject->FileName);
     Ccb = FileObject->FsContext2;
 
+    Irp->IoStatus.Information = 0;
+
     /* Fail, if the CCB is not a pipe CCB */
     if (Ccb->Type != CCB_PIPE)
     {
         DPRINT("Not a pipe!\n");
         Status = STATUS_INVALID_PARAMETER;
-        Irp->IoStatus.Information = 0;
         goto done;
     }
 
@@ -326,19 +559,14 @@ NpfsRead(IN PDEVICE_OBJECT DeviceObject,
     {
         DPRINT("Irp->MdlAddress == NULL\n");
         Status = STATUS_UNSUCCESSFUL;
-        Irp->IoStatus.Information = 0;
         goto done;
     }
 
-    Context = (PNPFS_CONTEXT)&Irp->Tail.Overlay.DriverContext;
-
     if ((Ccb->OtherSide) && (Ccb->OtherSide->PipeState == FILE_PIPE_DISCONNECTED_STATE) && (Ccb->PipeState == FILE_PIPE_DISCONNECTED_STATE))
     {
         DPRINT("Both Client and Server are disconnected!\n");
         Status = STATUS_PIPE_DISCONNECTED;
-        Irp->IoStatus.Information = 0;
         goto done;
-
     }
 
     if ((Ccb->OtherSide == NULL) && (Ccb->ReadDataAvailable == 0))
@@ -351,7 +579,6 @@ NpfsRead(IN PDEVICE_OBJECT DeviceObject,
             Status = STATUS_PIPE_DISCONNECTED;
         else
             Status = STATUS_UNSUCCESSFUL;
-        Irp->IoStatus.Information = 0;
         goto done;
     }
 
@@ -359,376 +586,42 @@ NpfsRead(IN PDEVICE_OBJECT DeviceObject,
     {
         DPRINT("Pipe is NOT readable!\n");
         Status = STATUS_UNSUCCESSFUL;
-        Irp->IoStatus.Information = 0;
         goto done;
     }
 
     ExAcquireFastMutex(&Ccb->DataListLock);
 
-    if (IoIsOperationSynchronous(Irp))
-    {
-        InsertTailList(&Ccb->ReadRequestListHead, &Context->ListEntry);
-        if (Ccb->ReadRequestListHead.Flink != &Context->ListEntry)
-        {
-            KeInitializeEvent(&Event, SynchronizationEvent, FALSE);
-            Context->WaitEvent = &Event;
-            ExReleaseFastMutex(&Ccb->DataListLock);
-            Status = KeWaitForSingleObject(&Event,
-                Executive,
-                Irp->RequestorMode,
-                FALSE,
-                NULL);
-            if ((Status == STATUS_USER_APC) || (Status == STATUS_KERNEL_APC))
-            {
-                Status = STATUS_CANCELLED;
-                goto done;
-            }
-            if (!NT_SUCCESS(Status))
-            {
-                ASSERT(FALSE);
-            }
-            ExAcquireFastMutex(&Ccb->DataListLock);
-        }
-        Irp->IoStatus.Information = 0;
-    }
-    else
+    /* Reads are served in order, so only the first one may take data now */
+    if (IsListEmpty(&Ccb->ReadRequestListHead) &&
+        NpfsReadFromBuffer(Ccb, Irp))
     {
-        KIRQL oldIrql;
-        if (IsListEmpty(&Ccb->ReadRequestListHead) ||
-            Ccb->ReadRequestListHead.Flink != &Context->ListEntry)
-        {
-            /* this is a new request */
-            Irp->IoStatus.Information = 0;
-            Context->WaitEvent = &Ccb->ReadEvent;
-            InsertTailList(&Ccb->ReadRequestListHead, &Context->ListEntry);
-            if (Ccb->ReadRequestListHead.Flink != &Context->ListEntry)
-            {
-                /* there was already a request on the list */
-                IoAcquireCancelSpinLock(&oldIrql);
-                if (Irp->Cancel)
-                {
-                    IoReleaseCancelSpinLock(oldIrql);
-                    RemoveEntryList(&Context->ListEntry);
-                    ExReleaseFastMutex(&Ccb->DataListLock);
-                    Status = STATUS_CANCELLED;
-                    goto done;
-                }
-                (void)IoSetCancelRoutine(Irp, NpfsReadWriteCancelRoutine);
-                IoReleaseCancelSpinLock(oldIrql);
-                ExReleaseFastMutex(&Ccb->DataListLock);
-                IoMarkIrpPending(Irp);
-                Status = STATUS_PENDING;
-                goto done;
-            }
-        }
+        /* Room was made, let the writes waiting for it in */
+        NpfsServiceWriteRequests(Ccb);
+        ExReleaseFastMutex(&Ccb->DataListLock);
+        Status = STATUS_SUCCESS;
+        goto done;
     }
 
-    while (1)
+    if ((Ccb->PipeState != FILE_PIPE_CONNECTED_STATE) || (!Ccb->OtherSide))
     {
-        Buffer = MmGetSystemAddressForMdl(Irp->MdlAddress);
-        Information = Irp->IoStatus.Information;
-        Length = IoGetCurrentIrpStackLocation(Irp)->Parameters.Read.Length;
-        ASSERT (Information <= Length);
-        Buffer = (PVOID)((ULONG_PTR)Buffer + Information);
-        Length -= Information;
-        Status = STATUS_SUCCESS;
-
-        while (1)
-        {
-            if (Ccb->ReadDataAvailable == 0)
-            {
-                ULONG ConnectionSideReadMode;
-
-                if (Ccb->PipeEnd == FILE_PIPE_CLIENT_END) ConnectionSideReadMode=Ccb->Fcb->ClientReadMode;
-                else ConnectionSideReadMode = Ccb->Fcb->ServerReadMode;
-
-                if ((Ccb->PipeState == FILE_PIPE_CONNECTED_STATE) && (Ccb->OtherSide))
-                {
-                    KeSetEvent(&Ccb->OtherSide->WriteEvent, IO_NO_INCREMENT, FALSE);
-                }
-                if (Information > 0 &&
-                    (ConnectionSideReadMode != FILE_PIPE_BYTE_STREAM_MODE ||
-                    Ccb->PipeState != FILE_PIPE_CONNECTED_STATE))
-                {
-                    break;
-                }
-                if (((Ccb->PipeState != FILE_PIPE_CONNECTED_STATE) || (!Ccb->OtherSide)) && (Ccb->ReadDataAvailable == 0))
-                {
-                    DPRINT("PipeState: %x\n", Ccb->PipeState);
-                    Status = STATUS_PIPE_BROKEN;
-                    break;
-                }
-                ExReleaseFastMutex(&Ccb->DataListLock);
-
-                if (IoIsOperationSynchronous(Irp))
-                {
-                    /* Wait for ReadEvent to become signaled */
-
-                    DPRINT("Waiting for readable data (%wZ)\n", &Ccb->Fcb->PipeName);
-                    Status = KeWaitForSingleObject(&Ccb->ReadEvent,
-                        UserRequest,
-                        Irp->RequestorMode,
-                        FALSE,
-                        NULL);
-                    DPRINT("Finished waiting (%wZ)! Status: %x\n", &Ccb->Fcb->PipeName, Status);
-
-                    if ((Status == STATUS_USER_APC) || (Status == STATUS_KERNEL_APC))
-                    {
-                        Status = STATUS_CANCELLED;
-                        break;
-                    }
-                    if (!NT_SUCCESS(Status))
-                    {
-                        ASSERT(FALSE);
-                    }
-                    ExAcquireFastMutex(&Ccb->DataListLock);
-                }
-                else
-                {
-                    Context = (PNPFS_CONTEXT)&Irp->Tail.Overlay.DriverContext;
-
-                    Context->WaitEvent = &Ccb->ReadEvent;
-                    Status = NpfsAddWaitingReadWriteRequest(DeviceObject, Irp);
-
-                    if (NT_SUCCESS(Status))
-                    {
-                        Status = STATUS_PENDING;
-                        goto done;
-                    }
-                    ExAcquireFastMutex(&Ccb->DataListLock);
-                    break;
-                }
-            }
-            ASSERT(IoGetCurrentIrpStackLocation(Irp)->FileObject != NULL);
-
-            /* If the pipe type and read mode are both byte stream */
-            if (Ccb->Fcb->PipeType == FILE_PIPE_BYTE_STREAM_TYPE)
-            {
-                DPRINT("Byte stream mode: Ccb->Data %x\n", Ccb->Data);
-                /* Byte stream mode */
-                while (Length > 0 && Ccb->ReadDataAvailable > 0)
-                {
-                    CopyLength = min(Ccb->ReadDataAvailable, Length);
-                    if ((ULONG_PTR)Ccb->ReadPtr + CopyLength <= (ULONG_PTR)Ccb->Data + Ccb->MaxDataLength)
-                    {
-                        memcpy(Buffer, Ccb->ReadPtr, CopyLength);
-                        Ccb->ReadPtr = (PVOID)((ULONG_PTR)Ccb->ReadPtr + CopyLength);
-                        if (Ccb->ReadPtr == (PVOID)((ULONG_PTR)Ccb->Data + Ccb->MaxDataLength))
-                        {
-                            Ccb->ReadPtr = Ccb->Data;
-                        }
-                    }
-                    else
-                    {
-                        TempLength = (ULONG)((ULONG_PTR)Ccb->Data + Ccb->MaxDataLength - (ULONG_PTR)Ccb->ReadPtr);
-                        memcpy(Buffer, Ccb->ReadPtr, TempLength);
-                        memcpy((PVOID)((ULONG_PTR)Buffer + TempLength), Ccb->Data, CopyLength - TempLength);
-                        Ccb->ReadPtr = (PVOID)((ULONG_PTR)Ccb->Data + CopyLength - TempLength);
-                    }
-
-                    Buffer = (PVOID)((ULONG_PTR)Buffer + CopyLength);
-                    Length -= CopyLength;
-                    Information += CopyLength;
-
-                    Ccb->ReadDataAvailable -= CopyLength;
-                    Ccb->WriteQuotaAvailable += CopyLength;
-                }
-
-                if ((Length == 0) || (Ccb->ReadDataAvailable == 0))
-                {
-                    if ((Ccb->PipeState == FILE_PIPE_CONNECTED_STATE) && (Ccb->OtherSide))
-                    {
-                        KeSetEvent(&Ccb->OtherSide->WriteEvent, IO_NO_INCREMENT, FALSE);
-                    }
-                    KeResetEvent(&Ccb->ReadEvent);
-                    break;
-                }
-            }
-            else if (Ccb->Fcb->PipeType == FILE_PIPE_MESSAGE_TYPE)
-            {
-                DPRINT("Message mode: Ccb>Data %x\n", Ccb->Data);
-
-                /* Check if buffer is full and the read pointer is not at the start of the buffer */
-                if ((Ccb->WriteQuotaAvailable == 0) && (Ccb->ReadPtr > Ccb->Data))
-                {
-                    Ccb->WriteQuotaAvailable += (ULONG_PTR)Ccb->ReadPtr - (ULONG_PTR)Ccb->Data;
-                    memcpy(Ccb->Data, Ccb->ReadPtr, (ULONG_PTR)Ccb->WritePtr - (ULONG_PTR)Ccb->ReadPtr);
-                    Ccb->WritePtr = (PVOID)((ULONG_PTR)Ccb->WritePtr - ((ULONG_PTR)Ccb->ReadPtr - (ULONG_PTR)Ccb->Data));
-                    Ccb->ReadPtr = Ccb->Data;
-                    ASSERT((ULONG_PTR)Ccb->WritePtr < ((ULONG_PTR)Ccb->Data + Ccb->MaxDataLength));
-                    ASSERT(Ccb->WritePtr >= Ccb->Data);
-                }
-
-                /* For Message mode, the Message length is stored in the buffer preceeding the Message. */
-                if (Ccb->ReadDataAvailable)
-                {
-                    ULONG NextMessageLength = 0;
-
-                    /*First get the size of the message */
-                    memcpy(&NextMessageLength, Ccb->ReadPtr, sizeof(NextMessageLength));
-
-                    if ((NextMessageLength == 0) || (NextMessageLength > Ccb->ReadDataAvailable))
-                    {
-                        DPRINT1("Possible memory corruption.\n");
-                        HexDump(Ccb->Data, (ULONG_PTR)Ccb->WritePtr - (ULONG_PTR)Ccb->Data);
-                        ASSERT(FALSE);
-                    }
-
-                    /* Use the smaller value */
-                    CopyLength = min(NextMessageLength, Length);
-                    ASSERT(CopyLength > 0);
-                    ASSERT(CopyLength <= Ccb->ReadDataAvailable);
-                    /* retrieve the message from the buffer */
-                    memcpy(Buffer, (PVOID)((ULONG_PTR)Ccb->ReadPtr + sizeof(NextMessageLength)), CopyLength);
-
-                    if (Ccb->ReadDataAvailable > CopyLength)
-                    {
-                        if (CopyLength < NextMessageLength)
-                        /* Client only requested part of the message */
-                        {
-                            /* Calculate the remaining message new size */
-                            ULONG NewMessageSize = NextMessageLength-CopyLength;
-
-                            /* Update ReadPtr to point to new Message size location */
-                            Ccb->ReadPtr = (PVOID)((ULONG_PTR)Ccb->ReadPtr + CopyLength);
-
-                            /* Write a new Message size to buffer for the part of the message still there */
-                            memcpy(Ccb->ReadPtr, &NewMessageSize, sizeof(NewMessageSize));
-                        }
-                        else
-                        /* Client wanted the entire message */
-                        {
-                            /* Update ReadPtr to point to next message size */
-                            Ccb->ReadPtr = (PVOID)((ULONG_PTR)Ccb->ReadPtr + CopyLength + sizeof(CopyLength));
-                        }
-                    }
-                    else
-                    {
-                        /* This was the last Message, so just zero start of buffer for safety sake */
-                        memset(Ccb->Data, 0, NextMessageLength + sizeof(NextMessageLength));
-
-                        /* Reset to MaxDataLength as partial message retrievals dont
-                           give the length back to Quota */
-                        Ccb->WriteQuotaAvailable = Ccb->MaxDataLength;
-
-                        /* reset read and write pointer to beginning of buffer */
-                        Ccb->WritePtr = Ccb->Data;
-                        Ccb->ReadPtr = Ccb->Data;
-                    }
-#ifndef NDEBUG
-                    DPRINT("Length %d Buffer %x\n",CopyLength,Buffer);
-                    HexDump((PUCHAR)Buffer, CopyLength);
-#endif
-
-                    Information += CopyLength;
-
-                    Ccb->ReadDataAvailable -= CopyLength;
-
-                    if ((ULONG)Ccb->WriteQuotaAvailable > (ULONG)Ccb->MaxDataLength) ASSERT(FALSE);
-                }
-
-                if (Information > 0)
-                {
-                    ULONG ConnectionSideReadMode;
-
-                    if (Ccb->PipeEnd == FILE_PIPE_CLIENT_END) ConnectionSideReadMode=Ccb->Fcb->ClientReadMode;
-                    else ConnectionSideReadMode = Ccb->Fcb->ServerReadMode;
-
-                    if ((ConnectionSideReadMode == FILE_PIPE_BYTE_STREAM_MODE) && (Ccb->ReadDataAvailable) && (Length > CopyLength))
-                    {
-                        Buffer = (PVOID)((ULONG_PTR)Buffer + CopyLength);
-                        Length -= CopyLength;
-                    }
-                    else
-                    {
-                        KeResetEvent(&Ccb->ReadEvent);
-
-                        if ((Ccb->PipeState == FILE_PIPE_CONNECTED_STATE) && (Ccb->WriteQuotaAvailable > 0) && (Ccb->OtherSide))
-                        {
-                            KeSetEvent(&Ccb->OtherSide->WriteEvent, IO_NO_INCREMENT, FALSE);
-                        }
-                        break;
-                    }
-                }
-            }
-            else
-            {
-                DPRINT1("Unhandled Pipe Mode!\n");
-                ASSERT(FALSE);
-            }
-        }
-        Irp->IoStatus.Information = Information;
-        Irp->IoStatus.Status = Status;
-
-        ASSERT(IoGetCurrentIrpStackLocation(Irp)->FileObject != NULL);
-
-        if (Status == STATUS_CANCELLED)
-            goto done;
-
-        if (IoIsOperationSynchronous(Irp))
-        {
-            RemoveEntryList(&Context->ListEntry);
-            if (!IsListEmpty(&Ccb->ReadRequestListHead))
-            {
-                Context = CONTAINING_RECORD(Ccb->ReadRequestListHead.Flink, NPFS_CONTEXT, ListEntry);
-                KeSetEvent(Context->WaitEvent, IO_NO_INCREMENT, FALSE);
-            }
-            ExReleaseFastMutex(&Ccb->DataListLock);
-            IoCompleteRequest(Irp, IO_NO_INCREMENT);
-
-            DPRINT("NpfsRead done (Status %lx)\n", Status);
-            return Status;
-        }
-        else
-        {
-            KIRQL oldIrql;
-
-            if (IsOriginalRequest)
-            {
-                IsOriginalRequest = FALSE;
-                OriginalStatus = Status;
-            }
-            if (Status == STATUS_PENDING)
-            {
-                ExReleaseFastMutex(&Ccb->DataListLock);
-                DPRINT("NpfsRead done (Status %lx)\n", OriginalStatus);
-                return OriginalStatus;
-            }
-            RemoveEntryList(&Context->ListEntry);
-            IoCompleteRequest(Irp, IO_NO_INCREMENT);
-            if (IsListEmpty(&Ccb->ReadRequestListHead))
-            {
-                ExReleaseFastMutex(&Ccb->DataListLock);
-                DPRINT("NpfsRead done (Status %lx)\n", OriginalStatus);
-                return OriginalStatus;
-            }
+        DPRINT("PipeState: %x\n", Ccb->PipeState);
+        ExReleaseFastMutex(&Ccb->DataListLock);
+        Status = STATUS_PIPE_BROKEN;
+        goto done;
+    }
 
-            IoAcquireCancelSpinLock(&oldIrql);
-            Context = CONTAINING_RECORD(Ccb->ReadRequestListHead.Flink, NPFS_CONTEXT, ListEntry);
+    /* Wait for a write, the calling thread is not blocked */
+    DPRINT("Waiting for readable data (%wZ)\n", &Ccb->Fcb->PipeName);
+    Status = NpfsQueueRequest(Ccb, &Ccb->ReadRequestListHead, Irp);
+    ExReleaseFastMutex(&Ccb->DataListLock);
 
-            Irp = CONTAINING_RECORD(Context, IRP, Tail.Overlay.DriverContext);
-            /* Verify the Irp wasnt cancelled */
-            if (Irp->Cancel)
-            {
-                IoReleaseCancelSpinLock(oldIrql);
-                RemoveEntryList(&Context->ListEntry);
-                ExReleaseFastMutex(&Ccb->DataListLock);
-                Status = STATUS_CANCELLED;
-                goto done;
-            }
-            /* The Irp will now be handled, so remove the CancelRoutine */
-            (void)IoSetCancelRoutine(Irp, NULL);
-            IoReleaseCancelSpinLock(oldIrql);
-        }
-    }
+    DPRINT("NpfsRead pending\n");
+    return Status;
 
 done:
     Irp->IoStatus.Status = Status;
+    IoCompleteRequest(Irp, IO_NO_INCREMENT);
 
-    if (Status != STATUS_PENDING)
-    {
-        IoCompleteRequest(Irp, IO_NO_INCREMENT);
-    }
     DPRINT("NpfsRead done (Status %lx)\n", Status);
 
     return Status;
@@ -740,16 +633,11 @@ NpfsWrite(PDEVICE_OBJECT DeviceObject,
 {
     PIO_STACK_LOCATION IoStack;
     PFILE_OBJECT FileObject;
-    PNPFS_FCB Fcb = NULL;
     PNPFS_CCB Ccb = NULL;
     PNPFS_CCB ReaderCcb;
-    PUCHAR Buffer;
     NTSTATUS Status = STATUS_SUCCESS;
-    ULONG Length;
-    ULONG Offset;
-    ULONG Information = 0;
-    ULONG CopyLength;
-    ULONG TempLength;
+    ULONG Available;
+    BOOLEAN Done;
 
     DPRINT("NpfsWrite()\n");
 
@@ -760,26 +648,22 @@ NpfsWrite(PDEVICE_OBJECT DeviceObject,
 
     Ccb = FileObject->FsContext2;
 
+    Irp->IoStatus.Information = 0;
+
     /* Fail, if the CCB is not a pipe CCB */
     if (Ccb->Type != CCB_PIPE)
     {
         DPRINT("Not a pipe!\n");
         Status = STATUS_INVALID_PARAMETER;
-        Length = 0;
         goto done;
     }
 
     ReaderCcb = Ccb->OtherSide;
-    Fcb = Ccb->Fcb;
-
-    Length = IoStack->Parameters.Write.Length;
-    Offset = IoStack->Parameters.Write.ByteOffset.u.LowPart;
 
     if (Irp->MdlAddress == NULL)
     {
         DPRINT("Irp->MdlAddress == NULL\n");
         Status = STATUS_UNSUCCESSFUL;
-        Length = 0;
         goto done;
     }
 
@@ -792,7 +676,6 @@ NpfsWrite(PDEVICE_OBJECT DeviceObject,
             Status = STATUS_PIPE_DISCONNECTED;
         else
             Status = STATUS_UNSUCCESSFUL;
-        Length = 0;
         goto done;
     }
 
@@ -800,187 +683,68 @@ NpfsWrite(PDEVICE_OBJECT DeviceObject,
     {
         DPRINT("Pipe is NOT writable!\n");
         Status = STATUS_UNSUCCESSFUL;
-        Length = 0;
         goto done;
     }
 
-    Status = STATUS_SUCCESS;
-    Buffer = MmGetSystemAddressForMdlSafe (Irp->MdlAddress, NormalPagePriority);
-
-    if (!Buffer)
+    if (!MmGetSystemAddressForMdlSafe(Irp->MdlAddress, NormalPagePriority))
     {
         DPRINT("MmGetSystemAddressForMdlSafe failed\n");
         Status = STATUS_INSUFFICIENT_RESOURCES;
-        Length = 0;
         goto done;
-
     }
 
-    ExAcquireFastMutex(&ReaderCcb->DataListLock);
-
 #ifndef NDEBUG
-    DPRINT("Length %d Buffer %x Offset %x\n",Length,Buffer,Offset);
-    HexDump(Buffer, Length);
+    DPRINT("Length %d Buffer %x\n", IoStack->Parameters.Write.Length, MmGetSystemAddressForMdl(Irp->MdlAddress));
+    HexDump(MmGetSystemAddressForMdl(Irp->MdlAddress), IoStack->Parameters.Write.Length);
 #endif
 
-    while(1)
+    ExAcquireFastMutex(&ReaderCcb->DataListLock);
+
+    /* The reader may have gone away before we got the lock */
+    if (Ccb->PipeState != FILE_PIPE_CONNECTED_STATE || ReaderCcb->Data == NULL)
     {
-        if ((ReaderCcb->WriteQuotaAvailable == 0))
-        {
-            if (Ccb->PipeState != FILE_PIPE_CONNECTED_STATE || !Ccb->OtherSide)
-            {
-                Status = STATUS_PIPE_BROKEN;
-                ExReleaseFastMutex(&ReaderCcb->DataListLock);
-                goto done;
-            }
-            KeSetEvent(&ReaderCcb->ReadEvent, IO_NO_INCREMENT, FALSE);
-            ExReleaseFastMutex(&ReaderCcb->DataListLock);
-
-            DPRINT("Write Waiting for buffer space (%S)\n", Fcb->PipeName.Buffer);
-            Status = KeWaitForSingleObject(&Ccb->WriteEvent,
-                UserRequest,
-                Irp->RequestorMode,
-                FALSE,
-                NULL);
-            DPRINT("Write Finished waiting (%S)! Status: %x\n", Fcb->PipeName.Buffer, Status);
-
-            if ((Status == STATUS_USER_APC) || (Status == STATUS_KERNEL_APC))
-            {
-                Status = STATUS_CANCELLED;
-                goto done;
-            }
-            if (!NT_SUCCESS(Status))
-            {
-                ASSERT(FALSE);
-            }
-            /*
-            * It's possible that the event was signaled because the
-            * other side of pipe was closed.
-            */
-            if (Ccb->PipeState != FILE_PIPE_CONNECTED_STATE || !Ccb->OtherSide)
-            {
-                DPRINT("PipeState: %x\n", Ccb->PipeState);
-                Status = STATUS_PIPE_BROKEN;
-                goto done;
-            }
-            /* Check that the pipe has not been closed */
-            if (ReaderCcb->PipeState != FILE_PIPE_CONNECTED_STATE || !ReaderCcb->OtherSide)
-            {
-                Status = STATUS_PIPE_BROKEN;
-                goto done;
-            }
-            ExAcquireFastMutex(&ReaderCcb->DataListLock);
-        }
+        ExReleaseFastMutex(&ReaderCcb->DataListLock);
+        Status = STATUS_PIPE_BROKEN;
+        goto done;
+    }
 
-        if (Ccb->Fcb->PipeType == FILE_PIPE_BYTE_STREAM_TYPE)
+    /* Writes are served in order, so wait behind those already waiting */
+    Done = FALSE;
+    if (IsListEmpty(&ReaderCcb->WriteRequestListHead))
+    {
+        if (ReaderCcb->ReadDataAvailable == 0)
         {
-            DPRINT("Byte stream mode: Ccb->Data %x, Ccb->WritePtr %x\n", ReaderCcb->Data, ReaderCcb->WritePtr);
-
-            while (Length > 0 && ReaderCcb->WriteQuotaAvailable > 0)
-            {
-                CopyLength = min(Length, ReaderCcb->WriteQuotaAvailable);
-
-                if ((ULONG_PTR)ReaderCcb->WritePtr + CopyLength <= (ULONG_PTR)ReaderCcb->Data + ReaderCcb->MaxDataLength)
-                {
-                    memcpy(ReaderCcb->WritePtr, Buffer, CopyLength);
-                    ReaderCcb->WritePtr = (PVOID)((ULONG_PTR)ReaderCcb->WritePtr + CopyLength);
-                    if ((ULONG_PTR)ReaderCcb->WritePtr == (ULONG_PTR)ReaderCcb->Data + ReaderCcb->MaxDataLength)
-                    {
-                        ReaderCcb->WritePtr = ReaderCcb->Data;
-                    }
-                }
-                else
-                {
-
-                    TempLength = (ULONG)((ULONG_PTR)ReaderCcb->Data + ReaderCcb->MaxDataLength -
-                            (ULONG_PTR)ReaderCcb->WritePtr);
-
-                    memcpy(ReaderCcb->WritePtr, Buffer, TempLength);
-                    memcpy(ReaderCcb->Data, Buffer + TempLength, CopyLength - TempLength);
-                    ReaderCcb->WritePtr = (PVOID)((ULONG_PTR)ReaderCcb->Data + CopyLength - TempLength);
-                }
-
-                Buffer += CopyLength;
-                Length -= CopyLength;
-                Information += CopyLength;
-
-                ReaderCcb->ReadDataAvailable += CopyLength;
-                ReaderCcb->WriteQuotaAvailable -= CopyLength;
-            }
-
-            if (Length == 0)
-            {
-                KeSetEvent(&ReaderCcb->ReadEvent, IO_NO_INCREMENT, FALSE);
-                KeResetEvent(&Ccb->WriteEvent);
-                break;
-            }
+            NpfsHandOffToReaders(ReaderCcb, Irp);
         }
-        else if (Ccb->Fcb->PipeType == FILE_PIPE_MESSAGE_TYPE)
-        {
-            /* For Message Type Pipe, the Pipes memory will be used to store the size of each message */
-            DPRINT("Message mode: Ccb->Data %x, Ccb->WritePtr %x\n",ReaderCcb->Data, ReaderCcb->WritePtr);
-            if (Length > 0)
-            {
-                /* Verify the WritePtr is still inside the buffer */
-                if (((ULONG_PTR)ReaderCcb->WritePtr > ((ULONG_PTR)ReaderCcb->Data + (ULONG_PTR)ReaderCcb->MaxDataLength)) ||
-                ((ULONG_PTR)ReaderCcb->WritePtr < (ULONG_PTR)ReaderCcb->Data))
-                {
-                    DPRINT1("NPFS is writing out of its buffer. Report to developer!\n");
-                    DPRINT1("ReaderCcb->WritePtr %x, ReaderCcb->Data %x, ReaderCcb->MaxDataLength %lu\n",
-                        ReaderCcb->WritePtr, ReaderCcb->Data, ReaderCcb->MaxDataLength);
-                    ASSERT(FALSE);
-                }
-
-                CopyLength = min(Length, ReaderCcb->WriteQuotaAvailable - sizeof(ULONG));
-                if (CopyLength > ReaderCcb->WriteQuotaAvailable)
-                {
-                    DPRINT1("Writing %lu byte to pipe would overflow as only %lu bytes are available\n",
-                        CopyLength, ReaderCcb->WriteQuotaAvailable);
-                    ASSERT(FALSE);
-                }
 
-                /* First Copy the Length of the message into the pipes buffer */
-                memcpy(ReaderCcb->WritePtr, &CopyLength, sizeof(CopyLength));
-
-                /* Now the user buffer itself */
-                memcpy((PVOID)((ULONG_PTR)ReaderCcb->WritePtr + sizeof(CopyLength)), Buffer, CopyLength);
-
-                /* Update the write pointer */
-                ReaderCcb->WritePtr = (PVOID)((ULONG_PTR)ReaderCcb->WritePtr + sizeof(CopyLength) + CopyLength);
-
-                Information += CopyLength;
-
-                ReaderCcb->ReadDataAvailable += CopyLength;
+        do
+        {
+            Done = NpfsWriteToBuffer(ReaderCcb, Irp);
 
-                ReaderCcb->WriteQuotaAvailable -= (CopyLength + sizeof(ULONG));
+            Available = ReaderCcb->ReadDataAvailable;
+            NpfsServiceReadRequests(ReaderCcb);
 
-                if ((ULONG_PTR)ReaderCcb->WriteQuotaAvailable > (ULONG)ReaderCcb->MaxDataLength)
-                {
-                    DPRINT1("QuotaAvailable is greater than buffer size!\n");
-                    ASSERT(FALSE);
-                }
-            }
+            /* Go on while waiting reads make room */
+        } while (!Done && ReaderCcb->ReadDataAvailable < Available);
+    }
 
-            if (Information > 0)
-            {
-                KeSetEvent(&ReaderCcb->ReadEvent, IO_NO_INCREMENT, FALSE);
-                KeResetEvent(&Ccb->WriteEvent);
-                break;
-            }
-        }
-        else
-        {
-            DPRINT1("Unhandled Pipe Type Mode and Read Write Mode!\n");
-            ASSERT(FALSE);
-        }
+    if (Done)
+    {
+        ExReleaseFastMutex(&ReaderCcb->DataListLock);
+        Status = STATUS_SUCCESS;
+        goto done;
     }
 
+    /* Wait for buffer space, the calling thread is not blocked */
+    DPRINT("Write Waiting for buffer space (%wZ)\n", &Ccb->Fcb->PipeName);
+    Status = NpfsQueueRequest(ReaderCcb, &ReaderCcb->WriteRequestListHead, Irp);
     ExReleaseFastMutex(&ReaderCcb->DataListLock);
 
+    DPRINT("NpfsWrite pending\n");
+    return Status;
+
 done:
     Irp->IoStatus.Status = Status;
-    Irp->IoStatus.Information = Information;
-
     IoCompleteRequest(Irp, IO_NO_INCREMENT);
 
     DPRINT("NpfsWrite done (Status %lx)\n", Status);
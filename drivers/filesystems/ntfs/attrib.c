@@ -111,6 +111,130 @@ FindRun (PNONRESIDENT_ATTRIBUTE NresAttr,
 }
 
 
+NTSTATUS
+NtfsDecodeRunList(PNONRESIDENT_ATTRIBUTE NresAttr,
+		  PNTFS_EXTENT_MAP *Map)
+/*
+ * FUNCTION: Decodes the mapping pairs of a nonresident attribute once, so
+ *           that later VCN lookups need not walk the run list again
+ */
+{
+  PNTFS_EXTENT_MAP NewMap;
+  PNTFS_EXTENT Extent;
+  PUCHAR RunStart;
+  PUCHAR RunEnd;
+  PUCHAR run;
+  ULONGLONG Vcn;
+  LONGLONG Lcn;
+  ULONGLONG Count;
+  ULONG Runs;
+
+  RunStart = (PUCHAR)((ULONG_PTR)NresAttr + NresAttr->RunArrayOffset);
+  RunEnd = (PUCHAR)((ULONG_PTR)NresAttr + NresAttr->Attribute.Length);
+
+  /* Count the runs, making sure none of them leaves the attribute */
+  Runs = 0;
+  for (run = RunStart; run < RunEnd && *run != 0; run += RunLength(run))
+    {
+      if ((*run & 0x0f) > 8 || ((*run >> 4) & 0x0f) > 8 ||
+	  run + RunLength(run) > RunEnd)
+	{
+	  DPRINT1("Corrupt run list in attribute %p\n", NresAttr);
+	  return STATUS_FILE_CORRUPT_ERROR;
+	}
+      Runs++;
+    }
+
+  NewMap = ExAllocatePoolWithTag(NonPagedPool,
+				 FIELD_OFFSET(NTFS_EXTENT_MAP, Extents) +
+				 Runs * sizeof(NTFS_EXTENT),
+				 TAG_NTFS);
+  if (NewMap == NULL)
+    {
+      return STATUS_INSUFFICIENT_RESOURCES;
+    }
+
+  /* Decode them, merging runs that follow each other on disk */
+  NewMap->Count = 0;
+  Extent = NULL;
+  Vcn = NresAttr->StartVcn;
+  Lcn = 0;
+  for (run = RunStart; Runs > 0; run += RunLength(run), Runs--)
+    {
+      Count = RunCount(run);
+      Lcn += RunLCN(run);
+
+      if (Extent != NULL &&
+	  ((RunLCN(run) == 0 && Extent->Lcn == 0) ||
+	   (RunLCN(run) != 0 && Extent->Lcn != 0 &&
+	    Extent->Lcn + Extent->Count == (ULONGLONG)Lcn)))
+	{
+	  Extent->Count += Count;
+	}
+      else
+	{
+	  Extent = &NewMap->Extents[NewMap->Count++];
+	  Extent->Vcn = Vcn;
+	  Extent->Lcn = (RunLCN(run) == 0) ? 0 : Lcn;
+	  Extent->Count = Count;
+	}
+
+      Vcn += Count;
+    }
+
+  *Map = NewMap;
+
+  return STATUS_SUCCESS;
+}
+
+
+BOOLEAN
+NtfsLookupExtent(PNTFS_EXTENT_MAP Map,
+		 ULONGLONG Vcn,
+		 PULONGLONG Lcn,
+		 PULONGLONG Count)
+/*
+ * FUNCTION: Same as FindRun, but on a decoded run list
+ */
+{
+  PNTFS_EXTENT Extent;
+  ULONG Low = 0;
+  ULONG High = Map->Count;
+  ULONG Middle;
+
+  while (Low < High)
+    {
+      Middle = Low + (High - Low) / 2;
+      Extent = &Map->Extents[Middle];
+
+      if (Vcn < Extent->Vcn)
+	{
+	  High = Middle;
+	}
+      else if (Vcn >= Extent->Vcn + Extent->Count)
+	{
+	  Low = Middle + 1;
+	}
+      else
+	{
+	  *Lcn = (Extent->Lcn == 0) ? 0 : Extent->Lcn + Vcn - Extent->Vcn;
+	  *Count = Extent->Count - (Vcn - Extent->Vcn);
+
+	  return TRUE;
+	}
+    }
+
+  return FALSE;
+}
+
+
+VOID
+NtfsFreeExtentMap(PNTFS_EXTENT_MAP Map)
+{
+  ExFreePoolWithTag(Map, TAG_NTFS);
+}
+
+
 static VOID
 NtfsDumpFileNameAttribute(PATTRIBUTE Attribute)
 {
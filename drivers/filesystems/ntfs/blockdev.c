@@ -37,7 +37,7 @@
 
 NTSTATUS
 NtfsReadSectors(IN PDEVICE_OBJECT DeviceObject,
-		IN ULONG DiskSector,
+		IN ULONGLONG DiskSector,
 		IN ULONG SectorCount,
 		IN ULONG SectorSize,
 		IN OUT PUCHAR Buffer,
@@ -58,7 +58,7 @@ NtfsReadSectors(IN PDEVICE_OBJECT DeviceObject,
   Offset.QuadPart = (LONGLONG)DiskSector * (LONGLONG)SectorSize;
   BlockSize = SectorCount * SectorSize;
 
-  DPRINT("NtfsReadSectors(DeviceObject %p, DiskSector %d, Buffer %p)\n",
+  DPRINT("NtfsReadSectors(DeviceObject %p, DiskSector %I64u, Buffer %p)\n",
 	 DeviceObject, DiskSector, Buffer);
   DPRINT("Offset %I64x BlockSize %ld\n",
 	 Offset.QuadPart,
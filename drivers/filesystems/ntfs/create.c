@@ -148,6 +148,46 @@ NtfsOpenFile(PDEVICE_EXTENSION DeviceExt,
 }
 
 
+static NTSTATUS
+NtfsOpenFileById(PDEVICE_EXTENSION DeviceExt,
+		 PFILE_OBJECT FileObject)
+/*
+ * FUNCTION: Opens a file by its file reference, which is passed as the
+ *           file name. Name lookup in directories is not implemented yet,
+ *           so this is the way to get at the data of a file.
+ */
+{
+  ULONGLONG FileId;
+  PNTFS_FCB Fcb;
+  NTSTATUS Status;
+
+  if (FileObject->RelatedFileObject != NULL ||
+      FileObject->FileName.Length != sizeof(ULONGLONG))
+    {
+      return(STATUS_INVALID_PARAMETER);
+    }
+
+  RtlCopyMemory(&FileId, FileObject->FileName.Buffer, sizeof(ULONGLONG));
+  DPRINT("NtfsOpenFileById(%p, %p, %I64x)\n", DeviceExt, FileObject, FileId);
+
+  Status = NtfsMakeFCBFromFileId(DeviceExt, FileId, &Fcb);
+  if (!NT_SUCCESS(Status))
+    {
+      return(Status);
+    }
+
+  Status = NtfsAttachFCBToFileObject(DeviceExt,
+				     Fcb,
+				     FileObject);
+  if (!NT_SUCCESS(Status))
+    {
+      NtfsReleaseFCB(DeviceExt, Fcb);
+    }
+
+  return(Status);
+}
+
+
 static NTSTATUS
 NtfsCreateFile(PDEVICE_OBJECT DeviceObject,
 	       PIRP Irp)
@@ -188,9 +228,17 @@ NtfsCreateFile(PDEVICE_OBJECT DeviceObject,
       return(STATUS_ACCESS_DENIED);
     }
 
-  Status = NtfsOpenFile(DeviceExt,
-			FileObject,
-			FileObject->FileName.Buffer);
+  if (Stack->Parameters.Create.Options & FILE_OPEN_BY_FILE_ID)
+    {
+      Status = NtfsOpenFileById(DeviceExt,
+				FileObject);
+    }
+  else
+    {
+      Status = NtfsOpenFile(DeviceExt,
+			    FileObject,
+			    FileObject->FileName.Buffer);
+    }
 
   /*
    * If the directory containing the file to open doesn't exist then
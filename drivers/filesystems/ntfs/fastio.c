@@ -53,12 +53,25 @@ BOOLEAN NTAPI
 NtfsAcqReadAhead(PVOID Context,
                  BOOLEAN Wait)
 {
-  UNIMPLEMENTED;
-  return FALSE;
+  PNTFS_FCB Fcb = (PNTFS_FCB)Context;
+
+  ASSERT(Fcb->Identifier.Type == NTFS_TYPE_FCB);
+
+  if (!ExAcquireResourceSharedLite(&Fcb->MainResource, Wait))
+    return FALSE;
+
+  /* Let the paging reads know they come from the cache manager */
+  IoSetTopLevelIrp((PIRP)FSRTL_CACHE_TOP_LEVEL_IRP);
+  return TRUE;
 }
 
 VOID NTAPI
 NtfsRelReadAhead(PVOID Context)
 {
-  UNIMPLEMENTED;
+  PNTFS_FCB Fcb = (PNTFS_FCB)Context;
+
+  ASSERT(Fcb->Identifier.Type == NTFS_TYPE_FCB);
+
+  IoSetTopLevelIrp(NULL);
+  ExReleaseResourceLite(&Fcb->MainResource);
 }
@@ -26,6 +26,7 @@
 /* INCLUDES *****************************************************************/
 
 #include "ntfs.h"
+#include <stdio.h>
 
 #define NDEBUG
 #include <debug.h>
@@ -76,6 +77,10 @@ NtfsCreateFCB(PCWSTR FileName, PNTFS_VCB Vcb)
   ASSERT(Vcb->Identifier.Type == NTFS_TYPE_VCB);
 
   Fcb = ExAllocatePoolWithTag(NonPagedPool, sizeof(NTFS_FCB), TAG_FCB);
+  if (Fcb == NULL)
+  {
+    return(NULL);
+  }
   RtlZeroMemory(Fcb, sizeof(NTFS_FCB));
 
   Fcb->Identifier.Type = NTFS_TYPE_FCB;
@@ -112,6 +117,15 @@ NtfsDestroyFCB(PNTFS_FCB Fcb)
 
   ExDeleteResourceLite(&Fcb->MainResource);
 
+  if (Fcb->DataExtents)
+  {
+    NtfsFreeExtentMap(Fcb->DataExtents);
+  }
+  if (Fcb->ResidentData)
+  {
+    ExFreePool(Fcb->ResidentData);
+  }
+
   ExFreePool(Fcb);
 }
 
@@ -119,9 +133,7 @@ NtfsDestroyFCB(PNTFS_FCB Fcb)
 BOOLEAN
 NtfsFCBIsDirectory(PNTFS_FCB Fcb)
 {
-//  return(Fcb->entry.Attrib & FILE_ATTRIBUTE_DIRECTORY);
-//  return(Fcb->Entry.FileFlags & 0x02);
-  return(TRUE);
+  return(!(Fcb->Flags & FCB_IS_FILE));
 }
 
 
@@ -165,7 +177,9 @@ NtfsReleaseFCB(PNTFS_VCB Vcb,
   if (Fcb->RefCount <= 0 && !NtfsFCBIsDirectory(Fcb))
   {
     RemoveEntryList(&Fcb->FcbListEntry);
-    CcUninitializeCacheMap(Fcb->FileObject, NULL, NULL);
+    /* Only directories have a stream file object of their own */
+    if (Fcb->FileObject != NULL)
+      CcUninitializeCacheMap(Fcb->FileObject, NULL, NULL);
     NtfsDestroyFCB(Fcb);
   }
   KeReleaseSpinLock(&Vcb->FcbListLock, oldIrql);
@@ -274,6 +288,10 @@ NtfsMakeRootFCB(PNTFS_VCB Vcb)
   PNTFS_FCB Fcb;
 
   Fcb = NtfsCreateFCB(L"\\", Vcb);
+  if (Fcb == NULL)
+  {
+    return(NULL);
+  }
 
 //  memset(Fcb->entry.Filename, ' ', 11);
 
@@ -282,6 +300,7 @@ NtfsMakeRootFCB(PNTFS_VCB Vcb)
 //  Fcb->Entry.FileFlags = 0x02; // FILE_ATTRIBUTE_DIRECTORY;
   Fcb->RefCount = 1;
   Fcb->DirIndex = 0;
+  Fcb->MftIndex = NTFS_FILE_ROOT;
   Fcb->RFCB.FileSize.QuadPart = PAGE_SIZE;//Vcb->CdInfo.RootSize;
   Fcb->RFCB.ValidDataLength.QuadPart = PAGE_SIZE;//Vcb->CdInfo.RootSize;
   Fcb->RFCB.AllocationSize.QuadPart = PAGE_SIZE;//Vcb->CdInfo.RootSize;
@@ -309,6 +328,177 @@ NtfsOpenRootFCB(PNTFS_VCB Vcb)
 }
 
 
+static NTSTATUS
+NtfsMakeFCBFromFileRecord(PNTFS_VCB Vcb,
+                          ULONGLONG FileId,
+                          PCWSTR pathName,
+                          PNTFS_FCB *pFCB)
+/*
+ * FUNCTION: Makes a FCB named pathName for the file whose file reference
+ *           is FileId. For a file it describes the unnamed data stream.
+ */
+{
+  PFILE_RECORD_HEADER FileRecord;
+  PNONRESIDENT_ATTRIBUTE NresAttr;
+  PRESIDENT_ATTRIBUTE ResAttr;
+  PATTRIBUTE Attribute;
+  PNTFS_FCB Fcb;
+  ULONGLONG MftIndex;
+  USHORT SequenceNumber;
+  NTSTATUS Status;
+
+  /* The low 48 bits are the record number, the high 16 its sequence number */
+  MftIndex = FileId & 0x0000FFFFFFFFFFFFULL;
+  SequenceNumber = (USHORT)(FileId >> 48);
+
+  FileRecord = ExAllocatePoolWithTag(NonPagedPool,
+                                     Vcb->NtfsInfo.BytesPerFileRecord,
+                                     TAG_NTFS);
+  if (FileRecord == NULL)
+  {
+    return(STATUS_INSUFFICIENT_RESOURCES);
+  }
+
+  Status = ReadFileRecord(Vcb, MftIndex, FileRecord, NULL);
+  if (!NT_SUCCESS(Status))
+  {
+    ExFreePool(FileRecord);
+    return(Status);
+  }
+
+  if (FileRecord->Ntfs.Type != NRH_FILE_TYPE ||
+      !(FileRecord->Flags & FRH_IN_USE) ||
+      FileRecord->BaseFileRecord != 0 ||
+      (SequenceNumber != 0 && SequenceNumber != FileRecord->SequenceNumber))
+  {
+    ExFreePool(FileRecord);
+    return(STATUS_INVALID_PARAMETER);
+  }
+
+  /* Directories are looked up through their index, they have no data */
+  if (FileRecord->Flags & FRH_DIRECTORY)
+  {
+    ExFreePool(FileRecord);
+
+    Fcb = NtfsCreateFCB(pathName, Vcb);
+    if (Fcb == NULL)
+    {
+      return(STATUS_INSUFFICIENT_RESOURCES);
+    }
+    Fcb->MftIndex = MftIndex;
+    Fcb->RefCount++;
+    NtfsAddFCBToTable(Vcb, Fcb);
+    *pFCB = Fcb;
+
+    return(STATUS_SUCCESS);
+  }
+
+  /* Compressed and encrypted data cannot be handed out as it is on disk */
+  Attribute = FindAttribute(FileRecord, AttributeData, NULL);
+  if (Attribute == NULL ||
+      (Attribute->Flags & (ATTR_IS_COMPRESSED | ATTR_IS_ENCRYPTED)))
+  {
+    ExFreePool(FileRecord);
+    return(STATUS_NOT_IMPLEMENTED);
+  }
+
+  Fcb = NtfsCreateFCB(pathName, Vcb);
+  if (Fcb == NULL)
+  {
+    ExFreePool(FileRecord);
+    return(STATUS_INSUFFICIENT_RESOURCES);
+  }
+  Fcb->Flags |= FCB_IS_FILE;
+  Fcb->MftIndex = MftIndex;
+
+  if (Attribute->Nonresident)
+  {
+    NresAttr = (PNONRESIDENT_ATTRIBUTE)Attribute;
+
+    /* Streams split over several attribute records are not supported yet */
+    if (NresAttr->StartVcn != 0 ||
+        (NresAttr->LastVcn + 1) * Vcb->NtfsInfo.BytesPerCluster <
+          NresAttr->AllocatedSize)
+    {
+      Status = STATUS_NOT_IMPLEMENTED;
+    }
+    else
+    {
+      Status = NtfsDecodeRunList(NresAttr, &Fcb->DataExtents);
+    }
+
+    Fcb->RFCB.FileSize.QuadPart = NresAttr->DataSize;
+    Fcb->RFCB.ValidDataLength.QuadPart = NresAttr->InitializedSize;
+    Fcb->RFCB.AllocationSize.QuadPart = NresAttr->AllocatedSize;
+  }
+  else
+  {
+    ResAttr = (PRESIDENT_ATTRIBUTE)Attribute;
+
+    Status = STATUS_SUCCESS;
+    if (ResAttr->ValueLength != 0)
+    {
+      Fcb->ResidentData = ExAllocatePoolWithTag(NonPagedPool,
+                                                ResAttr->ValueLength,
+                                                TAG_NTFS);
+      if (Fcb->ResidentData == NULL)
+      {
+        Status = STATUS_INSUFFICIENT_RESOURCES;
+      }
+      else
+      {
+        RtlCopyMemory(Fcb->ResidentData,
+                      (PVOID)((ULONG_PTR)ResAttr + ResAttr->ValueOffset),
+                      ResAttr->ValueLength);
+      }
+    }
+
+    Fcb->RFCB.FileSize.QuadPart = ResAttr->ValueLength;
+    Fcb->RFCB.ValidDataLength.QuadPart = ResAttr->ValueLength;
+    Fcb->RFCB.AllocationSize.QuadPart =
+      ROUND_UP(ResAttr->ValueLength, Vcb->NtfsInfo.BytesPerSector);
+  }
+
+  ExFreePool(FileRecord);
+
+  if (!NT_SUCCESS(Status))
+  {
+    NtfsDestroyFCB(Fcb);
+    return(Status);
+  }
+
+  Fcb->RefCount++;
+  NtfsAddFCBToTable(Vcb, Fcb);
+  *pFCB = Fcb;
+
+  return(STATUS_SUCCESS);
+}
+
+
+NTSTATUS
+NtfsMakeFCBFromFileId(PNTFS_VCB Vcb,
+                      ULONGLONG FileId,
+                      PNTFS_FCB *pFCB)
+/*
+ * FUNCTION: Makes a FCB for the file whose file reference is FileId
+ */
+{
+  WCHAR pathName[MAX_PATH];
+  PNTFS_FCB Fcb;
+
+  swprintf(pathName, L"\\$FileId:%I64x", FileId & 0x0000FFFFFFFFFFFFULL);
+
+  Fcb = NtfsGrabFCBFromTable(Vcb, pathName);
+  if (Fcb != NULL)
+  {
+    *pFCB = Fcb;
+    return(STATUS_SUCCESS);
+  }
+
+  return(NtfsMakeFCBFromFileRecord(Vcb, FileId, pathName, pFCB));
+}
+
+
 #if 0
 static VOID
 NtfsGetDirEntryName(PDEVICE_EXTENSION DeviceExt,
@@ -428,8 +618,8 @@ NtfsAttachFCBToFileObject(PNTFS_VCB Vcb,
     CcInitializeCacheMap(FileObject,
                          (PCC_FILE_SIZES)(&Fcb->RFCB.AllocationSize),
                          FALSE,
-                         NULL,
-                         NULL);
+                         &(NtfsGlobalData->CacheMgrCallbacks),
+                         Fcb);
 
     Fcb->Flags |= FCB_CACHE_INITIALIZED;
   }
@@ -446,108 +636,46 @@ NtfsDirFindFile(PNTFS_VCB Vcb,
                 PWSTR FileToFind,
                 PNTFS_FCB *FoundFCB)
 {
-#if 0
-  WCHAR TempName[2];
-  WCHAR Name[256];
-  PVOID Block;
-  ULONG FirstSector;
-  ULONG DirSize;
-  PDIR_RECORD Record;
-  ULONG Offset;
-  ULONG BlockOffset;
+  WCHAR pathName[MAX_PATH];
+  ULONGLONG FileReference;
   NTSTATUS Status;
 
-  LARGE_INTEGER StreamOffset;
-  PVOID Context;
-
-  ASSERT(DeviceExt);
+  ASSERT(Vcb);
   ASSERT(DirectoryFcb);
   ASSERT(FileToFind);
 
-  DPRINT("NtfsDirFindFile(VCB:%08x, dirFCB:%08x, File:%S)\n",
-	 DeviceExt,
-	 DirectoryFcb,
-	 FileToFind);
+  DPRINT("NtfsDirFindFile(VCB:%p, dirFCB:%p, File:%S)\n",
+         Vcb,
+         DirectoryFcb,
+         FileToFind);
   DPRINT("Dir Path:%S\n", DirectoryFcb->PathName);
 
-  /*  default to '.' if no filename specified */
-  if (wcslen(FileToFind) == 0)
-    {
-      TempName[0] = L'.';
-      TempName[1] = 0;
-      FileToFind = TempName;
-    }
-
-  DirSize = DirectoryFcb->Entry.DataLengthL;
-  StreamOffset.QuadPart = (LONGLONG)DirectoryFcb->Entry.ExtentLocationL * (LONGLONG)BLOCKSIZE;
-
-  if(!CcMapData(DeviceExt->StreamFileObject, &StreamOffset,
-		BLOCKSIZE, TRUE, &Context, &Block))
+  if (wcslen(DirectoryFcb->PathName) + 1 + wcslen(FileToFind) >= MAX_PATH)
   {
-    DPRINT("CcMapData() failed\n");
-    return(STATUS_UNSUCCESSFUL);
+    return(STATUS_OBJECT_NAME_INVALID);
   }
 
-  Offset = 0;
-  BlockOffset = 0;
-  Record = (PDIR_RECORD)Block;
-  while(TRUE)
-    {
-      if (Record->RecordLength == 0)
-	{
-	  DPRINT("RecordLength == 0  Stopped!\n");
-	  break;
-	}
-
-      DPRINT("RecordLength %u  ExtAttrRecordLength %u  NameLength %u\n",
-	     Record->RecordLength, Record->ExtAttrRecordLength, Record->FileIdLength);
-
-      NtfsGetDirEntryName(DeviceExt, Record, Name);
-      DPRINT("Name '%S'\n", Name);
-
-      if (wstrcmpjoki(Name, FileToFind))
-	{
-	  DPRINT("Match found, %S\n", Name);
-	  Status = NtfsMakeFCBFromDirEntry(DeviceExt,
-					   DirectoryFcb,
-					   Name,
-					   Record,
-					   FoundFCB);
-
-	  CcUnpinData(Context);
-
-	  return(Status);
-	}
-
-      Offset += Record->RecordLength;
-      BlockOffset += Record->RecordLength;
-      Record = (PDIR_RECORD)(Block + BlockOffset);
-      if (BlockOffset >= BLOCKSIZE || Record->RecordLength == 0)
-	{
-	  DPRINT("Map next sector\n");
-	  CcUnpinData(Context);
-	  StreamOffset.QuadPart += BLOCKSIZE;
-	  Offset = ROUND_UP(Offset, BLOCKSIZE);
-	  BlockOffset = 0;
-
-	  if (!CcMapData(DeviceExt->StreamFileObject,
-			 &StreamOffset,
-			 BLOCKSIZE, TRUE,
-			 &Context, &Block))
-	    {
-	      DPRINT("CcMapData() failed\n");
-	      return(STATUS_UNSUCCESSFUL);
-	    }
-	  Record = (PDIR_RECORD)(Block + BlockOffset);
-	}
+  Status = NtfsLookupIndex(Vcb,
+                           DirectoryFcb->MftIndex,
+                           FileToFind,
+                           &FileReference);
+  if (Status == STATUS_NOT_A_DIRECTORY)
+  {
+    return(STATUS_OBJECT_PATH_NOT_FOUND);
+  }
+  if (!NT_SUCCESS(Status))
+  {
+    return(Status);
+  }
 
-      if (Offset >= DirSize)
-	break;
-    }
+  wcscpy(pathName, DirectoryFcb->PathName);
+  if (!NtfsFCBIsRoot(DirectoryFcb))
+  {
+    wcscat(pathName, L"\\");
+  }
+  wcscat(pathName, FileToFind);
 
-  CcUnpinData(Context);
-#endif
-  return(STATUS_OBJECT_NAME_NOT_FOUND);
+  return(NtfsMakeFCBFromFileRecord(Vcb, FileReference, pathName, FoundFCB));
 }
 
 
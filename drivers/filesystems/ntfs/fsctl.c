@@ -253,6 +253,24 @@ NtfsGetVolumeData(PDEVICE_OBJECT DeviceObject,
     return Status;
   }
 
+  FixupUpdateSequenceArray(MftRecord);
+
+  /* Decode the runs of the MFT once, every file record is read through them */
+  Attribute = FindAttribute(MftRecord, AttributeData, NULL);
+  if (Attribute == NULL || !Attribute->Nonresident)
+  {
+    ExFreePool(MftRecord);
+    return STATUS_FILE_CORRUPT_ERROR;
+  }
+
+  Status = NtfsDecodeRunList((PNONRESIDENT_ATTRIBUTE)Attribute,
+                             &DeviceExt->MftDataMap);
+  if (!NT_SUCCESS(Status))
+  {
+    ExFreePool(MftRecord);
+    return Status;
+  }
+
   VolumeRecord = ExAllocatePoolWithTag(NonPagedPool, NtfsInfo->BytesPerFileRecord, TAG_NTFS);
   if (VolumeRecord == NULL)
   {
@@ -262,9 +280,10 @@ NtfsGetVolumeData(PDEVICE_OBJECT DeviceObject,
 
   /* Read Volume File (MFT index 3) */
   DeviceExt->StorageDevice = DeviceObject;
-  Status = ReadFileRecord(DeviceExt, 3, VolumeRecord, MftRecord);
+  Status = ReadFileRecord(DeviceExt, NTFS_FILE_VOLUME, VolumeRecord, MftRecord);
   if (!NT_SUCCESS(Status))
   {
+    ExFreePool(VolumeRecord);
     ExFreePool(MftRecord);
     return Status;
   }
@@ -362,6 +381,8 @@ NtfsMountVolume(PDEVICE_OBJECT DeviceObject,
   Vcb->Identifier.Type = NTFS_TYPE_VCB;
   Vcb->Identifier.Size = sizeof(NTFS_TYPE_VCB);
 
+  NtfsInitializeRecordCache(Vcb);
+
   Status = NtfsGetVolumeData(DeviceToMount,
                              Vcb);
   if (!NT_SUCCESS(Status))
@@ -446,6 +467,10 @@ ByeBye:
     /* Cleanup */
     if (Vcb && Vcb->StreamFileObject)
       ObDereferenceObject(Vcb->StreamFileObject);
+    if (Vcb && Vcb->MftDataMap)
+      NtfsFreeExtentMap(Vcb->MftDataMap);
+    if (Vcb)
+      NtfsFreeRecordCache(Vcb);
     if (Fcb)
       ExFreePool(Fcb);
     if (Ccb)
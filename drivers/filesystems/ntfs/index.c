@@ -0,0 +1,331 @@
+/*
+ *  Odyssey kernel
+ *  Copyright (C) 2011 NasuTek Enterprises
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA.
+ *
+ * COPYRIGHT:        See COPYING in the top level directory
+ * PROJECT:          Odyssey kernel
+ * FILE:             drivers/filesystem/ntfs/index.c
+ * PURPOSE:          NTFS filesystem driver
+ */
+
+/* INCLUDES *****************************************************************/
+
+#include "ntfs.h"
+
+#define NDEBUG
+#include <debug.h>
+
+/* GLOBALS *****************************************************************/
+
+/* Deeper trees than this are taken for a loop in a corrupt index */
+#define NTFS_MAX_INDEX_DEPTH 32
+
+/* Smallest entry that carries a file name key */
+#define NTFS_MIN_INDEX_ENTRY \
+  (FIELD_OFFSET(INDEX_ENTRY_ATTRIBUTE, FileName) + \
+   FIELD_OFFSET(FILENAME_ATTRIBUTE, Name))
+
+
+/* FUNCTIONS ****************************************************************/
+
+static LONG
+NtfsCompareIndexKey(PCWSTR FileName,
+		    ULONG NameLength,
+		    PFILENAME_ATTRIBUTE Key)
+/*
+ * FUNCTION: Compares a name with the key of an entry of a $I30 index, the
+ *           way the index is collated: case-insensitive, by code point
+ */
+{
+  WCHAR Char1;
+  WCHAR Char2;
+  ULONG i;
+
+  for (i = 0; i < NameLength && i < Key->NameLength; i++)
+    {
+      Char1 = RtlUpcaseUnicodeChar(FileName[i]);
+      Char2 = RtlUpcaseUnicodeChar(Key->Name[i]);
+      if (Char1 != Char2)
+	{
+	  return (Char1 < Char2) ? -1 : 1;
+	}
+    }
+
+  if (NameLength == Key->NameLength)
+    return 0;
+
+  return (NameLength < Key->NameLength) ? -1 : 1;
+}
+
+
+static NTSTATUS
+NtfsSearchIndexNode(PINDEX_HEADER Header,
+		    ULONG Size,
+		    PCWSTR FileName,
+		    ULONG NameLength,
+		    PINDEX_ENTRY_ATTRIBUTE *Entries,
+		    PINDEX_ENTRY_ATTRIBUTE *Entry)
+/*
+ * FUNCTION: Binary-searches the entries of one index node for FileName
+ * ARGUMENTS:
+ *           Header = index header of the node
+ *           Size = bytes from Header to the end of the node
+ *           Entries = scratch array of Size / NTFS_MIN_INDEX_ENTRY + 1
+ *                     entry pointers
+ * RETURNS: STATUS_SUCCESS and the matching entry in *Entry, or
+ *          STATUS_OBJECT_NAME_NOT_FOUND and the entry whose subnode would
+ *          hold the name in *Entry
+ */
+{
+  PINDEX_ENTRY_ATTRIBUTE Current;
+  ULONG Offset;
+  ULONG Count;
+  ULONG Low;
+  ULONG High;
+  ULONG Middle;
+  LONG Result;
+
+  if (Header->IndexLength > Size ||
+      Header->EntriesOffset >= Header->IndexLength)
+    {
+      return STATUS_FILE_CORRUPT_ERROR;
+    }
+
+  /* Entries vary in size, so collect pointers to them first */
+  Count = 0;
+  Offset = Header->EntriesOffset;
+  while (TRUE)
+    {
+      Current = (PINDEX_ENTRY_ATTRIBUTE)((ULONG_PTR)Header + Offset);
+
+      if (Offset + FIELD_OFFSET(INDEX_ENTRY_ATTRIBUTE, FileName) > Header->IndexLength ||
+	  Current->Length < FIELD_OFFSET(INDEX_ENTRY_ATTRIBUTE, FileName) ||
+	  Offset + Current->Length > Header->IndexLength)
+	{
+	  return STATUS_FILE_CORRUPT_ERROR;
+	}
+
+      if (Current->Flags & INDEX_ENTRY_END)
+	break;
+
+      if (Current->Length < NTFS_MIN_INDEX_ENTRY ||
+	  Current->KeyLength < FIELD_OFFSET(FILENAME_ATTRIBUTE, Name) +
+			       Current->FileName.NameLength * sizeof(WCHAR))
+	{
+	  return STATUS_FILE_CORRUPT_ERROR;
+	}
+
+      Entries[Count++] = Current;
+      Offset += Current->Length;
+    }
+
+  /* Find the first entry that does not sort below the name */
+  Low = 0;
+  High = Count;
+  while (Low < High)
+    {
+      Middle = Low + (High - Low) / 2;
+      Result = NtfsCompareIndexKey(FileName, NameLength,
+				   &Entries[Middle]->FileName);
+      if (Result == 0)
+	{
+	  *Entry = Entries[Middle];
+	  return STATUS_SUCCESS;
+	}
+
+      if (Result < 0)
+	High = Middle;
+      else
+	Low = Middle + 1;
+    }
+
+  *Entry = (Low < Count) ? Entries[Low] : Current;
+
+  return STATUS_OBJECT_NAME_NOT_FOUND;
+}
+
+
+NTSTATUS
+NtfsLookupIndex(PNTFS_VCB Vcb,
+		ULONGLONG DirectoryIndex,
+		PCWSTR FileName,
+		PULONGLONG FileReference)
+/*
+ * FUNCTION: Looks FileName up in the file name index of a directory,
+ *           descending from $INDEX_ROOT through the $INDEX_ALLOCATION
+ *           blocks
+ */
+{
+  PFILE_RECORD_HEADER FileRecord;
+  PRESIDENT_ATTRIBUTE ResAttr;
+  PINDEX_ROOT_ATTRIBUTE IndexRoot;
+  PATTRIBUTE Attribute;
+  PNTFS_EXTENT_MAP AllocationMap = NULL;
+  PINDEX_BUFFER IndexBuffer = NULL;
+  PINDEX_ENTRY_ATTRIBUTE *Entries = NULL;
+  PINDEX_ENTRY_ATTRIBUTE Entry;
+  PINDEX_HEADER Header;
+  ULONG NameLength;
+  ULONG Size;
+  ULONG VcnSize;
+  ULONG Depth;
+  ULONGLONG Vcn;
+  NTSTATUS Status;
+
+  DPRINT("NtfsLookupIndex(%p, %I64u, '%S')\n", Vcb, DirectoryIndex, FileName);
+
+  NameLength = (ULONG)wcslen(FileName);
+
+  FileRecord = ExAllocatePoolWithTag(NonPagedPool,
+				     Vcb->NtfsInfo.BytesPerFileRecord,
+				     TAG_NTFS);
+  if (FileRecord == NULL)
+    {
+      return STATUS_INSUFFICIENT_RESOURCES;
+    }
+
+  Status = ReadFileRecord(Vcb, DirectoryIndex, FileRecord, NULL);
+  if (!NT_SUCCESS(Status))
+    {
+      goto ByeBye;
+    }
+
+  if (FileRecord->Ntfs.Type != NRH_FILE_TYPE ||
+      !(FileRecord->Flags & FRH_DIRECTORY))
+    {
+      Status = STATUS_NOT_A_DIRECTORY;
+      goto ByeBye;
+    }
+
+  Attribute = FindAttribute(FileRecord, AttributeIndexRoot, NULL);
+  if (Attribute == NULL || Attribute->Nonresident ||
+      ((PRESIDENT_ATTRIBUTE)Attribute)->ValueLength < sizeof(INDEX_ROOT_ATTRIBUTE))
+    {
+      Status = STATUS_FILE_CORRUPT_ERROR;
+      goto ByeBye;
+    }
+
+  ResAttr = (PRESIDENT_ATTRIBUTE)Attribute;
+  IndexRoot = (PINDEX_ROOT_ATTRIBUTE)((ULONG_PTR)ResAttr + ResAttr->ValueOffset);
+  Header = &IndexRoot->Header;
+  Size = ResAttr->ValueLength - FIELD_OFFSET(INDEX_ROOT_ATTRIBUTE, Header);
+
+  if (IndexRoot->IndexBlockSize == 0 ||
+      IndexRoot->IndexBlockSize % Vcb->NtfsInfo.BytesPerSector != 0)
+    {
+      Status = STATUS_FILE_CORRUPT_ERROR;
+      goto ByeBye;
+    }
+
+  /* One scratch array serves every node, so size it for the larger kind */
+  Entries = ExAllocatePoolWithTag(NonPagedPool,
+				  (max(Size, IndexRoot->IndexBlockSize) /
+				   NTFS_MIN_INDEX_ENTRY + 1) *
+				  sizeof(PINDEX_ENTRY_ATTRIBUTE),
+				  TAG_NTFS);
+  if (Entries == NULL)
+    {
+      Status = STATUS_INSUFFICIENT_RESOURCES;
+      goto ByeBye;
+    }
+
+  /* Subnode VCNs count clusters, or 512 byte units if blocks are smaller */
+  VcnSize = (IndexRoot->IndexBlockSize >= Vcb->NtfsInfo.BytesPerCluster) ?
+	    Vcb->NtfsInfo.BytesPerCluster : 512;
+
+  for (Depth = 0; Depth < NTFS_MAX_INDEX_DEPTH; Depth++)
+    {
+      Status = NtfsSearchIndexNode(Header, Size, FileName, NameLength,
+				   Entries, &Entry);
+      if (Status != STATUS_OBJECT_NAME_NOT_FOUND)
+	{
+	  if (NT_SUCCESS(Status))
+	    *FileReference = Entry->FileReference;
+	  goto ByeBye;
+	}
+
+      if (!(Entry->Flags & INDEX_ENTRY_NODE))
+	{
+	  goto ByeBye;
+	}
+
+      Vcn = *(PULONGLONG)((ULONG_PTR)Entry + Entry->Length - sizeof(ULONGLONG));
+
+      /* Decode the runs of the index blocks on the first descent only */
+      if (AllocationMap == NULL)
+	{
+	  Attribute = FindAttribute(FileRecord, AttributeIndexAllocation, NULL);
+	  if (Attribute == NULL || !Attribute->Nonresident)
+	    {
+	      Status = STATUS_FILE_CORRUPT_ERROR;
+	      goto ByeBye;
+	    }
+
+	  Status = NtfsDecodeRunList((PNONRESIDENT_ATTRIBUTE)Attribute,
+				     &AllocationMap);
+	  if (!NT_SUCCESS(Status))
+	    {
+	      goto ByeBye;
+	    }
+
+	  IndexBuffer = ExAllocatePoolWithTag(NonPagedPool,
+					      IndexRoot->IndexBlockSize,
+					      TAG_NTFS);
+	  if (IndexBuffer == NULL)
+	    {
+	      Status = STATUS_INSUFFICIENT_RESOURCES;
+	      goto ByeBye;
+	    }
+	}
+
+      Status = NtfsReadExtents(Vcb,
+			       AllocationMap,
+			       Vcn * VcnSize,
+			       IndexRoot->IndexBlockSize,
+			       (PUCHAR)IndexBuffer);
+      if (!NT_SUCCESS(Status))
+	{
+	  goto ByeBye;
+	}
+
+      if (IndexBuffer->Ntfs.Type != NRH_INDX_TYPE)
+	{
+	  Status = STATUS_FILE_CORRUPT_ERROR;
+	  goto ByeBye;
+	}
+
+      FixupUpdateSequenceArray((PFILE_RECORD_HEADER)IndexBuffer);
+
+      Header = &IndexBuffer->Header;
+      Size = IndexRoot->IndexBlockSize - FIELD_OFFSET(INDEX_BUFFER, Header);
+    }
+
+  Status = STATUS_FILE_CORRUPT_ERROR;
+
+ByeBye:
+  if (Entries)
+    ExFreePoolWithTag(Entries, TAG_NTFS);
+  if (IndexBuffer)
+    ExFreePoolWithTag(IndexBuffer, TAG_NTFS);
+  if (AllocationMap)
+    NtfsFreeExtentMap(AllocationMap);
+  ExFreePoolWithTag(FileRecord, TAG_NTFS);
+
+  return Status;
+}
+
+/* EOF */
@@ -33,6 +33,9 @@
 
 /* GLOBALS *****************************************************************/
 
+#define NtfsRecordCacheBucket(Vcb, Index) \
+  (&(Vcb)->RecordCacheHash[(ULONG)(Index) % NTFS_RECORD_CACHE_BUCKETS])
+
 
 /* FUNCTIONS ****************************************************************/
 
@@ -173,6 +176,7 @@ ReadAttribute (PATTRIBUTE attr,
 	memcpy (buffer,
 		(PVOID)((ULONG_PTR)attr + ((PRESIDENT_ATTRIBUTE)attr)->ValueOffset),
 		((PRESIDENT_ATTRIBUTE)attr)->ValueLength);
+	return;
     }
 
   ReadExternalAttribute(Vcb, NresAttr, 0, (ULONG)(NresAttr->LastVcn) + 1,
@@ -183,20 +187,168 @@ ReadAttribute (PATTRIBUTE attr,
 
 
 
+VOID
+NtfsInitializeRecordCache(PDEVICE_EXTENSION Vcb)
+{
+  ULONG i;
+
+  ExInitializeFastMutex(&Vcb->RecordCacheLock);
+  for (i = 0; i < NTFS_RECORD_CACHE_BUCKETS; i++)
+    {
+      InitializeListHead(&Vcb->RecordCacheHash[i]);
+    }
+  InitializeListHead(&Vcb->RecordCacheLru);
+  Vcb->RecordCacheCount = 0;
+}
+
+
+VOID
+NtfsFreeRecordCache(PDEVICE_EXTENSION Vcb)
+{
+  PNTFS_RECORD_CACHE_ENTRY Entry;
+
+  while (!IsListEmpty(&Vcb->RecordCacheLru))
+    {
+      Entry = CONTAINING_RECORD(RemoveHeadList(&Vcb->RecordCacheLru),
+				NTFS_RECORD_CACHE_ENTRY, LruEntry);
+      RemoveEntryList(&Entry->HashEntry);
+      ExFreePoolWithTag(Entry, TAG_NTFS);
+    }
+  Vcb->RecordCacheCount = 0;
+}
+
+
+static BOOLEAN
+NtfsLookupCachedRecord(PDEVICE_EXTENSION Vcb,
+		       ULONGLONG index,
+		       PFILE_RECORD_HEADER file)
+{
+  PLIST_ENTRY Bucket = NtfsRecordCacheBucket(Vcb, index);
+  PNTFS_RECORD_CACHE_ENTRY Entry;
+  PLIST_ENTRY current_entry;
+
+  ExAcquireFastMutex(&Vcb->RecordCacheLock);
+
+  for (current_entry = Bucket->Flink;
+       current_entry != Bucket;
+       current_entry = current_entry->Flink)
+    {
+      Entry = CONTAINING_RECORD(current_entry, NTFS_RECORD_CACHE_ENTRY, HashEntry);
+      if (Entry->MftIndex == index)
+	{
+	  /* Keep it away from the end of the LRU list */
+	  RemoveEntryList(&Entry->LruEntry);
+	  InsertHeadList(&Vcb->RecordCacheLru, &Entry->LruEntry);
+
+	  memcpy(file, Entry + 1, Vcb->NtfsInfo.BytesPerFileRecord);
+
+	  ExReleaseFastMutex(&Vcb->RecordCacheLock);
+	  return TRUE;
+	}
+    }
+
+  ExReleaseFastMutex(&Vcb->RecordCacheLock);
+  return FALSE;
+}
+
+
+static VOID
+NtfsCacheRecord(PDEVICE_EXTENSION Vcb,
+		ULONGLONG index,
+		PFILE_RECORD_HEADER file)
+{
+  PLIST_ENTRY Bucket = NtfsRecordCacheBucket(Vcb, index);
+  PNTFS_RECORD_CACHE_ENTRY Entry;
+  PLIST_ENTRY current_entry;
+
+  ExAcquireFastMutex(&Vcb->RecordCacheLock);
+
+  /* Someone else may have read it in the meantime */
+  for (current_entry = Bucket->Flink;
+       current_entry != Bucket;
+       current_entry = current_entry->Flink)
+    {
+      Entry = CONTAINING_RECORD(current_entry, NTFS_RECORD_CACHE_ENTRY, HashEntry);
+      if (Entry->MftIndex == index)
+	{
+	  ExReleaseFastMutex(&Vcb->RecordCacheLock);
+	  return;
+	}
+    }
+
+  /* Grow up to the limit, then recycle the least recently used record */
+  if (Vcb->RecordCacheCount < NTFS_RECORD_CACHE_SIZE)
+    {
+      Entry = ExAllocatePoolWithTag(NonPagedPool,
+				    sizeof(NTFS_RECORD_CACHE_ENTRY) +
+				    Vcb->NtfsInfo.BytesPerFileRecord,
+				    TAG_NTFS);
+      if (Entry == NULL)
+	{
+	  ExReleaseFastMutex(&Vcb->RecordCacheLock);
+	  return;
+	}
+      Vcb->RecordCacheCount++;
+    }
+  else
+    {
+      Entry = CONTAINING_RECORD(RemoveTailList(&Vcb->RecordCacheLru),
+				NTFS_RECORD_CACHE_ENTRY, LruEntry);
+      RemoveEntryList(&Entry->HashEntry);
+    }
+
+  Entry->MftIndex = index;
+  memcpy(Entry + 1, file, Vcb->NtfsInfo.BytesPerFileRecord);
+  InsertHeadList(Bucket, &Entry->HashEntry);
+  InsertHeadList(&Vcb->RecordCacheLru, &Entry->LruEntry);
+
+  ExReleaseFastMutex(&Vcb->RecordCacheLock);
+}
+
+
 NTSTATUS
 ReadFileRecord (PDEVICE_EXTENSION Vcb,
-		ULONG index,
+		ULONGLONG index,
 		PFILE_RECORD_HEADER file,
 		PFILE_RECORD_HEADER Mft)
 {
   PVOID p;
+  NTSTATUS Status;
   ULONG BytesPerFileRecord = Vcb->NtfsInfo.BytesPerFileRecord;
   ULONG clusters = max(BytesPerFileRecord / Vcb->NtfsInfo.BytesPerCluster, 1);
   ULONGLONG vcn = index * BytesPerFileRecord / Vcb->NtfsInfo.BytesPerCluster;
   LONG m = (Vcb->NtfsInfo.BytesPerCluster / BytesPerFileRecord) - 1;
-  ULONG n = m > 0 ? (index & m) : 0;
+  ULONG n = m > 0 ? (ULONG)(index & m) : 0;
+
+  /* Once mounted, read just the record through the decoded $MFT runs */
+  if (Vcb->MftDataMap != NULL)
+    {
+      if (NtfsLookupCachedRecord(Vcb, index, file))
+	{
+	  return STATUS_SUCCESS;
+	}
+
+      Status = NtfsReadExtents(Vcb, Vcb->MftDataMap,
+			       index * BytesPerFileRecord,
+			       BytesPerFileRecord, (PUCHAR)file);
+      if (!NT_SUCCESS(Status))
+	{
+	  return Status;
+	}
+
+      FixupUpdateSequenceArray(file);
+
+      /* The volume is read-only, so a cached record never goes stale */
+      NtfsCacheRecord(Vcb, index, file);
+
+      return STATUS_SUCCESS;
+    }
 
   p = ExAllocatePoolWithTag(NonPagedPool, clusters * Vcb->NtfsInfo.BytesPerCluster, TAG_NTFS);
+  if (p == NULL)
+    {
+      return STATUS_INSUFFICIENT_RESOURCES;
+    }
 
   ReadVCN (Vcb, Mft, AttributeData, vcn, clusters, p);
 
@@ -218,34 +370,85 @@ ReadExternalAttribute (PDEVICE_EXTENSION Vcb,
 		       ULONG count,
 		       PVOID buffer)
 {
-  ULONGLONG lcn;
-  ULONGLONG runcount;
-  ULONG readcount;
-  ULONG left;
-  ULONG n;
+  PNTFS_EXTENT_MAP Map;
+  ULONG BytesPerCluster = Vcb->NtfsInfo.BytesPerCluster;
 
-    PUCHAR bytes = (PUCHAR)buffer;
-
-  for (left = count; left>0; left -=readcount)
+  /* Decode the runs once instead of once per run read */
+  if (!NT_SUCCESS(NtfsDecodeRunList(NresAttr, &Map)))
     {
-		FindRun(NresAttr, vcn, &lcn, &runcount);
+      memset(buffer, 0, count * BytesPerCluster);
+      return;
+    }
 
-//		readcount = (ULONG)(__min(runcount, left));
-		readcount = (ULONG)min (runcount, left);
+  NtfsReadExtents(Vcb, Map, vcn * BytesPerCluster, count * BytesPerCluster,
+		  (PUCHAR)buffer);
 
+  NtfsFreeExtentMap(Map);
+}
 
-		n = readcount * Vcb->NtfsInfo.BytesPerCluster;
 
-		if (lcn == 0)
-			memset(bytes, 0, n);
-		else
-		  ReadLCN(Vcb, lcn, readcount, bytes);
+NTSTATUS
+NtfsReadExtents(PDEVICE_EXTENSION Vcb,
+		PNTFS_EXTENT_MAP Map,
+		ULONGLONG Offset,
+		ULONG Length,
+		PUCHAR Buffer)
+/*
+ * FUNCTION: Reads Length bytes at byte Offset of the stream described by
+ *           Map, issuing one disk read per run rather than per cluster.
+ *           Offset and Length must be multiples of the sector size.
+ */
+{
+  ULONG BytesPerCluster = Vcb->NtfsInfo.BytesPerCluster;
+  ULONG BytesPerSector = Vcb->NtfsInfo.BytesPerSector;
+  ULONGLONG DiskOffset;
+  ULONGLONG Lcn;
+  ULONGLONG Count;
+  ULONGLONG RunBytes;
+  ULONG ReadLength;
+  NTSTATUS Status;
+
+  ASSERT(Offset % BytesPerSector == 0);
+  ASSERT(Length % BytesPerSector == 0);
+
+  while (Length > 0)
+    {
+      if (!NtfsLookupExtent(Map, Offset / BytesPerCluster, &Lcn, &Count))
+	{
+	  /* Nothing is allocated here, which reads as zeroes */
+	  memset(Buffer, 0, Length);
+	  break;
+	}
 
-		vcn += readcount;
-		bytes += n;
+      /* Bytes left in this run from Offset on */
+      RunBytes = Count * BytesPerCluster - Offset % BytesPerCluster;
+      ReadLength = (ULONG)min(RunBytes, (ULONGLONG)Length);
 
+      if (Lcn == 0)
+	{
+	  memset(Buffer, 0, ReadLength);
+	}
+      else
+	{
+	  DiskOffset = Lcn * BytesPerCluster + Offset % BytesPerCluster;
+	  Status = NtfsReadSectors(Vcb->StorageDevice,
+				   DiskOffset / BytesPerSector,
+				   ReadLength / BytesPerSector,
+				   BytesPerSector,
+				   Buffer,
+				   FALSE);
+	  if (!NT_SUCCESS(Status))
+	    {
+	      return Status;
+	    }
+	}
 
+      Offset += ReadLength;
+      Buffer += ReadLength;
+      Length -= ReadLength;
     }
+
+  return STATUS_SUCCESS;
 }
 
 
@@ -305,12 +508,8 @@ ReadLCN (PDEVICE_EXTENSION Vcb,
 	 ULONG count,
 	 PVOID buffer)
 {
-  LARGE_INTEGER DiskSector;
-
-  DiskSector.QuadPart = lcn;
-
   return NtfsReadSectors (Vcb->StorageDevice,
-			  DiskSector.u.LowPart * Vcb->NtfsInfo.SectorsPerCluster,
+			  lcn * Vcb->NtfsInfo.SectorsPerCluster,
 			  count * Vcb->NtfsInfo.SectorsPerCluster,
 			  Vcb->NtfsInfo.BytesPerSector,
 			  buffer,
@@ -79,6 +79,33 @@ typedef struct _NTFS_INFO
 
 } NTFS_INFO, *PNTFS_INFO;
 
+/* A decoded run of a nonresident attribute */
+typedef struct _NTFS_EXTENT
+{
+  ULONGLONG Vcn;	/* First VCN of the run */
+  ULONGLONG Lcn;	/* First LCN of the run, 0 if it is sparse */
+  ULONGLONG Count;	/* Length of the run in clusters */
+} NTFS_EXTENT, *PNTFS_EXTENT;
+
+/* Runs of an attribute, sorted by VCN and merged where contiguous on disk */
+typedef struct _NTFS_EXTENT_MAP
+{
+  ULONG Count;
+  NTFS_EXTENT Extents[1];
+} NTFS_EXTENT_MAP, *PNTFS_EXTENT_MAP;
+
+/* Fixed-up MFT records kept by ReadFileRecord, looked up by record number */
+#define NTFS_RECORD_CACHE_BUCKETS 64
+#define NTFS_RECORD_CACHE_SIZE    256
+
+typedef struct _NTFS_RECORD_CACHE_ENTRY
+{
+  LIST_ENTRY HashEntry;
+  LIST_ENTRY LruEntry;
+  ULONGLONG MftIndex;
+  /* The file record follows */
+} NTFS_RECORD_CACHE_ENTRY, *PNTFS_RECORD_CACHE_ENTRY;
+
 #define NTFS_TYPE_CCB         '20SF'
 #define NTFS_TYPE_FCB         '30SF'
 #define	NTFS_TYPE_VCB         '50SF'
@@ -108,6 +135,12 @@ typedef struct
 
   NTFS_INFO NtfsInfo;
 
+  PNTFS_EXTENT_MAP MftDataMap;	/* Runs of $MFT:$DATA, built at mount time */
+
+  FAST_MUTEX RecordCacheLock;
+  LIST_ENTRY RecordCacheHash[NTFS_RECORD_CACHE_BUCKETS];
+  LIST_ENTRY RecordCacheLru;	/* Most recently used first */
+  ULONG RecordCacheCount;
 
 } DEVICE_EXTENSION, *PDEVICE_EXTENSION, NTFS_VCB, *PNTFS_VCB;
 
@@ -115,6 +148,7 @@ typedef struct
 #define FCB_CACHE_INITIALIZED   0x0001
 #define FCB_IS_VOLUME_STREAM    0x0002
 #define FCB_IS_VOLUME           0x0004
+#define FCB_IS_FILE             0x0008
 #define MAX_PATH                260
 
 typedef struct _FCB
@@ -138,6 +172,10 @@ typedef struct _FCB
 
   ULONG DirIndex;
 
+  ULONGLONG MftIndex;		/* File record of a FCB_IS_FILE FCB */
+  PNTFS_EXTENT_MAP DataExtents;	/* Runs of a nonresident $DATA */
+  PUCHAR ResidentData;		/* Copy of a resident $DATA */
+
   LONG RefCount;
   ULONG Flags;
 
@@ -205,6 +243,11 @@ typedef struct
 
 /* NTFS_RECORD_HEADER.Type */
 #define NRH_FILE_TYPE  0x454C4946  /* 'FILE' */
+#define NRH_INDX_TYPE  0x58444E49  /* 'INDX' */
+
+/* Well known file records */
+#define NTFS_FILE_VOLUME  3
+#define NTFS_FILE_ROOT    5
 
 
 typedef struct
@@ -240,6 +283,12 @@ typedef struct
   USHORT AttributeNumber;
 } ATTRIBUTE, *PATTRIBUTE;
 
+/* Flags in ATTRIBUTE */
+
+#define ATTR_IS_COMPRESSED  0x0001
+#define ATTR_IS_ENCRYPTED   0x4000
+#define ATTR_IS_SPARSE      0x8000
+
 typedef struct
 {
   ATTRIBUTE Attribute;
@@ -311,6 +360,48 @@ typedef struct
   WCHAR Name[1];
 } FILENAME_ATTRIBUTE, *PFILENAME_ATTRIBUTE;
 
+typedef struct
+{
+  ULONG EntriesOffset;          /* Offset to the first entry, from this header */
+  ULONG IndexLength;            /* Bytes in use, from this header */
+  ULONG AllocatedSize;
+  UCHAR Flags;
+  UCHAR Padding[3];
+} INDEX_HEADER, *PINDEX_HEADER;
+
+typedef struct
+{
+  ULONG AttributeType;          /* Type of the indexed attribute */
+  ULONG CollationRule;
+  ULONG IndexBlockSize;         /* Size of the blocks in $INDEX_ALLOCATION */
+  UCHAR ClustersPerIndexBlock;
+  UCHAR Padding[3];
+  INDEX_HEADER Header;
+} INDEX_ROOT_ATTRIBUTE, *PINDEX_ROOT_ATTRIBUTE;
+
+typedef struct
+{
+  NTFS_RECORD_HEADER Ntfs;      /* Magic number 'INDX' */
+  ULONGLONG Vcn;                /* VCN of this block */
+  INDEX_HEADER Header;
+} INDEX_BUFFER, *PINDEX_BUFFER;
+
+typedef struct
+{
+  ULONGLONG FileReference;      /* File the entry refers to */
+  USHORT Length;                /* Size of the entry */
+  USHORT KeyLength;             /* Size of FileName */
+  USHORT Flags;
+  USHORT Padding;
+  FILENAME_ATTRIBUTE FileName;  /* Key, absent in the last entry of a node */
+  /* The VCN of the subnode is in the last 8 bytes if INDEX_ENTRY_NODE */
+} INDEX_ENTRY_ATTRIBUTE, *PINDEX_ENTRY_ATTRIBUTE;
+
+/* Flags in INDEX_ENTRY_ATTRIBUTE */
+
+#define INDEX_ENTRY_NODE  0x0001   /* Entry has a subnode */
+#define INDEX_ENTRY_END   0x0002   /* Last entry of the node */
+
 typedef struct
 {
   ULONGLONG Unknown1;
@@ -355,6 +446,19 @@ FindRun (PNONRESIDENT_ATTRIBUTE NresAttr,
 	 PULONGLONG lcn,
 	 PULONGLONG count);
 
+NTSTATUS
+NtfsDecodeRunList(PNONRESIDENT_ATTRIBUTE NresAttr,
+		  PNTFS_EXTENT_MAP *Map);
+
+BOOLEAN
+NtfsLookupExtent(PNTFS_EXTENT_MAP Map,
+		 ULONGLONG Vcn,
+		 PULONGLONG Lcn,
+		 PULONGLONG Count);
+
+VOID
+NtfsFreeExtentMap(PNTFS_EXTENT_MAP Map);
+
 VOID
 NtfsDumpFileAttributes (PFILE_RECORD_HEADER FileRecord);
 
@@ -362,7 +466,7 @@ NtfsDumpFileAttributes (PFILE_RECORD_HEADER FileRecord);
 
 NTSTATUS
 NtfsReadSectors(IN PDEVICE_OBJECT DeviceObject,
-		IN ULONG DiskSector,
+		IN ULONGLONG DiskSector,
 		IN ULONG SectorCount,
 		IN ULONG SectorSize,
 		IN OUT PUCHAR Buffer,
@@ -460,6 +564,11 @@ NtfsMakeRootFCB(PNTFS_VCB Vcb);
 PNTFS_FCB
 NtfsOpenRootFCB(PNTFS_VCB Vcb);
 
+NTSTATUS
+NtfsMakeFCBFromFileId(PNTFS_VCB Vcb,
+		      ULONGLONG FileId,
+		      PNTFS_FCB *pFCB);
+
 NTSTATUS
 NtfsAttachFCBToFileObject(PNTFS_VCB Vcb,
 			  PNTFS_FCB Fcb,
@@ -472,6 +581,15 @@ NtfsGetFCBForFile(PNTFS_VCB Vcb,
 		  const PWSTR pFileName);
 
 
+/* index.c */
+
+NTSTATUS
+NtfsLookupIndex(PNTFS_VCB Vcb,
+		ULONGLONG DirectoryIndex,
+		PCWSTR FileName,
+		PULONGLONG FileReference);
+
+
 /* finfo.c */
 
 DRIVER_DISPATCH NtfsFsdQueryInformation;
@@ -492,6 +610,12 @@ NtfsFsdFileSystemControl(PDEVICE_OBJECT DeviceObject,
 NTSTATUS
 NtfsOpenMft (PDEVICE_EXTENSION Vcb);
 
+VOID
+NtfsInitializeRecordCache(PDEVICE_EXTENSION Vcb);
+
+VOID
+NtfsFreeRecordCache(PDEVICE_EXTENSION Vcb);
+
 
 VOID
 ReadAttribute(PATTRIBUTE attr, PVOID buffer, PDEVICE_EXTENSION Vcb,
@@ -505,7 +629,7 @@ AttributeAllocatedLength (PATTRIBUTE Attribute);
 
 NTSTATUS
 ReadFileRecord (PDEVICE_EXTENSION Vcb,
-		ULONG index,
+		ULONGLONG index,
 		PFILE_RECORD_HEADER file,
 		PFILE_RECORD_HEADER Mft);
 
@@ -535,6 +659,13 @@ ReadExternalAttribute (PDEVICE_EXTENSION Vcb,
 		       ULONG count,
 		       PVOID buffer);
 
+NTSTATUS
+NtfsReadExtents(PDEVICE_EXTENSION Vcb,
+		PNTFS_EXTENT_MAP Map,
+		ULONGLONG Offset,
+		ULONG Length,
+		PUCHAR Buffer);
+
 NTSTATUS
 ReadLCN (PDEVICE_EXTENSION Vcb,
 	 ULONGLONG lcn,
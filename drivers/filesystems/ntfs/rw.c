@@ -47,85 +47,122 @@ NtfsReadFile(PDEVICE_EXTENSION DeviceExt,
 	     PFILE_OBJECT FileObject,
 	     PUCHAR Buffer,
 	     ULONG Length,
-	     ULONG ReadOffset,
+	     ULONGLONG ReadOffset,
 	     ULONG IrpFlags,
 	     PULONG LengthRead)
 /*
  * FUNCTION: Reads data from a file
  */
 {
-#if 0
   NTSTATUS Status = STATUS_SUCCESS;
-  PUCHAR TempBuffer;
-  ULONG TempLength;
-  PCCB Ccb;
-  PFCB Fcb;
+  ULONG BytesPerSector = DeviceExt->NtfsInfo.BytesPerSector;
+  ULONGLONG FileSize;
+  ULONGLONG ValidLength;
+  ULONG Copied;
+  PNTFS_FCB Fcb;
 
-  DPRINT("CdfsReadFile(ReadOffset %lu  Length %lu)\n", ReadOffset, Length);
+  DPRINT("NtfsReadFile(ReadOffset %I64u  Length %lu)\n", ReadOffset, Length);
 
   *LengthRead = 0;
 
   if (Length == 0)
     return(STATUS_SUCCESS);
 
-  Ccb = (PCCB)FileObject->FsContext2;
-  Fcb = (PFCB)FileObject->FsContext;
+  Fcb = (PNTFS_FCB)FileObject->FsContext;
+  FileSize = Fcb->RFCB.FileSize.QuadPart;
 
-  if (ReadOffset >= Fcb->Entry.DataLengthL)
+  /* Directories have no data stream that could be read yet */
+  if (!(Fcb->Flags & (FCB_IS_FILE | FCB_IS_VOLUME_STREAM)))
+    return(STATUS_INVALID_DEVICE_REQUEST);
+
+  if (ReadOffset >= FileSize)
     return(STATUS_END_OF_FILE);
 
-  DPRINT("Reading %d bytes at %d\n", Length, ReadOffset);
+  DPRINT("Reading %lu bytes at %I64u\n", Length, ReadOffset);
 
   if (!(IrpFlags & (IRP_NOCACHE|IRP_PAGING_IO)))
     {
       LARGE_INTEGER FileOffset;
       IO_STATUS_BLOCK IoStatus;
 
-      if (ReadOffset + Length > Fcb->Entry.DataLengthL)
-         Length = Fcb->Entry.DataLengthL - ReadOffset;
+      if (ReadOffset + Length > FileSize)
+	Length = (ULONG)(FileSize - ReadOffset);
       if (FileObject->PrivateCacheMap == NULL)
-      {
-	  CcRosInitializeFileCache(FileObject, PAGE_SIZE);
-      }
+	{
+	  CcInitializeCacheMap(FileObject,
+			       (PCC_FILE_SIZES)(&Fcb->RFCB.AllocationSize),
+			       FALSE,
+			       &(NtfsGlobalData->CacheMgrCallbacks),
+			       Fcb);
+	}
 
       FileOffset.QuadPart = (LONGLONG)ReadOffset;
-      CcCopyRead(FileObject,
-		 &FileOffset,
-		 Length,
-		 TRUE,
-		 Buffer,
-		 &IoStatus);
+      if (!CcCopyRead(FileObject,
+		      &FileOffset,
+		      Length,
+		      TRUE,
+		      Buffer,
+		      &IoStatus))
+	{
+	  return(STATUS_UNSUCCESSFUL);
+	}
       *LengthRead = IoStatus.Information;
 
       return(IoStatus.Status);
     }
 
-  if ((ReadOffset % BLOCKSIZE) != 0 || (Length % BLOCKSIZE) != 0)
+  if ((ReadOffset % BytesPerSector) != 0 || (Length % BytesPerSector) != 0)
     {
       return STATUS_INVALID_PARAMETER;
     }
-  if (ReadOffset + Length > ROUND_UP(Fcb->Entry.DataLengthL, BLOCKSIZE))
-    Length = ROUND_UP(Fcb->Entry.DataLengthL, BLOCKSIZE) - ReadOffset;
+  if (ReadOffset + Length > ROUND_UP(FileSize, BytesPerSector))
+    Length = (ULONG)(ROUND_UP(FileSize, BytesPerSector) - ReadOffset);
+
+  if (Fcb->Flags & FCB_IS_VOLUME_STREAM)
+    {
+      /* The stream file object maps the volume as it is */
+      Status = NtfsReadSectors(DeviceExt->StorageDevice,
+			       ReadOffset / BytesPerSector,
+			       Length / BytesPerSector,
+			       BytesPerSector,
+			       Buffer,
+			       FALSE);
+      if (NT_SUCCESS(Status))
+	*LengthRead = Length;
+
+      return(Status);
+    }
+
+  if (Fcb->DataExtents != NULL)
+    {
+      /* Whole runs go to the disk at once */
+      Status = NtfsReadExtents(DeviceExt,
+			       Fcb->DataExtents,
+			       ReadOffset,
+			       Length,
+			       Buffer);
+      ValidLength = Fcb->RFCB.ValidDataLength.QuadPart;
+    }
+  else
+    {
+      Copied = (ULONG)min(FileSize - ReadOffset, (ULONGLONG)Length);
+      memcpy(Buffer, Fcb->ResidentData + ReadOffset, Copied);
+      ValidLength = FileSize;
+    }
 
-  Status = CdfsReadSectors(DeviceExt->StorageDevice,
-			   Fcb->Entry.ExtentLocationL + (ReadOffset / BLOCKSIZE),
-			   Length / BLOCKSIZE,
-			   Buffer);
   if (NT_SUCCESS(Status))
     {
       *LengthRead = Length;
-      if (Length + ReadOffset > Fcb->Entry.DataLengthL)
-      {
-	memset(Buffer + Fcb->Entry.DataLengthL - ReadOffset,
-	       0, Length + ReadOffset - Fcb->Entry.DataLengthL);
-      }
+
+      /* Data past the valid length was never written, so it reads as zeroes */
+      if (Length + ReadOffset > ValidLength)
+	{
+	  Copied = (ULONG)(max(ValidLength, ReadOffset) - ReadOffset);
+	  memset(Buffer + Copied, 0, Length - Copied);
+	}
     }
 
   return(Status);
-#else
-  *LengthRead = 0;
-  return STATUS_END_OF_FILE;
-#endif
 }
 
 
@@ -136,6 +173,7 @@ NtfsFsdRead(PDEVICE_OBJECT DeviceObject,
   PDEVICE_EXTENSION DeviceExt;
   PIO_STACK_LOCATION Stack;
   PFILE_OBJECT FileObject;
+  PNTFS_FCB Fcb;
   PVOID Buffer;
   ULONG ReadLength;
   LARGE_INTEGER ReadOffset;
@@ -151,15 +189,25 @@ NtfsFsdRead(PDEVICE_OBJECT DeviceObject,
   ReadLength = Stack->Parameters.Read.Length;
   ReadOffset = Stack->Parameters.Read.ByteOffset;
   Buffer = MmGetSystemAddressForMdl(Irp->MdlAddress);
+  Fcb = (PNTFS_FCB)FileObject->FsContext;
+
+  /* Paging reads come from the cache manager, which holds the FCB already */
+  FsRtlEnterFileSystem();
+  if (!(Irp->Flags & IRP_PAGING_IO))
+    ExAcquireResourceSharedLite(&Fcb->MainResource, TRUE);
 
   Status = NtfsReadFile(DeviceExt,
 			FileObject,
 			Buffer,
 			ReadLength,
-			ReadOffset.u.LowPart,
+			ReadOffset.QuadPart,
 			Irp->Flags,
 			&ReturnedReadLength);
 
+  if (!(Irp->Flags & IRP_PAGING_IO))
+    ExReleaseResourceLite(&Fcb->MainResource);
+  FsRtlExitFileSystem();
+
   if (NT_SUCCESS(Status))
     {
       if (FileObject->Flags & FO_SYNCHRONOUS_IO)
@@ -224,6 +224,30 @@ NTSTATUS WarmSocketForConnection( PAFD_FCB FCB ) {
                                           FCB->Connection.Object );
     }
 
+    /* Buffer sizes set before the connection existed have to reach the
+     * transport before the handshake, which picks the window scale */
+    if( NT_SUCCESS(Status) && FCB->Recv.Size ) {
+        TdiSetInformationEx( FCB->Connection.Object,
+                             CO_TL_ENTITY,
+                             TL_INSTANCE,
+                             INFO_CLASS_PROTOCOL,
+                             INFO_TYPE_CONNECTION,
+                             TCP_SOCKET_WINDOW,
+                             &FCB->Recv.Size,
+                             sizeof(FCB->Recv.Size) );
+    }
+
+    if( NT_SUCCESS(Status) && FCB->Send.Size ) {
+        TdiSetInformationEx( FCB->Connection.Object,
+                             CO_TL_ENTITY,
+                             TL_INSTANCE,
+                             INFO_CLASS_PROTOCOL,
+                             INFO_TYPE_CONNECTION,
+                             TCP_SOCKET_SEND_WINDOW,
+                             &FCB->Send.Size,
+                             sizeof(FCB->Send.Size) );
+    }
+
     return Status;
 }
 
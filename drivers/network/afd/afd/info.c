@@ -106,7 +106,7 @@ AfdSetInfo( PDEVICE_OBJECT DeviceObject, PIRP Irp,
     PAFD_INFO InfoReq = LockRequest(Irp, IrpSp);
     PFILE_OBJECT FileObject = IrpSp->FileObject;
     PAFD_FCB FCB = FileObject->FsContext;
-    PCHAR NewBuffer;
+    ULONG Size;
 
     if (!SocketAcquireStateLock(FCB)) return LostSocket(Irp);
     
@@ -123,56 +123,50 @@ AfdSetInfo( PDEVICE_OBJECT DeviceObject, PIRP Irp,
           FCB->OobInline = InfoReq->Information.Boolean;
           break;
         case AFD_INFO_RECEIVE_WINDOW_SIZE:
-          NewBuffer = ExAllocatePool(PagedPool, InfoReq->Information.Ulong);
-          if (NewBuffer)
+          Size = MIN(InfoReq->Information.Ulong, AFD_MAXIMUM_WINDOW_SIZE);
+          if (!Size)
           {
-              if (FCB->Recv.Content > InfoReq->Information.Ulong)
-                  FCB->Recv.Content = InfoReq->Information.Ulong;
-              
-              if (FCB->Recv.Window)
-              {
-                  RtlCopyMemory(NewBuffer,
-                                FCB->Recv.Window,
-                                FCB->Recv.Content);
-                  
-                  ExFreePool(FCB->Recv.Window);
-              }
-              
-              FCB->Recv.Size = InfoReq->Information.Ulong;
-              FCB->Recv.Window = NewBuffer;
-              
-              Status = STATUS_SUCCESS;
-          }
-          else
-          {
-              Status = STATUS_NO_MEMORY;
+              Status = STATUS_INVALID_PARAMETER;
+              break;
           }
+
+          /* Once allocated, the window is handed to the receive in flight,
+           * so only a socket that has none yet takes the new size for it */
+          if (!FCB->Recv.Window)
+              FCB->Recv.Size = Size;
+
+          /* Let the transport size its window after the buffer asked for */
+          if (FCB->Connection.Object)
+              TdiSetInformationEx(FCB->Connection.Object,
+                                  CO_TL_ENTITY,
+                                  TL_INSTANCE,
+                                  INFO_CLASS_PROTOCOL,
+                                  INFO_TYPE_CONNECTION,
+                                  TCP_SOCKET_WINDOW,
+                                  &Size,
+                                  sizeof(Size));
           break;
         case AFD_INFO_SEND_WINDOW_SIZE:
-          NewBuffer = ExAllocatePool(PagedPool, InfoReq->Information.Ulong);
-          if (NewBuffer)
+          Size = MIN(InfoReq->Information.Ulong, AFD_MAXIMUM_WINDOW_SIZE);
+          if (!Size)
           {
-              if (FCB->Send.BytesUsed > InfoReq->Information.Ulong)
-                  FCB->Send.BytesUsed = InfoReq->Information.Ulong;
-                  
-              if (FCB->Send.Window)
-              {
-                  RtlCopyMemory(NewBuffer,
-                                FCB->Send.Window,
-                                FCB->Send.BytesUsed);
-                  
-                  ExFreePool(FCB->Send.Window);
-              }
-                  
-              FCB->Send.Size = InfoReq->Information.Ulong;
-              FCB->Send.Window = NewBuffer;
-                  
-              Status = STATUS_SUCCESS;
-          }
-          else
-          {
-              Status = STATUS_NO_MEMORY;
+              Status = STATUS_INVALID_PARAMETER;
+              break;
           }
+
+          /* Sends in flight point into the window, so it keeps its size */
+          if (!FCB->Send.Window)
+              FCB->Send.Size = Size;
+
+          if (FCB->Connection.Object)
+              TdiSetInformationEx(FCB->Connection.Object,
+                                  CO_TL_ENTITY,
+                                  TL_INSTANCE,
+                                  INFO_CLASS_PROTOCOL,
+                                  INFO_TYPE_CONNECTION,
+                                  TCP_SOCKET_SEND_WINDOW,
+                                  &Size,
+                                  sizeof(Size));
           break;
         default:
           AFD_DbgPrint(MIN_TRACE,("Unknown request %d\n", InfoReq->InformationClass));
@@ -41,9 +41,17 @@
 #define IOCTL_TCP_QUERY_INFORMATION_EX \
 	CTL_CODE(FILE_DEVICE_NETWORK, 0, METHOD_NEITHER, FILE_ANY_ACCESS)
 
+#define IOCTL_TCP_SET_INFORMATION_EX \
+	CTL_CODE(FILE_DEVICE_NETWORK, 1, METHOD_BUFFERED, FILE_WRITE_ACCESS)
+
 #define TL_INSTANCE 0
 #define	IP_MIB_STATS_ID 1
 #define	IP_MIB_ADDRTABLE_ENTRY_ID 0x102
+#define TCP_SOCKET_WINDOW 6
+#define TCP_SOCKET_SEND_WINDOW 0x100
+
+/* Largest SO_RCVBUF/SO_SNDBUF we buffer, the most the transport's window grows */
+#define AFD_MAXIMUM_WINDOW_SIZE 0x40000
 
 typedef struct IPSNMP_INFO {
 	ULONG Forwarding;
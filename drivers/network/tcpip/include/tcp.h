@@ -178,6 +178,11 @@ NTSTATUS TCPGetSockAddress
   PTRANSPORT_ADDRESS TransportAddress,
   BOOLEAN RemoteAddress );
 
+NTSTATUS TCPSetBufferSize
+( PCONNECTION_ENDPOINT Connection,
+  BOOLEAN Receive,
+  UINT Size );
+
 NTSTATUS TCPStartup(
   VOID);
 
@@ -186,6 +191,10 @@ NTSTATUS TCPShutdown(
 
 BOOLEAN TCPRemoveIRP( PCONNECTION_ENDPOINT Connection, PIRP Irp );
 
+VOID TCPLockCore( VOID );
+
+VOID TCPUnlockCore( VOID );
+
 VOID
 TCPUpdateInterfaceLinkStatus(PIP_INTERFACE IF);
 
@@ -278,6 +278,10 @@ typedef struct _CONNECTION_ENDPOINT {
     BOOLEAN SendShutdown;
     BOOLEAN ReceiveShutdown;
 
+    /* Buffer sizes set by the client (0 if autotuned) */
+    UINT ReceiveBufferSize;
+    UINT SendBufferSize;
+
     struct _CONNECTION_ENDPOINT *Next; /* Next connection in address file list */
 } CONNECTION_ENDPOINT, *PCONNECTION_ENDPOINT;
 
@@ -64,6 +64,32 @@ TDI_STATUS SetAddressFileInfo(TDIObjectID *ID,
     }
 }
 
+TDI_STATUS SetConnectionInfo(TDIObjectID *ID,
+                             PCONNECTION_ENDPOINT Connection,
+                             PVOID Buffer,
+                             UINT BufferSize)
+{
+    switch (ID->toi_id)
+    {
+      case TCP_SOCKET_WINDOW:
+         if (BufferSize < sizeof(UINT))
+             return TDI_INVALID_PARAMETER;
+
+         return TCPSetBufferSize(Connection, TRUE, *((PUINT)Buffer));
+
+      case TCP_SOCKET_SEND_WINDOW:
+         if (BufferSize < sizeof(UINT))
+             return TDI_INVALID_PARAMETER;
+
+         return TCPSetBufferSize(Connection, FALSE, *((PUINT)Buffer));
+
+      default:
+         DbgPrint("Unimplemented option %x\n", ID->toi_id);
+
+         return TDI_INVALID_REQUEST;
+    }
+}
+
 TDI_STATUS GetAddressFileInfo(TDIObjectID *ID,
                               PADDRESS_FILE AddrFile,
                               PVOID Buffer,
@@ -583,12 +583,15 @@ NTSTATUS DispTdiListen(
        Irp,
        (PDRIVER_CANCEL)DispCancelListenRequest);
 
+  /* Starting the listener calls into lwIP, whose lock ranks above ours */
+  TCPLockCore();
   LockObject(Connection, &OldIrql);
 
   if (Connection->AddressFile == NULL)
   {
      TI_DbgPrint(MID_TRACE, ("No associated address file\n"));
      UnlockObject(Connection, OldIrql);
+     TCPUnlockCore();
      Status = STATUS_INVALID_PARAMETER;
      goto done;
   }
@@ -634,6 +637,7 @@ NTSTATUS DispTdiListen(
 
   UnlockObjectFromDpcLevel(Connection->AddressFile);
   UnlockObject(Connection, OldIrql);
+  TCPUnlockCore();
 
 done:
   if (Status != STATUS_PENDING) {
@@ -1517,6 +1521,17 @@ NTSTATUS DispTdiSetInformationEx(
         return Irp->IoStatus.Status;
     }
 
+    /* Connection options act on the connection of the file they come in on */
+    if (Info->ID.toi_type == INFO_TYPE_CONNECTION &&
+        (ULONG_PTR)IrpSp->FileObject->FsContext2 != TDI_CONNECTION_FILE) {
+        Irp->IoStatus.Status      = STATUS_INVALID_PARAMETER;
+        Irp->IoStatus.Information = 0;
+
+        TI_DbgPrint(DEBUG_IRP, ("Completing IRP at (0x%X).\n", Irp));
+
+        return Irp->IoStatus.Status;
+    }
+
     Status = DispPrepareIrpForCancel(TranContext, Irp, NULL);
     if (NT_SUCCESS(Status)) {
         Request.RequestNotifyObject = DispDataRequestComplete;
@@ -404,6 +404,7 @@ NTSTATUS FileCloseAddress(
 
   if (!Request->Handle.AddressHandle) return STATUS_INVALID_PARAMETER;
 
+  TCPLockCore();
   LockObject(AddrFile, &OldIrql);
 
   /* We have to close this listener because we started it */
@@ -413,6 +414,7 @@ NTSTATUS FileCloseAddress(
   }
 
   UnlockObject(AddrFile, OldIrql);
+  TCPUnlockCore();
 
   DereferenceObject(AddrFile);
 
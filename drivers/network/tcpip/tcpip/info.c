@@ -333,6 +333,12 @@ TDI_STATUS InfoTdiSetInformationEx
                    return TDI_INVALID_PARAMETER;
           }
 
+          /* Only passed in for connection files, see DispTdiSetInformationEx */
+          if (ID->toi_type == INFO_TYPE_CONNECTION)
+          {
+              return SetConnectionInfo(ID, Request->Handle.ConnectionContext, Buffer, BufferSize);
+          }
+
 	  switch (ID->toi_id)
           {
 	      case IP_MIB_ARPTABLE_ENTRY_ID:
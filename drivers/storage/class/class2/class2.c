@@ -36,6 +36,33 @@
 //#define DEFAULT_SECTORS_PER_TRACK    63
 //#define DEFAULT_TRACKS_PER_CYLINDER 255
 
+//
+// Kept in the DriverContext of a request while it waits in the queue of
+// the disk. The IRP itself is linked by starting offset through
+// Tail.Overlay.ListEntry.
+//
+
+typedef struct _CLASS_QUEUE_ENTRY {
+    LIST_ENTRY FifoEntry;
+    ULONG ArrivalTime;
+} CLASS_QUEUE_ENTRY, *PCLASS_QUEUE_ENTRY;
+
+C_ASSERT(sizeof(CLASS_QUEUE_ENTRY) <= RTL_FIELD_SIZE(IRP, Tail.Overlay.DriverContext));
+
+#define CLASS_QUEUE_ENTRY_FROM_IRP(Irp) \
+    ((PCLASS_QUEUE_ENTRY)&(Irp)->Tail.Overlay.DriverContext[0])
+
+//
+// A transfer made of several contiguous requests, going through a buffer
+// of its own.
+//
+
+typedef struct _CLASS_MERGED_TRANSFER {
+    PSCSI_REQUEST_BLOCK Srb;
+    PUCHAR Buffer;
+    LIST_ENTRY RequestList;
+} CLASS_MERGED_TRANSFER, *PCLASS_MERGED_TRANSFER;
+
 NTSTATUS
 NTAPI
 ScsiClassCreateClose(
@@ -119,6 +146,60 @@ ClassCompletionRoutine(IN PDEVICE_OBJECT DeviceObject,
                        IN PIRP Irp,
                        IN PVOID Context);
 
+ULONG
+NTAPI
+ScsiClassMaximumMergeLength(
+    IN PDEVICE_EXTENSION DeviceExtension
+    );
+
+VOID
+NTAPI
+ScsiClassSendQueuedRequest(
+    IN PIRP Irp
+    );
+
+VOID
+NTAPI
+ScsiClassSendRequestList(
+    IN PDEVICE_OBJECT PhysicalDevice,
+    IN PLIST_ENTRY RequestList
+    );
+
+VOID
+NTAPI
+ScsiClassSendMergedTransfer(
+    IN PDEVICE_OBJECT PhysicalDevice,
+    IN PLIST_ENTRY RequestList,
+    IN ULONG Length
+    );
+
+VOID
+NTAPI
+ScsiClassQueueRequest(
+    IN PDEVICE_OBJECT DeviceObject,
+    IN PIRP Irp
+    );
+
+VOID
+NTAPI
+ScsiClassStartQueuedRequests(
+    IN PDEVICE_OBJECT PhysicalDevice
+    );
+
+VOID
+NTAPI
+ScsiClassQueueTransferDone(
+    IN PDEVICE_OBJECT PhysicalDevice
+    );
+
+NTSTATUS
+NTAPI
+ScsiClassIoCompleteMerged(
+    IN PDEVICE_OBJECT DeviceObject,
+    IN PIRP Irp,
+    IN PVOID Context
+    );
+
 
 NTSTATUS
 NTAPI
@@ -329,7 +410,7 @@ Routine Description:
     This is the system entry point for read and write requests. The device-specific handler is invoked
     to perform any validation necessary. The number of bytes in the request are
     checked against the maximum byte counts that the adapter supports and requests are broken up into
-    smaller sizes if necessary.
+    smaller sizes if necessary. Other requests go through the request queue of the disk.
 
 Arguments:
 
@@ -483,16 +564,13 @@ Return Value:
     }
 
     //
-    // Build SRB and CDB for this IRP.
+    // Queue the request on the disk. It is sent to the port driver at once
+    // unless that already has a full queue depth of transfers.
     //
 
-    ScsiClassBuildRequest(DeviceObject, Irp);
-
-    //
-    // Return the results of the call to the port driver.
-    //
+    ScsiClassQueueRequest(DeviceObject, Irp);
 
-    return IoCallDriver(deviceExtension->PortDeviceObject, Irp);
+    return STATUS_PENDING;
 
 } // end ScsiClassReadWrite()
 
@@ -1589,6 +1667,15 @@ Return Value:
         if (irpStack->MajorFunction != IRP_MJ_DEVICE_CONTROL) {
             IoStartNextPacket(DeviceObject, FALSE);
         }
+    } else if (irpStack->MajorFunction == IRP_MJ_READ ||
+               irpStack->MajorFunction == IRP_MJ_WRITE) {
+
+        //
+        // This was sent from the request queue of the disk, let the next
+        // requests go.
+        //
+
+        ScsiClassQueueTransferDone(deviceExtension->PhysicalDevice);
     }
 
     return status;
@@ -1808,6 +1895,692 @@ Return Value:
 
 } // end ScsiClassIoCompleteAssociated()
 
+
+ULONG
+NTAPI
+ScsiClassMaximumMergeLength(
+    IN PDEVICE_EXTENSION DeviceExtension
+    )
+
+/*++
+
+Routine Description:
+
+    This routine returns the largest transfer the request queue may build
+    by coalescing requests. It stays within the limits ScsiClassReadWrite
+    splits requests at, and within the block count of a 10 byte CDB.
+
+Arguments:
+
+    DeviceExtension - The extension of the physical device.
+
+Return Value:
+
+    The length in bytes, zero if the port driver can not take a transfer
+    of more than one page.
+
+--*/
+
+{
+    ULONG maximumLength = DeviceExtension->PortCapabilities->MaximumTransferLength;
+    ULONG transferPages = DeviceExtension->PortCapabilities->MaximumPhysicalPages;
+
+    if (transferPages <= 1) {
+        return 0;
+    }
+
+    if (maximumLength > (transferPages - 1) << PAGE_SHIFT) {
+        maximumLength = (transferPages - 1) << PAGE_SHIFT;
+    }
+
+    if (maximumLength > (ULONG)0xFFFF << DeviceExtension->SectorShift) {
+        maximumLength = (ULONG)0xFFFF << DeviceExtension->SectorShift;
+    }
+
+    return maximumLength;
+
+} // end ScsiClassMaximumMergeLength()
+
+
+VOID
+NTAPI
+ScsiClassSendQueuedRequest(
+    IN PIRP Irp
+    )
+
+/*++
+
+Routine Description:
+
+    This routine builds the SRB for a request taken from the queue and
+    passes it to the port driver. The request completes through
+    ScsiClassIoComplete like any other.
+
+Arguments:
+
+    Irp - The request, its byte offset is relative to the start of the disk.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+    PDEVICE_OBJECT    deviceObject = IoGetCurrentIrpStackLocation(Irp)->DeviceObject;
+    PDEVICE_EXTENSION deviceExtension = deviceObject->DeviceExtension;
+
+    ScsiClassBuildRequest(deviceObject, Irp);
+
+    IoCallDriver(deviceExtension->PortDeviceObject, Irp);
+
+} // end ScsiClassSendQueuedRequest()
+
+
+VOID
+NTAPI
+ScsiClassSendRequestList(
+    IN PDEVICE_OBJECT PhysicalDevice,
+    IN PLIST_ENTRY RequestList
+    )
+
+/*++
+
+Routine Description:
+
+    This routine sends the requests of a merge that could not be made, or
+    that failed, to the port driver one by one. Each of them gets the
+    retries and error handling of a request of its own.
+
+Arguments:
+
+    PhysicalDevice - The disk the requests were queued on.
+
+    RequestList - The requests, linked through Tail.Overlay.ListEntry. The
+        caller holds the outstanding transfer count of one of them.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+    PDEVICE_EXTENSION deviceExtension = PhysicalDevice->DeviceExtension;
+    PLIST_ENTRY       entry;
+    ULONG             count = 0;
+    KIRQL             irql;
+
+    for (entry = RequestList->Flink; entry != RequestList; entry = entry->Flink) {
+        count++;
+    }
+
+    KeAcquireSpinLock(&deviceExtension->RequestQueueLock, &irql);
+    deviceExtension->QueueStatistics.OutstandingCount += count - 1;
+    deviceExtension->QueueStatistics.TransferCount += count - 1;
+    KeReleaseSpinLock(&deviceExtension->RequestQueueLock, irql);
+
+    while (!IsListEmpty(RequestList)) {
+        entry = RemoveHeadList(RequestList);
+        ScsiClassSendQueuedRequest(CONTAINING_RECORD(entry, IRP, Tail.Overlay.ListEntry));
+    }
+
+} // end ScsiClassSendRequestList()
+
+
+VOID
+NTAPI
+ScsiClassSendMergedTransfer(
+    IN PDEVICE_OBJECT PhysicalDevice,
+    IN PLIST_ENTRY RequestList,
+    IN ULONG Length
+    )
+
+/*++
+
+Routine Description:
+
+    This routine sends contiguous requests of the same kind to the port
+    driver as a single transfer. The data goes through a nonpaged buffer,
+    since the port drivers take one MDL per SRB. If the resources for
+    that are not there, the requests are sent one by one.
+
+Arguments:
+
+    PhysicalDevice - The disk the requests were queued on.
+
+    RequestList - The requests in ascending order, linked through
+        Tail.Overlay.ListEntry.
+
+    Length - The sum of their lengths.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+    PDEVICE_EXTENSION      deviceExtension = PhysicalDevice->DeviceExtension;
+    PIRP                   irp = CONTAINING_RECORD(RequestList->Flink, IRP, Tail.Overlay.ListEntry);
+    PIO_STACK_LOCATION     irpStack = IoGetCurrentIrpStackLocation(irp);
+    PIO_STACK_LOCATION     newIrpStack;
+    PCLASS_MERGED_TRANSFER transfer;
+    PLIST_ENTRY            entry;
+    PIRP                   newIrp = NULL;
+    PMDL                   mdl = NULL;
+    PUCHAR                 buffer;
+    PVOID                  systemAddress;
+
+    transfer = ExAllocatePool(NonPagedPool, sizeof(CLASS_MERGED_TRANSFER));
+
+    if (transfer == NULL) {
+        ScsiClassSendRequestList(PhysicalDevice, RequestList);
+        return;
+    }
+
+    transfer->Buffer = ExAllocatePool(NonPagedPool, Length);
+
+    if (transfer->Buffer != NULL) {
+        mdl = IoAllocateMdl(transfer->Buffer, Length, FALSE, FALSE, NULL);
+    }
+
+    if (mdl != NULL) {
+        newIrp = IoAllocateIrp(PhysicalDevice->StackSize, FALSE);
+    }
+
+    //
+    // Map every request now, so completion only has to copy. Writes are
+    // gathered into the buffer right away.
+    //
+
+    buffer = transfer->Buffer;
+
+    for (entry = RequestList->Flink;
+         newIrp != NULL && entry != RequestList;
+         entry = entry->Flink) {
+
+        irp = CONTAINING_RECORD(entry, IRP, Tail.Overlay.ListEntry);
+
+        systemAddress = MmGetSystemAddressForMdlSafe(irp->MdlAddress, NormalPagePriority);
+
+        if (systemAddress == NULL) {
+            IoFreeIrp(newIrp);
+            newIrp = NULL;
+            break;
+        }
+
+        if (irpStack->MajorFunction == IRP_MJ_WRITE) {
+            RtlCopyMemory(buffer,
+                          systemAddress,
+                          IoGetCurrentIrpStackLocation(irp)->Parameters.Write.Length);
+        }
+
+        buffer += IoGetCurrentIrpStackLocation(irp)->Parameters.Write.Length;
+    }
+
+    if (newIrp == NULL) {
+
+        DebugPrint((1, "ScsiClassSendMergedTransfer: Can't merge, sending requests one by one\n"));
+
+        if (mdl != NULL) {
+            IoFreeMdl(mdl);
+        }
+
+        if (transfer->Buffer != NULL) {
+            ExFreePool(transfer->Buffer);
+        }
+
+        ExFreePool(transfer);
+        ScsiClassSendRequestList(PhysicalDevice, RequestList);
+        return;
+    }
+
+    MmBuildMdlForNonPagedPool(mdl);
+
+    //
+    // Take the requests over into the transfer.
+    //
+
+    InitializeListHead(&transfer->RequestList);
+
+    while (!IsListEmpty(RequestList)) {
+        InsertTailList(&transfer->RequestList, RemoveHeadList(RequestList));
+    }
+
+    //
+    // Describe the whole range in the stack location of the new IRP, like
+    // ScsiClassSplitRequest does for its partial transfers.
+    //
+
+    newIrp->MdlAddress = mdl;
+
+    IoSetNextIrpStackLocation(newIrp);
+    newIrpStack = IoGetCurrentIrpStackLocation(newIrp);
+
+    newIrpStack->MajorFunction = irpStack->MajorFunction;
+    newIrpStack->Flags = irpStack->Flags & SL_WRITE_THROUGH;
+    newIrpStack->Parameters.Read.Length = Length;
+    newIrpStack->Parameters.Read.ByteOffset = irpStack->Parameters.Read.ByteOffset;
+    newIrpStack->DeviceObject = PhysicalDevice;
+
+    ScsiClassBuildRequest(PhysicalDevice, newIrp);
+
+    transfer->Srb = IoGetNextIrpStackLocation(newIrp)->Parameters.Scsi.Srb;
+
+    IoSetCompletionRoutine(newIrp,
+                           ScsiClassIoCompleteMerged,
+                           transfer,
+                           TRUE,
+                           TRUE,
+                           TRUE);
+
+    IoCallDriver(deviceExtension->PortDeviceObject, newIrp);
+
+} // end ScsiClassSendMergedTransfer()
+
+
+VOID
+NTAPI
+ScsiClassQueueRequest(
+    IN PDEVICE_OBJECT DeviceObject,
+    IN PIRP Irp
+    )
+
+/*++
+
+Routine Description:
+
+    This routine takes a read or write request into the queue of the disk.
+    As long as the port driver has fewer than CLASS_QUEUE_DEPTH transfers
+    and nothing is waiting, the request is sent right away. Otherwise it
+    waits, sorted by starting offset, until ScsiClassStartQueuedRequests
+    picks it.
+
+Arguments:
+
+    DeviceObject - The device object of the disk or partition.
+
+    Irp - The request, marked pending. Its byte offset is relative to the
+        start of the disk.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+    PDEVICE_EXTENSION       deviceExtension = DeviceObject->DeviceExtension;
+    PDEVICE_EXTENSION       physicalExtension = deviceExtension->PhysicalDevice->DeviceExtension;
+    PCLASS_QUEUE_STATISTICS statistics = &physicalExtension->QueueStatistics;
+    PIO_STACK_LOCATION      irpStack = IoGetCurrentIrpStackLocation(Irp);
+    LONGLONG                startingOffset = irpStack->Parameters.Read.ByteOffset.QuadPart;
+    PLIST_ENTRY             entry;
+    PIRP                    queuedIrp;
+    KIRQL                   irql;
+
+    KeAcquireSpinLock(&physicalExtension->RequestQueueLock, &irql);
+
+    statistics->RequestCount++;
+
+    if (IsListEmpty(&physicalExtension->RequestQueueHead) &&
+        statistics->OutstandingCount < CLASS_QUEUE_DEPTH) {
+
+        statistics->OutstandingCount++;
+        statistics->TransferCount++;
+        physicalExtension->RequestQueuePosition = startingOffset +
+                                                  irpStack->Parameters.Read.Length;
+
+        KeReleaseSpinLock(&physicalExtension->RequestQueueLock, irql);
+
+        ScsiClassSendQueuedRequest(Irp);
+        return;
+    }
+
+    //
+    // Insert by starting offset. Search from the end, since streams mostly
+    // ascend.
+    //
+
+    for (entry = physicalExtension->RequestQueueHead.Blink;
+         entry != &physicalExtension->RequestQueueHead;
+         entry = entry->Blink) {
+
+        queuedIrp = CONTAINING_RECORD(entry, IRP, Tail.Overlay.ListEntry);
+
+        if (IoGetCurrentIrpStackLocation(queuedIrp)->Parameters.Read.ByteOffset.QuadPart <= startingOffset) {
+            break;
+        }
+    }
+
+    InsertHeadList(entry, &Irp->Tail.Overlay.ListEntry);
+
+    CLASS_QUEUE_ENTRY_FROM_IRP(Irp)->ArrivalTime = (ULONG)(KeQueryInterruptTime() / 10000);
+    InsertTailList(&physicalExtension->RequestFifoHead,
+                   &CLASS_QUEUE_ENTRY_FROM_IRP(Irp)->FifoEntry);
+
+    if (++statistics->QueueDepth > statistics->MaximumQueueDepth) {
+        statistics->MaximumQueueDepth = statistics->QueueDepth;
+    }
+
+    KeReleaseSpinLock(&physicalExtension->RequestQueueLock, irql);
+
+} // end ScsiClassQueueRequest()
+
+
+VOID
+NTAPI
+ScsiClassStartQueuedRequests(
+    IN PDEVICE_OBJECT PhysicalDevice
+    )
+
+/*++
+
+Routine Description:
+
+    This routine sends queued requests to the port driver until it has
+    CLASS_QUEUE_DEPTH transfers. The next request is the first one at or
+    beyond the position of the elevator, wrapping around to the lowest
+    offset, unless the oldest one has waited for CLASS_QUEUE_DEADLINE.
+    Requests that continue it contiguously in the same direction go out
+    with it as one transfer.
+
+    A transfer may complete inside IoCallDriver, and its completion calls
+    back in here. Only one caller sends at a time, any other one returns
+    at once and leaves the freed slot to the loop that is already running,
+    so the stack does not grow with every transfer that completes inline.
+
+Arguments:
+
+    PhysicalDevice - The disk.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+    PDEVICE_EXTENSION       deviceExtension = PhysicalDevice->DeviceExtension;
+    PCLASS_QUEUE_STATISTICS statistics = &deviceExtension->QueueStatistics;
+    PLIST_ENTRY             queueHead = &deviceExtension->RequestQueueHead;
+    PIO_STACK_LOCATION      irpStack;
+    PIO_STACK_LOCATION      nextIrpStack;
+    PCLASS_QUEUE_ENTRY      queueEntry;
+    LIST_ENTRY              requestList;
+    PLIST_ENTRY             entry;
+    PIRP                    irp;
+    LONGLONG                endingOffset;
+    ULONG                   maximumLength = ScsiClassMaximumMergeLength(deviceExtension);
+    ULONG                   length;
+    ULONG                   count;
+    KIRQL                   irql;
+
+    KeAcquireSpinLock(&deviceExtension->RequestQueueLock, &irql);
+
+    if (deviceExtension->RequestQueueDispatching) {
+        KeReleaseSpinLock(&deviceExtension->RequestQueueLock, irql);
+        return;
+    }
+
+    deviceExtension->RequestQueueDispatching = TRUE;
+
+    while (TRUE) {
+
+        if (IsListEmpty(queueHead) ||
+            statistics->OutstandingCount >= CLASS_QUEUE_DEPTH) {
+
+            //
+            // Decided under the lock, so any slot freed after this is seen
+            // by a caller that finds the flag clear.
+            //
+
+            deviceExtension->RequestQueueDispatching = FALSE;
+            KeReleaseSpinLock(&deviceExtension->RequestQueueLock, irql);
+            return;
+        }
+
+        queueEntry = CONTAINING_RECORD(deviceExtension->RequestFifoHead.Flink,
+                                       CLASS_QUEUE_ENTRY,
+                                       FifoEntry);
+
+        if ((ULONG)(KeQueryInterruptTime() / 10000) - queueEntry->ArrivalTime >= CLASS_QUEUE_DEADLINE) {
+
+            irp = CONTAINING_RECORD(queueEntry, IRP, Tail.Overlay.DriverContext);
+            statistics->DeadlineCount++;
+
+        } else {
+
+            for (entry = queueHead->Flink; entry != queueHead; entry = entry->Flink) {
+
+                irp = CONTAINING_RECORD(entry, IRP, Tail.Overlay.ListEntry);
+
+                if (IoGetCurrentIrpStackLocation(irp)->Parameters.Read.ByteOffset.QuadPart >=
+                    deviceExtension->RequestQueuePosition) {
+                    break;
+                }
+            }
+
+            if (entry == queueHead) {
+                entry = queueHead->Flink;
+            }
+
+            irp = CONTAINING_RECORD(entry, IRP, Tail.Overlay.ListEntry);
+        }
+
+        //
+        // Take the request and the run of requests continuing it.
+        //
+
+        InitializeListHead(&requestList);
+
+        irpStack = IoGetCurrentIrpStackLocation(irp);
+        endingOffset = irpStack->Parameters.Read.ByteOffset.QuadPart;
+        length = 0;
+        count = 0;
+
+        while (TRUE) {
+
+            nextIrpStack = IoGetCurrentIrpStackLocation(irp);
+            entry = irp->Tail.Overlay.ListEntry.Flink;
+
+            RemoveEntryList(&irp->Tail.Overlay.ListEntry);
+            RemoveEntryList(&CLASS_QUEUE_ENTRY_FROM_IRP(irp)->FifoEntry);
+            InsertTailList(&requestList, &irp->Tail.Overlay.ListEntry);
+
+            length += nextIrpStack->Parameters.Read.Length;
+            endingOffset += nextIrpStack->Parameters.Read.Length;
+            count++;
+
+            if (entry == queueHead || count == CLASS_MAXIMUM_MERGE) {
+                break;
+            }
+
+            irp = CONTAINING_RECORD(entry, IRP, Tail.Overlay.ListEntry);
+            nextIrpStack = IoGetCurrentIrpStackLocation(irp);
+
+            if (nextIrpStack->Parameters.Read.ByteOffset.QuadPart != endingOffset ||
+                nextIrpStack->MajorFunction != irpStack->MajorFunction ||
+                nextIrpStack->Flags != irpStack->Flags ||
+                length + nextIrpStack->Parameters.Read.Length > maximumLength) {
+                break;
+            }
+        }
+
+        statistics->QueueDepth -= count;
+        statistics->OutstandingCount++;
+        statistics->TransferCount++;
+
+        if (count > 1) {
+            statistics->MergedRequestCount += count;
+            statistics->MergedTransferCount++;
+        }
+
+        deviceExtension->RequestQueuePosition = endingOffset;
+
+        KeReleaseSpinLock(&deviceExtension->RequestQueueLock, irql);
+
+        if (count == 1) {
+            ScsiClassSendQueuedRequest(CONTAINING_RECORD(requestList.Flink, IRP, Tail.Overlay.ListEntry));
+        } else {
+            ScsiClassSendMergedTransfer(PhysicalDevice, &requestList, length);
+        }
+
+        KeAcquireSpinLock(&deviceExtension->RequestQueueLock, &irql);
+    }
+
+} // end ScsiClassStartQueuedRequests()
+
+
+VOID
+NTAPI
+ScsiClassQueueTransferDone(
+    IN PDEVICE_OBJECT PhysicalDevice
+    )
+
+/*++
+
+Routine Description:
+
+    This routine is called when a transfer sent from the request queue has
+    completed. It lets the next queued requests go.
+
+Arguments:
+
+    PhysicalDevice - The disk.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+    PDEVICE_EXTENSION deviceExtension = PhysicalDevice->DeviceExtension;
+    KIRQL             irql;
+
+    KeAcquireSpinLock(&deviceExtension->RequestQueueLock, &irql);
+    ASSERT(deviceExtension->QueueStatistics.OutstandingCount > 0);
+    deviceExtension->QueueStatistics.OutstandingCount--;
+    KeReleaseSpinLock(&deviceExtension->RequestQueueLock, irql);
+
+    ScsiClassStartQueuedRequests(PhysicalDevice);
+
+} // end ScsiClassQueueTransferDone()
+
+
+NTSTATUS
+NTAPI
+ScsiClassIoCompleteMerged(
+    IN PDEVICE_OBJECT DeviceObject,
+    IN PIRP Irp,
+    IN PVOID Context
+    )
+
+/*++
+
+Routine Description:
+
+    This routine executes when the port driver has completed a transfer
+    built by ScsiClassSendMergedTransfer. On success the data of reads is
+    copied out and every request is completed. On failure the requests are
+    sent again one by one, so errors and retries apply to each of them
+    alone.
+
+Arguments:
+
+    DeviceObject - The disk.
+
+    Irp - The IRP of the merged transfer.
+
+    Context - Supplies a pointer to the CLASS_MERGED_TRANSFER.
+
+Return Value:
+
+    STATUS_MORE_PROCESSING_REQUIRED
+
+--*/
+
+{
+    PCLASS_MERGED_TRANSFER transfer = Context;
+    PSCSI_REQUEST_BLOCK    srb = transfer->Srb;
+    PDEVICE_EXTENSION      deviceExtension = DeviceObject->DeviceExtension;
+    PIO_STACK_LOCATION     irpStack;
+    PLIST_ENTRY            entry;
+    PIRP                   originalIrp;
+    PUCHAR                 buffer = transfer->Buffer;
+    BOOLEAN                success = (SRB_STATUS(srb->SrbStatus) == SRB_STATUS_SUCCESS);
+
+    if (!success) {
+
+        DebugPrint((1, "ScsiClassIoCompleteMerged: IRP %lx, SRB %lx failed, retrying requests one by one\n",
+                    Irp, srb));
+
+        //
+        // Release the queue if it is frozen.
+        //
+
+        if (srb->SrbStatus & SRB_STATUS_QUEUE_FROZEN) {
+            ScsiClassReleaseQueue(DeviceObject);
+        }
+    }
+
+    //
+    // Return SRB to list.
+    //
+
+    ExFreeToNPagedLookasideList(&deviceExtension->SrbLookasideListHead,
+                                srb);
+
+    if (success) {
+
+        while (!IsListEmpty(&transfer->RequestList)) {
+
+            entry = RemoveHeadList(&transfer->RequestList);
+            originalIrp = CONTAINING_RECORD(entry, IRP, Tail.Overlay.ListEntry);
+            irpStack = IoGetCurrentIrpStackLocation(originalIrp);
+
+            //
+            // The MDL was mapped when the transfer was built.
+            //
+
+            if (irpStack->MajorFunction == IRP_MJ_READ) {
+                RtlCopyMemory(MmGetSystemAddressForMdlSafe(originalIrp->MdlAddress, NormalPagePriority),
+                              buffer,
+                              irpStack->Parameters.Read.Length);
+            }
+
+            buffer += irpStack->Parameters.Read.Length;
+
+            originalIrp->IoStatus.Status = STATUS_SUCCESS;
+            originalIrp->IoStatus.Information = irpStack->Parameters.Read.Length;
+
+            IoCompleteRequest(originalIrp, IO_DISK_INCREMENT);
+        }
+
+    } else {
+
+        //
+        // The requests take over the outstanding transfer.
+        //
+
+        ScsiClassSendRequestList(DeviceObject, &transfer->RequestList);
+    }
+
+    IoFreeMdl(Irp->MdlAddress);
+    ExFreePool(transfer->Buffer);
+    ExFreePool(transfer);
+    IoFreeIrp(Irp);
+
+    if (success) {
+        ScsiClassQueueTransferDone(DeviceObject);
+    }
+
+    return STATUS_MORE_PROCESSING_REQUIRED;
+
+} // end ScsiClassIoCompleteMerged()
+
 
 NTSTATUS
 NTAPI
@@ -3671,6 +4444,39 @@ Return Value:
         goto SetStatusAndReturn;
     }
 
+    if (irpStack->Parameters.DeviceIoControl.IoControlCode == IOCTL_SCSI_CLASS_QUEUE_STATISTICS) {
+
+        PDEVICE_EXTENSION physicalExtension = deviceExtension->PhysicalDevice->DeviceExtension;
+        KIRQL irql;
+
+        if (irpStack->Parameters.DeviceIoControl.OutputBufferLength <
+            sizeof(CLASS_QUEUE_STATISTICS)) {
+
+            Irp->IoStatus.Status = STATUS_BUFFER_TOO_SMALL;
+            Irp->IoStatus.Information = 0;
+            IoCompleteRequest(Irp, IO_NO_INCREMENT);
+            status = STATUS_BUFFER_TOO_SMALL;
+            goto SetStatusAndReturn;
+        }
+
+        //
+        // The queue belongs to the whole disk, also when asked through a
+        // partition.
+        //
+
+        KeAcquireSpinLock(&physicalExtension->RequestQueueLock, &irql);
+        RtlCopyMemory(Irp->AssociatedIrp.SystemBuffer,
+                      &physicalExtension->QueueStatistics,
+                      sizeof(CLASS_QUEUE_STATISTICS));
+        KeReleaseSpinLock(&physicalExtension->RequestQueueLock, irql);
+
+        Irp->IoStatus.Information = sizeof(CLASS_QUEUE_STATISTICS);
+        Irp->IoStatus.Status = STATUS_SUCCESS;
+        IoCompleteRequest(Irp, IO_NO_INCREMENT);
+        status = STATUS_SUCCESS;
+        goto SetStatusAndReturn;
+    }
+
     srb = ExAllocatePool(NonPagedPool, SCSI_REQUEST_BLOCK_SIZE);
 
     if (srb == NULL) {
@@ -4295,6 +5101,18 @@ Return Value:
 
         deviceExtension->MediaChangeCount = 0;
 
+        //
+        // Set up the request queue. Partitions use the one of the physical
+        // device.
+        //
+
+        KeInitializeSpinLock(&deviceExtension->RequestQueueLock);
+        InitializeListHead(&deviceExtension->RequestQueueHead);
+        InitializeListHead(&deviceExtension->RequestFifoHead);
+        deviceExtension->RequestQueuePosition = 0;
+        deviceExtension->RequestQueueDispatching = FALSE;
+        RtlZeroMemory(&deviceExtension->QueueStatistics, sizeof(CLASS_QUEUE_STATISTICS));
+
         //
         // If a pointer to the physical device object was passed in then use
         // that.  If the value was NULL, then this is the physical device so
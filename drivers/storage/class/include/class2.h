@@ -42,6 +42,33 @@
 
 #define DEV_NO_12BYTE_CDB 0x00000008
 
+//
+// Reads and writes are held in the request queue of the disk while this
+// many transfers are outstanding at the port driver.
+//
+
+#define CLASS_QUEUE_DEPTH           8
+
+//
+// A queued request that has waited this long (in ms) is sent next,
+// whatever the elevator order.
+//
+
+#define CLASS_QUEUE_DEADLINE        500
+
+//
+// Most requests coalesced into one transfer.
+//
+
+#define CLASS_MAXIMUM_MERGE         16
+
+//
+// Returns the CLASS_QUEUE_STATISTICS of the disk.
+//
+
+#define IOCTL_SCSI_CLASS_QUEUE_STATISTICS \
+    CTL_CODE(IOCTL_DISK_BASE, 0x0800, METHOD_BUFFERED, FILE_ANY_ACCESS)
+
 
 struct _CLASS_INIT_DATA;
 
@@ -95,6 +122,19 @@ typedef struct _CLASS_INIT_DATA
 } CLASS_INIT_DATA, *PCLASS_INIT_DATA;
 
 
+typedef struct _CLASS_QUEUE_STATISTICS
+{
+  ULONG QueueDepth;           /* requests waiting in the queue */
+  ULONG MaximumQueueDepth;
+  ULONG OutstandingCount;     /* transfers at the port driver */
+  ULONG RequestCount;         /* reads and writes taken in */
+  ULONG TransferCount;        /* transfers sent to the port driver */
+  ULONG MergedRequestCount;   /* requests sent as part of a larger transfer */
+  ULONG MergedTransferCount;  /* transfers made of more than one request */
+  ULONG DeadlineCount;        /* transfers sent out of elevator order */
+} CLASS_QUEUE_STATISTICS, *PCLASS_QUEUE_STATISTICS;
+
+
 typedef struct _DEVICE_EXTENSION
 {
   PDEVICE_OBJECT DeviceObject;
@@ -133,6 +173,17 @@ typedef struct _DEVICE_EXTENSION
   HANDLE MediaChangeEventHandle;
   BOOLEAN MediaChangeNoMedia;
   ULONG MediaChangeCount;
+
+  //
+  // Request queue, only used in the extension of the physical device.
+  //
+
+  KSPIN_LOCK RequestQueueLock;
+  LIST_ENTRY RequestQueueHead;      /* by starting offset */
+  LIST_ENTRY RequestFifoHead;       /* by arrival */
+  LONGLONG RequestQueuePosition;    /* offset the elevator moves on from */
+  BOOLEAN RequestQueueDispatching;  /* ScsiClassStartQueuedRequests runs */
+  CLASS_QUEUE_STATISTICS QueueStatistics;
 } DEVICE_EXTENSION, *PDEVICE_EXTENSION;
 
 
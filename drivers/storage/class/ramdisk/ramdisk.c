@@ -82,6 +82,15 @@ typedef struct _RAMDISK_BUS_EXTENSION
     RAMDISK_EXTENSION;
 } RAMDISK_BUS_EXTENSION, *PRAMDISK_BUS_EXTENSION;
 
+typedef struct _RAMDISK_VIEW
+{
+    LIST_ENTRY ViewListEntry;
+    LONGLONG Offset;
+    ULONG Length;
+    LONG ReferenceCount;
+    PVOID BaseAddress;
+} RAMDISK_VIEW, *PRAMDISK_VIEW;
+
 typedef struct _RAMDISK_DRIVE_EXTENSION
 {
     //
@@ -110,6 +119,15 @@ typedef struct _RAMDISK_DRIVE_EXTENSION
     ULONG NumberOfHeads;
     ULONG Cylinders;
     ULONG HiddenSectors;
+    
+    //
+    // Windows mapped onto the disk, most recently used first
+    //
+    KSPIN_LOCK ViewLock;
+    LIST_ENTRY ViewList;
+    ULONG ViewCount;
+    ULONG MaximumViewCount;
+    ULONG ViewLength;
 } RAMDISK_DRIVE_EXTENSION, *PRAMDISK_DRIVE_EXTENSION;
 
 ULONG MaximumViewLength;
@@ -282,71 +300,221 @@ QueryParameters(IN PUNICODE_STRING RegistryPath)
     }
 }
 
-PVOID
+VOID
 NTAPI
-RamdiskMapPages(IN PRAMDISK_DRIVE_EXTENSION DeviceExtension,
-                IN LARGE_INTEGER Offset,
-                IN ULONG Length,
-                OUT PULONG OutputLength)
+RamdiskInitializeViews(IN PRAMDISK_DRIVE_EXTENSION DeviceExtension)
 {
-    PHYSICAL_ADDRESS PhysicalAddress;
-    PVOID MappedBase;
-    ULONG PageOffset;
-    SIZE_T ActualLength;
-    LARGE_INTEGER ActualOffset;
-    LARGE_INTEGER ActualPages;
+    ULONG ViewLength, ViewCount;
     
     //
-    // We only support boot disks for now
+    // Windows must start and end on a page
     //
-    ASSERT(DeviceExtension->DiskType == RAMDISK_BOOT_DISK);
+    ViewLength = DefaultViewLength & ~(PAGE_SIZE - 1);
+    ViewCount = DefaultViewCount;
     
     //
-    // Calculate the actual offset in the drive
+    // Stay within the address space one disk may take
     //
-    ActualOffset.QuadPart = DeviceExtension->DiskOffset + Offset.QuadPart;
+    if ((ULONGLONG)ViewLength * ViewCount > MaximumPerDiskViewLength)
+    {
+        ViewCount = MaximumPerDiskViewLength / ViewLength;
+        if (ViewCount < MinimumViewCount) ViewCount = MinimumViewCount;
+    }
     
     //
-    // Convert to pages
+    // Nothing is mapped until the disk is accessed
     //
-    ActualPages.QuadPart = ActualOffset.QuadPart >> PAGE_SHIFT;
+    KeInitializeSpinLock(&DeviceExtension->ViewLock);
+    InitializeListHead(&DeviceExtension->ViewList);
+    DeviceExtension->ViewCount = 0;
+    DeviceExtension->MaximumViewCount = ViewCount;
+    DeviceExtension->ViewLength = ViewLength;
+}
+
+PRAMDISK_VIEW
+NTAPI
+RamdiskFindView(IN PRAMDISK_DRIVE_EXTENSION DeviceExtension,
+                IN LONGLONG Offset)
+{
+    PLIST_ENTRY ListEntry;
+    PRAMDISK_VIEW View;
     
     //
-    // Now add the base page
+    // The caller holds the view lock
     //
-    ActualPages.QuadPart = DeviceExtension->BasePage + ActualPages.QuadPart;
+    for (ListEntry = DeviceExtension->ViewList.Flink;
+         ListEntry != &DeviceExtension->ViewList;
+         ListEntry = ListEntry->Flink)
+    {
+        View = CONTAINING_RECORD(ListEntry, RAMDISK_VIEW, ViewListEntry);
+        if (View->Offset == Offset) return View;
+    }
+    
+    return NULL;
+}
+
+PRAMDISK_VIEW
+NTAPI
+RamdiskTrimViews(IN PRAMDISK_DRIVE_EXTENSION DeviceExtension)
+{
+    PLIST_ENTRY ListEntry;
+    PRAMDISK_VIEW View;
+    
+    //
+    // The caller holds the view lock. Give up the least recently used window
+    // nobody is copying through, if there are more than we keep.
+    //
+    if (DeviceExtension->ViewCount <= DeviceExtension->MaximumViewCount)
+    {
+        return NULL;
+    }
+    
+    for (ListEntry = DeviceExtension->ViewList.Blink;
+         ListEntry != &DeviceExtension->ViewList;
+         ListEntry = ListEntry->Blink)
+    {
+        View = CONTAINING_RECORD(ListEntry, RAMDISK_VIEW, ViewListEntry);
+        if (!View->ReferenceCount)
+        {
+            RemoveEntryList(&View->ViewListEntry);
+            DeviceExtension->ViewCount--;
+            return View;
+        }
+    }
+    
+    return NULL;
+}
+
+VOID
+NTAPI
+RamdiskFreeView(IN PRAMDISK_VIEW View)
+{
+    //
+    // Unmap the window and free it
+    //
+    MmUnmapIoSpace(View->BaseAddress, View->Length);
+    ExFreePoolWithTag(View, 'dmaR');
+}
+
+PVOID
+NTAPI
+RamdiskMapPages(IN PRAMDISK_DRIVE_EXTENSION DeviceExtension,
+                IN LARGE_INTEGER Offset,
+                IN ULONG Length,
+                OUT PULONG OutputLength)
+{
+    PHYSICAL_ADDRESS PhysicalAddress;
+    PRAMDISK_VIEW View, NewView, OldView = NULL;
+    LONGLONG ActualOffset, ViewOffset, DiskEnd;
+    ULONG ViewLength;
+    KIRQL OldIrql;
     
     //
-    // Calculate final amount of bytes
+    // We only support boot disks for now
     //
-    PhysicalAddress.QuadPart = ActualPages.QuadPart << PAGE_SHIFT;
+    ASSERT(DeviceExtension->DiskType == RAMDISK_BOOT_DISK);
     
     //
-    // Calculate pages spanned for the mapping
+    // Nothing past the end of the disk can be mapped
     //
-    ActualLength = ADDRESS_AND_SIZE_TO_SPAN_PAGES(ActualOffset.QuadPart, Length);
+    if ((Offset.QuadPart < 0) ||
+        (Offset.QuadPart >= DeviceExtension->DiskLength.QuadPart)) return NULL;
     
     //
-    // And convert this back to bytes
+    // Calculate the actual offset in the drive, and the window holding it
     //
-    ActualLength <<= PAGE_SHIFT;
+    ActualOffset = DeviceExtension->DiskOffset + Offset.QuadPart;
+    DiskEnd = DeviceExtension->DiskOffset + DeviceExtension->DiskLength.QuadPart;
+    ViewOffset = ActualOffset - ActualOffset % DeviceExtension->ViewLength;
     
     //
-    // Get the offset within the page
+    // Use the window if it is already mapped
     //
-    PageOffset = BYTE_OFFSET(ActualOffset.QuadPart);
+    KeAcquireSpinLock(&DeviceExtension->ViewLock, &OldIrql);
+    View = RamdiskFindView(DeviceExtension, ViewOffset);
+    if (View)
+    {
+        View->ReferenceCount++;
+        RemoveEntryList(&View->ViewListEntry);
+        InsertHeadList(&DeviceExtension->ViewList, &View->ViewListEntry);
+    }
+    KeReleaseSpinLock(&DeviceExtension->ViewLock, OldIrql);
+    
+    if (!View)
+    {
+        //
+        // The last window ends with the disk
+        //
+        ViewLength = DeviceExtension->ViewLength;
+        if ((DiskEnd > ViewOffset) && (DiskEnd - ViewOffset < ViewLength))
+        {
+            ViewLength = (ULONG)ROUND_TO_PAGES(DiskEnd - ViewOffset);
+        }
+        
+        //
+        // Map the window from the loader, without holding the lock
+        //
+        NewView = ExAllocatePoolWithTag(NonPagedPool, sizeof(RAMDISK_VIEW), 'dmaR');
+        if (!NewView) return NULL;
+        
+        PhysicalAddress.QuadPart = ((LONGLONG)DeviceExtension->BasePage << PAGE_SHIFT) +
+                                   ViewOffset;
+        NewView->BaseAddress = MmMapIoSpace(PhysicalAddress, ViewLength, MmCached);
+        if (!NewView->BaseAddress)
+        {
+            ExFreePoolWithTag(NewView, 'dmaR');
+            return NULL;
+        }
+        NewView->Offset = ViewOffset;
+        NewView->Length = ViewLength;
+        NewView->ReferenceCount = 1;
+        
+        //
+        // Someone else may have mapped it meanwhile
+        //
+        KeAcquireSpinLock(&DeviceExtension->ViewLock, &OldIrql);
+        View = RamdiskFindView(DeviceExtension, ViewOffset);
+        if (View)
+        {
+            View->ReferenceCount++;
+            OldView = NewView;
+        }
+        else
+        {
+            View = NewView;
+            InsertHeadList(&DeviceExtension->ViewList, &View->ViewListEntry);
+            DeviceExtension->ViewCount++;
+            OldView = RamdiskTrimViews(DeviceExtension);
+        }
+        KeReleaseSpinLock(&DeviceExtension->ViewLock, OldIrql);
+        
+        //
+        // Unmap what we don't keep
+        //
+        if (OldView) RamdiskFreeView(OldView);
+    }
     
     //
-    // Map the I/O Space from the loader
+    // A window mapped shorter than the offset needs is of no use
     //
-    MappedBase = MmMapIoSpace(PhysicalAddress, ActualLength, MmCached);
+    if (ActualOffset - View->Offset >= View->Length)
+    {
+        OldView = NULL;
+        KeAcquireSpinLock(&DeviceExtension->ViewLock, &OldIrql);
+        if (!--View->ReferenceCount) OldView = RamdiskTrimViews(DeviceExtension);
+        KeReleaseSpinLock(&DeviceExtension->ViewLock, OldIrql);
+        
+        if (OldView) RamdiskFreeView(OldView);
+        return NULL;
+    }
     
     //
-    // Return actual offset within the page as well as the length
+    // Return the address within the window, and how much of the request it
+    // covers, which never goes past the end of the window or of the disk
     //
-    if (MappedBase) MappedBase = (PVOID)((ULONG_PTR)MappedBase + PageOffset);
-    *OutputLength = Length;
-    return MappedBase;
+    *OutputLength = (ULONG)min((LONGLONG)Length,
+                               min(View->Offset + View->Length, DiskEnd) - ActualOffset);
+    return (PVOID)((ULONG_PTR)View->BaseAddress + (ULONG_PTR)(ActualOffset - View->Offset));
 }
 
 VOID
@@ -356,9 +524,9 @@ RamdiskUnmapPages(IN PRAMDISK_DRIVE_EXTENSION DeviceExtension,
                   IN LARGE_INTEGER Offset,
                   IN ULONG Length)
 {
-    LARGE_INTEGER ActualOffset;
-    SIZE_T ActualLength;
-    ULONG PageOffset;
+    PRAMDISK_VIEW View, OldView = NULL;
+    LONGLONG ActualOffset;
+    KIRQL OldIrql;
     
     //
     // We only support boot disks for now
@@ -368,32 +536,21 @@ RamdiskUnmapPages(IN PRAMDISK_DRIVE_EXTENSION DeviceExtension,
     //
     // Calculate the actual offset in the drive
     //
-    ActualOffset.QuadPart = DeviceExtension->DiskOffset + Offset.QuadPart;
-    
-    //
-    // Calculate pages spanned for the mapping
-    //
-    ActualLength = ADDRESS_AND_SIZE_TO_SPAN_PAGES(ActualOffset.QuadPart, Length);
+    ActualOffset = DeviceExtension->DiskOffset + Offset.QuadPart;
     
     //
-    // And convert this back to bytes
+    // Drop our reference on the window, it stays mapped for the next request
+    // unless there are too many
     //
-    ActualLength <<= PAGE_SHIFT;
+    KeAcquireSpinLock(&DeviceExtension->ViewLock, &OldIrql);
+    View = RamdiskFindView(DeviceExtension,
+                           ActualOffset - ActualOffset % DeviceExtension->ViewLength);
+    ASSERT(View && View->ReferenceCount > 0);
+    ASSERT((ULONG_PTR)BaseAddress - (ULONG_PTR)View->BaseAddress + Length <= View->Length);
+    if (!--View->ReferenceCount) OldView = RamdiskTrimViews(DeviceExtension);
+    KeReleaseSpinLock(&DeviceExtension->ViewLock, OldIrql);
     
-    //
-    // Get the offset within the page
-    //
-    PageOffset = BYTE_OFFSET(ActualOffset.QuadPart);
-    
-    //
-    // Calculate actual base address where we mapped this
-    //
-    BaseAddress = (PVOID)((ULONG_PTR)BaseAddress - PageOffset);
-    
-    //
-    // Unmap the I/O space we got from the loader
-    //
-    MmUnmapIoSpace(BaseAddress, ActualLength);
+    if (OldView) RamdiskFreeView(OldView);
 }
 
 NTSTATUS
@@ -636,6 +793,7 @@ RamdiskCreateDiskDevice(IN PRAMDISK_BUS_EXTENSION DeviceExtension,
         DriveExtension->DiskLength = DiskLength;
         DriveExtension->DiskOffset = Input->DiskOffset;
         DriveExtension->BasePage = Input->BasePage;
+        RamdiskInitializeViews(DriveExtension);
         DriveExtension->BytesPerSector = 0;
         DriveExtension->SectorsPerTrack = 0;
         DriveExtension->NumberOfHeads = 0;
@@ -1314,12 +1472,31 @@ RamdiskReadWrite(IN PDEVICE_OBJECT DeviceObject,
     ByteOffset = IoStackLocation->Parameters.Read.ByteOffset;
     
     //
-    // FIXME: Validate offset
+    // Validate offset, the whole transfer has to lie within the disk
     //
+    if ((ByteOffset.QuadPart < 0) ||
+        (ByteOffset.QuadPart > DeviceExtension->DiskLength.QuadPart) ||
+        (Length > DeviceExtension->DiskLength.QuadPart - ByteOffset.QuadPart))
+    {
+        //
+        // Fail, this is beyond the disk
+        //
+        Status = STATUS_INVALID_PARAMETER;
+        goto Complete;
+    }
     
     //
-    // FIXME: Validate sector
+    // Validate sector, transfers are in whole sectors
     //
+    if ((ByteOffset.QuadPart % DeviceExtension->BytesPerSector) ||
+        (Length % DeviceExtension->BytesPerSector))
+    {
+        //
+        // Fail, this is not sector aligned
+        //
+        Status = STATUS_INVALID_PARAMETER;
+        goto Complete;
+    }
     
     //
     // Validate write
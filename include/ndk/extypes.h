@@ -298,6 +298,7 @@ typedef enum _SYSTEM_INFORMATION_CLASS
     SystemCoverageInformation,
     SystemPrefetchPathInformation,
     SystemVerifierFaultsInformation,
+    SystemDeviceIoStatisticsInformation,
     MaxSystemInfoClass,
 } SYSTEM_INFORMATION_CLASS;
 
@@ -1453,4 +1454,44 @@ typedef struct _SYSTEM_MEMORY_LIST_INFORMATION
 } SYSTEM_MEMORY_LIST_INFORMATION, *PSYSTEM_MEMORY_LIST_INFORMATION;
 
 #endif
+
+//
+// Class 98
+//
+#define SYSTEM_IO_STATISTICS_ENABLE         0x01
+#define SYSTEM_IO_STATISTICS_RESET          0x02
+
+#define SYSTEM_IO_MAJOR_FUNCTIONS           28
+#define SYSTEM_IO_LATENCY_BUCKETS           24
+
+//
+// Latencies are in microseconds. Bucket n of the histogram counts requests
+// that took less than 2^n microseconds, but not less than 2^(n-1); the last
+// bucket also counts all slower ones.
+//
+typedef struct _SYSTEM_IO_MAJOR_STATISTICS
+{
+    ULONG RequestCount;
+    LONG OutstandingCount;
+    LARGE_INTEGER TotalLatency;
+    ULONG MaximumLatency;
+    ULONG LatencyHistogram[SYSTEM_IO_LATENCY_BUCKETS];
+} SYSTEM_IO_MAJOR_STATISTICS, *PSYSTEM_IO_MAJOR_STATISTICS;
+
+typedef struct _SYSTEM_DEVICE_IO_STATISTICS
+{
+    PVOID DeviceObject;
+    ULONG DeviceType;
+    LONG OutstandingCount;
+    WCHAR DeviceName[64];
+    SYSTEM_IO_MAJOR_STATISTICS MajorFunction[SYSTEM_IO_MAJOR_FUNCTIONS];
+} SYSTEM_DEVICE_IO_STATISTICS, *PSYSTEM_DEVICE_IO_STATISTICS;
+
+typedef struct _SYSTEM_DEVICE_IO_STATISTICS_INFORMATION
+{
+    ULONG Flags;
+    ULONG NumberOfDevices;
+    SYSTEM_DEVICE_IO_STATISTICS Devices[1];
+} SYSTEM_DEVICE_IO_STATISTICS_INFORMATION, *PSYSTEM_DEVICE_IO_STATISTICS_INFORMATION;
+
 #endif
@@ -90,6 +90,15 @@
 #define AO_OPTION_UNBIND            37
 #define AO_OPTION_PROTECT           38
 
+/* Connection Object Options */
+#define TCP_SOCKET_NODELAY           1
+#define TCP_SOCKET_KEEPALIVE         2
+#define TCP_SOCKET_OOBINLINE         3
+#define TCP_SOCKET_BSDURGENT         4
+#define TCP_SOCKET_ATMARK            5
+#define TCP_SOCKET_WINDOW            6
+#define TCP_SOCKET_SEND_WINDOW       0x100 /* Odyssey extension */
+
 typedef struct IFEntry
 {
     ULONG if_index;
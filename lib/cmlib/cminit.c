@@ -82,6 +82,8 @@ CmpPrepareIndexOfKeys(
       for (i = 0; i < IndexCell->Count; i++)
       {
          PCM_KEY_INDEX SubIndexCell = HvGetCell(RegistryHive, IndexCell->List[i]);
+         if (SubIndexCell == NULL)
+            continue;
          if (SubIndexCell->Signature == CM_KEY_NODE_SIGNATURE)
             CmpPrepareKey(RegistryHive, (PCM_KEY_NODE)SubIndexCell);
          else
@@ -95,7 +97,8 @@ CmpPrepareIndexOfKeys(
       for (i = 0; i < HashCell->Count; i++)
       {
          PCM_KEY_NODE SubKeyCell = HvGetCell(RegistryHive, HashCell->List[i].Cell);
-         CmpPrepareKey(RegistryHive, SubKeyCell);
+         if (SubKeyCell != NULL)
+            CmpPrepareKey(RegistryHive, SubKeyCell);
       }
    }
    else
@@ -121,7 +124,8 @@ CmpPrepareKey(
    if (KeyCell->SubKeyCounts[Stable] > 0)
    {
       IndexCell = HvGetCell(RegistryHive, KeyCell->SubKeyLists[Stable]);
-      CmpPrepareIndexOfKeys(RegistryHive, IndexCell);
+      if (IndexCell != NULL)
+         CmpPrepareIndexOfKeys(RegistryHive, IndexCell);
    }
 }
 
@@ -132,5 +136,48 @@ CmPrepareHive(
    PCM_KEY_NODE RootCell;
 
    RootCell = HvGetCell(RegistryHive, RegistryHive->BaseBlock->RootCell);
-   CmpPrepareKey(RegistryHive, RootCell);
+   if (RootCell != NULL)
+      CmpPrepareKey(RegistryHive, RootCell);
+}
+
+/*
+ * Mapped hives are not walked from the root when they are loaded, so
+ * the stale volatile subkey lists are dropped bin by bin instead, as
+ * each one is read in. Key nodes are recognized by their signature and
+ * a name that fits the cell.
+ */
+VOID CMAPI
+CmPrepareBin(
+   PHHIVE RegistryHive,
+   PHBIN Bin)
+{
+   PHCELL Cell;
+   PCM_KEY_NODE KeyCell;
+   ULONG Offset;
+   ULONG CellSize;
+
+   UNREFERENCED_PARAMETER(RegistryHive);
+
+   for (Offset = sizeof(HBIN); Offset < Bin->Size; Offset += CellSize)
+   {
+      Cell = (PHCELL)((ULONG_PTR)Bin + Offset);
+      CellSize = (Cell->Size < 0) ? (ULONG)-Cell->Size : (ULONG)Cell->Size;
+      if (CellSize < sizeof(HCELL) || CellSize > Bin->Size - Offset)
+         break;
+
+      /* Only used cells can hold key nodes */
+      if (Cell->Size > 0 ||
+          CellSize < sizeof(HCELL) + FIELD_OFFSET(CM_KEY_NODE, Name))
+         continue;
+
+      KeyCell = (PCM_KEY_NODE)(Cell + 1);
+      if (KeyCell->Signature != CM_KEY_NODE_SIGNATURE ||
+          (KeyCell->Flags & KEY_HIVE_EXIT) ||
+          FIELD_OFFSET(CM_KEY_NODE, Name) + KeyCell->NameLength >
+             CellSize - sizeof(HCELL))
+         continue;
+
+      KeyCell->SubKeyLists[Volatile] = HCELL_NIL;
+      KeyCell->SubKeyCounts[Volatile] = 0;
+   }
 }
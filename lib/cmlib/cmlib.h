@@ -212,6 +212,20 @@ typedef struct _HV_TRACK_CELL_REF
     USHORT StaticCount;
 } HV_TRACK_CELL_REF, *PHV_TRACK_CELL_REF;
 
+//
+// Dirty blocks of a hive copied aside for writing. The buffer is laid
+// out like a log file, with the blocks packed behind the bitmap and a
+// copy of the base block at the very end.
+//
+typedef struct _HV_SYNC_CONTEXT
+{
+    PUCHAR Buffer;
+    SIZE_T BufferSize;
+    ULONG DataOffset;
+    RTL_BITMAP DirtyVector;
+    PHBASE_BLOCK BaseBlock;
+} HV_SYNC_CONTEXT, *PHV_SYNC_CONTEXT;
+
 extern ULONG CmlibTraceLevel;
 
 /*
@@ -296,6 +310,22 @@ BOOLEAN CMAPI
 HvSyncHive(
    PHHIVE RegistryHive);
 
+BOOLEAN CMAPI
+HvPrepareSync(
+   PHHIVE RegistryHive,
+   PHV_SYNC_CONTEXT Sync);
+
+BOOLEAN CMAPI
+HvWriteSync(
+   PHHIVE RegistryHive,
+   PHV_SYNC_CONTEXT Sync);
+
+VOID CMAPI
+HvCompleteSync(
+   PHHIVE RegistryHive,
+   PHV_SYNC_CONTEXT Sync,
+   BOOLEAN Success);
+
 BOOLEAN CMAPI
 HvWriteHive(
    PHHIVE RegistryHive);
@@ -309,6 +339,21 @@ VOID CMAPI
 CmPrepareHive(
    PHHIVE RegistryHive);
 
+VOID CMAPI
+CmPrepareBin(
+   PHHIVE RegistryHive,
+   PHBIN Bin);
+
+PHBIN CMAPI
+HvReadBin(
+   PHHIVE RegistryHive,
+   ULONG BlockIndex);
+
+VOID CMAPI
+HvMapBin(
+   PHHIVE RegistryHive,
+   PHBIN Bin);
+
 
 BOOLEAN
 CMAPI
@@ -334,6 +379,11 @@ HvpAddBin(
    ULONG Size,
    HSTORAGE_TYPE Storage);
 
+BOOLEAN CMAPI
+HvpMapBlock(
+   PHHIVE RegistryHive,
+   ULONG BlockIndex);
+
 NTSTATUS CMAPI
 HvpCreateHiveFreeCellList(
    PHHIVE Hive);
@@ -7,6 +7,37 @@
  */
 
 #include "cmlib.h"
+#define NDEBUG
+#include <debug.h>
+
+static __inline VOID CMAPI
+HvpAcquireViewLock(
+   PHHIVE RegistryHive)
+{
+   if (RegistryHive->AcquireViewLock)
+      RegistryHive->AcquireViewLock(RegistryHive);
+}
+
+static __inline VOID CMAPI
+HvpReleaseViewLock(
+   PHHIVE RegistryHive)
+{
+   if (RegistryHive->ReleaseViewLock)
+      RegistryHive->ReleaseViewLock(RegistryHive);
+}
+
+static BOOLEAN CMAPI
+HvpIsBlockResident(
+   PHHIVE RegistryHive,
+   ULONG BlockIndex)
+{
+   BOOLEAN Resident;
+
+   HvpAcquireViewLock(RegistryHive);
+   Resident = RegistryHive->Storage[Stable].BlockList[BlockIndex].BlockAddress != 0;
+   HvpReleaseViewLock(RegistryHive);
+   return Resident;
+}
 
 PHBIN CMAPI
 HvpAddBin(
@@ -14,7 +45,7 @@ HvpAddBin(
    ULONG Size,
    HSTORAGE_TYPE Storage)
 {
-   PHMAP_ENTRY BlockList;
+   PHMAP_ENTRY BlockList, OldBlockList;
    PHBIN Bin;
    SIZE_T BinSize;
    ULONG i;
@@ -48,23 +79,31 @@ HvpAddBin(
       return NULL;
    }
 
+   /* Readers may be mapping bins into the old list, so swap it under the view lock */
+   HvpAcquireViewLock(RegistryHive);
+
+   OldBlockList = RegistryHive->Storage[Storage].BlockList;
    if (OldBlockListSize > 0)
    {
-      RtlCopyMemory(BlockList, RegistryHive->Storage[Storage].BlockList,
+      RtlCopyMemory(BlockList, OldBlockList,
                     OldBlockListSize * sizeof(HMAP_ENTRY));
-      RegistryHive->Free(RegistryHive->Storage[Storage].BlockList, 0);
    }
 
-   RegistryHive->Storage[Storage].BlockList = BlockList;
-   RegistryHive->Storage[Storage].Length += BlockCount;
-
    for (i = 0; i < BlockCount; i++)
    {
-      RegistryHive->Storage[Storage].BlockList[OldBlockListSize + i].BlockAddress =
+      BlockList[OldBlockListSize + i].BlockAddress =
          ((ULONG_PTR)Bin + (i * HV_BLOCK_SIZE));
-      RegistryHive->Storage[Storage].BlockList[OldBlockListSize + i].BinAddress = (ULONG_PTR)Bin;
+      BlockList[OldBlockListSize + i].BinAddress = (ULONG_PTR)Bin;
    }
 
+   RegistryHive->Storage[Storage].BlockList = BlockList;
+   RegistryHive->Storage[Storage].Length += BlockCount;
+
+   HvpReleaseViewLock(RegistryHive);
+
+   if (OldBlockListSize > 0)
+      RegistryHive->Free(OldBlockList, 0);
+
    /* Initialize a free block in this heap. */
    Block = (PHCELL)(Bin + 1);
    Block->Size = (LONG)(BinSize - sizeof(HBIN));
@@ -98,7 +137,146 @@ HvpAddBin(
       RtlSetBits(&RegistryHive->DirtyVector,
                  Bin->FileOffset / HV_BLOCK_SIZE,
                  BlockCount);
+      RegistryHive->DirtyCount += BlockCount;
    }
 
    return Bin;
 }
+
+/**
+ * @name HvReadBin
+ *
+ * Reads the bin holding a block of a mapped hive in from the primary
+ * file. The bin is not visible to anyone until it is passed to HvMapBin,
+ * so several readers may do this for the same block at once.
+ */
+
+PHBIN CMAPI
+HvReadBin(
+   PHHIVE RegistryHive,
+   ULONG BlockIndex)
+{
+   PHBIN Header, Bin = NULL;
+   ULONG BinIndex;
+   ULONG FileOffset;
+
+   ASSERT(BlockIndex < RegistryHive->Storage[Stable].Length);
+
+   /* The file may be unbuffered, so read whole blocks */
+   Header = RegistryHive->Allocate(HV_BLOCK_SIZE, TRUE, TAG_CM);
+   if (Header == NULL)
+      return NULL;
+
+   /* Walk back to the header of the bin this block belongs to */
+   for (BinIndex = BlockIndex; ; BinIndex--)
+   {
+      /* Running into a resident bin means the file is corrupt */
+      if (BinIndex != BlockIndex && HvpIsBlockResident(RegistryHive, BinIndex))
+         break;
+
+      FileOffset = (BinIndex + 1) * HV_BLOCK_SIZE;
+      if (!RegistryHive->FileRead(RegistryHive, HFILE_TYPE_PRIMARY,
+                                  &FileOffset, Header, HV_BLOCK_SIZE))
+         break;
+
+      /* A bin header records its own offset, cell data will not */
+      if (Header->Signature == HV_BIN_SIGNATURE &&
+          Header->FileOffset == BinIndex * HV_BLOCK_SIZE)
+      {
+         if (Header->Size == 0 ||
+             (Header->Size % HV_BLOCK_SIZE) != 0 ||
+             BinIndex + Header->Size / HV_BLOCK_SIZE <= BlockIndex ||
+             BinIndex + Header->Size / HV_BLOCK_SIZE >
+                RegistryHive->Storage[Stable].Length)
+            break;
+
+         Bin = RegistryHive->Allocate(Header->Size, TRUE, TAG_CM);
+         if (Bin == NULL)
+            break;
+
+         /* Read the rest of the bin behind its first block */
+         RtlCopyMemory(Bin, Header, HV_BLOCK_SIZE);
+         FileOffset = (BinIndex + 2) * HV_BLOCK_SIZE;
+         if (Header->Size > HV_BLOCK_SIZE &&
+             !RegistryHive->FileRead(RegistryHive, HFILE_TYPE_PRIMARY,
+                                     &FileOffset,
+                                     (PVOID)((ULONG_PTR)Bin + HV_BLOCK_SIZE),
+                                     Header->Size - HV_BLOCK_SIZE))
+         {
+            RegistryHive->Free(Bin, 0);
+            Bin = NULL;
+            break;
+         }
+
+         /* Its free cells are listed once the allocator needs them */
+         Bin->Spare = HV_BIN_UNLISTED;
+         CmPrepareBin(RegistryHive, Bin);
+         break;
+      }
+
+      if (BinIndex == 0)
+         break;
+   }
+
+   if (Bin == NULL)
+      DPRINT1("Failed to read block %lu of hive %p\n", BlockIndex, RegistryHive);
+
+   RegistryHive->Free(Header, 0);
+   return Bin;
+}
+
+/**
+ * @name HvMapBin
+ *
+ * Makes a bin read by HvReadBin visible in the block map of its hive.
+ * If another reader got there first, the copy is dropped again.
+ */
+
+VOID CMAPI
+HvMapBin(
+   PHHIVE RegistryHive,
+   PHBIN Bin)
+{
+   PHMAP_ENTRY BlockList;
+   ULONG BinIndex = Bin->FileOffset / HV_BLOCK_SIZE;
+   ULONG i;
+
+   /* The block list may have been grown while the bin was read */
+   HvpAcquireViewLock(RegistryHive);
+   BlockList = RegistryHive->Storage[Stable].BlockList;
+
+   if (BlockList[BinIndex].BlockAddress)
+   {
+      HvpReleaseViewLock(RegistryHive);
+      RegistryHive->Free(Bin, 0);
+      return;
+   }
+
+   for (i = 0; i < Bin->Size / HV_BLOCK_SIZE; i++)
+   {
+      BlockList[BinIndex + i].BinAddress = (ULONG_PTR)Bin;
+      BlockList[BinIndex + i].BlockAddress =
+         (ULONG_PTR)Bin + (i * HV_BLOCK_SIZE);
+   }
+
+   HvpReleaseViewLock(RegistryHive);
+}
+
+BOOLEAN CMAPI
+HvpMapBlock(
+   PHHIVE RegistryHive,
+   ULONG BlockIndex)
+{
+   PHBIN Bin;
+
+   if (HvpIsBlockResident(RegistryHive, BlockIndex))
+      return TRUE;
+
+   /* Read without the view lock, the read may need to wait for I/O */
+   Bin = HvReadBin(RegistryHive, BlockIndex);
+   if (Bin == NULL)
+      return FALSE;
+
+   HvMapBin(RegistryHive, Bin);
+   return TRUE;
+}
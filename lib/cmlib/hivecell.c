@@ -31,7 +31,13 @@ HvpGetCellHeader(
       CellOffset = (CellIndex & HCELL_OFFSET_MASK) >> HCELL_OFFSET_SHIFT;
       ASSERT(CellBlock < RegistryHive->Storage[CellType].Length);
       Block = (PVOID)RegistryHive->Storage[CellType].BlockList[CellBlock].BlockAddress;
-      ASSERT(Block != NULL);
+      if (Block == NULL)
+      {
+         /* Mapped hives read their stable bins in on first access */
+         if (CellType != Stable || !HvpMapBlock(RegistryHive, CellBlock))
+            return NULL;
+         Block = (PVOID)RegistryHive->Storage[CellType].BlockList[CellBlock].BlockAddress;
+      }
       return (PVOID)((ULONG_PTR)Block + CellOffset);
    }
    else
@@ -62,6 +68,10 @@ HvIsCellAllocated(IN PHHIVE RegistryHive,
    if (RegistryHive->Storage[Type].BlockList[Block].BlockAddress)
       return TRUE;
 
+   /* It may just not have been read in yet */
+   if (Type == Stable)
+      return HvpMapBlock(RegistryHive, Block);
+
    /* No valid block, fail */
    return FALSE;
 }
@@ -71,7 +81,13 @@ HvGetCell(
    PHHIVE RegistryHive,
    HCELL_INDEX CellIndex)
 {
-   return (PVOID)(HvpGetCellHeader(RegistryHive, CellIndex) + 1);
+   PHCELL Cell;
+
+   Cell = HvpGetCellHeader(RegistryHive, CellIndex);
+   if (Cell == NULL)
+      return NULL;
+
+   return (PVOID)(Cell + 1);
 }
 
 static __inline LONG CMAPI
@@ -104,6 +120,8 @@ HvMarkCellDirty(
    HCELL_INDEX CellIndex,
    BOOLEAN HoldingLock)
 {
+   PHCELL Cell;
+   LONG CellSize;
    ULONG CellBlock;
    ULONG CellLastBlock;
 
@@ -115,11 +133,25 @@ HvMarkCellDirty(
    if ((CellIndex & HCELL_TYPE_MASK) >> HCELL_TYPE_SHIFT != Stable)
       return TRUE;
 
+   /* A cell may span several blocks, all of them have to be written */
+   Cell = HvpGetCellHeader(RegistryHive, CellIndex);
+   if (Cell == NULL)
+      return FALSE;
+
+   CellSize = (Cell->Size < 0) ? -Cell->Size : Cell->Size;
+   if (CellSize < (LONG)sizeof(HCELL))
+      CellSize = sizeof(HCELL);
    CellBlock = (CellIndex & HCELL_BLOCK_MASK) >> HCELL_BLOCK_SHIFT;
-   CellLastBlock = ((CellIndex + HV_BLOCK_SIZE - 1) & HCELL_BLOCK_MASK) >> HCELL_BLOCK_SHIFT;
+   CellLastBlock = ((CellIndex + CellSize - 1) & HCELL_BLOCK_MASK) >> HCELL_BLOCK_SHIFT;
 
-   RtlSetBits(&RegistryHive->DirtyVector,
-              CellBlock, CellLastBlock - CellBlock);
+   for (; CellBlock <= CellLastBlock; CellBlock++)
+   {
+      if (!RtlCheckBit(&RegistryHive->DirtyVector, CellBlock))
+      {
+         RtlSetBits(&RegistryHive->DirtyVector, CellBlock, 1);
+         RegistryHive->DirtyCount++;
+      }
+   }
    return TRUE;
 }
 
@@ -144,39 +176,89 @@ HvIsCellDirty(IN PHHIVE Hive,
    return IsDirty;
 }
 
+/*
+ * Free cells are kept on doubly linked lists threaded through their data.
+ * They also repeat their size in their last ULONG, so that HvFreeCell can
+ * find a free predecessor without walking the bin. Cells too small to hold
+ * this (only found in foreign hives) are simply left off the lists.
+ */
+typedef struct _HFREE_CELL
+{
+   HCELL Header;
+   HCELL_INDEX Next;
+   HCELL_INDEX Prev;
+} HFREE_CELL, *PHFREE_CELL;
+
+#define HFREE_CELL_MIN_SIZE   (sizeof(HFREE_CELL) + sizeof(ULONG))
+
+#define HvpGetFreeCellTag(Cell) \
+   ((PULONG)((ULONG_PTR)(Cell) + (Cell)->Size - sizeof(ULONG)))
+
 static __inline ULONG CMAPI
 HvpComputeFreeListIndex(
    ULONG Size)
 {
    ULONG Index;
-   static CCHAR FindFirstSet[256] = {
-      0, 0, 1, 1, 2, 2, 2, 2, 3, 3, 3, 3, 3, 3, 3, 3,
-      4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4,
-      5, 5, 5, 5, 5, 5, 5, 5, 5, 5, 5, 5, 5, 5, 5, 5,
-      5, 5, 5, 5, 5, 5, 5, 5, 5, 5, 5, 5, 5, 5, 5, 5,
-      6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6,
-      6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6,
-      6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6,
-      6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6,
-      7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7,
-      7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7,
-      7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7,
-      7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7,
-      7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7,
-      7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7,
-      7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7,
-      7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7};
-
-   Index = (Size >> 3) - 1;
-   if (Index >= 16)
+   ULONG Shift;
+
+   /* Small sizes get one exact-fit list per 8 byte size class */
+   if (Size <= HFREE_EXACT_LIMIT)
+      return (Size >> 3) - 1;
+
+   /* Larger sizes get HFREE_RANGE_SPLIT lists per power of two */
+   for (Shift = 0; (Size >> Shift) >= HFREE_EXACT_LIMIT * 2; Shift++);
+   Index = HFREE_EXACT_COUNT + Shift * HFREE_RANGE_SPLIT;
+   Index += (Size >> (Shift + HFREE_EXACT_SHIFT - HFREE_RANGE_SHIFT)) &
+            (HFREE_RANGE_SPLIT - 1);
+
+   ASSERT(Index < HFREE_DISPLAY_SIZE);
+   return Index;
+}
+
+static __inline VOID CMAPI
+HvpSetFreeSummary(
+   PDUAL Dual,
+   ULONG Index)
+{
+   Dual->FreeSummary[Index / 32] |= (ULONG)1 << (Index % 32);
+}
+
+static __inline VOID CMAPI
+HvpClearFreeSummary(
+   PDUAL Dual,
+   ULONG Index)
+{
+   Dual->FreeSummary[Index / 32] &= ~((ULONG)1 << (Index % 32));
+}
+
+static ULONG CMAPI
+HvpFindFreeList(
+   PDUAL Dual,
+   ULONG Index)
+{
+   ULONG Summary;
+   ULONG Word;
+
+   /* Scan the summary bitmap for the first non-empty list at or past Index */
+   for (Word = Index / 32; Word < HFREE_SUMMARY_SIZE; Word++)
    {
-      if (Index > 255)
-         Index = 23;
-      else
-         Index = FindFirstSet[Index] + 7;
+      Summary = Dual->FreeSummary[Word];
+      if (Word == Index / 32)
+         Summary &= ~(((ULONG)1 << (Index % 32)) - 1);
+
+      if (Summary)
+      {
+         Index = Word * 32;
+         while (!(Summary & 1))
+         {
+            Summary >>= 1;
+            Index++;
+         }
+         return Index;
+      }
    }
 
-   return Index;
+   return HFREE_DISPLAY_SIZE;
 }
 
 static NTSTATUS CMAPI
@@ -185,21 +267,34 @@ HvpAddFree(
    PHCELL FreeBlock,
    HCELL_INDEX FreeIndex)
 {
-   PHCELL_INDEX FreeBlockData;
-   HSTORAGE_TYPE Storage;
+   PHFREE_CELL FreeCell = (PHFREE_CELL)FreeBlock;
+   PHFREE_CELL NextCell;
+   PDUAL Dual;
    ULONG Index;
 
    ASSERT(RegistryHive != NULL);
    ASSERT(FreeBlock != NULL);
 
-   Storage = (FreeIndex & HCELL_TYPE_MASK) >> HCELL_TYPE_SHIFT;
+   /* Too small to be tracked, it will be reclaimed by coalescing */
+   if ((ULONG)FreeBlock->Size < HFREE_CELL_MIN_SIZE)
+      return STATUS_SUCCESS;
+
+   Dual = &RegistryHive->Storage[HvGetCellType(FreeIndex)];
    Index = HvpComputeFreeListIndex((ULONG)FreeBlock->Size);
 
-   FreeBlockData = (PHCELL_INDEX)(FreeBlock + 1);
-   *FreeBlockData = RegistryHive->Storage[Storage].FreeDisplay[Index];
-   RegistryHive->Storage[Storage].FreeDisplay[Index] = FreeIndex;
+   /* Push it on the head of its list */
+   FreeCell->Next = Dual->FreeDisplay[Index];
+   FreeCell->Prev = HCELL_NIL;
+   if (FreeCell->Next != HCELL_NIL)
+   {
+      NextCell = (PHFREE_CELL)HvpGetCellHeader(RegistryHive, FreeCell->Next);
+      NextCell->Prev = FreeIndex;
+   }
+   Dual->FreeDisplay[Index] = FreeIndex;
+   HvpSetFreeSummary(Dual, Index);
 
-   /* FIXME: Eventually get rid of free bins. */
+   /* Tag the end of the cell with its size */
+   *HvpGetFreeCellTag(FreeBlock) = (ULONG)FreeBlock->Size;
 
    return STATUS_SUCCESS;
 }
@@ -210,47 +305,79 @@ HvpRemoveFree(
    PHCELL CellBlock,
    HCELL_INDEX CellIndex)
 {
-   PHCELL_INDEX FreeCellData;
-   PHCELL_INDEX pFreeCellOffset;
-   HSTORAGE_TYPE Storage;
-   ULONG Index, FreeListIndex;
+   PHFREE_CELL FreeCell = (PHFREE_CELL)CellBlock;
+   PHFREE_CELL LinkCell;
+   PDUAL Dual;
+   ULONG Index;
 
    ASSERT(RegistryHive->ReadOnly == FALSE);
 
-   Storage = (CellIndex & HCELL_TYPE_MASK) >> HCELL_TYPE_SHIFT;
+   /* Untracked cells are not on any list */
+   if ((ULONG)CellBlock->Size < HFREE_CELL_MIN_SIZE)
+      return;
+
+   Dual = &RegistryHive->Storage[HvGetCellType(CellIndex)];
    Index = HvpComputeFreeListIndex((ULONG)CellBlock->Size);
 
-   pFreeCellOffset = &RegistryHive->Storage[Storage].FreeDisplay[Index];
-   while (*pFreeCellOffset != HCELL_NIL)
+   CMLTRACE(CMLIB_HCELL_DEBUG, "%s - Hive %p, CellIndex %08lx, list %d\n",
+       __FUNCTION__, RegistryHive, CellIndex, Index);
+
+   /* Unlink it from its neighbours */
+   if (FreeCell->Prev == HCELL_NIL)
    {
-      FreeCellData = (PHCELL_INDEX)HvGetCell(RegistryHive, *pFreeCellOffset);
-      if (*pFreeCellOffset == CellIndex)
-      {
-         *pFreeCellOffset = *FreeCellData;
-         return;
-      }
-      pFreeCellOffset = FreeCellData;
+      ASSERT(Dual->FreeDisplay[Index] == CellIndex);
+      Dual->FreeDisplay[Index] = FreeCell->Next;
+      if (FreeCell->Next == HCELL_NIL)
+         HvpClearFreeSummary(Dual, Index);
+   }
+   else
+   {
+      LinkCell = (PHFREE_CELL)HvpGetCellHeader(RegistryHive, FreeCell->Prev);
+      ASSERT(LinkCell->Next == CellIndex);
+      LinkCell->Next = FreeCell->Next;
    }
 
-   /* Something bad happened, print a useful trace info and bugcheck */
-   CMLTRACE(CMLIB_HCELL_DEBUG, "-- beginning of HvpRemoveFree trace --\n");
-   CMLTRACE(CMLIB_HCELL_DEBUG, "block we are about to free: %08x\n", CellIndex);
-   CMLTRACE(CMLIB_HCELL_DEBUG, "chosen free list index: %d\n", Index);
-   for (FreeListIndex = 0; FreeListIndex < 24; FreeListIndex++)
+   if (FreeCell->Next != HCELL_NIL)
    {
-      CMLTRACE(CMLIB_HCELL_DEBUG, "free list [%d]: ", FreeListIndex);
-      pFreeCellOffset = &RegistryHive->Storage[Storage].FreeDisplay[FreeListIndex];
-      while (*pFreeCellOffset != HCELL_NIL)
-      {
-         CMLTRACE(CMLIB_HCELL_DEBUG, "%08x ", *pFreeCellOffset);
-         FreeCellData = (PHCELL_INDEX)HvGetCell(RegistryHive, *pFreeCellOffset);
-         pFreeCellOffset = FreeCellData;
-      }
-      CMLTRACE(CMLIB_HCELL_DEBUG, "\n");
+      LinkCell = (PHFREE_CELL)HvpGetCellHeader(RegistryHive, FreeCell->Next);
+      ASSERT(LinkCell->Prev == CellIndex);
+      LinkCell->Prev = FreeCell->Prev;
    }
-   CMLTRACE(CMLIB_HCELL_DEBUG, "-- end of HvpRemoveFree trace --\n");
+}
+
+static BOOLEAN CMAPI
+HvpIsFreeCellLinked(
+   PHHIVE RegistryHive,
+   PHCELL CellBlock,
+   HCELL_INDEX CellIndex)
+{
+   PHFREE_CELL FreeCell = (PHFREE_CELL)CellBlock;
+   PHFREE_CELL PrevCell;
+   PDUAL Dual;
+   ULONG Type;
+
+   /* Only tracked free cells can be linked */
+   if ((CellBlock->Size <= 0) ||
+       ((ULONG)CellBlock->Size < HFREE_CELL_MIN_SIZE))
+      return FALSE;
+
+   Type = HvGetCellType(CellIndex);
+   Dual = &RegistryHive->Storage[Type];
 
-   ASSERT(FALSE);
+   /* The head of a list is linked if the display points at it */
+   if (FreeCell->Prev == HCELL_NIL)
+      return (Dual->FreeDisplay[HvpComputeFreeListIndex((ULONG)CellBlock->Size)] ==
+              CellIndex) ? TRUE : FALSE;
+
+   /* Otherwise its predecessor has to be a real cell pointing back at it */
+   if ((HvGetCellType(FreeCell->Prev) != Type) ||
+       (HvGetCellBlock(FreeCell->Prev) >= Dual->Length) ||
+       ((FreeCell->Prev & HCELL_OFFSET_MASK) > HV_BLOCK_SIZE - sizeof(HFREE_CELL)))
+      return FALSE;
+
+   PrevCell = (PHFREE_CELL)HvpGetCellHeader(RegistryHive, FreeCell->Prev);
+   return ((PrevCell->Header.Size > 0) &&
+           (PrevCell->Next == CellIndex)) ? TRUE : FALSE;
 }
 
 static HCELL_INDEX CMAPI
@@ -259,76 +386,143 @@ HvpFindFree(
    ULONG Size,
    HSTORAGE_TYPE Storage)
 {
-   PHCELL_INDEX FreeCellData;
+   PDUAL Dual = &RegistryHive->Storage[Storage];
+   PHCELL FreeCell;
    HCELL_INDEX FreeCellOffset;
-   PHCELL_INDEX pFreeCellOffset;
-   ULONG Index;
+   ULONG Index, SizeIndex;
 
-   for (Index = HvpComputeFreeListIndex(Size); Index < 24; Index++)
+   /* Exact-fit lists hold nothing but cells of the requested size */
+   SizeIndex = HvpComputeFreeListIndex(Size);
+   if (SizeIndex >= HFREE_EXACT_COUNT)
    {
-      pFreeCellOffset = &RegistryHive->Storage[Storage].FreeDisplay[Index];
-      while (*pFreeCellOffset != HCELL_NIL)
+      /* A range list may still hold a fit, look for it first */
+      FreeCellOffset = Dual->FreeDisplay[SizeIndex];
+      while (FreeCellOffset != HCELL_NIL)
       {
-         FreeCellData = (PHCELL_INDEX)HvGetCell(RegistryHive, *pFreeCellOffset);
-         if ((ULONG)HvpGetCellFullSize(RegistryHive, FreeCellData) >= Size)
+         FreeCell = HvpGetCellHeader(RegistryHive, FreeCellOffset);
+         if ((ULONG)FreeCell->Size >= Size)
          {
-            FreeCellOffset = *pFreeCellOffset;
-            *pFreeCellOffset = *FreeCellData;
+            HvpRemoveFree(RegistryHive, FreeCell, FreeCellOffset);
             return FreeCellOffset;
          }
-         pFreeCellOffset = FreeCellData;
+         FreeCellOffset = ((PHFREE_CELL)FreeCell)->Next;
       }
+
+      /* Anything on the following lists is big enough */
+      SizeIndex++;
+   }
+
+   /* Take the smallest cell that is known to fit */
+   Index = HvpFindFreeList(Dual, SizeIndex);
+   if (Index < HFREE_DISPLAY_SIZE)
+   {
+      FreeCellOffset = Dual->FreeDisplay[Index];
+      FreeCell = HvpGetCellHeader(RegistryHive, FreeCellOffset);
+      ASSERT((ULONG)FreeCell->Size >= Size);
+      HvpRemoveFree(RegistryHive, FreeCell, FreeCellOffset);
+      return FreeCellOffset;
    }
 
    return HCELL_NIL;
 }
 
+static NTSTATUS CMAPI
+HvpEnlistBin(
+   PHHIVE Hive,
+   PHBIN Bin)
+{
+   PHCELL FreeBlock;
+   ULONG FreeOffset;
+   NTSTATUS Status;
+
+   /* Search free blocks and add to list */
+   FreeOffset = sizeof(HBIN);
+   while (FreeOffset < Bin->Size)
+   {
+      FreeBlock = (PHCELL)((ULONG_PTR)Bin + FreeOffset);
+      if (FreeBlock->Size > 0)
+      {
+         Status = HvpAddFree(Hive, FreeBlock, Bin->FileOffset + FreeOffset);
+         if (!NT_SUCCESS(Status))
+            return Status;
+
+         FreeOffset += FreeBlock->Size;
+      }
+      else
+      {
+         FreeOffset -= FreeBlock->Size;
+      }
+   }
+
+   Bin->Spare &= ~HV_BIN_UNLISTED;
+   return STATUS_SUCCESS;
+}
+
+static BOOLEAN CMAPI
+HvpEnlistNextBin(
+   PHHIVE Hive)
+{
+   PHBIN Bin;
+
+   /*
+    * Read in and enlist the next bin a mapped hive has not listed yet.
+    * The scan resumes where the last one stopped, so every bin is visited
+    * once over the life of the hive rather than on each allocation.
+    */
+   while (Hive->EnlistBlock < Hive->Storage[Stable].Length)
+   {
+      if (!HvpMapBlock(Hive, Hive->EnlistBlock))
+         return FALSE;
+
+      Bin = (PHBIN)Hive->Storage[Stable].BlockList[Hive->EnlistBlock].BinAddress;
+      Hive->EnlistBlock += Bin->Size / HV_BLOCK_SIZE;
+
+      if (Bin->Spare & HV_BIN_UNLISTED)
+      {
+         HvpEnlistBin(Hive, Bin);
+         return TRUE;
+      }
+   }
+
+   return FALSE;
+}
+
 NTSTATUS CMAPI
 HvpCreateHiveFreeCellList(
    PHHIVE Hive)
 {
-   HCELL_INDEX BlockOffset;
-   PHCELL FreeBlock;
    ULONG BlockIndex;
-   ULONG FreeOffset;
    PHBIN Bin;
    NTSTATUS Status;
    ULONG Index;
 
    /* Initialize the free cell list */
-   for (Index = 0; Index < 24; Index++)
+   for (Index = 0; Index < HFREE_DISPLAY_SIZE; Index++)
    {
       Hive->Storage[Stable].FreeDisplay[Index] = HCELL_NIL;
       Hive->Storage[Volatile].FreeDisplay[Index] = HCELL_NIL;
    }
+   for (Index = 0; Index < HFREE_SUMMARY_SIZE; Index++)
+   {
+      Hive->Storage[Stable].FreeSummary[Index] = 0;
+      Hive->Storage[Volatile].FreeSummary[Index] = 0;
+   }
+
+   /* Mapped hives enlist their bins as they are read in and used */
+   if (Hive->Storage[Stable].Length &&
+       !Hive->Storage[Stable].BlockList[0].BlockAddress)
+      return STATUS_SUCCESS;
 
-   BlockOffset = 0;
    BlockIndex = 0;
    while (BlockIndex < Hive->Storage[Stable].Length)
    {
       Bin = (PHBIN)Hive->Storage[Stable].BlockList[BlockIndex].BinAddress;
 
-      /* Search free blocks and add to list */
-      FreeOffset = sizeof(HBIN);
-      while (FreeOffset < Bin->Size)
-      {
-         FreeBlock = (PHCELL)((ULONG_PTR)Bin + FreeOffset);
-         if (FreeBlock->Size > 0)
-         {
-            Status = HvpAddFree(Hive, FreeBlock, Bin->FileOffset + FreeOffset);
-            if (!NT_SUCCESS(Status))
-               return Status;
-
-            FreeOffset += FreeBlock->Size;
-         }
-         else
-         {
-            FreeOffset -= FreeBlock->Size;
-         }
-      }
+      Status = HvpEnlistBin(Hive, Bin);
+      if (!NT_SUCCESS(Status))
+         return Status;
 
       BlockIndex += Bin->Size / HV_BLOCK_SIZE;
-      BlockOffset += Bin->Size;
    }
 
    return STATUS_SUCCESS;
@@ -357,6 +551,13 @@ HvAllocateCell(
    /* First search in free blocks. */
    FreeCellOffset = HvpFindFree(RegistryHive, Size, Storage);
 
+   /* Bins of a mapped hive may still hold unlisted free cells */
+   while (FreeCellOffset == HCELL_NIL && Storage == Stable &&
+          HvpEnlistNextBin(RegistryHive))
+   {
+      FreeCellOffset = HvpFindFree(RegistryHive, Size, Storage);
+   }
+
    /* If no free cell was found we need to extend the hive file. */
    if (FreeCellOffset == HCELL_NIL)
    {
@@ -417,6 +618,9 @@ HvReallocateCell(
    Storage = (CellIndex & HCELL_TYPE_MASK) >> HCELL_TYPE_SHIFT;
 
    OldCell = HvGetCell(RegistryHive, CellIndex);
+   if (OldCell == NULL)
+      return HCELL_NIL;
+
    OldCellSize = HvGetCellSize(RegistryHive, OldCell);
    ASSERT(OldCellSize > 0);
 
@@ -433,7 +637,9 @@ HvReallocateCell(
       if (NewCellIndex == HCELL_NIL)
          return HCELL_NIL;
 
+      /* Freshly allocated cells are always resident */
       NewCell = HvGetCell(RegistryHive, NewCellIndex);
+      ASSERT(NewCell != NULL);
       RtlCopyMemory(NewCell, OldCell, (SIZE_T)OldCellSize);
 
       HvFreeCell(RegistryHive, CellIndex);
@@ -454,6 +660,8 @@ HvFreeCell(
    PHBIN Bin;
    ULONG CellType;
    ULONG CellBlock;
+   ULONG NeighborSize;
+   HCELL_INDEX NeighborCellIndex;
 
    ASSERT(RegistryHive->ReadOnly == FALSE);
 
@@ -461,61 +669,62 @@ HvFreeCell(
        __FUNCTION__, RegistryHive, CellIndex);
 
    Free = HvpGetCellHeader(RegistryHive, CellIndex);
+   if (Free == NULL)
+      return;
 
    ASSERT(Free->Size < 0);
 
-   Free->Size = -Free->Size;
-
    CellType = (CellIndex & HCELL_TYPE_MASK) >> HCELL_TYPE_SHIFT;
    CellBlock = (CellIndex & HCELL_BLOCK_MASK) >> HCELL_BLOCK_SHIFT;
 
-   /* FIXME: Merge free blocks */
+   /* Coalescing never crosses the bin this cell lives in */
    Bin = (PHBIN)RegistryHive->Storage[CellType].BlockList[CellBlock].BinAddress;
 
+   /* Its free neighbours have to be listed before they can be merged */
+   if (Bin->Spare & HV_BIN_UNLISTED)
+      HvpEnlistBin(RegistryHive, Bin);
+
+   Free->Size = -Free->Size;
+
+   /* Absorb the following cell if it is free */
    if ((CellIndex & ~HCELL_TYPE_MASK) + Free->Size <
        Bin->FileOffset + Bin->Size)
    {
       Neighbor = (PHCELL)((ULONG_PTR)Free + Free->Size);
       if (Neighbor->Size > 0)
       {
-         HvpRemoveFree(RegistryHive, Neighbor,
-                       ((HCELL_INDEX)((ULONG_PTR)Neighbor - (ULONG_PTR)Bin +
-                       Bin->FileOffset)) | (CellIndex & HCELL_TYPE_MASK));
+         HvpRemoveFree(RegistryHive, Neighbor, CellIndex + Free->Size);
          Free->Size += Neighbor->Size;
       }
    }
 
-   Neighbor = (PHCELL)(Bin + 1);
-   while (Neighbor < Free)
+   /*
+    * Find a free preceding cell through the size tag it keeps in its last
+    * ULONG. Those bytes are just data if that cell is in use, so only trust
+    * them if they lead to a cell that really is on a free list.
+    */
+   if ((ULONG_PTR)Free > (ULONG_PTR)(Bin + 1))
    {
-      if (Neighbor->Size > 0)
+      NeighborSize = *((PULONG)Free - 1);
+      if ((NeighborSize >= HFREE_CELL_MIN_SIZE) &&
+          !(NeighborSize & 7) &&
+          (NeighborSize <= (ULONG_PTR)Free - (ULONG_PTR)(Bin + 1)))
       {
-         if ((ULONG_PTR)Neighbor + Neighbor->Size == (ULONG_PTR)Free)
+         Neighbor = (PHCELL)((ULONG_PTR)Free - NeighborSize);
+         NeighborCellIndex = CellIndex - NeighborSize;
+
+         if (((ULONG)Neighbor->Size == NeighborSize) &&
+             (HvpIsFreeCellLinked(RegistryHive, Neighbor, NeighborCellIndex)))
          {
-            HCELL_INDEX NeighborCellIndex =
-               (HCELL_INDEX)((ULONG_PTR)Neighbor - (ULONG_PTR)Bin +
-               Bin->FileOffset) | (CellIndex & HCELL_TYPE_MASK);
-
-            if (HvpComputeFreeListIndex(Neighbor->Size) !=
-                HvpComputeFreeListIndex(Neighbor->Size + Free->Size))
-            {
-               HvpRemoveFree(RegistryHive, Neighbor, NeighborCellIndex);
-               Neighbor->Size += Free->Size;
-               HvpAddFree(RegistryHive, Neighbor, NeighborCellIndex);
-            }
-            else
-               Neighbor->Size += Free->Size;
+            HvpRemoveFree(RegistryHive, Neighbor, NeighborCellIndex);
+            Neighbor->Size += Free->Size;
+            HvpAddFree(RegistryHive, Neighbor, NeighborCellIndex);
 
             if (CellType == Stable)
                HvMarkCellDirty(RegistryHive, NeighborCellIndex, FALSE);
 
             return;
          }
-         Neighbor = (PHCELL)((ULONG_PTR)Neighbor + Neighbor->Size);
-      }
-      else
-      {
-         Neighbor = (PHCELL)((ULONG_PTR)Neighbor - Neighbor->Size);
       }
    }
 
@@ -48,6 +48,11 @@
 #define HV_SIGNATURE                   0x66676572
 #define HV_BIN_SIGNATURE               0x6e696268
 
+//
+// In-memory bin flags, kept in HBIN.Spare
+//
+#define HV_BIN_UNLISTED                0x1
+
 //
 // Hive versions
 //
@@ -67,6 +72,19 @@
 //
 #define HTYPE_COUNT 2
 
+//
+// Free cell display: one exact-fit list per 8 byte size class up to
+// HFREE_EXACT_LIMIT, then HFREE_RANGE_SPLIT lists per power of two above it
+//
+#define HFREE_EXACT_SHIFT                               10
+#define HFREE_EXACT_LIMIT                               (1 << HFREE_EXACT_SHIFT)
+#define HFREE_EXACT_COUNT                               (HFREE_EXACT_LIMIT / 8)
+#define HFREE_RANGE_SHIFT                               2
+#define HFREE_RANGE_SPLIT                               (1 << HFREE_RANGE_SHIFT)
+#define HFREE_DISPLAY_SIZE                              \
+    (HFREE_EXACT_COUNT + (32 - HFREE_EXACT_SHIFT) * HFREE_RANGE_SPLIT)
+#define HFREE_SUMMARY_SIZE                              ((HFREE_DISPLAY_SIZE + 31) / 32)
+
 /**
  * @name HCELL_INDEX
  *
@@ -174,7 +192,7 @@ typedef struct _HBIN
    /* When this bin was last modified */
    LARGE_INTEGER TimeStamp;
 
-   /* ? (In-memory only) */
+   /* HV_BIN_* flags (In-memory only) */
    ULONG Spare;
 } HBIN, *PHBIN;
 
@@ -232,6 +250,13 @@ typedef BOOLEAN (CMAPI *PFILE_FLUSH_ROUTINE)(
     ULONG Length
 );
 
+typedef VOID (CMAPI *PVIEW_LOCK_ROUTINE)(
+    struct _HHIVE *RegistryHive);
+
+//
+// Blocks of a hive loaded with HINIT_MAPFILE start out with a NULL
+// BlockAddress and are read in with their bin on first access (HvReadBin)
+//
 typedef struct _HMAP_ENTRY
 {
     ULONG_PTR BlockAddress;
@@ -256,8 +281,8 @@ typedef struct _DUAL
     PHMAP_DIRECTORY Map;
     PHMAP_ENTRY BlockList; // PHMAP_TABLE SmallDir;
     ULONG Guard;
-    HCELL_INDEX FreeDisplay[24]; //FREE_DISPLAY FreeDisplay[24];
-    ULONG FreeSummary;
+    HCELL_INDEX FreeDisplay[HFREE_DISPLAY_SIZE];
+    ULONG FreeSummary[HFREE_SUMMARY_SIZE];
     LIST_ENTRY FreeBins;
 } DUAL, *PDUAL;
 
@@ -272,6 +297,9 @@ typedef struct _HHIVE
     PFILE_WRITE_ROUTINE FileWrite;
     PFILE_SET_SIZE_ROUTINE FileSetSize;
     PFILE_FLUSH_ROUTINE FileFlush;
+    PVIEW_LOCK_ROUTINE AcquireViewLock;  // Optional, serializes changes to the block lists
+    PVIEW_LOCK_ROUTINE ReleaseViewLock;
+    ULONG EnlistBlock;  // First stable block not yet checked for unlisted free cells
     PHBASE_BLOCK BaseBlock;
     RTL_BITMAP DirtyVector;
     ULONG DirtyCount;
@@ -114,11 +114,16 @@ HvpCreateHive(
    BaseBlock->CheckSum = HvpHiveHeaderChecksum(BaseBlock);
 
    RegistryHive->BaseBlock = BaseBlock;
-   for (Index = 0; Index < 24; Index++)
+   for (Index = 0; Index < HFREE_DISPLAY_SIZE; Index++)
    {
       RegistryHive->Storage[Stable].FreeDisplay[Index] = HCELL_NIL;
       RegistryHive->Storage[Volatile].FreeDisplay[Index] = HCELL_NIL;
    }
+   for (Index = 0; Index < HFREE_SUMMARY_SIZE; Index++)
+   {
+      RegistryHive->Storage[Stable].FreeSummary[Index] = 0;
+      RegistryHive->Storage[Volatile].FreeSummary[Index] = 0;
+   }
    RtlInitializeBitMap(&RegistryHive->DirtyVector, NULL, 0);
 
    return STATUS_SUCCESS;
@@ -395,6 +400,94 @@ HvLoadHive(IN PHHIVE Hive,
     return HvpInitializeMemoryHive(Hive, HiveData);
 }
 
+/**
+ * @name HvpInitializeMappedHive
+ *
+ * Internal helper function to initalize hive descriptor structure for
+ * a hive file that is read in on demand. Only the base block is read
+ * here; bins are read by HvReadBin when a cell in them is first touched.
+ *
+ * @see HvInitialize
+ */
+
+NTSTATUS CMAPI
+HvpInitializeMappedHive(
+   PHHIVE Hive,
+   ULONG FileSize)
+{
+   PHBASE_BLOCK BaseBlock = NULL;
+   LARGE_INTEGER TimeStamp;
+   ULONG BitmapSize;
+   PULONG BitmapBuffer;
+   NTSTATUS Status;
+
+   /* Get the hive header */
+   switch (HvpGetHiveHeader(Hive, &BaseBlock, &TimeStamp))
+   {
+      case HiveSuccess:
+         break;
+
+      case NoMemory:
+         return STATUS_INSUFFICIENT_RESOURCES;
+
+      case NotHive:
+         return STATUS_NOT_REGISTRY_FILE;
+
+      default:
+         return STATUS_REGISTRY_CORRUPT;
+   }
+
+   if (FileSize < 2 * HV_BLOCK_SIZE)
+   {
+      Hive->Free(BaseBlock, 0);
+      return STATUS_REGISTRY_CORRUPT;
+   }
+
+   /* Set default boot type */
+   BaseBlock->BootType = 0;
+
+   /* Setup hive data */
+   Hive->BaseBlock = BaseBlock;
+   Hive->Version = BaseBlock->Minor;
+
+   /* Every block starts out absent */
+   Hive->Storage[Stable].Length = FileSize / HV_BLOCK_SIZE - 1;
+   Hive->Storage[Stable].BlockList =
+      Hive->Allocate(Hive->Storage[Stable].Length *
+                     sizeof(HMAP_ENTRY), TRUE, TAG_CM);
+   if (Hive->Storage[Stable].BlockList == NULL)
+   {
+      Hive->Free(BaseBlock, 0);
+      return STATUS_INSUFFICIENT_RESOURCES;
+   }
+   RtlZeroMemory(Hive->Storage[Stable].BlockList,
+                 Hive->Storage[Stable].Length * sizeof(HMAP_ENTRY));
+
+   /* The free lists are filled in as bins get used */
+   Status = HvpCreateHiveFreeCellList(Hive);
+   if (!NT_SUCCESS(Status))
+   {
+      HvpFreeHiveBins(Hive);
+      Hive->Free(BaseBlock, 0);
+      return Status;
+   }
+
+   BitmapSize = ROUND_UP(Hive->Storage[Stable].Length,
+                         sizeof(ULONG) * 8) / 8;
+   BitmapBuffer = (PULONG)Hive->Allocate(BitmapSize, TRUE, TAG_CM);
+   if (BitmapBuffer == NULL)
+   {
+      HvpFreeHiveBins(Hive);
+      Hive->Free(BaseBlock, 0);
+      return STATUS_INSUFFICIENT_RESOURCES;
+   }
+
+   RtlInitializeBitMap(&Hive->DirtyVector, BitmapBuffer, BitmapSize * 8);
+   RtlClearAllBits(&Hive->DirtyVector);
+
+   return STATUS_SUCCESS;
+}
+
 /**
  * @name HvInitialize
  *
@@ -413,6 +506,9 @@ HvLoadHive(IN PHHIVE Hive,
  *          Load an in-memory hive for read-only access. The pointer
  *          to data passed to this routine MUSTN'T be freed until
  *          HvFree is called.
+ *        - HINIT_MAPFILE
+ *          Open a hive file for read/write access, reading its bins
+ *          in only when they are first used.
  * @param ChunkBase
  *        Pointer to hive data.
  * @param ChunkSize
@@ -494,6 +590,12 @@ HvInitialize(
          if (Status == STATUS_REGISTRY_RECOVERED) ASSERT(FALSE);
          break;
 
+      case HINIT_MAPFILE:
+
+         /* Same hack of doom as above */
+         Status = HvpInitializeMappedHive(Hive, Cluster);
+         break;
+
       default:
          /* FIXME: A better return status value is needed */
          Status = STATUS_NOT_IMPLEMENTED;
@@ -503,7 +605,9 @@ HvInitialize(
    if (!NT_SUCCESS(Status))
       return Status;
 
-   if (Operation != HINIT_CREATE) CmPrepareHive(Hive);
+   /* Mapped hives are prepared one bin at a time, see CmPrepareBin */
+   if (Operation != HINIT_CREATE && Operation != HINIT_MAPFILE)
+      CmPrepareHive(Hive);
 
    return Status;
 }
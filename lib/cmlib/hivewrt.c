@@ -11,100 +11,51 @@
 
 static BOOLEAN CMAPI
 HvpWriteLog(
-   PHHIVE RegistryHive)
+   PHHIVE RegistryHive,
+   PHV_SYNC_CONTEXT Sync)
 {
+   PHBASE_BLOCK BaseBlock = Sync->BaseBlock;
    ULONG FileOffset;
-   SIZE_T BufferSize;
-   SIZE_T BitmapSize;
-   PUCHAR Buffer;
-   PUCHAR Ptr;
-   ULONG BlockIndex;
-   ULONG LastIndex;
-   PVOID BlockPtr;
    BOOLEAN Success;
 
-   UNIMPLEMENTED;
-   return TRUE;
+   /* Hives without a log file only get their primary updated */
+   if (!RegistryHive->Log)
+      return TRUE;
 
    ASSERT(RegistryHive->ReadOnly == FALSE);
 
    DPRINT("HvpWriteLog called\n");
 
-   if (RegistryHive->BaseBlock->Sequence1 !=
-       RegistryHive->BaseBlock->Sequence2)
-   {
-      return FALSE;
-   }
-
-   BitmapSize = RegistryHive->DirtyVector.SizeOfBitMap;
-   BufferSize = HV_LOG_HEADER_SIZE + sizeof(ULONG) + BitmapSize;
-   BufferSize = ROUND_UP(BufferSize, HV_BLOCK_SIZE);
-
-   DPRINT("Bitmap size %lu  buffer size: %lu\n", BitmapSize, BufferSize);
-
-   Buffer = RegistryHive->Allocate(BufferSize, TRUE, TAG_CM);
-   if (Buffer == NULL)
+   if (BaseBlock->Sequence1 != BaseBlock->Sequence2)
    {
       return FALSE;
    }
 
    /* Update first update counter and CheckSum */
-   RegistryHive->BaseBlock->Type = HFILE_TYPE_LOG;
-   RegistryHive->BaseBlock->Sequence1++;
-   RegistryHive->BaseBlock->CheckSum =
-      HvpHiveHeaderChecksum(RegistryHive->BaseBlock);
-
-   /* Copy hive header */
-   RtlCopyMemory(Buffer, RegistryHive->BaseBlock, HV_LOG_HEADER_SIZE);
-   Ptr = Buffer + HV_LOG_HEADER_SIZE;
-   RtlCopyMemory(Ptr, "DIRT", 4);
-   Ptr += 4;
-   RtlCopyMemory(Ptr, RegistryHive->DirtyVector.Buffer, BitmapSize);
+   BaseBlock->Type = HFILE_TYPE_LOG;
+   BaseBlock->Sequence1++;
+   BaseBlock->CheckSum = HvpHiveHeaderChecksum(BaseBlock);
+
+   /* The sync buffer already is a log image, put the header in front */
+   RtlCopyMemory(Sync->Buffer, BaseBlock, HV_LOG_HEADER_SIZE);
 
-   /* Write hive block and block bitmap */
+   /* Write hive header, block bitmap and dirty blocks in one go */
    FileOffset = 0;
    Success = RegistryHive->FileWrite(RegistryHive, HFILE_TYPE_LOG,
-                                     &FileOffset, Buffer, BufferSize);
-   RegistryHive->Free(Buffer, 0);
-
+                                     &FileOffset, Sync->Buffer,
+                                     Sync->BufferSize);
    if (!Success)
    {
       return FALSE;
    }
 
-   /* Write dirty blocks */
-   FileOffset = BufferSize;
-   BlockIndex = 0;
-   while (BlockIndex < RegistryHive->Storage[Stable].Length)
-   {
-      LastIndex = BlockIndex;
-      BlockIndex = RtlFindSetBits(&RegistryHive->DirtyVector, 1, BlockIndex);
-      if (BlockIndex == ~0U || BlockIndex < LastIndex)
-      {
-         break;
-      }
-
-      BlockPtr = (PVOID)RegistryHive->Storage[Stable].BlockList[BlockIndex].BlockAddress;
-
-      /* Write hive block */
-      Success = RegistryHive->FileWrite(RegistryHive, HFILE_TYPE_LOG,
-                                        &FileOffset, BlockPtr,
-                                        HV_BLOCK_SIZE);
-      if (!Success)
-      {
-         return FALSE;
-      }
-
-      BlockIndex++;
-      FileOffset += HV_BLOCK_SIZE;
-    }
-
+   FileOffset = (ULONG)Sync->BufferSize;
    Success = RegistryHive->FileSetSize(RegistryHive, HFILE_TYPE_LOG, FileOffset, FileOffset);
    if (!Success)
    {
       DPRINT("FileSetSize failed\n");
       return FALSE;
-    }
+   }
 
    /* Flush the log file */
    Success = RegistryHive->FileFlush(RegistryHive, HFILE_TYPE_LOG, NULL, 0);
@@ -114,14 +65,13 @@ HvpWriteLog(
    }
 
    /* Update first and second update counter and CheckSum. */
-   RegistryHive->BaseBlock->Sequence2++;
-   RegistryHive->BaseBlock->CheckSum =
-      HvpHiveHeaderChecksum(RegistryHive->BaseBlock);
+   BaseBlock->Sequence2++;
+   BaseBlock->CheckSum = HvpHiveHeaderChecksum(BaseBlock);
 
    /* Write hive header again with updated sequence counter. */
    FileOffset = 0;
    Success = RegistryHive->FileWrite(RegistryHive, HFILE_TYPE_LOG,
-                                     &FileOffset, RegistryHive->BaseBlock,
+                                     &FileOffset, BaseBlock,
                                      HV_LOG_HEADER_SIZE);
    if (!Success)
    {
@@ -138,69 +88,113 @@ HvpWriteLog(
    return TRUE;
 }
 
+static BOOLEAN CMAPI
+HvpWriteHeader(
+   PHHIVE RegistryHive,
+   PHBASE_BLOCK BaseBlock)
+{
+   ULONG FileOffset;
+
+   BaseBlock->CheckSum = HvpHiveHeaderChecksum(BaseBlock);
+
+   /* Write hive block */
+   FileOffset = 0;
+   return RegistryHive->FileWrite(RegistryHive, HFILE_TYPE_PRIMARY,
+                                  &FileOffset, BaseBlock,
+                                  sizeof(HBASE_BLOCK));
+}
+
 static BOOLEAN CMAPI
 HvpWriteHive(
    PHHIVE RegistryHive,
-   BOOLEAN OnlyDirty)
+   PHV_SYNC_CONTEXT Sync)
 {
    ULONG FileOffset;
    ULONG BlockIndex;
-   ULONG LastIndex;
-   PVOID BlockPtr;
+   ULONG RunStart;
+   ULONG RunLength;
+   PUCHAR RunData;
+   PHBIN Bin;
+   PHBASE_BLOCK BaseBlock;
    BOOLEAN Success;
 
    ASSERT(RegistryHive->ReadOnly == FALSE);
 
    DPRINT("HvpWriteHive called\n");
 
-   if (RegistryHive->BaseBlock->Sequence1 !=
-       RegistryHive->BaseBlock->Sequence2)
+   /* Syncs write the base block as it was when the blocks were copied */
+   BaseBlock = Sync ? Sync->BaseBlock : RegistryHive->BaseBlock;
+
+   if (BaseBlock->Sequence1 != BaseBlock->Sequence2)
    {
       return FALSE;
    }
 
    /* Update first update counter and CheckSum */
-   RegistryHive->BaseBlock->Type = HFILE_TYPE_PRIMARY;
-   RegistryHive->BaseBlock->Sequence1++;
-   RegistryHive->BaseBlock->CheckSum =
-   HvpHiveHeaderChecksum(RegistryHive->BaseBlock);
-
-   /* Write hive block */
-   FileOffset = 0;
-   Success = RegistryHive->FileWrite(RegistryHive, HFILE_TYPE_PRIMARY,
-                                     &FileOffset, RegistryHive->BaseBlock,
-                                     sizeof(HBASE_BLOCK));
-   if (!Success)
+   BaseBlock->Type = HFILE_TYPE_PRIMARY;
+   BaseBlock->Sequence1++;
+   if (!HvpWriteHeader(RegistryHive, BaseBlock))
    {
       return FALSE;
    }
 
-   BlockIndex = 0;
-   while (BlockIndex < RegistryHive->Storage[Stable].Length)
+   if (Sync)
    {
-      if (OnlyDirty)
+      /* Each run of dirty blocks sits packed in the sync buffer */
+      RunData = Sync->Buffer + Sync->DataOffset;
+      BlockIndex = 0;
+      while (BlockIndex < Sync->DirtyVector.SizeOfBitMap)
       {
-         LastIndex = BlockIndex;
-         BlockIndex = RtlFindSetBits(&RegistryHive->DirtyVector, 1, BlockIndex);
-         if (BlockIndex == ~0U || BlockIndex < LastIndex)
+         if (!RtlCheckBit(&Sync->DirtyVector, BlockIndex))
          {
-            break;
+            BlockIndex++;
+            continue;
          }
-      }
 
-      BlockPtr = (PVOID)RegistryHive->Storage[Stable].BlockList[BlockIndex].BlockAddress;
-      FileOffset = (BlockIndex + 1) * HV_BLOCK_SIZE;
+         RunStart = BlockIndex;
+         while (BlockIndex < Sync->DirtyVector.SizeOfBitMap &&
+                RtlCheckBit(&Sync->DirtyVector, BlockIndex))
+         {
+            BlockIndex++;
+         }
+         RunLength = (BlockIndex - RunStart) * HV_BLOCK_SIZE;
+
+         /* Write the whole run at once */
+         FileOffset = (RunStart + 1) * HV_BLOCK_SIZE;
+         Success = RegistryHive->FileWrite(RegistryHive, HFILE_TYPE_PRIMARY,
+                                           &FileOffset, RunData, RunLength);
+         if (!Success)
+         {
+            return FALSE;
+         }
 
-      /* Write hive block */
-      Success = RegistryHive->FileWrite(RegistryHive, HFILE_TYPE_PRIMARY,
-                                        &FileOffset, BlockPtr,
-                                        HV_BLOCK_SIZE);
-      if (!Success)
-      {
-         return FALSE;
+         RunData += RunLength;
       }
+   }
+   else
+   {
+      /* Bins are contiguous in memory, so write them whole */
+      BlockIndex = 0;
+      while (BlockIndex < RegistryHive->Storage[Stable].Length)
+      {
+         /* Blocks of a mapped hive may never have been read in */
+         if (!HvpMapBlock(RegistryHive, BlockIndex))
+         {
+            return FALSE;
+         }
+
+         Bin = (PHBIN)RegistryHive->Storage[Stable].BlockList[BlockIndex].BinAddress;
+         FileOffset = (BlockIndex + 1) * HV_BLOCK_SIZE;
+
+         Success = RegistryHive->FileWrite(RegistryHive, HFILE_TYPE_PRIMARY,
+                                           &FileOffset, Bin, Bin->Size);
+         if (!Success)
+         {
+            return FALSE;
+         }
 
-      BlockIndex++;
+         BlockIndex += Bin->Size / HV_BLOCK_SIZE;
+      }
    }
 
    Success = RegistryHive->FileFlush(RegistryHive, HFILE_TYPE_PRIMARY, NULL, 0);
@@ -210,16 +204,8 @@ HvpWriteHive(
    }
 
    /* Update second update counter and CheckSum */
-   RegistryHive->BaseBlock->Sequence2++;
-   RegistryHive->BaseBlock->CheckSum =
-      HvpHiveHeaderChecksum(RegistryHive->BaseBlock);
-
-   /* Write hive block */
-   FileOffset = 0;
-   Success = RegistryHive->FileWrite(RegistryHive, HFILE_TYPE_PRIMARY,
-                                     &FileOffset, RegistryHive->BaseBlock,
-                                     sizeof(HBASE_BLOCK));
-   if (!Success)
+   BaseBlock->Sequence2++;
+   if (!HvpWriteHeader(RegistryHive, BaseBlock))
    {
       return FALSE;
    }
@@ -233,36 +219,188 @@ HvpWriteHive(
    return TRUE;
 }
 
+/**
+ * @name HvPrepareSync
+ *
+ * Copies the dirty blocks of a hive aside and marks the hive clean, so
+ * that HvWriteSync can write them out while the hive keeps changing.
+ * The caller has to keep writers out of the hive for the duration.
+ *
+ * @return FALSE if the copy could not be made. A clean hive succeeds
+ *         with Sync->Buffer set to NULL.
+ */
+
 BOOLEAN CMAPI
-HvSyncHive(
-   PHHIVE RegistryHive)
+HvPrepareSync(
+   PHHIVE RegistryHive,
+   PHV_SYNC_CONTEXT Sync)
 {
+   ULONG BitmapSize;
+   ULONG BlockIndex;
+   ULONG DirtyCount;
+   PUCHAR Ptr;
+
    ASSERT(RegistryHive->ReadOnly == FALSE);
 
+   RtlZeroMemory(Sync, sizeof(HV_SYNC_CONTEXT));
+
    if (RtlFindSetBits(&RegistryHive->DirtyVector, 1, 0) == ~0U)
    {
       return TRUE;
    }
 
+   /* Count the dirty blocks, the dirty count is only a hint */
+   DirtyCount = 0;
+   for (BlockIndex = 0; BlockIndex < RegistryHive->Storage[Stable].Length; BlockIndex++)
+   {
+      if (RtlCheckBit(&RegistryHive->DirtyVector, BlockIndex))
+         DirtyCount++;
+   }
+
+   /* Lay the buffer out like a log: header, bitmap, then the blocks */
+   BitmapSize = RegistryHive->DirtyVector.SizeOfBitMap / 8;
+   Sync->DataOffset = ROUND_UP(HV_LOG_HEADER_SIZE + sizeof(ULONG) + BitmapSize,
+                               HV_BLOCK_SIZE);
+   Sync->BufferSize = Sync->DataOffset + (SIZE_T)DirtyCount * HV_BLOCK_SIZE;
+
+   DPRINT("Bitmap size %lu  buffer size: %lu\n", BitmapSize, Sync->BufferSize);
+
+   Sync->Buffer = RegistryHive->Allocate(Sync->BufferSize + sizeof(HBASE_BLOCK),
+                                         TRUE, TAG_CM);
+   if (Sync->Buffer == NULL)
+   {
+      return FALSE;
+   }
+   RtlZeroMemory(Sync->Buffer, Sync->DataOffset);
+
    /* Update hive header modification time */
    KeQuerySystemTime(&RegistryHive->BaseBlock->TimeStamp);
 
+   /*
+    * The writes go out without the hive lock, so they work on a copy of
+    * the base block. The live one already gets the sequence numbers the
+    * log and the primary will have once both are written.
+    */
+   Sync->BaseBlock = (PHBASE_BLOCK)(Sync->Buffer + Sync->BufferSize);
+   RtlCopyMemory(Sync->BaseBlock, RegistryHive->BaseBlock, sizeof(HBASE_BLOCK));
+   if (RegistryHive->BaseBlock->Sequence1 == RegistryHive->BaseBlock->Sequence2)
+   {
+      RegistryHive->BaseBlock->Sequence1 += RegistryHive->Log ? 2 : 1;
+      RegistryHive->BaseBlock->Sequence2 = RegistryHive->BaseBlock->Sequence1;
+   }
+
+   Ptr = Sync->Buffer + HV_LOG_HEADER_SIZE;
+   RtlCopyMemory(Ptr, "DIRT", 4);
+   Ptr += 4;
+   RtlCopyMemory(Ptr, RegistryHive->DirtyVector.Buffer, BitmapSize);
+   RtlInitializeBitMap(&Sync->DirtyVector, (PULONG)Ptr,
+                       RegistryHive->Storage[Stable].Length);
+
+   /* Pack the dirty blocks behind it */
+   Ptr = Sync->Buffer + Sync->DataOffset;
+   for (BlockIndex = 0; BlockIndex < RegistryHive->Storage[Stable].Length; BlockIndex++)
+   {
+      if (!RtlCheckBit(&Sync->DirtyVector, BlockIndex))
+         continue;
+
+      RtlCopyMemory(Ptr,
+                    (PVOID)RegistryHive->Storage[Stable].BlockList[BlockIndex].BlockAddress,
+                    HV_BLOCK_SIZE);
+      Ptr += HV_BLOCK_SIZE;
+   }
+
+   /* Everything changed from here on goes into the next sync */
+   RtlClearAllBits(&RegistryHive->DirtyVector);
+   RegistryHive->DirtyCount = 0;
+
+   return TRUE;
+}
+
+/**
+ * @name HvWriteSync
+ *
+ * Writes the blocks copied by HvPrepareSync to the log and hive files.
+ * Runs of adjacent dirty blocks go out in a single write each. Only
+ * other syncs of the same hive have to be kept out.
+ */
+
+BOOLEAN CMAPI
+HvWriteSync(
+   PHHIVE RegistryHive,
+   PHV_SYNC_CONTEXT Sync)
+{
+   ASSERT(RegistryHive->ReadOnly == FALSE);
+
+   if (Sync->Buffer == NULL)
+   {
+      return TRUE;
+   }
+
    /* Update log file */
-   if (!HvpWriteLog(RegistryHive))
+   if (!HvpWriteLog(RegistryHive, Sync))
    {
       return FALSE;
    }
 
    /* Update hive file */
-   if (!HvpWriteHive(RegistryHive, TRUE))
+   return HvpWriteHive(RegistryHive, Sync);
+}
+
+/**
+ * @name HvCompleteSync
+ *
+ * Releases the copy made by HvPrepareSync. If the write failed, the
+ * blocks are marked dirty again, which needs writers kept out again.
+ */
+
+VOID CMAPI
+HvCompleteSync(
+   PHHIVE RegistryHive,
+   PHV_SYNC_CONTEXT Sync,
+   BOOLEAN Success)
+{
+   ULONG BlockIndex;
+
+   if (Sync->Buffer == NULL)
+   {
+      return;
+   }
+
+   if (!Success)
+   {
+      for (BlockIndex = 0; BlockIndex < Sync->DirtyVector.SizeOfBitMap; BlockIndex++)
+      {
+         if (RtlCheckBit(&Sync->DirtyVector, BlockIndex) &&
+             !RtlCheckBit(&RegistryHive->DirtyVector, BlockIndex))
+         {
+            RtlSetBits(&RegistryHive->DirtyVector, BlockIndex, 1);
+            RegistryHive->DirtyCount++;
+         }
+      }
+   }
+
+   RegistryHive->Free(Sync->Buffer, 0);
+   Sync->Buffer = NULL;
+}
+
+BOOLEAN CMAPI
+HvSyncHive(
+   PHHIVE RegistryHive)
+{
+   HV_SYNC_CONTEXT Sync;
+   BOOLEAN Success;
+
+   ASSERT(RegistryHive->ReadOnly == FALSE);
+
+   if (!HvPrepareSync(RegistryHive, &Sync))
    {
       return FALSE;
    }
 
-   /* Clear dirty bitmap. */
-   RtlClearAllBits(&RegistryHive->DirtyVector);
+   Success = HvWriteSync(RegistryHive, &Sync);
+   HvCompleteSync(RegistryHive, &Sync, Success);
 
-   return TRUE;
+   return Success;
 }
 
 BOOLEAN
@@ -283,7 +421,7 @@ HvWriteHive(
    KeQuerySystemTime(&RegistryHive->BaseBlock->TimeStamp);
 
    /* Update hive file */
-   if (!HvpWriteHive(RegistryHive, FALSE))
+   if (!HvpWriteHive(RegistryHive, NULL))
    {
       return FALSE;
    }
@@ -53,6 +53,7 @@ NTSTATUS TCPListen(PCONNECTION_ENDPOINT Connection, UINT Backlog)
 
     ASSERT(Connection);
 
+    LibIPLockCore();
     LockObject(Connection, &OldIrql);
 
     ASSERT_KM_POINTER(Connection->AddressFile);
@@ -94,6 +95,7 @@ NTSTATUS TCPListen(PCONNECTION_ENDPOINT Connection, UINT Backlog)
     }
 
     UnlockObject(Connection, OldIrql);
+    LibIPUnlockCore();
 
     TI_DbgPrint(DEBUG_TCP,("[IP, TCPListen] Leaving. Status = %x\n", Status));
 
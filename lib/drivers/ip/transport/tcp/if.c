@@ -122,6 +122,8 @@ TCPRegisterInterface(PIP_INTERFACE IF)
     ipaddr.addr = 0;
     netmask.addr = 0;
     
+    /* The netif list is walked by input running on other processors */
+    LOCK_TCPIP_CORE();
     IF->TCPContext = netif_add(IF->TCPContext, 
                                &ipaddr,
                                &netmask,
@@ -129,12 +131,15 @@ TCPRegisterInterface(PIP_INTERFACE IF)
                                IF,
                                TCPInterfaceInit,
                                tcpip_input);
+    UNLOCK_TCPIP_CORE();
 }
 
 VOID
 TCPUnregisterInterface(PIP_INTERFACE IF)
 {
+    LOCK_TCPIP_CORE();
     netif_remove(IF->TCPContext);
+    UNLOCK_TCPIP_CORE();
 }
 
 VOID
@@ -154,6 +159,8 @@ TCPUpdateInterfaceIPInformation(PIP_INTERFACE IF)
                             ADE_ADDRMASK,
                             (PULONG)&netmask.addr);
     
+    LOCK_TCPIP_CORE();
+
     netif_set_addr(IF->TCPContext, &ipaddr, &netmask, &gw);
     
     if (ipaddr.addr != 0)
@@ -165,4 +172,6 @@ TCPUpdateInterfaceIPInformation(PIP_INTERFACE IF)
     {
         netif_set_down(IF->TCPContext);
     }
+
+    UNLOCK_TCPIP_CORE();
 }    
@@ -36,6 +36,7 @@ DisconnectTimeoutDpc(PKDPC Dpc,
     PTDI_BUCKET Bucket;
     NTSTATUS Status;
     
+    LibIPLockCore();
     LockObjectAtDpcLevel(Connection);
     
     /* We timed out waiting for pending sends so force it to shutdown */
@@ -66,6 +67,7 @@ DisconnectTimeoutDpc(PKDPC Dpc,
     }
     
     UnlockObjectFromDpcLevel(Connection);
+    LibIPUnlockCore();
     
     DereferenceObject(Connection);
 }
@@ -129,6 +131,7 @@ NTSTATUS TCPSocket( PCONNECTION_ENDPOINT Connection,
     NTSTATUS Status;
     KIRQL OldIrql;
 
+    LibIPLockCore();
     LockObject(Connection, &OldIrql);
 
     TI_DbgPrint(DEBUG_TCP,("[IP, TCPSocket] Called: Connection %x, Family %d, Type %d, "
@@ -142,6 +145,7 @@ NTSTATUS TCPSocket( PCONNECTION_ENDPOINT Connection,
         Status = STATUS_INSUFFICIENT_RESOURCES;
 
     UnlockObject(Connection, OldIrql);
+    LibIPUnlockCore();
 
     TI_DbgPrint(DEBUG_TCP,("[IP, TCPSocket] Leaving. Status = 0x%x\n", Status));
 
@@ -153,6 +157,7 @@ NTSTATUS TCPClose( PCONNECTION_ENDPOINT Connection )
     KIRQL OldIrql;
     PVOID Socket;
 
+    LibIPLockCore();
     LockObject(Connection, &OldIrql);
 
     Socket = Connection->SocketContext;
@@ -162,6 +167,7 @@ NTSTATUS TCPClose( PCONNECTION_ENDPOINT Connection )
     LibTCPClose(Connection, FALSE, TRUE);
 
     UnlockObject(Connection, OldIrql);
+    LibIPUnlockCore();
 
     DereferenceObject(Connection);
 
@@ -312,11 +318,13 @@ NTSTATUS TCPConnect
                  RemoteAddress.Address.IPv4Address,
                  RemotePort));
 
+    LibIPLockCore();
     LockObject(Connection, &OldIrql);
 
     if (!Connection->AddressFile)
     {
         UnlockObject(Connection, OldIrql);
+        LibIPUnlockCore();
         return STATUS_INVALID_PARAMETER;
     }
 
@@ -325,6 +333,7 @@ NTSTATUS TCPConnect
         if (!(NCE = RouteGetRouteToDestination(&RemoteAddress)))
         {
             UnlockObject(Connection, OldIrql);
+            LibIPUnlockCore();
             return STATUS_NETWORK_UNREACHABLE;
         }
 
@@ -364,6 +373,7 @@ NTSTATUS TCPConnect
             if (!Bucket)
             {
                 UnlockObject(Connection, OldIrql);
+                LibIPUnlockCore();
                 return STATUS_NO_MEMORY;
             }
             
@@ -379,6 +389,7 @@ NTSTATUS TCPConnect
     }
 
     UnlockObject(Connection, OldIrql);
+    LibIPUnlockCore();
 
     TI_DbgPrint(DEBUG_TCP,("[IP, TCPConnect] Leaving. Status = 0x%x\n", Status));
 
@@ -401,6 +412,7 @@ NTSTATUS TCPDisconnect
 
     TI_DbgPrint(DEBUG_TCP,("[IP, TCPDisconnect] Called\n"));
 
+    LibIPLockCore();
     LockObject(Connection, &OldIrql);
 
     if (Connection->SocketContext)
@@ -434,6 +446,7 @@ NTSTATUS TCPDisconnect
                 if (!Bucket)
                 {
                     UnlockObject(Connection, OldIrql);
+                    LibIPUnlockCore();
                     return STATUS_NO_MEMORY;
                 }
 
@@ -468,6 +481,7 @@ NTSTATUS TCPDisconnect
     }
 
     UnlockObject(Connection, OldIrql);
+    LibIPUnlockCore();
 
     TI_DbgPrint(DEBUG_TCP,("[IP, TCPDisconnect] Leaving. Status = 0x%x\n", Status));
 
@@ -536,6 +550,7 @@ NTSTATUS TCPSendData
     PTDI_BUCKET Bucket;
     KIRQL OldIrql;
 
+    LibIPLockCore();
     LockObject(Connection, &OldIrql);
 
     TI_DbgPrint(DEBUG_TCP,("[IP, TCPSendData] Called for %d bytes (on socket %x)\n",
@@ -560,6 +575,7 @@ NTSTATUS TCPSendData
         if (!Bucket)
         {
             UnlockObject(Connection, OldIrql);
+            LibIPUnlockCore();
             TI_DbgPrint(DEBUG_TCP,("[IP, TCPSendData] Failed to allocate bucket\n"));
             return STATUS_NO_MEMORY;
         }
@@ -581,6 +597,7 @@ NTSTATUS TCPSendData
     }
 
     UnlockObject(Connection, OldIrql);
+    LibIPUnlockCore();
 
     TI_DbgPrint(DEBUG_TCP, ("[IP, TCPSendData] Leaving. Status = %x\n", Status));
 
@@ -622,6 +639,7 @@ NTSTATUS TCPGetSockAddress
     AddressIP->Address[0].AddressLength = TDI_ADDRESS_LENGTH_IP;
     AddressIP->Address[0].AddressType = TDI_ADDRESS_TYPE_IP;
 
+    LibIPLockCore();
     LockObject(Connection, &OldIrql);
 
     if (GetRemote)
@@ -638,6 +656,7 @@ NTSTATUS TCPGetSockAddress
     }
 
     UnlockObject(Connection, OldIrql);
+    LibIPUnlockCore();
     
     AddressIP->Address[0].Address[0].in_addr = ipaddr.addr;
     
@@ -647,6 +666,49 @@ NTSTATUS TCPGetSockAddress
     return Status;
 }
 
+NTSTATUS TCPSetBufferSize
+( PCONNECTION_ENDPOINT Connection,
+  BOOLEAN Receive,
+  UINT Size )
+{
+    NTSTATUS Status;
+    KIRQL OldIrql;
+
+    TI_DbgPrint(DEBUG_TCP,("[IP, TCPSetBufferSize] Called: Connection %x, %s buffer %d\n",
+                           Connection, Receive ? "receive" : "send", Size));
+
+    LibIPLockCore();
+    LockObject(Connection, &OldIrql);
+
+    /* Kept for the connection an accept hands this endpoint later on */
+    if (Receive)
+        Connection->ReceiveBufferSize = Size;
+    else
+        Connection->SendBufferSize = Size;
+
+    Status = TCPTranslateError(LibTCPSetBufferSizes(Connection));
+
+    UnlockObject(Connection, OldIrql);
+    LibIPUnlockCore();
+
+    return Status;
+}
+
+VOID TCPLockCore( VOID )
+/*
+ * FUNCTION: Takes the lwIP core lock for callers outside the TCP library
+ * NOTES:
+ *     This must be taken before any endpoint or address file lock
+ */
+{
+    LibIPLockCore();
+}
+
+VOID TCPUnlockCore( VOID )
+{
+    LibIPUnlockCore();
+}
+
 BOOLEAN TCPRemoveIRP( PCONNECTION_ENDPOINT Endpoint, PIRP Irp )
 {
     PLIST_ENTRY Entry;
@@ -1195,7 +1195,8 @@ do_writemore(struct netconn *conn)
 {
   err_t err = ERR_OK;
   void *dataptr;
-  u16_t len, available;
+  u16_t len;
+  tcpwnd_size_t available;
   u8_t write_finished = 0;
   size_t diff;
   u8_t dontblock = netconn_is_nonblocking(conn) ||
@@ -1223,7 +1224,7 @@ do_writemore(struct netconn *conn)
   available = tcp_sndbuf(conn->pcb.tcp);
   if (available < len) {
     /* don't try to write more than sendbuf */
-    len = available;
+    len = (u16_t)available;
 #if LWIP_TCPIP_CORE_LOCKING
     conn->flags |= NETCONN_FLAG_WRITE_DELAYED;
 #endif
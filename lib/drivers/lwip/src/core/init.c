@@ -102,6 +102,18 @@
 #if (LWIP_TCP && (TCP_WND > 0xffff))
   #error "If you want to use TCP, TCP_WND must fit in an u16_t, so, you have to reduce it in your lwipopts.h"
 #endif
+#if (LWIP_TCP && (TCP_WND > TCP_WND_MAX))
+  #error "TCP_WND must not be larger than TCP_WND_MAX, so, you have to reduce it in your lwipopts.h"
+#endif
+#if (LWIP_TCP && (TCP_SND_BUF > TCP_SND_BUF_MAX))
+  #error "TCP_SND_BUF must not be larger than TCP_SND_BUF_MAX, so, you have to reduce it in your lwipopts.h"
+#endif
+#if (LWIP_TCP && !LWIP_WND_SCALE && ((TCP_WND_MAX > 0xffff) || (TCP_SND_BUF_MAX > 0xffff)))
+  #error "If you want to use TCP without LWIP_WND_SCALE, TCP_WND_MAX and TCP_SND_BUF_MAX must fit in an u16_t"
+#endif
+#if (LWIP_TCP && LWIP_WND_SCALE && ((TCP_RCV_SCALE > 14) || (TCP_WND_MAX > (0xffffUL << TCP_RCV_SCALE))))
+  #error "TCP_RCV_SCALE must be at most 14 and large enough for TCP_WND_MAX, so, you have to adjust it in your lwipopts.h"
+#endif
 #if (LWIP_TCP && (TCP_SND_QUEUELEN > 0xffff))
   #error "If you want to use TCP, TCP_SND_QUEUELEN must fit in an u16_t, so, you have to reduce it in your lwipopts.h"
 #endif
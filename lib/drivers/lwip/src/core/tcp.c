@@ -140,7 +140,7 @@ tcp_close_shutdown(struct tcp_pcb *pcb, u8_t rst_on_unacked_data)
   err_t err;
 
   if (rst_on_unacked_data && (pcb->state != LISTEN)) {
-    if ((pcb->refused_data != NULL) || (pcb->rcv_wnd != TCP_WND)) {
+    if ((pcb->refused_data != NULL) || (pcb->rcv_wnd != pcb->rcv_wnd_max)) {
       /* Not all data received by application, send RST to tell the remote
          side about this. */
       LWIP_ASSERT("pcb->flags & TF_RXCLOSED", pcb->flags & TF_RXCLOSED);
@@ -544,7 +544,7 @@ u32_t tcp_update_rcv_ann_wnd(struct tcp_pcb *pcb)
 {
   u32_t new_right_edge = pcb->rcv_nxt + pcb->rcv_wnd;
 
-  if (TCP_SEQ_GEQ(new_right_edge, pcb->rcv_ann_right_edge + LWIP_MIN((TCP_WND / 2), pcb->mss))) {
+  if (TCP_SEQ_GEQ(new_right_edge, pcb->rcv_ann_right_edge + LWIP_MIN((pcb->rcv_wnd_max / 2), pcb->mss))) {
     /* we can advertise more window */
     pcb->rcv_ann_wnd = pcb->rcv_wnd;
     return new_right_edge - pcb->rcv_ann_right_edge;
@@ -556,8 +556,8 @@ u32_t tcp_update_rcv_ann_wnd(struct tcp_pcb *pcb)
     } else {
       /* keep the right edge of window constant */
       u32_t new_rcv_ann_wnd = pcb->rcv_ann_right_edge - pcb->rcv_nxt;
-      LWIP_ASSERT("new_rcv_ann_wnd <= 0xffff", new_rcv_ann_wnd <= 0xffff);
-      pcb->rcv_ann_wnd = (u16_t)new_rcv_ann_wnd;
+      LWIP_ASSERT("new_rcv_ann_wnd <= rcv_wnd_max", new_rcv_ann_wnd <= pcb->rcv_wnd_max);
+      pcb->rcv_ann_wnd = (tcpwnd_size_t)new_rcv_ann_wnd;
     }
     return 0;
   }
@@ -577,11 +577,11 @@ tcp_recved(struct tcp_pcb *pcb, u16_t len)
   int wnd_inflation;
 
   LWIP_ASSERT("tcp_recved: len would wrap rcv_wnd\n",
-              len <= 0xffff - pcb->rcv_wnd );
+              (tcpwnd_size_t)(pcb->rcv_wnd + len) >= pcb->rcv_wnd);
 
   pcb->rcv_wnd += len;
-  if (pcb->rcv_wnd > TCP_WND) {
-    pcb->rcv_wnd = TCP_WND;
+  if (pcb->rcv_wnd > pcb->rcv_wnd_max) {
+    pcb->rcv_wnd = pcb->rcv_wnd_max;
   }
 
   wnd_inflation = tcp_update_rcv_ann_wnd(pcb);
@@ -595,8 +595,133 @@ tcp_recved(struct tcp_pcb *pcb, u16_t len)
     tcp_output(pcb);
   }
 
-  LWIP_DEBUGF(TCP_DEBUG, ("tcp_recved: recveived %"U16_F" bytes, wnd %"U16_F" (%"U16_F").\n",
-         len, pcb->rcv_wnd, TCP_WND - pcb->rcv_wnd));
+  LWIP_DEBUGF(TCP_DEBUG, ("tcp_recved: recveived %"U16_F" bytes, wnd %"U32_F" (%"U32_F").\n",
+         len, (u32_t)pcb->rcv_wnd, (u32_t)(pcb->rcv_wnd_max - pcb->rcv_wnd)));
+}
+
+/**
+ * Returns the largest receive window that can be announced on a connection.
+ * Until the handshake has shown whether the remote host does window scaling,
+ * it is assumed that it does.
+ *
+ * @param pcb the tcp_pcb to return the limit for
+ */
+tcpwnd_size_t
+tcp_rcv_wnd_limit(struct tcp_pcb *pcb)
+{
+#if LWIP_WND_SCALE
+  if ((pcb->flags & TF_WND_SCALE) ||
+      (pcb->state == CLOSED) || (pcb->state == SYN_SENT)) {
+    return (tcpwnd_size_t)0xffff << TCP_RCV_SCALE;
+  }
+#else /* LWIP_WND_SCALE */
+  LWIP_UNUSED_ARG(pcb);
+#endif /* LWIP_WND_SCALE */
+  return 0xffff;
+}
+
+/**
+ * Sets the receive buffer size of a connection, which is the largest window
+ * announced to the remote host. This stops the buffer from being autotuned.
+ *
+ * @param pcb the tcp_pcb to set the buffer size for
+ * @param size the buffer size in bytes, or 0 to have it autotuned again
+ */
+void
+tcp_setrcvbuf(struct tcp_pcb *pcb, u32_t size)
+{
+  tcpwnd_size_t used;
+
+  /* Listening pcbs have no buffers */
+  if (pcb->state == LISTEN) {
+    return;
+  }
+
+  if (size == 0) {
+    pcb->flags &= ~TF_RCVBUF_LOCK;
+    return;
+  }
+
+  size = LWIP_MAX(size, TCP_MSS);
+  size = LWIP_MIN(size, tcp_rcv_wnd_limit(pcb));
+
+  /* Data the application has not taken yet keeps its space */
+  used = pcb->rcv_wnd_max - pcb->rcv_wnd;
+  pcb->rcv_wnd_max = (tcpwnd_size_t)size;
+  pcb->rcv_wnd = (used < pcb->rcv_wnd_max) ? (pcb->rcv_wnd_max - used) : 0;
+  pcb->flags |= TF_RCVBUF_LOCK;
+
+  if ((pcb->state == CLOSED) || (pcb->state == SYN_SENT)) {
+    pcb->rcv_ann_wnd = pcb->rcv_wnd;
+  } else if ((pcb->state != TIME_WAIT) &&
+             (tcp_update_rcv_ann_wnd(pcb) >= TCP_WND_UPDATE_THRESHOLD)) {
+    /* The window opened up, tell the remote host right away */
+    tcp_ack_now(pcb);
+    tcp_output(pcb);
+  }
+}
+
+/**
+ * Sets the send buffer size of a connection, which is how much data
+ * tcp_write() queues before it fails with ERR_MEM. This stops the buffer
+ * from being autotuned.
+ *
+ * @param pcb the tcp_pcb to set the buffer size for
+ * @param size the buffer size in bytes, or 0 to have it autotuned again
+ */
+void
+tcp_setsndbuf(struct tcp_pcb *pcb, u32_t size)
+{
+  if (pcb->state == LISTEN) {
+    return;
+  }
+
+  if (size == 0) {
+    pcb->flags &= ~TF_SNDBUF_LOCK;
+  } else {
+    size = LWIP_MAX(size, TCP_MSS);
+    pcb->snd_buf_req = (tcpwnd_size_t)LWIP_MIN(size, TCP_SND_BUF_MAX);
+    pcb->flags |= TF_SNDBUF_LOCK;
+  }
+
+  tcp_sndbuf_adjust(pcb);
+}
+
+/**
+ * Moves the send buffer size of a connection towards its target: the size
+ * the application set or, when autotuned, twice what the congestion and
+ * send windows allow in flight, so the application can refill one half
+ * while the other drains. Autotuning only ever grows the buffer. Queued
+ * data keeps its space, so a smaller buffer takes effect as it is acked.
+ *
+ * Called by tcp_receive() when new data is acked.
+ *
+ * @param pcb the tcp_pcb to adjust the send buffer of
+ */
+void
+tcp_sndbuf_adjust(struct tcp_pcb *pcb)
+{
+  tcpwnd_size_t target;
+  tcpwnd_size_t delta;
+
+  if (pcb->flags & TF_SNDBUF_LOCK) {
+    target = pcb->snd_buf_req;
+  } else {
+    target = LWIP_MIN(pcb->cwnd, pcb->snd_wnd);
+    target = (target > TCP_SND_BUF_MAX / 2) ? TCP_SND_BUF_MAX : (target * 2);
+    if (target <= pcb->snd_buf_max) {
+      return;
+    }
+  }
+
+  if (target > pcb->snd_buf_max) {
+    pcb->snd_buf += target - pcb->snd_buf_max;
+    pcb->snd_buf_max = target;
+  } else {
+    delta = LWIP_MIN(pcb->snd_buf_max - target, pcb->snd_buf);
+    pcb->snd_buf -= delta;
+    pcb->snd_buf_max -= delta;
+  }
 }
 
 /**
@@ -705,8 +830,8 @@ tcp_connect(struct tcp_pcb *pcb, ip_addr_t *ipaddr, u16_t port,
   pcb->snd_nxt = iss;
   pcb->lastack = iss - 1;
   pcb->snd_lbb = iss - 1;
-  pcb->rcv_wnd = TCP_WND;
-  pcb->rcv_ann_wnd = TCP_WND;
+  pcb->rcv_wnd = pcb->rcv_wnd_max;
+  pcb->rcv_ann_wnd = pcb->rcv_wnd_max;
   pcb->rcv_ann_right_edge = pcb->rcv_nxt;
   pcb->snd_wnd = TCP_WND;
   /* As initial send MSS, we use TCP_MSS but limit it to 536.
@@ -750,7 +875,7 @@ void
 tcp_slowtmr(void)
 {
   struct tcp_pcb *pcb, *prev;
-  u16_t eff_wnd;
+  tcpwnd_size_t eff_wnd;
   u8_t pcb_remove;      /* flag if a PCB should be removed */
   u8_t pcb_reset;       /* flag if a RST should be sent when removing */
   err_t err;
@@ -820,9 +945,9 @@ tcp_slowtmr(void)
             pcb->ssthresh = (pcb->mss << 1);
           }
           pcb->cwnd = pcb->mss;
-          LWIP_DEBUGF(TCP_CWND_DEBUG, ("tcp_slowtmr: cwnd %"U16_F
-                                       " ssthresh %"U16_F"\n",
-                                       pcb->cwnd, pcb->ssthresh));
+          LWIP_DEBUGF(TCP_CWND_DEBUG, ("tcp_slowtmr: cwnd %"U32_F
+                                       " ssthresh %"U32_F"\n",
+                                       (u32_t)pcb->cwnd, (u32_t)pcb->ssthresh));
  
           /* The following needs to be called AFTER cwnd is set to one
              mss - STJ */
@@ -1209,9 +1334,11 @@ tcp_alloc(u8_t prio)
     memset(pcb, 0, sizeof(struct tcp_pcb));
     pcb->prio = prio;
     pcb->snd_buf = TCP_SND_BUF;
+    pcb->snd_buf_max = TCP_SND_BUF;
     pcb->snd_queuelen = 0;
     pcb->rcv_wnd = TCP_WND;
     pcb->rcv_ann_wnd = TCP_WND;
+    pcb->rcv_wnd_max = TCP_WND;
     pcb->tos = 0;
     pcb->ttl = TCP_TTL;
     /* As initial send MSS, we use TCP_MSS but limit it to 536.
@@ -51,6 +51,7 @@
 #include "lwip/netif.h"
 #include "lwip/mem.h"
 #include "lwip/memp.h"
+#include "lwip/sys.h"
 #include "lwip/inet_chksum.h"
 #include "lwip/stats.h"
 #include "lwip/snmp.h"
@@ -75,6 +76,7 @@ struct tcp_pcb *tcp_input_pcb;
 static err_t tcp_process(struct tcp_pcb *pcb);
 static void tcp_receive(struct tcp_pcb *pcb);
 static void tcp_parseopt(struct tcp_pcb *pcb);
+static void tcp_rcv_autotune(struct tcp_pcb *pcb);
 
 static err_t tcp_listen_input(struct tcp_pcb_listen *pcb);
 static err_t tcp_timewait_input(struct tcp_pcb *pcb);
@@ -357,10 +359,24 @@ tcp_input(struct pbuf *p, struct netif *inp)
            called when new send buffer space is available, we call it
            now. */
         if (pcb->acked > 0) {
+#if LWIP_WND_SCALE
+          /* pcb->acked may not fit into the u16_t the sent callback takes,
+             so it may have to be called more than once */
+          tcpwnd_size_t acked = pcb->acked;
+          while (acked > 0) {
+            u16_t acked16 = (u16_t)LWIP_MIN(acked, 0xffffU);
+            acked -= acked16;
+            TCP_EVENT_SENT(pcb, acked16, err);
+            if (err == ERR_ABRT) {
+              goto aborted;
+            }
+          }
+#else /* LWIP_WND_SCALE */
           TCP_EVENT_SENT(pcb, pcb->acked, err);
           if (err == ERR_ABRT) {
             goto aborted;
           }
+#endif /* LWIP_WND_SCALE */
         }
 
         if (recv_data != NULL) {
@@ -394,7 +410,7 @@ tcp_input(struct pbuf *p, struct netif *inp)
         if (recv_flags & TF_GOT_FIN) {
           /* correct rcv_wnd as the application won't call tcp_recved()
              for the FIN's seqno */
-          if (pcb->rcv_wnd != TCP_WND) {
+          if (pcb->rcv_wnd != pcb->rcv_wnd_max) {
             pcb->rcv_wnd++;
           }
           TCP_EVENT_CLOSED(pcb, err);
@@ -650,10 +666,21 @@ tcp_process(struct tcp_pcb *pcb)
       pcb->rcv_nxt = seqno + 1;
       pcb->rcv_ann_right_edge = pcb->rcv_nxt;
       pcb->lastack = ackno;
+      /* the window of a SYN segment is never scaled */
       pcb->snd_wnd = tcphdr->wnd;
       pcb->snd_wl1 = seqno - 1; /* initialise to seqno - 1 to force window update */
       pcb->state = ESTABLISHED;
 
+#if LWIP_WND_SCALE
+      if (!(pcb->flags & TF_WND_SCALE)) {
+        /* The remote host did not take up window scaling, so what we
+           announce has to fit into the 16 bit window field */
+        pcb->rcv_wnd_max = LWIP_MIN(pcb->rcv_wnd_max, 0xffff);
+        pcb->rcv_wnd = LWIP_MIN(pcb->rcv_wnd, 0xffff);
+        pcb->rcv_ann_wnd = LWIP_MIN(pcb->rcv_ann_wnd, 0xffff);
+      }
+#endif /* LWIP_WND_SCALE */
+
 #if TCP_CALCULATE_EFF_SEND_MSS
       pcb->mss = tcp_eff_send_mss(pcb->mss, &(pcb->remote_ip));
 #endif /* TCP_CALCULATE_EFF_SEND_MSS */
@@ -699,7 +726,7 @@ tcp_process(struct tcp_pcb *pcb)
     if (flags & TCP_ACK) {
       /* expected ACK number? */
       if (TCP_SEQ_BETWEEN(ackno, pcb->lastack+1, pcb->snd_nxt)) {
-        u16_t old_cwnd;
+        tcpwnd_size_t old_cwnd;
         pcb->state = ESTABLISHED;
         LWIP_DEBUGF(TCP_DEBUG, ("TCP connection established %"U16_F" -> %"U16_F".\n", inseg.tcphdr->src, inseg.tcphdr->dest));
 #if LWIP_CALLBACK_API
@@ -878,17 +905,17 @@ tcp_receive(struct tcp_pcb *pcb)
     /* Update window. */
     if (TCP_SEQ_LT(pcb->snd_wl1, seqno) ||
        (pcb->snd_wl1 == seqno && TCP_SEQ_LT(pcb->snd_wl2, ackno)) ||
-       (pcb->snd_wl2 == ackno && tcphdr->wnd > pcb->snd_wnd)) {
-      pcb->snd_wnd = tcphdr->wnd;
+       (pcb->snd_wl2 == ackno && SND_WND_SCALE(pcb, tcphdr->wnd) > pcb->snd_wnd)) {
+      pcb->snd_wnd = SND_WND_SCALE(pcb, tcphdr->wnd);
       pcb->snd_wl1 = seqno;
       pcb->snd_wl2 = ackno;
       if (pcb->snd_wnd > 0 && pcb->persist_backoff > 0) {
           pcb->persist_backoff = 0;
       }
-      LWIP_DEBUGF(TCP_WND_DEBUG, ("tcp_receive: window update %"U16_F"\n", pcb->snd_wnd));
+      LWIP_DEBUGF(TCP_WND_DEBUG, ("tcp_receive: window update %"U32_F"\n", (u32_t)pcb->snd_wnd));
 #if TCP_WND_DEBUG
     } else {
-      if (pcb->snd_wnd != tcphdr->wnd) {
+      if (pcb->snd_wnd != SND_WND_SCALE(pcb, tcphdr->wnd)) {
         LWIP_DEBUGF(TCP_WND_DEBUG, 
                     ("tcp_receive: no window update lastack %"U32_F" ackno %"
                      U32_F" wl1 %"U32_F" seqno %"U32_F" wl2 %"U32_F"\n",
@@ -934,7 +961,7 @@ tcp_receive(struct tcp_pcb *pcb)
               if (pcb->dupacks > 3) {
                 /* Inflate the congestion window, but not if it means that
                    the value overflows. */
-                if ((u16_t)(pcb->cwnd + pcb->mss) > pcb->cwnd) {
+                if ((tcpwnd_size_t)(pcb->cwnd + pcb->mss) > pcb->cwnd) {
                   pcb->cwnd += pcb->mss;
                 }
               } else if (pcb->dupacks == 3) {
@@ -967,8 +994,9 @@ tcp_receive(struct tcp_pcb *pcb)
       /* Reset the retransmission time-out. */
       pcb->rto = (pcb->sa >> 3) + pcb->sv;
 
-      /* Update the send buffer space. Diff between the two can never exceed 64K? */
-      pcb->acked = (u16_t)(ackno - pcb->lastack);
+      /* Update the send buffer space. Without window scaling the diff
+         between the two can never exceed 64K */
+      pcb->acked = (tcpwnd_size_t)(ackno - pcb->lastack);
 
       pcb->snd_buf += pcb->acked;
 
@@ -980,18 +1008,21 @@ tcp_receive(struct tcp_pcb *pcb)
          ssthresh). */
       if (pcb->state >= ESTABLISHED) {
         if (pcb->cwnd < pcb->ssthresh) {
-          if ((u16_t)(pcb->cwnd + pcb->mss) > pcb->cwnd) {
+          if ((tcpwnd_size_t)(pcb->cwnd + pcb->mss) > pcb->cwnd) {
             pcb->cwnd += pcb->mss;
           }
-          LWIP_DEBUGF(TCP_CWND_DEBUG, ("tcp_receive: slow start cwnd %"U16_F"\n", pcb->cwnd));
+          LWIP_DEBUGF(TCP_CWND_DEBUG, ("tcp_receive: slow start cwnd %"U32_F"\n", (u32_t)pcb->cwnd));
         } else {
-          u16_t new_cwnd = (pcb->cwnd + pcb->mss * pcb->mss / pcb->cwnd);
+          tcpwnd_size_t new_cwnd = (pcb->cwnd + pcb->mss * pcb->mss / pcb->cwnd);
           if (new_cwnd > pcb->cwnd) {
             pcb->cwnd = new_cwnd;
           }
-          LWIP_DEBUGF(TCP_CWND_DEBUG, ("tcp_receive: congestion avoidance cwnd %"U16_F"\n", pcb->cwnd));
+          LWIP_DEBUGF(TCP_CWND_DEBUG, ("tcp_receive: congestion avoidance cwnd %"U32_F"\n", (u32_t)pcb->cwnd));
         }
       }
+
+      /* Let the send buffer follow what the window allows in flight */
+      tcp_sndbuf_adjust(pcb);
       LWIP_DEBUGF(TCP_INPUT_DEBUG, ("tcp_receive: ACK for %"U32_F", unacked->seqno %"U32_F":%"U32_F"\n",
                                     ackno,
                                     pcb->unacked != NULL?
@@ -1350,6 +1381,7 @@ tcp_receive(struct tcp_pcb *pcb)
         }
 #endif /* TCP_QUEUE_OOSEQ */
 
+        tcp_rcv_autotune(pcb);
 
         /* Acknowledge the segment(s). */
         tcp_ack(pcb);
@@ -1545,6 +1577,27 @@ tcp_parseopt(struct tcp_pcb *pcb)
         /* Advance to next option */
         c += 0x04;
         break;
+#if LWIP_WND_SCALE
+      case 0x03:
+        LWIP_DEBUGF(TCP_INPUT_DEBUG, ("tcp_parseopt: WND_SCALE\n"));
+        if (opts[c + 1] != 0x03 || c + 0x03 > max_c) {
+          /* Bad length */
+          LWIP_DEBUGF(TCP_INPUT_DEBUG, ("tcp_parseopt: bad length\n"));
+          return;
+        }
+        /* The option only counts on SYN segments, and only the first time:
+           a retransmitted SYN must not change the scale in use. Our own
+           scale is offered in every SYN we send, so once the remote host
+           has sent one as well both directions are scaled. */
+        if ((flags & TCP_SYN) && !(pcb->flags & TF_WND_SCALE)) {
+          pcb->snd_scale = LWIP_MIN(opts[c + 2], 14);
+          pcb->rcv_scale = TCP_RCV_SCALE;
+          pcb->flags |= TF_WND_SCALE;
+        }
+        /* Advance to next option */
+        c += 0x03;
+        break;
+#endif /* LWIP_WND_SCALE */
 #if LWIP_TCP_TIMESTAMPS
       case 0x08:
         LWIP_DEBUGF(TCP_INPUT_DEBUG, ("tcp_parseopt: TS\n"));
@@ -1582,4 +1635,75 @@ tcp_parseopt(struct tcp_pcb *pcb)
   }
 }
 
+/**
+ * Grows the receive window of a connection with the bandwidth-delay product
+ * the remote host shows. Once per round trip we look at how much arrived in
+ * it: when that is more than in any round trip before, the window is likely
+ * what holds the sender back, so it is made twice that size.
+ *
+ * The round trip time is taken on the receiving side as the time the remote
+ * host needs to fill the window we announced, which doesn't need anything
+ * to be sent in the other direction.
+ *
+ * Called from tcp_receive() after in-sequence data arrived.
+ *
+ * @param pcb the tcp_pcb that received data
+ */
+static void
+tcp_rcv_autotune(struct tcp_pcb *pcb)
+{
+  u32_t now = sys_now();
+  u32_t sample;
+  u32_t copied;
+  tcpwnd_size_t limit;
+  tcpwnd_size_t target;
+
+  /* Measure how long filling the announced window took */
+  if ((pcb->rcv_rtt_time == 0) || TCP_SEQ_GEQ(pcb->rcv_nxt, pcb->rcv_rtt_seq)) {
+    if (pcb->rcv_rtt_time != 0) {
+      sample = LWIP_MAX(now - pcb->rcv_rtt_time, 1);
+      if ((pcb->rcv_rtt == 0) || (sample < pcb->rcv_rtt)) {
+        pcb->rcv_rtt = sample;
+      } else {
+        pcb->rcv_rtt += (sample - pcb->rcv_rtt) >> 3;
+      }
+    }
+    pcb->rcv_rtt_seq = pcb->rcv_nxt + pcb->rcv_wnd;
+    pcb->rcv_rtt_time = LWIP_MAX(now, 1);
+  }
+
+  if ((pcb->rcv_rtt == 0) || (pcb->flags & TF_RCVBUF_LOCK)) {
+    return;
+  }
+
+  if (pcb->rcv_space_time == 0) {
+    pcb->rcv_space = pcb->rcv_wnd_max / 2;
+    pcb->rcv_space_seq = pcb->rcv_nxt;
+    pcb->rcv_space_time = LWIP_MAX(now, 1);
+    return;
+  }
+
+  if ((u32_t)(now - pcb->rcv_space_time) < pcb->rcv_rtt) {
+    return;
+  }
+
+  copied = pcb->rcv_nxt - pcb->rcv_space_seq;
+  if (copied > pcb->rcv_space) {
+    pcb->rcv_space = (tcpwnd_size_t)LWIP_MIN(copied, pcb->rcv_wnd_max);
+
+    limit = LWIP_MIN(tcp_rcv_wnd_limit(pcb), TCP_WND_MAX);
+    target = (copied > limit / 2) ? limit : (tcpwnd_size_t)(copied * 2);
+    if (target > pcb->rcv_wnd_max) {
+      LWIP_DEBUGF(TCP_WND_DEBUG, ("tcp_rcv_autotune: window %"U32_F" -> %"U32_F" (rtt %"U32_F" ms)\n",
+                                  (u32_t)pcb->rcv_wnd_max, (u32_t)target, pcb->rcv_rtt));
+      pcb->rcv_wnd += target - pcb->rcv_wnd_max;
+      pcb->rcv_wnd_max = target;
+      tcp_update_rcv_ann_wnd(pcb);
+    }
+  }
+
+  pcb->rcv_space_seq = pcb->rcv_nxt;
+  pcb->rcv_space_time = LWIP_MAX(now, 1);
+}
+
 #endif /* LWIP_TCP */
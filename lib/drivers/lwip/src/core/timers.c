@@ -62,6 +62,52 @@
 static struct sys_timeo *next_timeout;
 #if NO_SYS
 static u32_t timeouts_last_time;
+#else /* NO_SYS */
+/* Timeouts are started under the core lock on any processor while the
+   tcpip thread sleeps in sys_timeouts_mbox_fetch(). The time of the first
+   timeout counts from timeouts_last_time, and a timeout that becomes the
+   first one wakes the thread with a timeouts_wakeup message so that it
+   does not oversleep. */
+static u32_t timeouts_last_time;
+static sys_mbox_t *timeouts_mbox;
+static int timeouts_waiting;
+static int timeouts_wakeup_pending;
+static u8_t timeouts_wakeup;
+
+/**
+ * Charge the time passed since timeouts_last_time to the first timeout.
+ * Called with the core locked.
+ */
+static void
+sys_timeouts_catch_up(void)
+{
+  u32_t now, diff;
+
+  now = sys_now();
+  diff = now - timeouts_last_time;
+  timeouts_last_time = now;
+
+  if (next_timeout != NULL) {
+    if (diff < next_timeout->time) {
+      next_timeout->time -= diff;
+    } else {
+      next_timeout->time = 0;
+    }
+  }
+}
+
+/**
+ * Wake the tcpip thread if it waits for a timeout later than the first one.
+ * Called with the core locked.
+ */
+static void
+sys_timeouts_wakeup(void)
+{
+  if (timeouts_waiting && !timeouts_wakeup_pending) {
+    timeouts_wakeup_pending = 1;
+    sys_mbox_post(timeouts_mbox, &timeouts_wakeup);
+  }
+}
 #endif /* NO_SYS */
 
 #if LWIP_TCP
@@ -281,8 +327,16 @@ sys_timeout(u32_t msecs, sys_timeout_handler handler, void *arg)
     (void *)timeout, msecs, handler_name, (void *)arg));
 #endif /* LWIP_DEBUG_TIMERNAMES */
 
+#if !NO_SYS
+  /* The first timeout's time has to count from now to compare with msecs */
+  sys_timeouts_catch_up();
+#endif /* !NO_SYS */
+
   if (next_timeout == NULL) {
     next_timeout = timeout;
+#if !NO_SYS
+    sys_timeouts_wakeup();
+#endif /* !NO_SYS */
     return;
   }
 
@@ -290,6 +344,9 @@ sys_timeout(u32_t msecs, sys_timeout_handler handler, void *arg)
     next_timeout->time -= msecs;
     timeout->next = next_timeout;
     next_timeout = timeout;
+#if !NO_SYS
+    sys_timeouts_wakeup();
+#endif /* !NO_SYS */
   } else {
     for(t = next_timeout; t != NULL; t = t->next) {
       timeout->time -= t->time;
@@ -423,51 +480,56 @@ sys_timeouts_mbox_fetch(sys_mbox_t *mbox, void **msg)
   void *arg;
 
  again:
-  if (!next_timeout) {
-    time_needed = sys_arch_mbox_fetch(mbox, msg, 0);
-  } else {
-    if (next_timeout->time > 0) {
-      time_needed = sys_arch_mbox_fetch(mbox, msg, next_timeout->time);
-    } else {
-      time_needed = SYS_ARCH_TIMEOUT;
-    }
-
-    if (time_needed == SYS_ARCH_TIMEOUT) {
-      /* If time == SYS_ARCH_TIMEOUT, a timeout occured before a message
-         could be fetched. We should now call the timeout handler and
-         deallocate the memory allocated for the timeout. */
-      tmptimeout = next_timeout;
-      next_timeout = tmptimeout->next;
-      handler = tmptimeout->h;
-      arg = tmptimeout->arg;
+  /* The timeout list is shared with sys_timeout() callers on other
+     processors, so it is only touched with the core locked. */
+  LOCK_TCPIP_CORE();
+  sys_timeouts_catch_up();
+
+  if (next_timeout && next_timeout->time == 0) {
+    /* The first timeout has expired. Call the timeout handler and
+       deallocate the memory allocated for the timeout. */
+    tmptimeout = next_timeout;
+    next_timeout = tmptimeout->next;
+    handler = tmptimeout->h;
+    arg = tmptimeout->arg;
 #if LWIP_DEBUG_TIMERNAMES
-      if (handler != NULL) {
-        LWIP_DEBUGF(TIMERS_DEBUG, ("stmf calling h=%s arg=%p\n",
-          tmptimeout->handler_name, arg));
-      }
+    if (handler != NULL) {
+      LWIP_DEBUGF(TIMERS_DEBUG, ("stmf calling h=%s arg=%p\n",
+        tmptimeout->handler_name, arg));
+    }
 #endif /* LWIP_DEBUG_TIMERNAMES */
-      memp_free(MEMP_SYS_TIMEOUT, tmptimeout);
-      if (handler != NULL) {
-        /* For LWIP_TCPIP_CORE_LOCKING, lock the core before calling the
-           timeout handler function. */
-        LOCK_TCPIP_CORE();
-        handler(arg);
-        UNLOCK_TCPIP_CORE();
-      }
-      LWIP_TCPIP_THREAD_ALIVE();
-
-      /* We try again to fetch a message from the mbox. */
-      goto again;
-    } else {
-      /* If time != SYS_ARCH_TIMEOUT, a message was received before the timeout
-         occured. The time variable is set to the number of
-         milliseconds we waited for the message. */
-      if (time_needed < next_timeout->time) {
-        next_timeout->time -= time_needed;
-      } else {
-        next_timeout->time = 0;
-      }
+    memp_free(MEMP_SYS_TIMEOUT, tmptimeout);
+    if (handler != NULL) {
+      handler(arg);
     }
+    UNLOCK_TCPIP_CORE();
+    LWIP_TCPIP_THREAD_ALIVE();
+
+    /* We try again to fetch a message from the mbox. */
+    goto again;
+  }
+
+  /* Sleep until the first timeout, or until a message arrives. A timeout
+     started meanwhile ahead of it posts timeouts_wakeup. */
+  time_needed = next_timeout ? next_timeout->time : 0;
+  timeouts_mbox = mbox;
+  timeouts_waiting = 1;
+  UNLOCK_TCPIP_CORE();
+
+  time_needed = sys_arch_mbox_fetch(mbox, msg, time_needed);
+
+  LOCK_TCPIP_CORE();
+  timeouts_waiting = 0;
+  if (time_needed != SYS_ARCH_TIMEOUT && *msg == &timeouts_wakeup) {
+    timeouts_wakeup_pending = 0;
+    time_needed = SYS_ARCH_TIMEOUT;
+  }
+  UNLOCK_TCPIP_CORE();
+
+  /* On a timeout or a wakeup, the time slept is charged to the first
+     timeout when the list is looked at again. */
+  if (time_needed == SYS_ARCH_TIMEOUT) {
+    goto again;
   }
 }
 
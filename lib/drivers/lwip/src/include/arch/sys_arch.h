@@ -15,6 +15,15 @@ typedef struct _sys_mbox_t
     int Valid;
 } sys_mbox_t;
 
+typedef struct _sys_mutex_t
+{
+    KSPIN_LOCK Lock;
+    KIRQL OldIrql;
+    PKTHREAD Owner;
+    ULONG RecursionCount;
+    int Valid;
+} sys_mutex_t;
+
 typedef KIRQL sys_prot_t;
 
 typedef u32_t sys_thread_t;
@@ -899,6 +899,16 @@
 #define TCP_WND                         (4 * TCP_MSS)
 #endif 
 
+/**
+ * TCP_WND_MAX: The largest receive window a connection may grow to when
+ * its receive buffer is autotuned. Connections start out with TCP_WND
+ * and grow towards this as the measured bandwidth-delay product demands.
+ * Anything above 0xffff needs LWIP_WND_SCALE.
+ */
+#ifndef TCP_WND_MAX
+#define TCP_WND_MAX                     TCP_WND
+#endif
+
 /**
  * TCP_MAXRTX: Maximum number of retransmissions of data segments.
  */
@@ -952,6 +962,15 @@
 #define TCP_SND_BUF                     256
 #endif
 
+/**
+ * TCP_SND_BUF_MAX: The largest sender buffer space (bytes) a connection may
+ * grow to when its send buffer is autotuned. Connections start out with
+ * TCP_SND_BUF.
+ */
+#ifndef TCP_SND_BUF_MAX
+#define TCP_SND_BUF_MAX                 TCP_SND_BUF
+#endif
+
 /**
  * TCP_SND_QUEUELEN: TCP sender buffer space (pbufs). This must be at least
  * as much as (2 * TCP_SND_BUF/TCP_MSS) for things to work.
@@ -1019,6 +1038,20 @@
 #define LWIP_TCP_TIMESTAMPS             0
 #endif
 
+/**
+ * LWIP_WND_SCALE==1: support the TCP window scale option (RFC 1323).
+ * TCP_RCV_SCALE is the shift count we offer for our receive window
+ * (0..14); it must be large enough for TCP_WND_MAX to fit in
+ * (0xffff << TCP_RCV_SCALE).
+ */
+#ifndef LWIP_WND_SCALE
+#define LWIP_WND_SCALE                  0
+#endif
+
+#ifndef TCP_RCV_SCALE
+#define TCP_RCV_SCALE                   0
+#endif
+
 /**
  * TCP_WND_UPDATE_THRESHOLD: difference in window to trigger an
  * explicit window update
@@ -151,6 +151,13 @@ enum tcp_state {
 #define DEF_ACCEPT_CALLBACK
 #endif /* LWIP_CALLBACK_API */
 
+/** Type for window and buffer sizes: windows above 64K need window scaling */
+#if LWIP_WND_SCALE
+typedef u32_t tcpwnd_size_t;
+#else /* LWIP_WND_SCALE */
+typedef u16_t tcpwnd_size_t;
+#endif /* LWIP_WND_SCALE */
+
 /**
  * members common to struct tcp_pcb and struct tcp_listen_pcb
  */
@@ -175,23 +182,35 @@ struct tcp_pcb {
   /* ports are in host byte order */
   u16_t remote_port;
   
-  u8_t flags;
-#define TF_ACK_DELAY   ((u8_t)0x01U)   /* Delayed ACK. */
-#define TF_ACK_NOW     ((u8_t)0x02U)   /* Immediate ACK. */
-#define TF_INFR        ((u8_t)0x04U)   /* In fast recovery. */
-#define TF_TIMESTAMP   ((u8_t)0x08U)   /* Timestamp option enabled */
-#define TF_RXCLOSED    ((u8_t)0x10U)   /* rx closed by tcp_shutdown */
-#define TF_FIN         ((u8_t)0x20U)   /* Connection was closed locally (FIN segment enqueued). */
-#define TF_NODELAY     ((u8_t)0x40U)   /* Disable Nagle algorithm */
-#define TF_NAGLEMEMERR ((u8_t)0x80U)   /* nagle enabled, memerr, try to output to prevent delayed ACK to happen */
+  u16_t flags;
+#define TF_ACK_DELAY   ((u16_t)0x0001U)   /* Delayed ACK. */
+#define TF_ACK_NOW     ((u16_t)0x0002U)   /* Immediate ACK. */
+#define TF_INFR        ((u16_t)0x0004U)   /* In fast recovery. */
+#define TF_TIMESTAMP   ((u16_t)0x0008U)   /* Timestamp option enabled */
+#define TF_RXCLOSED    ((u16_t)0x0010U)   /* rx closed by tcp_shutdown */
+#define TF_FIN         ((u16_t)0x0020U)   /* Connection was closed locally (FIN segment enqueued). */
+#define TF_NODELAY     ((u16_t)0x0040U)   /* Disable Nagle algorithm */
+#define TF_NAGLEMEMERR ((u16_t)0x0080U)   /* nagle enabled, memerr, try to output to prevent delayed ACK to happen */
+#define TF_WND_SCALE   ((u16_t)0x0100U)   /* Window scale option enabled */
+#define TF_RCVBUF_LOCK ((u16_t)0x0200U)   /* Receive buffer size set by the application, don't autotune */
+#define TF_SNDBUF_LOCK ((u16_t)0x0400U)   /* Send buffer size set by the application, don't autotune */
 
   /* the rest of the fields are in host byte order
      as we have to do some math with them */
   /* receiver variables */
   u32_t rcv_nxt;   /* next seqno expected */
-  u16_t rcv_wnd;   /* receiver window available */
-  u16_t rcv_ann_wnd; /* receiver window to announce */
+  tcpwnd_size_t rcv_wnd;   /* receiver window available */
+  tcpwnd_size_t rcv_ann_wnd; /* receiver window to announce */
   u32_t rcv_ann_right_edge; /* announced right edge of window */
+  tcpwnd_size_t rcv_wnd_max; /* receive buffer size, rcv_wnd when all data is taken */
+
+  /* receive buffer autotuning */
+  u32_t rcv_rtt;       /* receiver side RTT estimate in ms, 0 if none yet */
+  u32_t rcv_rtt_seq;   /* seqno that ends the current RTT measurement */
+  u32_t rcv_rtt_time;  /* sys_now() when the current RTT measurement started */
+  tcpwnd_size_t rcv_space; /* most data received in one round trip so far */
+  u32_t rcv_space_seq;  /* rcv_nxt at the start of the current round trip */
+  u32_t rcv_space_time; /* sys_now() at the start of the current round trip */
 
   /* Timers */
   u32_t tmr;
@@ -215,19 +234,21 @@ struct tcp_pcb {
   u8_t dupacks;
   
   /* congestion avoidance/control variables */
-  u16_t cwnd;  
-  u16_t ssthresh;
+  tcpwnd_size_t cwnd;
+  tcpwnd_size_t ssthresh;
 
   /* sender variables */
   u32_t snd_nxt;   /* next new seqno to be sent */
-  u16_t snd_wnd;   /* sender window */
+  tcpwnd_size_t snd_wnd;   /* sender window */
   u32_t snd_wl1, snd_wl2; /* Sequence and acknowledgement numbers of last
                              window update. */
   u32_t snd_lbb;       /* Sequence number of next byte to be buffered. */
 
-  u16_t acked;
+  tcpwnd_size_t acked;
   
-  u16_t snd_buf;   /* Available buffer space for sending (in bytes). */
+  tcpwnd_size_t snd_buf;   /* Available buffer space for sending (in bytes). */
+  tcpwnd_size_t snd_buf_max; /* Send buffer size, snd_buf when nothing is queued. */
+  tcpwnd_size_t snd_buf_req; /* Send buffer size set by the application. */
 #define TCP_SNDQUEUELEN_OVERFLOW (0xffffU-3)
   u16_t snd_queuelen; /* Available buffer space for sending (in tcp_segs). */
 
@@ -277,6 +298,11 @@ struct tcp_pcb {
 
   /* KEEPALIVE counter */
   u8_t keep_cnt_sent;
+
+#if LWIP_WND_SCALE
+  u8_t snd_scale;  /* shift count for the windows the remote host announces */
+  u8_t rcv_scale;  /* shift count for the windows we announce */
+#endif /* LWIP_WND_SCALE */
 };
 
 struct tcp_pcb_listen {  
@@ -337,6 +363,8 @@ void             tcp_err     (struct tcp_pcb *pcb, tcp_err_fn err);
 #endif /* TCP_LISTEN_BACKLOG */
 
 void             tcp_recved  (struct tcp_pcb *pcb, u16_t len);
+void             tcp_setrcvbuf(struct tcp_pcb *pcb, u32_t size);
+void             tcp_setsndbuf(struct tcp_pcb *pcb, u32_t size);
 err_t            tcp_bind    (struct tcp_pcb *pcb, ip_addr_t *ipaddr,
                               u16_t port);
 err_t            tcp_connect (struct tcp_pcb *pcb, ip_addr_t *ipaddr,
@@ -10,7 +10,7 @@
 
 /* Define LWIP_COMPAT_MUTEX if the port has no mutexes and binary semaphores
  should be used instead */
-#define LWIP_COMPAT_MUTEX               1
+#define LWIP_COMPAT_MUTEX               0
 
 #define MEM_ALIGNMENT                   4
 
@@ -64,6 +64,14 @@
 
 #define TCP_SND_BUF                     TCP_WND
 
+/* Windows start at TCP_WND and TCP_SND_BUF and are autotuned up to
+ * these, or set with SO_RCVBUF and SO_SNDBUF */
+#define TCP_WND_MAX                     (256 * 1024)
+
+#define TCP_SND_BUF_MAX                 (256 * 1024)
+
+#define TCP_SND_QUEUELEN                ((4 * (TCP_SND_BUF_MAX) + (TCP_MSS - 1))/(TCP_MSS))
+
 #define TCP_MAXRTX                      8
 
 #define TCP_SYNMAXRTX                   4
@@ -72,10 +80,20 @@
 
 #define LWIP_TCP_TIMESTAMPS             1
 
+#define LWIP_WND_SCALE                  1
+
+#define TCP_RCV_SCALE                   3
+
 #define LWIP_CALLBACK_API               1
 
 #define LWIP_NETIF_API                  1
 
+/* Callers take the core lock and run the stack on their own processor;
+ * the tcpip thread is left with the timers and deferred frees */
+#define LWIP_TCPIP_CORE_LOCKING         1
+
+#define LWIP_TCPIP_CORE_LOCKING_INPUT   1
+
 #define LWIP_SOCKET                     0
 
 #define LWIP_NETCONN                    0
@@ -18,72 +18,6 @@ typedef struct _QUEUE_ENTRY
     LIST_ENTRY ListEntry;
 } QUEUE_ENTRY, *PQUEUE_ENTRY;
 
-struct lwip_callback_msg
-{
-    /* Synchronization */
-    KEVENT Event;
-    
-    /* Input */
-    union {
-        struct {
-            PVOID Arg;
-        } Socket;
-        struct {
-            PCONNECTION_ENDPOINT Connection;
-            struct ip_addr *IpAddress;
-            u16_t Port;
-        } Bind;
-        struct {
-            PCONNECTION_ENDPOINT Connection;
-            u8_t Backlog;
-        } Listen;
-        struct {
-            PCONNECTION_ENDPOINT Connection;
-            void *Data;
-            u16_t DataLength;
-        } Send;
-        struct {
-            PCONNECTION_ENDPOINT Connection;
-            struct ip_addr *IpAddress;
-            u16_t Port;
-        } Connect;
-        struct {
-            PCONNECTION_ENDPOINT Connection;
-            int shut_rx;
-            int shut_tx;
-        } Shutdown;
-        struct {
-            PCONNECTION_ENDPOINT Connection;
-            int Callback;
-        } Close;
-    } Input;
-    
-    /* Output */
-    union {
-        struct {
-            struct tcp_pcb *NewPcb;
-        } Socket;
-        struct {
-            err_t Error;
-        } Bind;
-        struct {
-            struct tcp_pcb *NewPcb;
-        } Listen;
-        struct {
-            err_t Error;
-        } Send;
-        struct {
-            err_t Error;
-        } Connect;
-        struct {
-            err_t Error;
-        } Shutdown;
-        struct {
-            err_t Error;
-        } Close;
-    } Output;
-};
-
 NTSTATUS    LibTCPGetDataFromConnectionQueue(PCONNECTION_ENDPOINT Connection, PUCHAR RecvBuffer, UINT RecvLen, UINT *Received);
 
 /* External TCP event handlers */
@@ -101,6 +35,7 @@ err_t       LibTCPSend(PCONNECTION_ENDPOINT Connection, void *const dataptr, con
 err_t       LibTCPConnect(PCONNECTION_ENDPOINT Connection, struct ip_addr *const ipaddr, const u16_t port);
 err_t       LibTCPShutdown(PCONNECTION_ENDPOINT Connection, const int shut_rx, const int shut_tx);
 err_t       LibTCPClose(PCONNECTION_ENDPOINT Connection, const int safe, const int callback);
+err_t       LibTCPSetBufferSizes(PCONNECTION_ENDPOINT Connection);
 
 err_t       LibTCPGetPeerName(PTCP_PCB pcb, struct ip_addr *const ipaddr, u16_t *const port);
 err_t       LibTCPGetHostName(PTCP_PCB pcb, struct ip_addr *const ipaddr, u16_t *const port);
@@ -111,4 +46,8 @@ void LibIPInsertPacket(void *ifarg, const void *const data, const u32_t size);
 void LibIPInitialize(void);
 void LibIPShutdown(void);
 
+/* lwIP core lock, taken ahead of any endpoint or address file lock */
+void LibIPLockCore(void);
+void LibIPUnlockCore(void);
+
 #endif
\ No newline at end of file
@@ -44,4 +44,16 @@ LibIPShutdown(void)
 {
     /* This is synchronous */
     sys_shutdown();
+}
+
+void
+LibIPLockCore(void)
+{
+    LOCK_TCPIP_CORE();
+}
+
+void
+LibIPUnlockCore(void)
+{
+    UNLOCK_TCPIP_CORE();
 }
\ No newline at end of file
@@ -19,16 +19,17 @@ static const char * const tcp_state_str[] = {
   "TIME_WAIT"
 };
 
-/* The way that lwIP does multi-threading is really not ideal for our purposes but
- * we best go along with it unless we want another unstable TCP library. lwIP uses
- * a thread called the "tcpip thread" which is the only one allowed to call raw API
- * functions. Since this is the case, for each of our LibTCP* functions, we queue a request
- * for a callback to "tcpip thread" which calls our LibTCP*Callback functions. Yes, this is
- * a lot of unnecessary thread swapping and it could definitely be faster, but I don't want
- * to going messing around in lwIP because I have no desire to create another mess like oskittcp */
-
-extern KEVENT TerminationEvent;
-extern NPAGED_LOOKASIDE_LIST MessageLookasideList;
+/* lwIP only lets one thread at a time into its raw API. We used to queue every LibTCP*
+ * request to the "tcpip thread" and wait for it there, which cost a pair of context
+ * switches for each send. lwIP is now built with core locking instead: our LibTCP*
+ * functions take the core lock (a spin lock, see sys_arch.c) and call the raw API on the
+ * caller's processor, and incoming segments are processed the same way on the receive
+ * DPC. The tcpip thread is left with the timers and deferred frees.
+ *
+ * lwIP calls our event handlers with the core lock held and those take endpoint and
+ * address file locks, so the core lock must always be taken first. Callers passing
+ * 'safe' are already running inside lwIP and hold it. */
+
 extern NPAGED_LOOKASIDE_LIST QueueEntryLookasideList;
 
 static
@@ -45,7 +46,7 @@ LibTCPEmptyQueue(PCONNECTION_ENDPOINT Connection)
         Entry = RemoveHeadList(&Connection->PacketQueue);
         qp = CONTAINING_RECORD(Entry, QUEUE_ENTRY, ListEntry);
 
-        /* We're in the tcpip thread here so this is safe */
+        /* We hold the core lock here so this is safe */
         pbuf_free(qp->p);
 
         ExFreeToNPagedLookasideList(&QueueEntryLookasideList, qp);
@@ -125,14 +126,16 @@ NTSTATUS LibTCPGetDataFromConnectionQueue(PCONNECTION_ENDPOINT Connection, PUCHA
                 RtlCopyMemory(RecvBuffer + (*Received), p->payload, p->len);
             }
 
-            LockObject(Connection, &OldIrql);
+            /* The core lock ranks above ours so free the pbuf before relocking */
+            LOCK_TCPIP_CORE();
+            pbuf_free(qp->p);
+            UNLOCK_TCPIP_CORE();
 
-            RecvLen -= ReadLength;
+            ExFreeToNPagedLookasideList(&QueueEntryLookasideList, qp);
 
-            /* Use this special pbuf free callback function because we're outside tcpip thread */
-            pbuf_free_callback(qp->p);
+            LockObject(Connection, &OldIrql);
 
-            ExFreeToNPagedLookasideList(&QueueEntryLookasideList, qp);
+            RecvLen -= ReadLength;
 
             if (!RecvLen)
                 break;
@@ -154,31 +157,6 @@ NTSTATUS LibTCPGetDataFromConnectionQueue(PCONNECTION_ENDPOINT Connection, PUCHA
     return Status;
 }
 
-static
-BOOLEAN
-WaitForEventSafely(PRKEVENT Event)
-{
-    PVOID WaitObjects[] = {Event, &TerminationEvent};
-
-    if (KeWaitForMultipleObjects(2,
-                                 WaitObjects,
-                                 WaitAny,
-                                 Executive,
-                                 KernelMode,
-                                 FALSE,
-                                 NULL,
-                                 NULL) == STATUS_WAIT_0)
-    {
-        /* Signalled by the caller's event */
-        return TRUE;
-    }
-    else /* if KeWaitForMultipleObjects() == STATUS_WAIT_1 */
-    {
-        /* Signalled by our termination event */
-        return FALSE;
-    }
-}
-
 static
 err_t
 InternalSendEventHandler(void *arg, PTCP_PCB pcb, const u16_t space)
@@ -267,440 +245,256 @@ InternalErrorEventHandler(void *arg, const err_t err)
     TCPFinEventHandler(arg, err);
 }
 
-static
-void
-LibTCPSocketCallback(void *arg)
-{
-    struct lwip_callback_msg *msg = arg;
-
-    ASSERT(msg);
-
-    msg->Output.Socket.NewPcb = tcp_new();
-
-    if (msg->Output.Socket.NewPcb)
-    {
-        tcp_arg(msg->Output.Socket.NewPcb, msg->Input.Socket.Arg);
-        tcp_err(msg->Output.Socket.NewPcb, InternalErrorEventHandler);
-    }
-
-    KeSetEvent(&msg->Event, IO_NO_INCREMENT, FALSE);
-}
-
 struct tcp_pcb *
 LibTCPSocket(void *arg)
 {
-    struct lwip_callback_msg *msg = ExAllocateFromNPagedLookasideList(&MessageLookasideList);
     struct tcp_pcb *ret;
 
-    if (msg)
-    {
-        KeInitializeEvent(&msg->Event, NotificationEvent, FALSE);
-        msg->Input.Socket.Arg = arg;
-
-        tcpip_callback_with_block(LibTCPSocketCallback, msg, 1);
-
-        if (WaitForEventSafely(&msg->Event))
-            ret = msg->Output.Socket.NewPcb;
-        else
-            ret = NULL;
-
-        ExFreeToNPagedLookasideList(&MessageLookasideList, msg);
-
-        return ret;
-    }
-
-    return NULL;
-}
-
-static
-void
-LibTCPBindCallback(void *arg)
-{
-    struct lwip_callback_msg *msg = arg;
+    LOCK_TCPIP_CORE();
 
-    ASSERT(msg);
-
-    if (!msg->Input.Bind.Connection->SocketContext)
+    ret = tcp_new();
+    if (ret)
     {
-        msg->Output.Bind.Error = ERR_CLSD;
-        goto done;
+        tcp_arg(ret, arg);
+        tcp_err(ret, InternalErrorEventHandler);
     }
 
-    msg->Output.Bind.Error = tcp_bind((PTCP_PCB)msg->Input.Bind.Connection->SocketContext,
-                                      msg->Input.Bind.IpAddress,
-                                      ntohs(msg->Input.Bind.Port));
+    UNLOCK_TCPIP_CORE();
 
-done:
-    KeSetEvent(&msg->Event, IO_NO_INCREMENT, FALSE);
+    return ret;
 }
 
 err_t
 LibTCPBind(PCONNECTION_ENDPOINT Connection, struct ip_addr *const ipaddr, const u16_t port)
 {
-    struct lwip_callback_msg *msg;
     err_t ret;
 
-    msg = ExAllocateFromNPagedLookasideList(&MessageLookasideList);
-    if (msg)
-    {
-        KeInitializeEvent(&msg->Event, NotificationEvent, FALSE);
-        msg->Input.Bind.Connection = Connection;
-        msg->Input.Bind.IpAddress = ipaddr;
-        msg->Input.Bind.Port = port;
-
-        tcpip_callback_with_block(LibTCPBindCallback, msg, 1);
-
-        if (WaitForEventSafely(&msg->Event))
-            ret = msg->Output.Bind.Error;
-        else
-            ret = ERR_CLSD;
-
-        ExFreeToNPagedLookasideList(&MessageLookasideList, msg);
-
-        return ret;
-    }
-
-    return ERR_MEM;
-}
-
-static
-void
-LibTCPListenCallback(void *arg)
-{
-    struct lwip_callback_msg *msg = arg;
-
-    ASSERT(msg);
-
-    if (!msg->Input.Listen.Connection->SocketContext)
-    {
-        msg->Output.Listen.NewPcb = NULL;
-        goto done;
-    }
+    LOCK_TCPIP_CORE();
 
-    msg->Output.Listen.NewPcb = tcp_listen_with_backlog((PTCP_PCB)msg->Input.Listen.Connection->SocketContext, msg->Input.Listen.Backlog);
+    if (Connection->SocketContext)
+        ret = tcp_bind((PTCP_PCB)Connection->SocketContext, ipaddr, ntohs(port));
+    else
+        ret = ERR_CLSD;
 
-    if (msg->Output.Listen.NewPcb)
-    {
-        tcp_accept(msg->Output.Listen.NewPcb, InternalAcceptEventHandler);
-    }
+    UNLOCK_TCPIP_CORE();
 
-done:
-    KeSetEvent(&msg->Event, IO_NO_INCREMENT, FALSE);
+    return ret;
 }
 
 PTCP_PCB
 LibTCPListen(PCONNECTION_ENDPOINT Connection, const u8_t backlog)
 {
-    struct lwip_callback_msg *msg;
-    PTCP_PCB ret;
-
-    msg = ExAllocateFromNPagedLookasideList(&MessageLookasideList);
-    if (msg)
-    {
-        KeInitializeEvent(&msg->Event, NotificationEvent, FALSE);
-        msg->Input.Listen.Connection = Connection;
-        msg->Input.Listen.Backlog = backlog;
+    PTCP_PCB ret = NULL;
 
-        tcpip_callback_with_block(LibTCPListenCallback, msg, 1);
-
-        if (WaitForEventSafely(&msg->Event))
-            ret = msg->Output.Listen.NewPcb;
-        else
-            ret = NULL;
+    LOCK_TCPIP_CORE();
 
-        ExFreeToNPagedLookasideList(&MessageLookasideList, msg);
+    if (Connection->SocketContext)
+    {
+        ret = tcp_listen_with_backlog((PTCP_PCB)Connection->SocketContext, backlog);
 
-        return ret;
+        if (ret)
+        {
+            tcp_accept(ret, InternalAcceptEventHandler);
+        }
     }
 
-    return NULL;
+    UNLOCK_TCPIP_CORE();
+
+    return ret;
 }
 
-static
-void
-LibTCPSendCallback(void *arg)
+err_t
+LibTCPSend(PCONNECTION_ENDPOINT Connection, void *const dataptr, const u16_t len, const int safe)
 {
-    struct lwip_callback_msg *msg = arg;
-
-    ASSERT(msg);
+    err_t ret;
 
-    if (!msg->Input.Send.Connection->SocketContext)
-    {
-        msg->Output.Send.Error = ERR_CLSD;
-        goto done;
-    }
+    if (!safe)
+        LOCK_TCPIP_CORE();
 
-    if (msg->Input.Send.Connection->SendShutdown)
+    if (!Connection->SocketContext || Connection->SendShutdown)
     {
-        msg->Output.Send.Error = ERR_CLSD;
+        ret = ERR_CLSD;
         goto done;
     }
 
-    msg->Output.Send.Error = tcp_write((PTCP_PCB)msg->Input.Send.Connection->SocketContext,
-                                       msg->Input.Send.Data,
-                                       msg->Input.Send.DataLength,
-                                       TCP_WRITE_FLAG_COPY);
-    if (msg->Output.Send.Error == ERR_MEM)
+    ret = tcp_write((PTCP_PCB)Connection->SocketContext, dataptr, len, TCP_WRITE_FLAG_COPY);
+    if (ret == ERR_MEM)
     {
         /* No buffer space so return pending */
-        msg->Output.Send.Error = ERR_INPROGRESS;
+        ret = ERR_INPROGRESS;
     }
-    else if (msg->Output.Send.Error == ERR_OK)
+    else if (ret == ERR_OK)
     {
         /* Queued successfully so try to send it */
-        tcp_output((PTCP_PCB)msg->Input.Send.Connection->SocketContext);
+        tcp_output((PTCP_PCB)Connection->SocketContext);
     }
 
 done:
-    KeSetEvent(&msg->Event, IO_NO_INCREMENT, FALSE);
+    if (!safe)
+        UNLOCK_TCPIP_CORE();
+
+    return ret;
 }
 
 err_t
-LibTCPSend(PCONNECTION_ENDPOINT Connection, void *const dataptr, const u16_t len, const int safe)
+LibTCPConnect(PCONNECTION_ENDPOINT Connection, struct ip_addr *const ipaddr, const u16_t port)
 {
     err_t ret;
-    struct lwip_callback_msg *msg;
-
-    msg = ExAllocateFromNPagedLookasideList(&MessageLookasideList);
-    if (msg)
-    {
-        KeInitializeEvent(&msg->Event, NotificationEvent, FALSE);
-        msg->Input.Send.Connection = Connection;
-        msg->Input.Send.Data = dataptr;
-        msg->Input.Send.DataLength = len;
-
-        if (safe)
-            LibTCPSendCallback(msg);
-        else
-            tcpip_callback_with_block(LibTCPSendCallback, msg, 1);
-
-        if (WaitForEventSafely(&msg->Event))
-            ret = msg->Output.Send.Error;
-        else
-            ret = ERR_CLSD;
-
-        ExFreeToNPagedLookasideList(&MessageLookasideList, msg);
-
-        return ret;
-    }
 
-    return ERR_MEM;
-}
+    LOCK_TCPIP_CORE();
 
-static
-void
-LibTCPConnectCallback(void *arg)
-{
-    struct lwip_callback_msg *msg = arg;
-    err_t Error;
-
-    ASSERT(arg);
-
-    if (!msg->Input.Connect.Connection->SocketContext)
+    if (!Connection->SocketContext)
     {
-        msg->Output.Connect.Error = ERR_CLSD;
+        ret = ERR_CLSD;
         goto done;
     }
 
-    tcp_recv((PTCP_PCB)msg->Input.Connect.Connection->SocketContext, InternalRecvEventHandler);
-    tcp_sent((PTCP_PCB)msg->Input.Connect.Connection->SocketContext, InternalSendEventHandler);
+    tcp_recv((PTCP_PCB)Connection->SocketContext, InternalRecvEventHandler);
+    tcp_sent((PTCP_PCB)Connection->SocketContext, InternalSendEventHandler);
 
-    Error = tcp_connect((PTCP_PCB)msg->Input.Connect.Connection->SocketContext,
-                        msg->Input.Connect.IpAddress, ntohs(msg->Input.Connect.Port),
-                        InternalConnectEventHandler);
+    ret = tcp_connect((PTCP_PCB)Connection->SocketContext,
+                      ipaddr, ntohs(port),
+                      InternalConnectEventHandler);
 
-    msg->Output.Connect.Error = Error == ERR_OK ? ERR_INPROGRESS : Error;
+    if (ret == ERR_OK)
+        ret = ERR_INPROGRESS;
 
 done:
-    KeSetEvent(&msg->Event, IO_NO_INCREMENT, FALSE);
+    UNLOCK_TCPIP_CORE();
+
+    return ret;
 }
 
 err_t
-LibTCPConnect(PCONNECTION_ENDPOINT Connection, struct ip_addr *const ipaddr, const u16_t port)
+LibTCPShutdown(PCONNECTION_ENDPOINT Connection, const int shut_rx, const int shut_tx)
 {
-    struct lwip_callback_msg *msg;
+    PTCP_PCB pcb;
     err_t ret;
 
-    msg = ExAllocateFromNPagedLookasideList(&MessageLookasideList);
-    if (msg)
-    {
-        KeInitializeEvent(&msg->Event, NotificationEvent, FALSE);
-        msg->Input.Connect.Connection = Connection;
-        msg->Input.Connect.IpAddress = ipaddr;
-        msg->Input.Connect.Port = port;
-
-        tcpip_callback_with_block(LibTCPConnectCallback, msg, 1);
+    LOCK_TCPIP_CORE();
 
-        if (WaitForEventSafely(&msg->Event))
-        {
-            ret = msg->Output.Connect.Error;
-        }
-        else
-            ret = ERR_CLSD;
-
-        ExFreeToNPagedLookasideList(&MessageLookasideList, msg);
-
-        return ret;
-    }
-
-    return ERR_MEM;
-}
-
-static
-void
-LibTCPShutdownCallback(void *arg)
-{
-    struct lwip_callback_msg *msg = arg;
-    PTCP_PCB pcb = msg->Input.Shutdown.Connection->SocketContext;
-
-    if (!msg->Input.Shutdown.Connection->SocketContext)
+    pcb = Connection->SocketContext;
+    if (!pcb)
     {
-        msg->Output.Shutdown.Error = ERR_CLSD;
+        ret = ERR_CLSD;
         goto done;
     }
 
     if (pcb->state == CLOSE_WAIT)
     {
         /* This case actually results in a socket closure later (lwIP bug?) */
-        msg->Input.Shutdown.Connection->SocketContext = NULL;
+        Connection->SocketContext = NULL;
     }
 
-    msg->Output.Shutdown.Error = tcp_shutdown(pcb, msg->Input.Shutdown.shut_rx, msg->Input.Shutdown.shut_tx);
-    if (msg->Output.Shutdown.Error)
+    ret = tcp_shutdown(pcb, shut_rx, shut_tx);
+    if (ret)
     {
-        msg->Input.Shutdown.Connection->SocketContext = pcb;
+        Connection->SocketContext = pcb;
     }
     else
     {
-        if (msg->Input.Shutdown.shut_rx)
-            msg->Input.Shutdown.Connection->ReceiveShutdown = TRUE;
+        if (shut_rx)
+            Connection->ReceiveShutdown = TRUE;
 
-        if (msg->Input.Shutdown.shut_tx)
-            msg->Input.Shutdown.Connection->SendShutdown = TRUE;
+        if (shut_tx)
+            Connection->SendShutdown = TRUE;
     }
 
 done:
-    KeSetEvent(&msg->Event, IO_NO_INCREMENT, FALSE);
+    UNLOCK_TCPIP_CORE();
+
+    return ret;
 }
 
 err_t
-LibTCPShutdown(PCONNECTION_ENDPOINT Connection, const int shut_rx, const int shut_tx)
+LibTCPClose(PCONNECTION_ENDPOINT Connection, const int safe, const int callback)
 {
-    struct lwip_callback_msg *msg;
+    PTCP_PCB pcb;
     err_t ret;
 
-    msg = ExAllocateFromNPagedLookasideList(&MessageLookasideList);
-    if (msg)
-    {
-        KeInitializeEvent(&msg->Event, NotificationEvent, FALSE);
-
-        msg->Input.Shutdown.Connection = Connection;
-        msg->Input.Shutdown.shut_rx = shut_rx;
-        msg->Input.Shutdown.shut_tx = shut_tx;
-
-        tcpip_callback_with_block(LibTCPShutdownCallback, msg, 1);
-
-        if (WaitForEventSafely(&msg->Event))
-            ret = msg->Output.Shutdown.Error;
-        else
-            ret = ERR_CLSD;
-
-        ExFreeToNPagedLookasideList(&MessageLookasideList, msg);
-
-        return ret;
-    }
-
-    return ERR_MEM;
-}
-
-static
-void
-LibTCPCloseCallback(void *arg)
-{
-    struct lwip_callback_msg *msg = arg;
-    PTCP_PCB pcb = msg->Input.Close.Connection->SocketContext;
+    if (!safe)
+        LOCK_TCPIP_CORE();
 
     /* Empty the queue even if we're already "closed" */
-    LibTCPEmptyQueue(msg->Input.Close.Connection);
+    LibTCPEmptyQueue(Connection);
 
-    if (!msg->Input.Close.Connection->SocketContext)
+    pcb = Connection->SocketContext;
+    if (!pcb)
     {
-        msg->Output.Close.Error = ERR_OK;
+        ret = ERR_OK;
         goto done;
     }
 
     /* Clear the PCB pointer */
-    msg->Input.Close.Connection->SocketContext = NULL;
+    Connection->SocketContext = NULL;
 
     switch (pcb->state)
     {
         case CLOSED:
         case LISTEN:
         case SYN_SENT:
-           msg->Output.Close.Error = tcp_close(pcb);
+           ret = tcp_close(pcb);
 
-           if (!msg->Output.Close.Error && msg->Input.Close.Callback)
-               TCPFinEventHandler(msg->Input.Close.Connection, ERR_OK);
+           if (!ret && callback)
+               TCPFinEventHandler(Connection, ERR_OK);
            break;
 
         default:
-           if (msg->Input.Close.Connection->SendShutdown &&
-               msg->Input.Close.Connection->ReceiveShutdown)
+           if (Connection->SendShutdown &&
+               Connection->ReceiveShutdown)
            {
                /* Abort the connection */
                tcp_abort(pcb);
 
                /* Aborts always succeed */
-               msg->Output.Close.Error = ERR_OK;
+               ret = ERR_OK;
            }
            else
            {
                /* Start the graceful close process (or send RST for pending data) */
-               msg->Output.Close.Error = tcp_close(pcb);
+               ret = tcp_close(pcb);
            }
            break;
     }
 
-    if (msg->Output.Close.Error)
+    if (ret)
     {
         /* Restore the PCB pointer */
-        msg->Input.Close.Connection->SocketContext = pcb;
+        Connection->SocketContext = pcb;
     }
 
 done:
-    KeSetEvent(&msg->Event, IO_NO_INCREMENT, FALSE);
+    if (!safe)
+        UNLOCK_TCPIP_CORE();
+
+    return ret;
 }
 
-err_t
-LibTCPClose(PCONNECTION_ENDPOINT Connection, const int safe, const int callback)
+static
+void
+LibTCPApplyBufferSizes(PTCP_PCB pcb, PCONNECTION_ENDPOINT Connection)
 {
-    err_t ret;
-    struct lwip_callback_msg *msg;
-
-    msg = ExAllocateFromNPagedLookasideList(&MessageLookasideList);
-    if (msg)
-    {
-        KeInitializeEvent(&msg->Event, NotificationEvent, FALSE);
+    /* A size of 0 leaves the buffer to autotuning */
+    tcp_setrcvbuf(pcb, Connection->ReceiveBufferSize);
+    tcp_setsndbuf(pcb, Connection->SendBufferSize);
+}
 
-        msg->Input.Close.Connection = Connection;
-        msg->Input.Close.Callback = callback;
+err_t
+LibTCPSetBufferSizes(PCONNECTION_ENDPOINT Connection)
+{
+    PTCP_PCB pcb;
 
-        if (safe)
-            LibTCPCloseCallback(msg);
-        else
-            tcpip_callback_with_block(LibTCPCloseCallback, msg, 1);
+    LOCK_TCPIP_CORE();
 
-        if (WaitForEventSafely(&msg->Event))
-            ret = msg->Output.Close.Error;
-        else
-            ret = ERR_CLSD;
+    /* The sizes are applied again when a connection is accepted on
+       this endpoint, so there is nothing to do until there is one */
+    pcb = Connection->SocketContext;
+    if (pcb && pcb->state != LISTEN)
+        LibTCPApplyBufferSizes(pcb, Connection);
 
-        ExFreeToNPagedLookasideList(&MessageLookasideList, msg);
+    UNLOCK_TCPIP_CORE();
 
-        return ret;
-    }
-
-    return ERR_MEM;
+    return ERR_OK;
 }
 
 void
@@ -714,6 +508,8 @@ LibTCPAccept(PTCP_PCB pcb, struct tcp_pcb *listen_pcb, void *arg)
     tcp_err(pcb, InternalErrorEventHandler);
     tcp_arg(pcb, arg);
 
+    LibTCPApplyBufferSizes(pcb, arg);
+
     tcp_accepted(listen_pcb);
 }
 
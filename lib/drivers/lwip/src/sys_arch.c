@@ -12,7 +12,6 @@ static LIST_ENTRY ThreadListHead;
 static KSPIN_LOCK ThreadListLock;
 
 KEVENT TerminationEvent;
-NPAGED_LOOKASIDE_LIST MessageLookasideList;
 NPAGED_LOOKASIDE_LIST QueueEntryLookasideList;
 
 static LARGE_INTEGER StartTime;
@@ -129,6 +128,79 @@ sys_arch_sem_wait(sys_sem_t* sem, u32_t timeout)
     return SYS_ARCH_TIMEOUT;
 }
 
+err_t
+sys_mutex_new(sys_mutex_t *mutex)
+{
+    /* This only backs the core lock, which is held for short runs of lwIP code
+     * on whatever processor needs them (often a receive DPC), so it is a spin lock.
+     * lwIP calls back into us with it held and we may call into lwIP again from
+     * there, so the owner is allowed to take it recursively */
+    KeInitializeSpinLock(&mutex->Lock);
+
+    mutex->Owner = NULL;
+    mutex->RecursionCount = 0;
+
+    mutex->Valid = 1;
+
+    return ERR_OK;
+}
+
+int sys_mutex_valid(sys_mutex_t *mutex)
+{
+    return mutex->Valid;
+}
+
+void sys_mutex_set_invalid(sys_mutex_t *mutex)
+{
+    mutex->Valid = 0;
+}
+
+void
+sys_mutex_free(sys_mutex_t *mutex)
+{
+    ASSERT(mutex->Owner == NULL);
+
+    sys_mutex_set_invalid(mutex);
+}
+
+void
+sys_mutex_lock(sys_mutex_t *mutex)
+{
+    PKTHREAD Thread = KeGetCurrentThread();
+    KIRQL OldIrql;
+
+    /* Only the owner can see itself here since it runs at DISPATCH_LEVEL
+     * until the lock is dropped */
+    if (mutex->Owner == Thread)
+    {
+        mutex->RecursionCount++;
+        return;
+    }
+
+    KeAcquireSpinLock(&mutex->Lock, &OldIrql);
+
+    mutex->OldIrql = OldIrql;
+    mutex->Owner = Thread;
+    mutex->RecursionCount = 1;
+}
+
+void
+sys_mutex_unlock(sys_mutex_t *mutex)
+{
+    KIRQL OldIrql;
+
+    ASSERT(mutex->Owner == KeGetCurrentThread());
+    ASSERT(mutex->RecursionCount != 0);
+
+    if (--mutex->RecursionCount != 0)
+        return;
+
+    OldIrql = mutex->OldIrql;
+    mutex->Owner = NULL;
+
+    KeReleaseSpinLock(&mutex->Lock, OldIrql);
+}
+
 err_t
 sys_mbox_new(sys_mbox_t *mbox, int size)
 {    
@@ -316,14 +388,6 @@ sys_init(void)
     
     KeInitializeEvent(&TerminationEvent, NotificationEvent, FALSE);
     
-    ExInitializeNPagedLookasideList(&MessageLookasideList,
-                                    NULL,
-                                    NULL,
-                                    0,
-                                    sizeof(struct lwip_callback_msg),
-                                    LWIP_TAG,
-                                    0);
-    
     ExInitializeNPagedLookasideList(&QueueEntryLookasideList,
                                     NULL,
                                     NULL,
@@ -359,6 +423,5 @@ sys_shutdown(void)
         }
     }
     
-    ExDeleteNPagedLookasideList(&MessageLookasideList);
     ExDeleteNPagedLookasideList(&QueueEntryLookasideList);
 }
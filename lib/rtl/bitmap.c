@@ -287,8 +287,11 @@ RtlClearBits(
 
     /* Clear what's left */
     NumberToClear &= 31;
-    Mask = MAXULONG << NumberToClear;
-    *Buffer &= Mask;
+    if (NumberToClear != 0)
+    {
+        Mask = MAXULONG << NumberToClear;
+        *Buffer &= Mask;
+    }
 }
 
 VOID
@@ -344,8 +347,11 @@ RtlSetBits(
 
     /* Set what's left */
     NumberToSet &= 31;
-    Mask = MAXULONG << NumberToSet;
-    *Buffer |= ~Mask;
+    if (NumberToSet != 0)
+    {
+        Mask = MAXULONG << NumberToSet;
+        *Buffer |= ~Mask;
+    }
 }
 
 BOOLEAN
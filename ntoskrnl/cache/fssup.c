@@ -18,6 +18,7 @@
 /* GLOBALS ********************************************************************/
 
 PFSN_PREFETCHER_GLOBALS CcPfGlobals;
+ULONG CcPfEnablePrefetcher;
 extern LONG CcOutstandingDeletes;
 extern KEVENT CcpLazyWriteEvent;
 extern KEVENT CcFinalizeEvent;
@@ -128,6 +129,26 @@ CcPfInitializePrefetcher(VOID)
     /* FIXME: Setup the rest of the prefetecher */
 }
 
+VOID
+NTAPI
+CcPfBeginAppLaunch(IN PEPROCESS Process)
+{
+    /* FIXME: The launch prefetcher needs the old cache manager */
+}
+
+VOID
+NTAPI
+CcPfProcessExitNotification(IN PEPROCESS Process)
+{
+}
+
+VOID
+NTAPI
+CcPfLogPageFault(IN PFILE_OBJECT FileObject,
+                 IN ULONG FileOffset)
+{
+}
+
 BOOLEAN
 NTAPI
 CcpAcquireFileLock(PNOCC_CACHE_MAP Map)
@@ -31,6 +31,7 @@ CcPfInitializePrefetcher(VOID)
     InitializeListHead(&CcPfGlobals.ActiveTraces);
     InitializeListHead(&CcPfGlobals.CompletedTraces);
     ExInitializeFastMutex(&CcPfGlobals.CompletedTracesLock);
+    KeInitializeSpinLock(&CcPfGlobals.ActiveTracesLock);
 
     /* FIXME: Setup the rest of the prefetecher */
 }
@@ -0,0 +1,638 @@
+/*
+ * COPYRIGHT:       See COPYING in the top level directory
+ * PROJECT:         Odyssey kernel
+ * FILE:            ntoskrnl/cc/prefetch.c
+ * PURPOSE:         Application launch prefetcher
+ *
+ * PROGRAMMERS:
+ */
+
+/* INCLUDES *****************************************************************/
+
+#include <ntoskrnl.h>
+#define NDEBUG
+#include <debug.h>
+
+/* GLOBALS *******************************************************************/
+
+ULONG CcPfEnablePrefetcher;
+EX_PUSH_LOCK CcPfTraceLock;
+UNICODE_STRING CcPfPrefetchDirectory = RTL_CONSTANT_STRING(L"\\SystemRoot\\Prefetch");
+
+/* PRIVATE FUNCTIONS *********************************************************/
+
+NTSTATUS
+NTAPI
+CcPfBuildTraceFileName(IN PEPROCESS Process,
+                       OUT PUNICODE_STRING TraceFileName)
+{
+    POBJECT_NAME_INFORMATION ImageName;
+    ULONG Hash = 0, i;
+    WCHAR Buffer[64];
+    PCHAR Name;
+    USHORT Length;
+
+    /* We need the full image name to tell same-named images apart */
+    ImageName = Process->SeAuditProcessCreationInfo.ImageFileName;
+    if (!(ImageName) || !(ImageName->Name.Length)) return STATUS_OBJECT_NAME_NOT_FOUND;
+
+    /* Hash it */
+    for (i = 0; i < ImageName->Name.Length / sizeof(WCHAR); i++)
+    {
+        Hash = (Hash * 37) + RtlUpcaseUnicodeChar(ImageName->Name.Buffer[i]);
+    }
+
+    /* The trace is named after the image, like "NOTEPAD.EXE-1A2B3C4D.pf" */
+    for (Name = (PCHAR)Process->ImageFileName, i = 0; (*Name) && (i < 16); i++)
+    {
+        Buffer[i] = RtlUpcaseUnicodeChar((UCHAR)*Name++);
+    }
+    swprintf(Buffer + i, L"-%08lX.pf", Hash);
+
+    /* Build the full path */
+    Length = CcPfPrefetchDirectory.Length + sizeof(WCHAR) +
+             (USHORT)(wcslen(Buffer) * sizeof(WCHAR));
+    TraceFileName->Buffer = ExAllocatePoolWithTag(PagedPool,
+                                                  Length + sizeof(UNICODE_NULL),
+                                                  TAG_PREFETCH);
+    if (!TraceFileName->Buffer) return STATUS_INSUFFICIENT_RESOURCES;
+    TraceFileName->Length = 0;
+    TraceFileName->MaximumLength = Length + sizeof(UNICODE_NULL);
+    RtlAppendUnicodeStringToString(TraceFileName, &CcPfPrefetchDirectory);
+    RtlAppendUnicodeToString(TraceFileName, L"\\");
+    RtlAppendUnicodeToString(TraceFileName, Buffer);
+    return STATUS_SUCCESS;
+}
+
+NTSTATUS
+NTAPI
+CcPfOpenFile(IN PUNICODE_STRING FileName,
+             IN ACCESS_MASK DesiredAccess,
+             IN ULONG Disposition,
+             IN ULONG Options,
+             OUT PHANDLE FileHandle)
+{
+    OBJECT_ATTRIBUTES ObjectAttributes;
+    IO_STATUS_BLOCK IoStatusBlock;
+
+    /* All our handles are kernel handles */
+    InitializeObjectAttributes(&ObjectAttributes,
+                               FileName,
+                               OBJ_CASE_INSENSITIVE | OBJ_KERNEL_HANDLE,
+                               NULL,
+                               NULL);
+    return ZwCreateFile(FileHandle,
+                        DesiredAccess | SYNCHRONIZE,
+                        &ObjectAttributes,
+                        &IoStatusBlock,
+                        NULL,
+                        FILE_ATTRIBUTE_NORMAL,
+                        FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE,
+                        Disposition,
+                        Options | FILE_SYNCHRONOUS_IO_NONALERT,
+                        NULL,
+                        0);
+}
+
+PPF_LAUNCH_TRACE
+NTAPI
+CcPfReadTrace(IN PUNICODE_STRING TraceFileName)
+{
+    FILE_STANDARD_INFORMATION FileInformation;
+    IO_STATUS_BLOCK IoStatusBlock;
+    PPF_LAUNCH_TRACE Trace = NULL;
+    PPF_LAUNCH_TRACE_FILE File;
+    HANDLE FileHandle;
+    NTSTATUS Status;
+    ULONG Size, i;
+
+    /* Open the trace of the previous launch, if there was one */
+    Status = CcPfOpenFile(TraceFileName,
+                          FILE_READ_DATA,
+                          FILE_OPEN,
+                          FILE_NON_DIRECTORY_FILE,
+                          &FileHandle);
+    if (!NT_SUCCESS(Status)) return NULL;
+
+    /* Get its size */
+    Status = ZwQueryInformationFile(FileHandle,
+                                    &IoStatusBlock,
+                                    &FileInformation,
+                                    sizeof(FileInformation),
+                                    FileStandardInformation);
+    if (!(NT_SUCCESS(Status)) ||
+        (FileInformation.EndOfFile.QuadPart < sizeof(PF_LAUNCH_TRACE)) ||
+        (FileInformation.EndOfFile.QuadPart > PF_MAX_TRACE_SIZE))
+    {
+        goto Quickie;
+    }
+    Size = FileInformation.EndOfFile.LowPart;
+
+    /* Read it in whole */
+    Trace = ExAllocatePoolWithTag(PagedPool, Size, TAG_PREFETCH);
+    if (!Trace) goto Quickie;
+    Status = ZwReadFile(FileHandle,
+                        NULL,
+                        NULL,
+                        NULL,
+                        &IoStatusBlock,
+                        Trace,
+                        Size,
+                        NULL,
+                        NULL);
+    if (!(NT_SUCCESS(Status)) || (IoStatusBlock.Information != Size)) goto Invalid;
+
+    /* Validate the header */
+    if ((Trace->Magic != PF_LAUNCH_TRACE_MAGIC) ||
+        (Trace->Version != PF_LAUNCH_TRACE_VERSION) ||
+        (Trace->Size != Size) ||
+        (Trace->NumFiles > PF_MAX_TRACE_FILES) ||
+        (Trace->NumPages > PF_MAX_TRACE_PAGES) ||
+        (Trace->FileTableOffset > Size) ||
+        ((Size - Trace->FileTableOffset) / sizeof(PF_LAUNCH_TRACE_FILE) < Trace->NumFiles) ||
+        (Trace->PageTableOffset > Size) ||
+        ((Size - Trace->PageTableOffset) / sizeof(ULONG) < Trace->NumPages))
+    {
+        goto Invalid;
+    }
+
+    /* And every file record */
+    File = (PPF_LAUNCH_TRACE_FILE)((ULONG_PTR)Trace + Trace->FileTableOffset);
+    for (i = 0; i < Trace->NumFiles; i++, File++)
+    {
+        if ((File->NameOffset > Size) ||
+            (File->NameLength > Size - File->NameOffset) ||
+            (File->NameLength > MAXUSHORT) ||
+            (File->NameLength & (sizeof(WCHAR) - 1)) ||
+            (File->FirstPage > Trace->NumPages) ||
+            (File->NumPages > Trace->NumPages - File->FirstPage))
+        {
+            goto Invalid;
+        }
+    }
+
+    /* It's good */
+    goto Quickie;
+
+Invalid:
+    /* Ignore it, the next launch writes a new one */
+    DPRINT1("Ignoring invalid prefetch trace %wZ\n", TraceFileName);
+    if (Trace) ExFreePoolWithTag(Trace, TAG_PREFETCH);
+    Trace = NULL;
+
+Quickie:
+    ZwClose(FileHandle);
+    return Trace;
+}
+
+VOID
+NTAPI
+CcPfPrefetchFiles(IN PPFSN_LAUNCH_TRACE LaunchTrace,
+                  IN PPF_LAUNCH_TRACE Trace)
+{
+    PPF_LAUNCH_TRACE_FILE File;
+    IO_STATUS_BLOCK IoStatusBlock;
+    UNICODE_STRING FileName;
+    LARGE_INTEGER Offset;
+    HANDLE FileHandle;
+    NTSTATUS Status;
+    PULONG Pages;
+    PVOID Buffer;
+    ULONG i, j, Run;
+
+    /* Get a buffer for the reads, the data only has to reach the cache */
+    Buffer = ExAllocatePoolWithTag(PagedPool, PF_MAX_PREFETCH_RUN, TAG_PREFETCH);
+    if (!Buffer) return;
+
+    File = (PPF_LAUNCH_TRACE_FILE)((ULONG_PTR)Trace + Trace->FileTableOffset);
+    Pages = (PULONG)((ULONG_PTR)Trace + Trace->PageTableOffset);
+    for (i = 0; i < Trace->NumFiles; i++, File++)
+    {
+        /* Open the file through the cache */
+        FileName.Buffer = (PWCHAR)((ULONG_PTR)Trace + File->NameOffset);
+        FileName.Length = FileName.MaximumLength = (USHORT)File->NameLength;
+        Status = CcPfOpenFile(&FileName,
+                              FILE_READ_DATA,
+                              FILE_OPEN,
+                              FILE_NON_DIRECTORY_FILE,
+                              &FileHandle);
+        if (!NT_SUCCESS(Status)) continue;
+
+        /* Read the pages the last launch faulted on in runs */
+        for (j = File->FirstPage; j < File->FirstPage + File->NumPages; j += Run)
+        {
+            /* Extend the run over consecutive pages */
+            for (Run = 1;
+                 (j + Run < File->FirstPage + File->NumPages) &&
+                 (Pages[j + Run] == Pages[j] + Run) &&
+                 ((Run + 1) << PAGE_SHIFT <= PF_MAX_PREFETCH_RUN);
+                 Run++);
+
+            /* Past the end of file just means it changed, so don't care */
+            Offset.QuadPart = (LONGLONG)Pages[j] << PAGE_SHIFT;
+            ZwReadFile(FileHandle,
+                       NULL,
+                       NULL,
+                       NULL,
+                       &IoStatusBlock,
+                       Buffer,
+                       Run << PAGE_SHIFT,
+                       &Offset,
+                       NULL);
+        }
+
+        /* Keep the file open, its cache map goes away with the last handle */
+        LaunchTrace->PrefetchHandles[i] = FileHandle;
+    }
+
+    ExFreePoolWithTag(Buffer, TAG_PREFETCH);
+}
+
+VOID
+NTAPI
+CcPfSortEntries(IN PULONGLONG Entries,
+                IN ULONG Count)
+{
+    ULONG Gap, i, j;
+    ULONGLONG Entry;
+
+    /* Shell sort, the traces are small */
+    for (Gap = Count / 2; Gap; Gap /= 2)
+    {
+        for (i = Gap; i < Count; i++)
+        {
+            Entry = Entries[i];
+            for (j = i; (j >= Gap) && (Entries[j - Gap] > Entry); j -= Gap)
+            {
+                Entries[j] = Entries[j - Gap];
+            }
+            Entries[j] = Entry;
+        }
+    }
+}
+
+VOID
+NTAPI
+CcPfWriteTrace(IN PPFSN_LAUNCH_TRACE LaunchTrace)
+{
+    POBJECT_NAME_INFORMATION Names[PF_MAX_TRACE_FILES];
+    PPF_LAUNCH_TRACE_FILE File;
+    PPF_LAUNCH_TRACE Trace;
+    IO_STATUS_BLOCK IoStatusBlock;
+    HANDLE FileHandle;
+    NTSTATUS Status;
+    PULONG Pages;
+    PWCHAR Name;
+    ULONG NumEntries, NumPages, NameSize, Size, Length, i, j;
+
+    /* Sort the faults by file and page, then drop the duplicates */
+    NumEntries = min(LaunchTrace->NumEntries, PF_MAX_TRACE_PAGES);
+    if (!NumEntries) return;
+    CcPfSortEntries(LaunchTrace->Entries, NumEntries);
+    for (i = 1, NumPages = 1; i < NumEntries; i++)
+    {
+        if (LaunchTrace->Entries[i] != LaunchTrace->Entries[NumPages - 1])
+        {
+            LaunchTrace->Entries[NumPages++] = LaunchTrace->Entries[i];
+        }
+    }
+
+    /* Get the names of the files */
+    RtlZeroMemory(Names, sizeof(Names));
+    for (i = 0, NameSize = 0; i < LaunchTrace->NumFiles; i++)
+    {
+        Status = ObQueryNameString(LaunchTrace->Files[i], NULL, 0, &Length);
+        if (Status != STATUS_INFO_LENGTH_MISMATCH) continue;
+
+        Names[i] = ExAllocatePoolWithTag(PagedPool, Length, TAG_PREFETCH);
+        if (!Names[i]) continue;
+
+        Status = ObQueryNameString(LaunchTrace->Files[i], Names[i], Length, &Length);
+        if (!NT_SUCCESS(Status))
+        {
+            ExFreePoolWithTag(Names[i], TAG_PREFETCH);
+            Names[i] = NULL;
+            continue;
+        }
+
+        NameSize += Names[i]->Name.Length;
+    }
+
+    /* Allocate the trace */
+    Size = sizeof(PF_LAUNCH_TRACE) +
+           LaunchTrace->NumFiles * sizeof(PF_LAUNCH_TRACE_FILE) +
+           NumPages * sizeof(ULONG) +
+           NameSize;
+    Trace = ExAllocatePoolWithTag(PagedPool, Size, TAG_PREFETCH);
+    if (!Trace) goto Quickie;
+
+    /* Fill out the header */
+    Trace->Magic = PF_LAUNCH_TRACE_MAGIC;
+    Trace->Version = PF_LAUNCH_TRACE_VERSION;
+    Trace->FileTableOffset = sizeof(PF_LAUNCH_TRACE);
+    Trace->PageTableOffset = Trace->FileTableOffset +
+                             LaunchTrace->NumFiles * sizeof(PF_LAUNCH_TRACE_FILE);
+    Trace->NumFiles = 0;
+    Trace->NumPages = 0;
+    File = (PPF_LAUNCH_TRACE_FILE)((ULONG_PTR)Trace + Trace->FileTableOffset);
+    Pages = (PULONG)((ULONG_PTR)Trace + Trace->PageTableOffset);
+    Name = (PWCHAR)(Pages + NumPages);
+
+    /* Add a record for every file we know the name of */
+    for (i = 0, j = 0; i < LaunchTrace->NumFiles; i++)
+    {
+        /* Skip to this file's pages */
+        while ((j < NumPages) && ((LaunchTrace->Entries[j] >> 32) < i)) j++;
+        if (!Names[i]) continue;
+
+        File->NameOffset = (ULONG)((ULONG_PTR)Name - (ULONG_PTR)Trace);
+        File->NameLength = Names[i]->Name.Length;
+        RtlCopyMemory(Name, Names[i]->Name.Buffer, File->NameLength);
+        Name += File->NameLength / sizeof(WCHAR);
+
+        File->FirstPage = Trace->NumPages;
+        while ((j < NumPages) && ((LaunchTrace->Entries[j] >> 32) == i))
+        {
+            Pages[Trace->NumPages++] = (ULONG)LaunchTrace->Entries[j++];
+        }
+        File->NumPages = Trace->NumPages - File->FirstPage;
+
+        Trace->NumFiles++;
+        File++;
+    }
+
+    /* Close the gap left by files without a name */
+    if (Trace->NumFiles != LaunchTrace->NumFiles)
+    {
+        Length = (ULONG)((ULONG_PTR)Name - (ULONG_PTR)Pages);
+        j = (LaunchTrace->NumFiles - Trace->NumFiles) * sizeof(PF_LAUNCH_TRACE_FILE);
+        RtlMoveMemory((PVOID)((ULONG_PTR)Pages - j), Pages, Length);
+        Trace->PageTableOffset -= j;
+        File = (PPF_LAUNCH_TRACE_FILE)((ULONG_PTR)Trace + Trace->FileTableOffset);
+        for (i = 0; i < Trace->NumFiles; i++) File[i].NameOffset -= j;
+        Name = (PWCHAR)((ULONG_PTR)Name - j);
+    }
+    Trace->Size = (ULONG)((ULONG_PTR)Name - (ULONG_PTR)Trace);
+
+    /* Make sure the directory is there */
+    Status = CcPfOpenFile(&CcPfPrefetchDirectory,
+                          FILE_LIST_DIRECTORY,
+                          FILE_OPEN_IF,
+                          FILE_DIRECTORY_FILE,
+                          &FileHandle);
+    if (NT_SUCCESS(Status))
+    {
+        ZwClose(FileHandle);
+
+        /* And replace the old trace */
+        Status = CcPfOpenFile(&LaunchTrace->TraceFileName,
+                              FILE_WRITE_DATA,
+                              FILE_OVERWRITE_IF,
+                              FILE_NON_DIRECTORY_FILE,
+                              &FileHandle);
+        if (NT_SUCCESS(Status))
+        {
+            Status = ZwWriteFile(FileHandle,
+                                 NULL,
+                                 NULL,
+                                 NULL,
+                                 &IoStatusBlock,
+                                 Trace,
+                                 Trace->Size,
+                                 NULL,
+                                 NULL);
+            ZwClose(FileHandle);
+        }
+    }
+
+    if (!NT_SUCCESS(Status))
+    {
+        DPRINT1("Failed to write prefetch trace %wZ (Status %lx)\n",
+                &LaunchTrace->TraceFileName, Status);
+    }
+
+    ExFreePoolWithTag(Trace, TAG_PREFETCH);
+
+Quickie:
+    for (i = 0; i < LaunchTrace->NumFiles; i++)
+    {
+        if (Names[i]) ExFreePoolWithTag(Names[i], TAG_PREFETCH);
+    }
+}
+
+VOID
+NTAPI
+CcPfFreeTrace(IN PPFSN_LAUNCH_TRACE LaunchTrace)
+{
+    ULONG i;
+
+    /* Let go of the files */
+    for (i = 0; i < PF_MAX_TRACE_FILES; i++)
+    {
+        if (LaunchTrace->PrefetchHandles[i]) ZwClose(LaunchTrace->PrefetchHandles[i]);
+        if (LaunchTrace->Files[i]) ObDereferenceObject(LaunchTrace->Files[i]);
+    }
+
+    /* And everything else */
+    if (LaunchTrace->Process) ObDereferenceObject(LaunchTrace->Process);
+    if (LaunchTrace->TraceFileName.Buffer)
+    {
+        ExFreePoolWithTag(LaunchTrace->TraceFileName.Buffer, TAG_PREFETCH);
+    }
+    if (LaunchTrace->Entries) ExFreePoolWithTag(LaunchTrace->Entries, TAG_PREFETCH);
+    ExFreePoolWithTag(LaunchTrace, TAG_PREFETCH);
+}
+
+VOID
+NTAPI
+CcPfEndTraceWorker(IN PVOID Parameter)
+{
+    PPFSN_LAUNCH_TRACE LaunchTrace = Parameter;
+    KIRQL OldIrql;
+
+    /* If the timer already fired, its DPC may still be running */
+    if (!KeCancelTimer(&LaunchTrace->TraceTimer))
+    {
+        KeWaitForSingleObject(&LaunchTrace->TraceTimerDone,
+                              Executive,
+                              KernelMode,
+                              FALSE,
+                              NULL);
+    }
+
+    /* Stop logging */
+    KeEnterCriticalRegion();
+    ExAcquirePushLockExclusive(&CcPfTraceLock);
+    LaunchTrace->Process->PrefetchTrace.Object = NULL;
+    ExReleasePushLockExclusive(&CcPfTraceLock);
+    KeLeaveCriticalRegion();
+
+    /* Unlink it */
+    KeAcquireSpinLock(&CcPfGlobals.ActiveTracesLock, &OldIrql);
+    RemoveEntryList(&LaunchTrace->ActiveTracesLink);
+    KeReleaseSpinLock(&CcPfGlobals.ActiveTracesLock, OldIrql);
+
+    /* Save what we saw for the next launch */
+    CcPfWriteTrace(LaunchTrace);
+    CcPfFreeTrace(LaunchTrace);
+}
+
+VOID
+NTAPI
+CcPfTraceTimerDpc(IN PKDPC Dpc,
+                  IN PVOID DeferredContext,
+                  IN PVOID SystemArgument1,
+                  IN PVOID SystemArgument2)
+{
+    PPFSN_LAUNCH_TRACE LaunchTrace = DeferredContext;
+
+    /* The launch period is over, end the trace unless process exit did */
+    if (!InterlockedExchange(&LaunchTrace->EndTraceCalled, TRUE))
+    {
+        ExQueueWorkItem(&LaunchTrace->EndTraceWorkItem, DelayedWorkQueue);
+    }
+
+    /* This must be the last access to the trace */
+    KeSetEvent(&LaunchTrace->TraceTimerDone, IO_NO_INCREMENT, FALSE);
+}
+
+/* PUBLIC FUNCTIONS **********************************************************/
+
+VOID
+NTAPI
+CcPfBeginAppLaunch(IN PEPROCESS Process)
+{
+    PPFSN_LAUNCH_TRACE LaunchTrace;
+    PPF_LAUNCH_TRACE Trace;
+    LARGE_INTEGER DueTime;
+    NTSTATUS Status;
+    KIRQL OldIrql;
+    PAGED_CODE();
+
+    /* Only the first thread of a process does this */
+    if (PspSetProcessFlag(Process, PSF_LAUNCH_PREFETCHED_BIT) &
+        PSF_LAUNCH_PREFETCHED_BIT)
+    {
+        return;
+    }
+
+    /* Allocate the trace for this launch */
+    LaunchTrace = ExAllocatePoolWithTag(NonPagedPool,
+                                        sizeof(PFSN_LAUNCH_TRACE),
+                                        TAG_PREFETCH);
+    if (!LaunchTrace) return;
+    RtlZeroMemory(LaunchTrace, sizeof(PFSN_LAUNCH_TRACE));
+    ObReferenceObject(Process);
+    LaunchTrace->Process = Process;
+    KeInitializeSpinLock(&LaunchTrace->FileTableLock);
+    KeInitializeTimer(&LaunchTrace->TraceTimer);
+    KeInitializeDpc(&LaunchTrace->TraceTimerDpc, CcPfTraceTimerDpc, LaunchTrace);
+    KeInitializeEvent(&LaunchTrace->TraceTimerDone, NotificationEvent, FALSE);
+    ExInitializeWorkItem(&LaunchTrace->EndTraceWorkItem,
+                         CcPfEndTraceWorker,
+                         LaunchTrace);
+
+    /* Faults are logged straight into this, at any IRQL up to APC_LEVEL */
+    LaunchTrace->Entries = ExAllocatePoolWithTag(PagedPool,
+                                                 PF_MAX_TRACE_PAGES * sizeof(ULONGLONG),
+                                                 TAG_PREFETCH);
+    if (!LaunchTrace->Entries) goto Cleanup;
+
+    /* Find out where the trace of this image lives */
+    Status = CcPfBuildTraceFileName(Process, &LaunchTrace->TraceFileName);
+    if (!NT_SUCCESS(Status)) goto Cleanup;
+
+    /* Prefetch what the last launch needed before the loader runs */
+    Trace = CcPfReadTrace(&LaunchTrace->TraceFileName);
+    if (Trace)
+    {
+        InterlockedIncrement(&CcPfGlobals.ActivePrefetches);
+        CcPfPrefetchFiles(LaunchTrace, Trace);
+        InterlockedDecrement(&CcPfGlobals.ActivePrefetches);
+        ExFreePoolWithTag(Trace, TAG_PREFETCH);
+    }
+
+    /* Start tracing this launch */
+    KeAcquireSpinLock(&CcPfGlobals.ActiveTracesLock, &OldIrql);
+    InsertTailList(&CcPfGlobals.ActiveTraces, &LaunchTrace->ActiveTracesLink);
+    KeReleaseSpinLock(&CcPfGlobals.ActiveTracesLock, OldIrql);
+    KeEnterCriticalRegion();
+    ExAcquirePushLockExclusive(&CcPfTraceLock);
+    Process->PrefetchTrace.Object = LaunchTrace;
+    ExReleasePushLockExclusive(&CcPfTraceLock);
+    KeLeaveCriticalRegion();
+
+    /* And stop once the launch period is over */
+    DueTime.QuadPart = Int32x32To64(PF_TRACE_PERIOD_SECONDS, -10 * 1000 * 1000);
+    KeSetTimer(&LaunchTrace->TraceTimer, DueTime, &LaunchTrace->TraceTimerDpc);
+    return;
+
+Cleanup:
+    CcPfFreeTrace(LaunchTrace);
+}
+
+VOID
+NTAPI
+CcPfProcessExitNotification(IN PEPROCESS Process)
+{
+    PPFSN_LAUNCH_TRACE LaunchTrace;
+
+    /* End the trace early if the process didn't live through the period */
+    KeEnterCriticalRegion();
+    ExAcquirePushLockShared(&CcPfTraceLock);
+    LaunchTrace = Process->PrefetchTrace.Object;
+    if ((LaunchTrace) && !(InterlockedExchange(&LaunchTrace->EndTraceCalled, TRUE)))
+    {
+        ExQueueWorkItem(&LaunchTrace->EndTraceWorkItem, DelayedWorkQueue);
+    }
+    ExReleasePushLockShared(&CcPfTraceLock);
+    KeLeaveCriticalRegion();
+}
+
+VOID
+NTAPI
+CcPfLogPageFault(IN PFILE_OBJECT FileObject,
+                 IN ULONG FileOffset)
+{
+    PEPROCESS Process = PsGetCurrentProcess();
+    PPFSN_LAUNCH_TRACE LaunchTrace;
+    ULONG FileIndex, Page, Entry;
+    KIRQL OldIrql;
+
+    /* Nothing to do unless this process is being traced */
+    if (!Process->PrefetchTrace.Object) return;
+
+    KeEnterCriticalRegion();
+    ExAcquirePushLockShared(&CcPfTraceLock);
+    LaunchTrace = Process->PrefetchTrace.Object;
+    if (LaunchTrace)
+    {
+        /* Find the file, or add it */
+        KeAcquireSpinLock(&LaunchTrace->FileTableLock, &OldIrql);
+        for (FileIndex = 0; FileIndex < LaunchTrace->NumFiles; FileIndex++)
+        {
+            if (LaunchTrace->Files[FileIndex] == FileObject) break;
+        }
+        if ((FileIndex == LaunchTrace->NumFiles) && (FileIndex < PF_MAX_TRACE_FILES))
+        {
+            ObReferenceObject(FileObject);
+            LaunchTrace->Files[LaunchTrace->NumFiles++] = FileObject;
+        }
+        KeReleaseSpinLock(&LaunchTrace->FileTableLock, OldIrql);
+
+        if (FileIndex < PF_MAX_TRACE_FILES)
+        {
+            /* Log the page, and the next one if the read straddles it */
+            for (Page = FileOffset >> PAGE_SHIFT;
+                 Page <= (FileOffset + PAGE_SIZE - 1) >> PAGE_SHIFT;
+                 Page++)
+            {
+                Entry = InterlockedIncrement(&LaunchTrace->NumEntries) - 1;
+                if (Entry >= PF_MAX_TRACE_PAGES) break;
+                LaunchTrace->Entries[Entry] = ((ULONGLONG)FileIndex << 32) | Page;
+            }
+        }
+    }
+    ExReleasePushLockShared(&CcPfTraceLock);
+    KeLeaveCriticalRegion();
+}
@@ -82,7 +82,6 @@ CmpDoFlushAll(IN BOOLEAN ForceFlush)
 {
     PLIST_ENTRY NextEntry;
     PCMHIVE Hive;
-    NTSTATUS Status;
     BOOLEAN Result = TRUE;
 
     /* Make sure that the registry isn't read-only now */
@@ -100,9 +99,6 @@ CmpDoFlushAll(IN BOOLEAN ForceFlush)
         Hive = CONTAINING_RECORD(NextEntry, CMHIVE, HiveList);
         if (!(Hive->Hive.HiveFlags & HIVE_NOLAZYFLUSH))
         {
-            /* Acquire the flusher lock */
-            CmpLockHiveFlusherExclusive(Hive);
-            
             /* Check for illegal state */
             if ((ForceFlush) && (Hive->UseCount))
             {
@@ -115,11 +111,8 @@ CmpDoFlushAll(IN BOOLEAN ForceFlush)
             /* Only sync if we are forced to or if it won't cause a hive shrink */
             if ((ForceFlush) || (!HvHiveWillShrink(&Hive->Hive)))
             {
-                /* Do the sync */
-                Status = HvSyncHive(&Hive->Hive);
-
-                /* If something failed - set the flag and continue looping */
-                if (!NT_SUCCESS(Status)) Result = FALSE;
+                /* Do the sync, if something failed - set the flag and continue looping */
+                if (!CmpFlushHive(Hive)) Result = FALSE;
             }
             else
             {
@@ -127,9 +120,6 @@ CmpDoFlushAll(IN BOOLEAN ForceFlush)
                 Result = FALSE;
                 CmpForceForceFlush = TRUE;
             }
-
-            /* Release the flusher lock */
-            CmpUnlockHiveFlusher(Hive);
         }
 
         /* Try the next entry */
@@ -601,11 +591,12 @@ CmSetValueKey(IN PCM_KEY_CONTROL_BLOCK Kcb,
     BOOLEAN Found, Result;
     ULONG Count, ChildIndex, SmallData, Storage;
     VALUE_SEARCH_RETURN_TYPE SearchResult;
-    BOOLEAN FirstTry = TRUE, FlusherLocked = FALSE;
+    BOOLEAN FirstTry = TRUE, FlusherLocked = FALSE, HiveLocked;
     HCELL_INDEX ParentCell = HCELL_NIL, ChildCell = HCELL_NIL;
 
-    /* Acquire hive and KCB lock */
+    /* Acquire the registry, keep readers of this hive out, and lock the KCB */
     CmpLockRegistry();
+    HiveLocked = CmpLockHiveExclusive((PCMHIVE)Kcb->KeyHive);
     CmpAcquireKcbLockShared(Kcb);
     
     /* Sanity check */
@@ -678,7 +669,12 @@ DoAgain:
 
         /* Get the parent */
         Parent = (PCM_KEY_NODE)HvGetCell(Hive, Cell);
-        ASSERT(Parent);
+        if (!Parent)
+        {
+            /* Fail */
+            Status = STATUS_INSUFFICIENT_RESOURCES;
+            goto Quickie;
+        }
         ParentCell = Cell;
         
         /* Prepare to scan the key node */
@@ -818,25 +814,16 @@ DoAgain:
         KeQuerySystemTime(&Parent->LastWriteTime);
         Kcb->KcbLastWriteTime = Parent->LastWriteTime;
         
-        /* Check if the cell is cached */
-        if ((Found) && (CMP_IS_CELL_CACHED(Kcb->ValueCache.ValueList)))
-        {
-            /* Shouldn't happen */
-            ASSERT(FALSE);
-        }
-        else
-        {
-            /* Cleanup the value cache */
-            CmpCleanUpKcbValueCache(Kcb);
+        /* Cleanup the value cache, the index gets rebuilt on the next lookup */
+        CmpCleanUpKcbValueCache(Kcb);
 
-            /* Sanity checks */
-            ASSERT(!(CMP_IS_CELL_CACHED(Kcb->ValueCache.ValueList)));
-            ASSERT(!(Kcb->ExtFlags & CM_KCB_SYM_LINK_FOUND));
-            
-            /* Set the value cache */
-            Kcb->ValueCache.Count = Parent->ValueList.Count;
-            Kcb->ValueCache.ValueList = Parent->ValueList.List;
-        }
+        /* Sanity checks */
+        ASSERT(!(CMP_IS_CELL_CACHED(Kcb->ValueCache.ValueList)));
+        ASSERT(!(Kcb->ExtFlags & CM_KCB_SYM_LINK_FOUND));
+        
+        /* Set the value cache */
+        Kcb->ValueCache.Count = Parent->ValueList.Count;
+        Kcb->ValueCache.ValueList = Parent->ValueList.List;
         
         /* Notify registered callbacks */
         CmpReportNotify(Kcb,
@@ -853,6 +840,7 @@ Quickie:
     /* Release the locks */
     if (FlusherLocked) CmpUnlockHiveFlusher((PCMHIVE)Hive);
     CmpReleaseKcbLock(Kcb);
+    if (HiveLocked) CmpUnlockHive((PCMHIVE)Kcb->KeyHive);
     CmpUnlockRegistry();
     return Status;
 }
@@ -869,10 +857,11 @@ CmDeleteValueKey(IN PCM_KEY_CONTROL_BLOCK Kcb,
     PCHILD_LIST ChildList;
     PCM_KEY_VALUE Value = NULL;
     ULONG ChildIndex;
-    BOOLEAN Result;
+    BOOLEAN Result, HiveLocked;
 
-    /* Acquire hive lock */
+    /* Acquire the registry lock and keep readers of this hive out */
     CmpLockRegistry();
+    HiveLocked = CmpLockHiveExclusive((PCMHIVE)Kcb->KeyHive);
     
     /* Lock KCB exclusively */
     CmpAcquireKcbLockExclusive(Kcb);
@@ -882,6 +871,7 @@ CmDeleteValueKey(IN PCM_KEY_CONTROL_BLOCK Kcb,
     {
         /* Undo everything */
         CmpReleaseKcbLock(Kcb);
+        if (HiveLocked) CmpUnlockHive((PCMHIVE)Kcb->KeyHive);
         CmpUnlockRegistry();
         return STATUS_KEY_DELETED;
     }
@@ -895,7 +885,12 @@ CmDeleteValueKey(IN PCM_KEY_CONTROL_BLOCK Kcb,
 
     /* Get the parent key node */
     Parent = (PCM_KEY_NODE)HvGetCell(Hive, Cell);
-    ASSERT(Parent);
+    if (!Parent)
+    {
+        /* Fail */
+        Status = STATUS_INSUFFICIENT_RESOURCES;
+        goto Quickie;
+    }
 
     /* Get the value list and check if it has any entries */
     ChildList = &Parent->ValueList;
@@ -929,7 +924,12 @@ CmDeleteValueKey(IN PCM_KEY_CONTROL_BLOCK Kcb,
 
         /* Get the key value */
         Value = (PCM_KEY_VALUE)HvGetCell(Hive,ChildCell);
-        ASSERT(Value);
+        if (!Value)
+        {
+            /* Fail */
+            Status = STATUS_INSUFFICIENT_RESOURCES;
+            goto Quickie;
+        }
 
         /* Mark it and all related data as dirty */
         if (!CmpMarkValueDataDirty(Hive, Value))
@@ -1012,6 +1012,7 @@ Quickie:
     /* Release locks */
     CmpUnlockHiveFlusher((PCMHIVE)Hive);
     CmpReleaseKcbLock(Kcb);
+    if (HiveLocked) CmpUnlockHive((PCMHIVE)Hive);
     CmpUnlockRegistry();
     return Status;
 }
@@ -1033,10 +1034,11 @@ CmQueryValueKey(IN PCM_KEY_CONTROL_BLOCK Kcb,
     HCELL_INDEX CellToRelease;
     VALUE_SEARCH_RETURN_TYPE Result;
     PHHIVE Hive;
+    BOOLEAN HiveLocked;
     PAGED_CODE();
 
-    /* Acquire hive lock */
-    CmpLockRegistry();
+    /* Readers only need the hive lock, not the registry lock */
+    HiveLocked = CmpLockHiveShared((PCMHIVE)Kcb->KeyHive);
     
     /* Lock the KCB shared */
     CmpAcquireKcbLockShared(Kcb);
@@ -1047,7 +1049,7 @@ DoAgain:
     {
         /* Undo everything */
         CmpReleaseKcbLock(Kcb);
-        CmpUnlockRegistry();
+        if (HiveLocked) CmpUnlockHive((PCMHIVE)Kcb->KeyHive);
         return STATUS_KEY_DELETED;
     }
     
@@ -1129,7 +1131,7 @@ DoAgain:
 
     /* Release locks */
     CmpReleaseKcbLock(Kcb);
-    CmpUnlockRegistry();
+    if (HiveLocked) CmpUnlockHive((PCMHIVE)Hive);
     return Status;
 }
 
@@ -1151,10 +1153,11 @@ CmEnumerateValueKey(IN PCM_KEY_CONTROL_BLOCK Kcb,
     PCELL_DATA CellData;
     PCM_CACHED_VALUE *CachedValue;
     PCM_KEY_VALUE ValueData = NULL;
+    BOOLEAN HiveLocked;
     PAGED_CODE();
 
-    /* Acquire hive lock */
-    CmpLockRegistry();
+    /* Readers only need the hive lock, not the registry lock */
+    HiveLocked = CmpLockHiveShared((PCMHIVE)Kcb->KeyHive);
     
     /* Lock the KCB shared */
     CmpAcquireKcbLockShared(Kcb);
@@ -1165,24 +1168,24 @@ DoAgain:
     {
         /* Undo everything */
         CmpReleaseKcbLock(Kcb);
-        CmpUnlockRegistry();
+        if (HiveLocked) CmpUnlockHive((PCMHIVE)Kcb->KeyHive);
         return STATUS_KEY_DELETED;
     }
 
     /* Get the hive and parent */
     Hive = Kcb->KeyHive;
     Parent = (PCM_KEY_NODE)HvGetCell(Hive, Kcb->KeyCell);
-    ASSERT(Parent);
-
-    /* FIXME: Lack of cache? */
-    if (Kcb->ValueCache.Count != Parent->ValueList.Count)
+    if (!Parent)
     {
-        DPRINT1("HACK: Overriding value cache count\n");
-        Kcb->ValueCache.Count = Parent->ValueList.Count;
+        /* Fail, there is no cell to release */
+        Status = STATUS_INSUFFICIENT_RESOURCES;
+        CmpReleaseKcbLock(Kcb);
+        if (HiveLocked) CmpUnlockHive((PCMHIVE)Hive);
+        return Status;
     }
 
-    /* Make sure the index is valid */    
-    if (Index >= Kcb->ValueCache.Count)
+    /* Make sure the index is valid, the value cache is synced below */
+    if (Index >= Parent->ValueList.Count)
     {
         /* Release the cell and fail */
         HvReleaseCell(Hive, Kcb->KeyCell);
@@ -1300,7 +1303,7 @@ Quickie:
 
     /* Release locks */
     CmpReleaseKcbLock(Kcb);
-    CmpUnlockRegistry();
+    if (HiveLocked) CmpUnlockHive((PCMHIVE)Hive);
     return Status;
 }
 
@@ -1316,9 +1319,10 @@ CmQueryKey(IN PCM_KEY_CONTROL_BLOCK Kcb,
     PHHIVE Hive;
     PCM_KEY_NODE Parent;
     HV_TRACK_CELL_REF CellReferences = {0};
+    BOOLEAN HiveLocked;
 
-    /* Acquire hive lock */
-    CmpLockRegistry();
+    /* Readers only need the hive lock, not the registry lock */
+    HiveLocked = CmpLockHiveShared((PCMHIVE)Kcb->KeyHive);
     
     /* Lock KCB shared */
     CmpAcquireKcbLockShared(Kcb);
@@ -1342,10 +1346,12 @@ CmQueryKey(IN PCM_KEY_CONTROL_BLOCK Kcb,
             /* Get the hive and parent */
             Hive = Kcb->KeyHive;
             Parent = (PCM_KEY_NODE)HvGetCell(Hive, Kcb->KeyCell);
-            ASSERT(Parent);
-            
-            /* Track cell references */
-            if (!HvTrackCellRef(&CellReferences, Hive, Kcb->KeyCell))
+            if (!Parent)
+            {
+                /* The key node could not be read in */
+                Status = STATUS_INSUFFICIENT_RESOURCES;
+            }
+            else if (!HvTrackCellRef(&CellReferences, Hive, Kcb->KeyCell))
             {
                 /* Not enough memory to track references */
                 Status = STATUS_INSUFFICIENT_RESOURCES;
@@ -1387,7 +1393,7 @@ Quickie:
 
     /* Release locks */
     CmpReleaseKcbLock(Kcb);
-    CmpUnlockRegistry();
+    if (HiveLocked) CmpUnlockHive((PCMHIVE)Kcb->KeyHive);
     return Status;
 }
 
@@ -1405,9 +1411,10 @@ CmEnumerateKey(IN PCM_KEY_CONTROL_BLOCK Kcb,
     PCM_KEY_NODE Parent, Child;
     HCELL_INDEX ChildCell;
     HV_TRACK_CELL_REF CellReferences = {0};
+    BOOLEAN HiveLocked;
 
-    /* Acquire hive lock */
-    CmpLockRegistry();
+    /* Readers only need the hive lock, not the registry lock */
+    HiveLocked = CmpLockHiveShared((PCMHIVE)Kcb->KeyHive);
     
     /* Lock the KCB shared */
     CmpAcquireKcbLockShared(Kcb);
@@ -1423,7 +1430,12 @@ CmEnumerateKey(IN PCM_KEY_CONTROL_BLOCK Kcb,
     /* Get the hive and parent */
     Hive = Kcb->KeyHive;
     Parent = (PCM_KEY_NODE)HvGetCell(Hive, Kcb->KeyCell);
-    ASSERT(Parent);
+    if (!Parent)
+    {
+        /* Fail */
+        Status = STATUS_INSUFFICIENT_RESOURCES;
+        goto Quickie;
+    }
 
     /* Get the child cell */
     ChildCell = CmpFindSubKeyByNumber(Hive, Parent, Index);
@@ -1441,7 +1453,12 @@ CmEnumerateKey(IN PCM_KEY_CONTROL_BLOCK Kcb,
 
     /* Now get the actual child node */
     Child = (PCM_KEY_NODE)HvGetCell(Hive, ChildCell);
-    ASSERT(Child);
+    if (!Child)
+    {
+        /* Fail */
+        Status = STATUS_INSUFFICIENT_RESOURCES;
+        goto Quickie;
+    }
     
     /* Track references */
     if (!HvTrackCellRef(&CellReferences, Hive, ChildCell))
@@ -1476,7 +1493,7 @@ Quickie:
 
     /* Release locks */
     CmpReleaseKcbLock(Kcb);
-    CmpUnlockRegistry();
+    if (HiveLocked) CmpUnlockHive((PCMHIVE)Kcb->KeyHive);
     return Status;
 }
 
@@ -1489,6 +1506,7 @@ CmDeleteKey(IN PCM_KEY_BODY KeyBody)
     PCM_KEY_NODE Node, Parent;
     HCELL_INDEX Cell, ParentCell;
     PCM_KEY_CONTROL_BLOCK Kcb;
+    BOOLEAN HiveLocked;
 
     /* Acquire hive lock */
     CmpLockRegistry();
@@ -1504,6 +1522,9 @@ CmDeleteKey(IN PCM_KEY_BODY KeyBody)
         return STATUS_CANNOT_DELETE;
     }
     
+    /* Keep readers of this hive out */
+    HiveLocked = CmpLockHiveExclusive((PCMHIVE)Kcb->KeyHive);
+    
     /* Lock parent and child */
     CmpAcquireTwoKcbLocksExclusiveByKey(Kcb->ConvKey, Kcb->ParentKcb->ConvKey);
     
@@ -1524,7 +1545,13 @@ CmDeleteKey(IN PCM_KEY_BODY KeyBody)
     
     /* Get the key node */
     Node = (PCM_KEY_NODE)HvGetCell(Hive, Cell);
-    ASSERT(Node);
+    if (!Node)
+    {
+        /* Fail */
+        Status = STATUS_INSUFFICIENT_RESOURCES;
+        CmpUnlockHiveFlusher((PCMHIVE)Hive);
+        goto Quickie2;
+    }
    
     /* Sanity check */
     ASSERT(Node->Flags == Kcb->Flags);
@@ -1590,6 +1617,7 @@ Quickie2:
     CmpReleaseTwoKcbLockByKey(Kcb->ConvKey, Kcb->ParentKcb->ConvKey);
 
     /* Release hive lock */
+    if (HiveLocked) CmpUnlockHive((PCMHIVE)Kcb->KeyHive);
     CmpUnlockRegistry();
     return Status;
 }
@@ -1619,7 +1647,6 @@ CmFlushKey(IN PCM_KEY_CONTROL_BLOCK Kcb,
     else
     {
         /* Don't touch the hive */
-        CmpLockHiveFlusherExclusive(CmHive);
         ASSERT(CmHive->ViewLock);
         KeAcquireGuardedMutex(CmHive->ViewLock);
         CmHive->ViewLockOwner = KeGetCurrentThread();
@@ -1640,14 +1667,11 @@ CmFlushKey(IN PCM_KEY_CONTROL_BLOCK Kcb,
         }
         
         /* Flush only this hive */
-        if (!HvSyncHive(Hive))
+        if (!CmpFlushHive(CmHive))
         {
             /* Fail */
             Status = STATUS_REGISTRY_IO_FAILED;
         }
-        
-        /* Release the flush lock */
-        CmpUnlockHiveFlusher((PCMHIVE)Hive);
     }
 
     /* Return the status */
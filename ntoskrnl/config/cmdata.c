@@ -522,6 +522,14 @@ INIT_FUNCTION CM_SYSTEM_CONTROL_VECTOR CmControlVector[] =
         NULL
     },
 
+    {
+        L"Session Manager\\Memory Management\\PrefetchParameters",
+        L"EnablePrefetcher",
+        &CcPfEnablePrefetcher,
+        NULL,
+        NULL
+    },
+
     {
         L"Session Manager\\Executive",
         L"AdditionalCriticalWorkerThreads",
@@ -586,6 +594,14 @@ INIT_FUNCTION CM_SYSTEM_CONTROL_VECTOR CmControlVector[] =
         NULL
     },
 
+    {
+        L"Session Manager\\I/O System",
+        L"IoStatistics",
+        &IopIoStatisticsEnabled,
+        NULL,
+        NULL
+    },
+
     {
         L"Session Manager\\I/O System",
         L"LargeIrpStackLocations",
@@ -775,8 +775,9 @@ CmpFindSubKeyByName(IN PHHIVE Hive,
 
                 /* Get the new Index Root and set the new cell to be released */
                 if (SubKey == HCELL_NIL) continue;
-                CellToRelease = SubKey;
                 IndexRoot = (PCM_KEY_INDEX)HvGetCell(Hive, SubKey);
+                if (!IndexRoot) return HCELL_NIL;
+                CellToRelease = SubKey;
             }
 
             /* Make sure the signature is what we expect it to be */
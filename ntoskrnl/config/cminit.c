@@ -196,6 +196,13 @@ CmpInitializeHive(OUT PCMHIVE *RegistryHive,
         return Status;
     }
 
+    /* Mapped hives read their bins in while readers hold the hive shared */
+    if (OperationType == HINIT_MAPFILE)
+    {
+        Hive->Hive.AcquireViewLock = CmpLockHiveViews;
+        Hive->Hive.ReleaseViewLock = CmpUnlockHiveViews;
+    }
+
     /* Check if we should verify the registry */
     if ((OperationType == HINIT_FILE) ||
         (OperationType == HINIT_MEMORY) ||
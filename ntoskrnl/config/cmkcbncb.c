@@ -17,6 +17,7 @@
 ULONG CmpHashTableSize = 2048;
 PCM_KEY_HASH_TABLE_ENTRY CmpCacheTable;
 PCM_NAME_HASH_TABLE_ENTRY CmpNameCacheTable;
+volatile LONG CmpSubKeyCreateCount;
 
 /* FUNCTIONS *****************************************************************/
 
@@ -143,19 +144,17 @@ CmpInsertKeyHash(IN PCM_KEY_HASH KeyHash,
     return NULL;
 }
 
-PCM_NAME_CONTROL_BLOCK
-NTAPI
-CmpGetNameControlBlock(IN PUNICODE_STRING NodeName)
+FORCEINLINE
+BOOLEAN
+CmpGetNameControlBlockKey(IN PCUNICODE_STRING NodeName,
+                          OUT PULONG ConvKey,
+                          OUT PULONG Length)
 {
-    PCM_NAME_CONTROL_BLOCK Ncb = NULL;
-    ULONG ConvKey = 0;
-    PWCHAR p, pp;
+    PWCHAR p;
     ULONG i;
-    BOOLEAN IsCompressed = TRUE, Found = FALSE;
-    PCM_NAME_HASH HashEntry;
-    ULONG Length, NcbSize;
 
     /* Loop the name */
+    *ConvKey = 0;
     p = NodeName->Buffer;
     for (i = 0; i < NodeName->Length; i += sizeof(WCHAR))
     {
@@ -163,7 +162,7 @@ CmpGetNameControlBlock(IN PUNICODE_STRING NodeName)
         if (*p != OBJ_NAME_PATH_SEPARATOR)
         {
             /* Add it to the hash */
-            ConvKey = 37 * ConvKey + RtlUpcaseUnicodeChar(*p);
+            *ConvKey = 37 * *ConvKey + RtlUpcaseUnicodeChar(*p);
         }
 
         /* Next character */
@@ -171,19 +170,78 @@ CmpGetNameControlBlock(IN PUNICODE_STRING NodeName)
     }
 
     /* Set assumed lengh and loop to check */
-    Length = NodeName->Length / sizeof(WCHAR);
+    *Length = NodeName->Length / sizeof(WCHAR);
     for (i = 0; i < (NodeName->Length / sizeof(WCHAR)); i++)
     {
         /* Check if this is a 16-bit character */
         if (NodeName->Buffer[i] > (UCHAR)-1)
         {
             /* This is the actual size, and we know we're not compressed */
-            Length = NodeName->Length;
-            IsCompressed = FALSE;
-            break;
+            *Length = NodeName->Length;
+            return FALSE;
         }
     }
 
+    /* The name can be stored compressed */
+    return TRUE;
+}
+
+FORCEINLINE
+BOOLEAN
+CmpIsNameControlBlockName(IN PCM_NAME_CONTROL_BLOCK Ncb,
+                          IN PCUNICODE_STRING NodeName,
+                          IN ULONG ConvKey,
+                          IN ULONG Length)
+{
+    PWCHAR p, pp;
+    ULONG i;
+
+    /* Check if the hash matches */
+    if ((ConvKey != Ncb->ConvKey) || (Length != Ncb->NameLength)) return FALSE;
+
+    /* If the NCB is compressed, do a compressed name compare */
+    if (Ncb->Compressed)
+    {
+        /* Compare names */
+        return CmpCompareCompressedName(NodeName, Ncb->Name, Length) ?
+               FALSE : TRUE;
+    }
+
+    /* Do a manual compare */
+    p = NodeName->Buffer;
+    pp = Ncb->Name;
+    for (i = 0; i < Ncb->NameLength; i += sizeof(WCHAR))
+    {
+        /* Compare the character */
+        if (RtlUpcaseUnicodeChar(*p) != RtlUpcaseUnicodeChar(*pp))
+        {
+            /* Failed */
+            return FALSE;
+        }
+
+        /* Next chars */
+        p++;
+        pp++;
+    }
+
+    /* The names are the same */
+    return TRUE;
+}
+
+PCM_NAME_CONTROL_BLOCK
+NTAPI
+CmpGetNameControlBlock(IN PUNICODE_STRING NodeName)
+{
+    PCM_NAME_CONTROL_BLOCK Ncb = NULL;
+    ULONG ConvKey;
+    ULONG i;
+    BOOLEAN IsCompressed, Found = FALSE;
+    PCM_NAME_HASH HashEntry;
+    ULONG Length, NcbSize;
+
+    /* Compute the hash and the stored length of the name */
+    IsCompressed = CmpGetNameControlBlockKey(NodeName, &ConvKey, &Length);
+
     /* Lock the NCB entry */
     CmpAcquireNcbLockExclusiveByKey(ConvKey);
 
@@ -194,51 +252,14 @@ CmpGetNameControlBlock(IN PUNICODE_STRING NodeName)
         /* Get the current NCB */
         Ncb = CONTAINING_RECORD(HashEntry, CM_NAME_CONTROL_BLOCK, NameHash);
 
-        /* Check if the hash matches */
-        if ((ConvKey == HashEntry->ConvKey) && (Length == Ncb->NameLength))
+        /* Check if we found a name */
+        if (CmpIsNameControlBlockName(Ncb, NodeName, ConvKey, Length))
         {
-            /* Assume success */
+            /* Reference it */
+            ASSERT(Ncb->RefCount != 0xFFFF);
+            Ncb->RefCount++;
             Found = TRUE;
-
-            /* If the NCB is compressed, do a compressed name compare */
-            if (Ncb->Compressed)
-            {
-                /* Compare names */
-                if (CmpCompareCompressedName(NodeName, Ncb->Name, Length))
-                {
-                    /* We failed */
-                    Found = FALSE;
-                }
-            }
-            else
-            {
-                /* Do a manual compare */
-                p = NodeName->Buffer;
-                pp = Ncb->Name;
-                for (i = 0; i < Ncb->NameLength; i += sizeof(WCHAR))
-                {
-                    /* Compare the character */
-                    if (RtlUpcaseUnicodeChar(*p) != RtlUpcaseUnicodeChar(*pp))
-                    {
-                        /* Failed */
-                        Found = FALSE;
-                        break;
-                    }
-
-                    /* Next chars */
-                    p++;
-                    pp++;
-                }
-            }
-
-            /* Check if we found a name */
-            if (Found)
-            {
-                /* Reference it */
-                ASSERT(Ncb->RefCount != 0xFFFF);
-                Ncb->RefCount++;
-                break;
-            }
+            break;
         }
 
         /* Go to the next hash */
@@ -472,6 +493,148 @@ CmpCleanUpKcbValueCache(IN PCM_KEY_CONTROL_BLOCK Kcb)
     }
 }
 
+BOOLEAN
+NTAPI
+CmpFindMissingSubKey(IN PCM_KEY_CONTROL_BLOCK Kcb,
+                     IN PCUNICODE_STRING Name)
+{
+    PCM_MISSING_KEY_BLOCK MissingKeys;
+    ULONG ConvKey, Length, i;
+    BOOLEAN Found = FALSE;
+
+    /* Nothing to look at if no lookup under this key ever failed */
+    if (!Kcb->MissingKeys) return FALSE;
+
+    /* Compute the hash and the stored length of the name */
+    CmpGetNameControlBlockKey(Name, &ConvKey, &Length);
+
+    /* Lock the KCB and check every missing name it remembers */
+    CmpAcquireKcbLockShared(Kcb);
+    MissingKeys = Kcb->MissingKeys;
+    if (MissingKeys)
+    {
+        for (i = 0; i < MissingKeys->Count; i++)
+        {
+            /* Check if this is the name we're looking for */
+            if (CmpIsNameControlBlockName(MissingKeys->NameBlock[i],
+                                          Name,
+                                          ConvKey,
+                                          Length))
+            {
+                /* It is, so the subkey doesn't exist */
+                Found = TRUE;
+                break;
+            }
+        }
+    }
+
+    /* Release the lock and return */
+    CmpReleaseKcbLock(Kcb);
+    return Found;
+}
+
+VOID
+NTAPI
+CmpAddMissingSubKey(IN PCM_KEY_CONTROL_BLOCK Kcb,
+                    IN PUNICODE_STRING Name,
+                    IN LONG CreateCount)
+{
+    PCM_MISSING_KEY_BLOCK MissingKeys;
+    PCM_NAME_CONTROL_BLOCK Ncb;
+
+    /* Get an NCB for the name */
+    Ncb = CmpGetNameControlBlock(Name);
+    if (!Ncb) return;
+
+    /* Lock the KCB exclusively */
+    CmpAcquireKcbLockExclusive(Kcb);
+
+    /* Don't remember anything if a key was created since the lookup */
+    if ((Kcb->Delete) || (CmpSubKeyCreateCount != CreateCount))
+    {
+        /* Undo everything */
+        CmpReleaseKcbLock(Kcb);
+        CmpDereferenceNameControlBlockWithLock(Ncb);
+        return;
+    }
+
+    /* Allocate the missing key block if this is the first failed lookup */
+    MissingKeys = Kcb->MissingKeys;
+    if (!MissingKeys)
+    {
+        MissingKeys = CmpAllocate(sizeof(CM_MISSING_KEY_BLOCK), TRUE, TAG_CM);
+        if (!MissingKeys)
+        {
+            /* Undo everything */
+            CmpReleaseKcbLock(Kcb);
+            CmpDereferenceNameControlBlockWithLock(Ncb);
+            return;
+        }
+
+        /* Start out empty */
+        RtlZeroMemory(MissingKeys, sizeof(CM_MISSING_KEY_BLOCK));
+        Kcb->MissingKeys = MissingKeys;
+    }
+
+    /* Check if the block is full */
+    if (MissingKeys->Count == CMP_MISSING_KEY_CACHE_SIZE)
+    {
+        /* Replace the oldest name */
+        CmpDereferenceNameControlBlockWithLock(MissingKeys->NameBlock[MissingKeys->Next]);
+        MissingKeys->NameBlock[MissingKeys->Next] = Ncb;
+        MissingKeys->Next = (MissingKeys->Next + 1) % CMP_MISSING_KEY_CACHE_SIZE;
+    }
+    else
+    {
+        /* Add it at the end */
+        MissingKeys->NameBlock[MissingKeys->Count++] = Ncb;
+    }
+
+    /* Release the lock */
+    CmpReleaseKcbLock(Kcb);
+}
+
+VOID
+NTAPI
+CmpCleanUpMissingSubKeys(IN PCM_KEY_CONTROL_BLOCK Kcb)
+{
+    ULONG i;
+
+    /* Sanity check */
+    ASSERT((CmpIsKcbLockedExclusive(Kcb) == TRUE) ||
+           (CmpTestRegistryLockExclusive() == TRUE));
+
+    /* Check if we have any missing names */
+    if (Kcb->MissingKeys)
+    {
+        /* Dereference all the NCBs */
+        for (i = 0; i < Kcb->MissingKeys->Count; i++)
+        {
+            CmpDereferenceNameControlBlockWithLock(Kcb->MissingKeys->NameBlock[i]);
+        }
+
+        /* Free the block */
+        CmpFree(Kcb->MissingKeys, 0);
+        Kcb->MissingKeys = NULL;
+    }
+}
+
+VOID
+NTAPI
+CmpInvalidateMissingSubKeys(IN PCM_KEY_CONTROL_BLOCK Kcb)
+{
+    /* Make lookups that are still running forget about their result */
+    InterlockedIncrement(&CmpSubKeyCreateCount);
+
+    /* Nothing else to do if this key never had a failed lookup */
+    if (!Kcb->MissingKeys) return;
+
+    /* Drop the names remembered for this key */
+    CmpAcquireKcbLockExclusive(Kcb);
+    CmpCleanUpMissingSubKeys(Kcb);
+    CmpReleaseKcbLock(Kcb);
+}
+
 VOID
 NTAPI
 CmpCleanUpKcbCacheWithLock(IN PCM_KEY_CONTROL_BLOCK Kcb,
@@ -485,8 +648,9 @@ CmpCleanUpKcbCacheWithLock(IN PCM_KEY_CONTROL_BLOCK Kcb,
            (CmpTestRegistryLockExclusive() == TRUE));
     ASSERT(Kcb->RefCount == 0);
 
-    /* Cleanup the value cache */
+    /* Cleanup the value cache and the missing subkeys */
     CmpCleanUpKcbValueCache(Kcb);
+    CmpCleanUpMissingSubKeys(Kcb);
 
     /* Dereference the NCB */
     CmpDereferenceNameControlBlockWithLock(Kcb->NameBlock);
@@ -728,6 +892,7 @@ CmpCreateKeyControlBlock(IN PHHIVE Hive,
     Kcb->ConvKey = ConvKey;
     Kcb->DelayedCloseIndex = CmpDelayedCloseSize;
     Kcb->InDelayClose = 0;
+    Kcb->MissingKeys = NULL;
     ASSERT_KCB_VALID(Kcb);
 
     /* Check if we have two hash entires */
@@ -29,13 +29,49 @@ LONG CmpFlushStarveWriters;
 
 /* FUNCTIONS ******************************************************************/
 
+BOOLEAN
+NTAPI
+CmpFlushHive(IN PCMHIVE CmHive)
+{
+    HV_SYNC_CONTEXT Sync;
+    BOOLEAN HiveLocked, Success;
+
+    /* Keep writers out only while the dirty blocks are copied aside */
+    HiveLocked = CmpLockHiveShared(CmHive);
+    CmpLockHiveFlusherExclusive(CmHive);
+    Success = HvPrepareSync(&CmHive->Hive, &Sync);
+    if (HiveLocked) CmpUnlockHive(CmHive);
+
+    /* Readers and writers can go on during the I/O, other flushers can't */
+    ExConvertExclusiveToSharedLite(CmHive->FlusherLock);
+    if (Success) Success = HvWriteSync(&CmHive->Hive, &Sync);
+    CmpUnlockHiveFlusher(CmHive);
+
+    /* Check if the copied blocks have to be dirtied again */
+    if ((Sync.Buffer) && !(Success))
+    {
+        /* Keep writers out for that, too */
+        HiveLocked = CmpLockHiveShared(CmHive);
+        CmpLockHiveFlusherExclusive(CmHive);
+        HvCompleteSync(&CmHive->Hive, &Sync, FALSE);
+        CmpUnlockHiveFlusher(CmHive);
+        if (HiveLocked) CmpUnlockHive(CmHive);
+    }
+    else
+    {
+        /* Just free the copy */
+        HvCompleteSync(&CmHive->Hive, &Sync, Success);
+    }
+
+    return Success;
+}
+
 BOOLEAN
 NTAPI
 CmpDoFlushNextHive(IN BOOLEAN ForceFlush,
                    OUT PBOOLEAN Error,
                    OUT PULONG DirtyCount)
 {
-    NTSTATUS Status;
     PLIST_ENTRY NextEntry;
     PCMHIVE CmHive;
     BOOLEAN Result;    
@@ -79,13 +115,17 @@ CmpDoFlushNextHive(IN BOOLEAN ForceFlush,
                 /* Do the sync */
                 DPRINT1("Flushing: %wZ\n", CmHive->FileFullPath);
                 DPRINT1("Handle: %lx\n", CmHive->FileHandles[HFILE_TYPE_PRIMARY]);
-                Status = HvSyncHive(&CmHive->Hive);
-                if(!NT_SUCCESS(Status))
+                if (!CmpFlushHive(CmHive))
                 {
                     /* Let them know we failed */
                     *Error = TRUE;
                     Result = FALSE;
                 }
+                else
+                {
+                    /* It's been flushed in this pass */
+                    CmHive->FlushCount = CmpLazyFlushCount;
+                }
             }
         }
         else if ((CmHive->Hive.DirtyCount) &&
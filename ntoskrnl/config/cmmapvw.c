@@ -29,3 +29,27 @@ CmpInitHiveViewList(IN PCMHIVE Hive)
     Hive->PinnedViews = 0;
     Hive->UseCount = 0;
 }
+
+VOID
+NTAPI
+CmpLockHiveViews(IN PHHIVE RegistryHive)
+{
+    PCMHIVE CmHive = (PCMHIVE)RegistryHive;
+
+    /* Readers only hold the hive shared, so they map bins under the view lock */
+    ASSERT(CmHive->ViewLock);
+    KeAcquireGuardedMutex(CmHive->ViewLock);
+    CmHive->ViewLockOwner = KeGetCurrentThread();
+}
+
+VOID
+NTAPI
+CmpUnlockHiveViews(IN PHHIVE RegistryHive)
+{
+    PCMHIVE CmHive = (PCMHIVE)RegistryHive;
+
+    /* Release the view lock */
+    ASSERT(KeGetCurrentThread() == CmHive->ViewLockOwner);
+    CmHive->ViewLockOwner = NULL;
+    KeReleaseGuardedMutex(CmHive->ViewLock);
+}
@@ -492,6 +492,9 @@ CmpDoCreate(IN PHHIVE Hive,
             ASSERT(FALSE);
         }
 
+        /* The parent may have remembered this name as missing */
+        CmpInvalidateMissingSubKeys(ParentKcb);
+
         /* Get the key node */
         KeyNode = (PCM_KEY_NODE)HvGetCell(Hive, Cell);
         if (!KeyNode)
@@ -907,6 +910,9 @@ CmpCreateLinkNode(IN PHHIVE Hive,
             /* Failure! We don't handle this yet! */
             ASSERT(FALSE);
         }
+
+        /* The parent may have remembered this name as missing */
+        CmpInvalidateMissingSubKeys(ParentKcb);
         
         /* Get the key body */
         KeyBody = (PCM_KEY_BODY)*Object;
@@ -1046,7 +1052,8 @@ CmpParseKey(IN PVOID ParseObject,
     PCM_PARSE_CONTEXT ParseContext = Context;
     ULONG TotalRemainingSubkeys = 0, MatchRemainSubkeyLevel = 0, TotalSubkeys = 0;
     PULONG LockedKcbs = NULL;
-    BOOLEAN Result, Last;
+    BOOLEAN Result, Last, HiveLocked;
+    LONG CreateCount;
     PAGED_CODE();
 
     /* Loop path separators at the end */
@@ -1162,8 +1169,16 @@ CmpParseKey(IN PVOID ParseObject,
             /* See if this is a sym link */
             if (!(Kcb->Flags & KEY_SYM_LINK))
             {
-                /* Find the subkey */
-                NextCell = CmpFindSubKeyByName(Hive, Node, &NextName);
+                /* Find the subkey, unless we already know it isn't there */
+                CreateCount = CmpSubKeyCreateCount;
+                if (CmpFindMissingSubKey(ParentKcb, &NextName))
+                {
+                    NextCell = HCELL_NIL;
+                }
+                else
+                {
+                    NextCell = CmpFindSubKeyByName(Hive, Node, &NextName);
+                }
                 if (NextCell != HCELL_NIL)
                 {
                     /* Get the new node */
@@ -1245,6 +1260,9 @@ CmpParseKey(IN PVOID ParseObject,
                     /* Check if this was the last key for a create */
                     if ((Last) && (ParseContext))
                     {
+                        /* Keep readers of the parent hive out */
+                        HiveLocked = CmpLockHiveExclusive((PCMHIVE)Hive);
+
                         /* Check if we're doing a link node */
                         if (ParseContext->CreateLink)
                         {
@@ -1271,6 +1289,9 @@ CmpParseKey(IN PVOID ParseObject,
                                                  ParentKcb,
                                                  Object);
                         }
+
+                        /* Let readers back in */
+                        if (HiveLocked) CmpUnlockHive((PCMHIVE)Hive);
                         
                         /* Check for reparse (in this case, someone beat us) */
                         if (Status == STATUS_REPARSE) break;
@@ -1281,7 +1302,8 @@ CmpParseKey(IN PVOID ParseObject,
                     }
                     else
                     {
-                        /* Key not found */
+                        /* Key not found, remember that for the next lookup */
+                        CmpAddMissingSubKey(ParentKcb, &NextName, CreateCount);
                         Status = STATUS_OBJECT_NAME_NOT_FOUND;
                         break;
                     }
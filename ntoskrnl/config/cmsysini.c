@@ -236,8 +236,8 @@ CmpInitHiveFromFile(IN PCUNICODE_STRING HiveName,
     }
     else
     {
-        /* Open it as a file */
-        Operation = HINIT_FILE;
+        /* Map it, so only the bins that get used are read in */
+        Operation = HINIT_MAPFILE;
         *New = FALSE;
     }
 
@@ -1739,6 +1739,60 @@ EndPath:
     return ServicePath;
 }
 
+VOID
+NTAPI
+CmpLockAllHivesExclusive(VOID)
+{
+    PLIST_ENTRY NextEntry;
+    PCMHIVE CmHive;
+
+    /* Lock the hive list and loop it */
+    ExAcquirePushLockShared(&CmpHiveListHeadLock);
+    NextEntry = CmpHiveListHead.Flink;
+    while (NextEntry != &CmpHiveListHead)
+    {
+        /* Wait for any readers of this hive to drain, and own it */
+        CmHive = CONTAINING_RECORD(NextEntry, CMHIVE, HiveList);
+        ExAcquirePushLockExclusive(&CmHive->HiveLock);
+        CmHive->HiveLockOwner = KeGetCurrentThread();
+
+        /* Try the next one */
+        NextEntry = NextEntry->Flink;
+    }
+
+    /* Unlock the list */
+    ExReleasePushLock(&CmpHiveListHeadLock);
+}
+
+VOID
+NTAPI
+CmpUnlockAllHives(VOID)
+{
+    PLIST_ENTRY NextEntry;
+    PCMHIVE CmHive;
+
+    /* Lock the hive list and loop it */
+    ExAcquirePushLockShared(&CmpHiveListHeadLock);
+    NextEntry = CmpHiveListHead.Flink;
+    while (NextEntry != &CmpHiveListHead)
+    {
+        /* Only release hives we locked, new ones may have been linked since */
+        CmHive = CONTAINING_RECORD(NextEntry, CMHIVE, HiveList);
+        if (CmHive->HiveLockOwner == KeGetCurrentThread())
+        {
+            /* Release it */
+            CmHive->HiveLockOwner = NULL;
+            ExReleasePushLock(&CmHive->HiveLock);
+        }
+
+        /* Try the next one */
+        NextEntry = NextEntry->Flink;
+    }
+
+    /* Unlock the list */
+    ExReleasePushLock(&CmpHiveListHeadLock);
+}
+
 VOID
 NTAPI
 CmpLockRegistryExclusive(VOID)
@@ -1747,6 +1801,16 @@ CmpLockRegistryExclusive(VOID)
     KeEnterCriticalRegion();
     ExAcquireResourceExclusiveLite(&CmpRegistryLock, TRUE);
 
+    /*
+     * Readers only hold their hive lock, so on the first acquisition we
+     * must also own every hive to keep them out.
+     */
+    if (ExIsResourceAcquiredSharedLite(&CmpRegistryLock) == 1)
+    {
+        /* Lock all the hives */
+        CmpLockAllHivesExclusive();
+    }
+
     /* Sanity check */
     ASSERT(CmpFlushStarveWriters == 0);
     RtlGetCallersAddress(&CmpRegistryLockCaller, &CmpRegistryLockCallerCaller);
@@ -1838,6 +1902,53 @@ CmpTestHiveFlusherLockExclusive(IN PCMHIVE Hive)
     return !ExIsResourceAcquiredExclusiveLite(Hive->FlusherLock) ? FALSE : TRUE;
 }
 
+BOOLEAN
+NTAPI
+CmpLockHiveShared(IN PCMHIVE Hive)
+{
+    /* Nothing to do if we already own the hive, the registry is locked */
+    if (Hive->HiveLockOwner == KeGetCurrentThread()) return FALSE;
+
+    /* Enter a critical region and lock the hive */
+    KeEnterCriticalRegion();
+    ExAcquirePushLockShared(&Hive->HiveLock);
+    return TRUE;
+}
+
+BOOLEAN
+NTAPI
+CmpLockHiveExclusive(IN PCMHIVE Hive)
+{
+    /* Nothing to do if we already own the hive, the registry is locked */
+    if (Hive->HiveLockOwner == KeGetCurrentThread()) return FALSE;
+
+    /* Enter a critical region and lock the hive */
+    KeEnterCriticalRegion();
+    ExAcquirePushLockExclusive(&Hive->HiveLock);
+    Hive->HiveLockOwner = KeGetCurrentThread();
+    return TRUE;
+}
+
+BOOLEAN
+NTAPI
+CmpTestHiveLockExclusive(IN PCMHIVE Hive)
+{
+    /* Test the lock */
+    return (Hive->HiveLockOwner == KeGetCurrentThread()) ? TRUE : FALSE;
+}
+
+VOID
+NTAPI
+CmpUnlockHive(IN PCMHIVE Hive)
+{
+    /* Clear the owner if we had it exclusively */
+    if (Hive->HiveLockOwner == KeGetCurrentThread()) Hive->HiveLockOwner = NULL;
+
+    /* Release the lock and leave the critical region */
+    ExReleasePushLock(&Hive->HiveLock);
+    KeLeaveCriticalRegion();
+}
+
 VOID
 NTAPI
 CmpUnlockRegistry(VOID)
@@ -1856,6 +1967,14 @@ CmpUnlockRegistry(VOID)
         CmpFlushOnLockRelease = FALSE;
     }
 
+    /* Release the hives if this is the last exclusive acquisition */
+    if ((CmpTestRegistryLockExclusive()) &&
+        (ExIsResourceAcquiredSharedLite(&CmpRegistryLock) == 1))
+    {
+        /* Let readers back in */
+        CmpUnlockAllHives();
+    }
+
     /* Release the lock and leave the critical region */
     ExReleaseResourceLite(&CmpRegistryLock);
     KeLeaveCriticalRegion();
@@ -12,32 +12,90 @@
 #define NDEBUG
 #include "debug.h"
 
+#define ASSERT_VALUE_CACHE() \
+    ASSERTMSG("Cached Values Not Yet Supported!", FALSE);
+
+/* FUNCTIONS *****************************************************************/
+
 FORCEINLINE
-BOOLEAN
-CmpIsValueCached(IN HCELL_INDEX CellIndex)
+ULONG
+CmpHashValueName(IN PCM_KEY_VALUE Value)
 {
-    /* Make sure that the cell is valid in the first place */
-    if (CellIndex == HCELL_NIL) return FALSE;
+    UNICODE_STRING ValueName;
+    PUCHAR p;
+    ULONG ConvKey = 0, i;
 
-    /*Is this cell actually a pointer to the cached value data? */
-    if (CellIndex & 1) return TRUE;
+    /* Check if the name is compressed */
+    if (Value->Flags & VALUE_COMP_NAME)
+    {
+        /* Hash it the same way as its Unicode form */
+        p = (PUCHAR)Value->Name;
+        for (i = 0; i < Value->NameLength; i++)
+        {
+            ConvKey = 37 * ConvKey + RtlUpcaseUnicodeChar((WCHAR)p[i]);
+        }
+        return ConvKey;
+    }
 
-    /* This is a regular cell */
-    return FALSE;
+    /* Use the standard routine, value names may contain separators */
+    ValueName.Length = Value->NameLength;
+    ValueName.MaximumLength = ValueName.Length;
+    ValueName.Buffer = Value->Name;
+    return CmpComputeHashKey(0, &ValueName, TRUE);
 }
 
-FORCEINLINE
-VOID
-CmpSetValueCached(IN PHCELL_INDEX CellIndex)
+PCM_CACHED_VALUE_INDEX
+NTAPI
+CmpBuildValueIndex(IN PHHIVE Hive,
+                   IN PCHILD_LIST ValueList,
+                   IN PCELL_DATA CellData)
 {
-    /* Set the cached bit */
-    *CellIndex |= 1;
-}
+    PCM_CACHED_VALUE_INDEX ValueIndex;
+    PCM_KEY_VALUE KeyValue;
+    ULONG Buckets, Size, i;
+
+    /* Use a power of two for the buckets, so lookups can mask */
+    for (Buckets = 1; Buckets < ValueList->Count; Buckets <<= 1);
+
+    /* The hash arrays live right behind the cell list */
+    Size = FIELD_OFFSET(CM_CACHED_VALUE_INDEX, Data.List) +
+           ValueList->Count * sizeof(ULONG_PTR) +
+           (Buckets + 2 * ValueList->Count) * sizeof(ULONG);
+    ValueIndex = CmpAllocate(Size, TRUE, TAG_CM);
+    if (!ValueIndex) return NULL;
+
+    /* Set it up */
+    ValueIndex->CellIndex = ValueList->List;
+    ValueIndex->HashMask = Buckets - 1;
+    ValueIndex->HashTable = (PULONG)&ValueIndex->Data.List[ValueList->Count];
+    ValueIndex->HashChain = ValueIndex->HashTable + Buckets;
+    ValueIndex->HashKey = ValueIndex->HashChain + ValueList->Count;
+    RtlZeroMemory(ValueIndex->HashTable, Buckets * sizeof(ULONG));
+
+    /* Loop every value, from the last so that chains keep list order */
+    for (i = ValueList->Count; i-- > 0;)
+    {
+        /* Copy the cell and hash the value's name */
+        ValueIndex->Data.List[i] = CellData->u.KeyList[i];
+        KeyValue = (PCM_KEY_VALUE)HvGetCell(Hive, CellData->u.KeyList[i]);
+        if (!KeyValue)
+        {
+            /* We can't read the value, so don't cache anything */
+            CmpFree(ValueIndex, 0);
+            return NULL;
+        }
+        ValueIndex->HashKey[i] = CmpHashValueName(KeyValue);
+        HvReleaseCell(Hive, CellData->u.KeyList[i]);
 
-#define ASSERT_VALUE_CACHE() \
-    ASSERTMSG("Cached Values Not Yet Supported!", FALSE);
+        /* Link it into its bucket; entries are stored as index + 1 */
+        ValueIndex->HashChain[i] =
+            ValueIndex->HashTable[ValueIndex->HashKey[i] & ValueIndex->HashMask];
+        ValueIndex->HashTable[ValueIndex->HashKey[i] & ValueIndex->HashMask] = i + 1;
+    }
 
-/* FUNCTIONS *****************************************************************/
+    /* Return the index */
+    return ValueIndex;
+}
 
 VALUE_SEARCH_RETURN_TYPE
 NTAPI
@@ -48,48 +106,78 @@ CmpGetValueListFromCache(IN PCM_KEY_CONTROL_BLOCK Kcb,
 {
     PHHIVE Hive;
     PCACHED_CHILD_LIST ChildList;
+    PCM_CACHED_VALUE_INDEX ValueIndex;
     HCELL_INDEX CellToRelease;
     PCM_KEY_NODE KeyNode;
+    CHILD_LIST ValueList;
 
     /* Set defaults */
     *ValueListToRelease = HCELL_NIL;
     *IndexIsCached = FALSE;
+    *CellData = NULL;
 
-    /* Get the hive and value cache */
+    /* Get the hive, the value cache, and the value list of the key node */
     Hive = Kcb->KeyHive;
     ChildList = &Kcb->ValueCache;
     KeyNode = (PCM_KEY_NODE)HvGetCell(Hive, Kcb->KeyCell);
-    ChildList = (PCACHED_CHILD_LIST)&KeyNode->ValueList;
+    if (!KeyNode) return SearchFail;
+    ValueList = KeyNode->ValueList;
+    HvReleaseCell(Hive, Kcb->KeyCell);
 
-    /* Check if the value is cached */
-    if (CmpIsValueCached(ChildList->ValueList))
-    {
-        /* It is: we don't expect this yet! */
-        ASSERT_VALUE_CACHE();
-        *IndexIsCached = TRUE;
-        *CellData = NULL;
-    }
-    else
+    /* Check if the value list is cached */
+    if (CMP_IS_CELL_CACHED(ChildList->ValueList))
     {
-        /* Make sure the KCB is locked exclusive */
-        if (!(CmpIsKcbLockedExclusive(Kcb)) &&
-            !(CmpTryToConvertKcbSharedToExclusive(Kcb)))
+        /* Make sure nobody changed the list behind our back */
+        ValueIndex = (PCM_CACHED_VALUE_INDEX)CMP_GET_CACHED_CELL(ChildList->ValueList);
+        if ((ValueIndex->CellIndex == ValueList.List) &&
+            (ChildList->Count == ValueList.Count))
         {
-            /* We need the exclusive lock */
-            return SearchNeedExclusiveLock;
+            /* It's current, use it */
+            *IndexIsCached = TRUE;
+            *CellData = CMP_GET_CACHED_DATA(ChildList->ValueList);
+            return SearchSuccess;
         }
-                
-        /* Select the value list as our cell, and get the actual list array */
-        CellToRelease = ChildList->ValueList;
-        *CellData = (PCELL_DATA)HvGetCell(Hive, CellToRelease);
-        if (!(*CellData)) return SearchFail;
-        
-        /* FIXME: Here we would cache the value */
+    }
+    else if ((ValueList.Count == 0) && (ChildList->Count == 0))
+    {
+        /* There's no list at all */
+        return SearchSuccess;
+    }
+
+    /* Make sure the KCB is locked exclusive */
+    if (!(CmpIsKcbLockedExclusive(Kcb)) &&
+        !(CmpTryToConvertKcbSharedToExclusive(Kcb)))
+    {
+        /* We need the exclusive lock */
+        return SearchNeedExclusiveLock;
+    }
+
+    /* Drop a stale index and pick up the key node's list */
+    CmpCleanUpKcbValueCache(Kcb);
+    ChildList->Count = ValueList.Count;
+    ChildList->ValueList = ValueList.List;
+    if (!ValueList.Count) return SearchSuccess;
 
-        /* Return the cell to be released */
-        *ValueListToRelease = CellToRelease;
+    /* Select the value list as our cell, and get the actual list array */
+    CellToRelease = ValueList.List;
+    *CellData = (PCELL_DATA)HvGetCell(Hive, CellToRelease);
+    if (!(*CellData)) return SearchFail;
+
+    /* Build the hashed index and cache it in the KCB */
+    ValueIndex = CmpBuildValueIndex(Hive, &ValueList, *CellData);
+    if (ValueIndex)
+    {
+        /* The list cell isn't needed anymore */
+        HvReleaseCell(Hive, CellToRelease);
+        ChildList->ValueList = (ULONG_PTR)ValueIndex | HCELL_CACHED;
+        *IndexIsCached = TRUE;
+        *CellData = CMP_GET_CACHED_DATA(ChildList->ValueList);
+        return SearchSuccess;
     }
 
+    /* No index, so return the cell to be released */
+    *ValueListToRelease = CellToRelease;
+
     /* If we got here, then the value list was found */
     return SearchSuccess;
 }
@@ -117,25 +205,24 @@ CmpGetValueKeyFromCache(IN PCM_KEY_CONTROL_BLOCK Kcb,
     /* Get the hive */
     Hive = Kcb->KeyHive;
 
-    /* Check if the index was cached */
+    /* Get the cell index, from the cached index if there is one */
     if (IndexIsCached)
     {
-        /* Not expected yet! */
-        ASSERT_VALUE_CACHE();
-        *ValueIsCached = TRUE;
+        Cell = (HCELL_INDEX)((PULONG_PTR)CellData)[Index];
     }
     else
     {
-        /* Get the cell index and the key value associated to it */
         Cell = CellData->u.KeyList[Index];
-        KeyValue = (PCM_KEY_VALUE)HvGetCell(Hive, Cell);
-        if (!KeyValue) return SearchFail;
-
-        /* Return the cell and the actual key value */
-        *CellToRelease = Cell;
-        *Value = KeyValue;
     }
 
+    /* Get the key value associated to it */
+    KeyValue = (PCM_KEY_VALUE)HvGetCell(Hive, Cell);
+    if (!KeyValue) return SearchFail;
+
+    /* Return the cell and the actual key value */
+    *CellToRelease = Cell;
+    *Value = KeyValue;
+
     /* If we got here, then we found the key value */
     return SearchSuccess;
 }
@@ -203,126 +290,142 @@ CmpFindValueByNameFromCache(IN PCM_KEY_CONTROL_BLOCK Kcb,
                             OUT PHCELL_INDEX CellToRelease)
 {
     PHHIVE Hive;
-    VALUE_SEARCH_RETURN_TYPE SearchResult = SearchFail;
+    VALUE_SEARCH_RETURN_TYPE SearchResult;
     LONG Result;
     UNICODE_STRING SearchName;
     PCELL_DATA CellData;
-    PCACHED_CHILD_LIST ChildList;
+    PCM_CACHED_VALUE_INDEX ValueIndex = NULL;
     PCM_KEY_VALUE KeyValue;
     BOOLEAN IndexIsCached;
-    ULONG i = 0;
+    ULONG i, Next, HashKey = 0;
     HCELL_INDEX Cell = HCELL_NIL;
-    PCM_KEY_NODE KeyNode;
 
     /* Set defaults */
     *CellToRelease = HCELL_NIL;
     *Value = NULL;
+    *ValueIsCached = FALSE;
 
-    /* Get the hive and child list */
+    /* Get the hive and the value list, this builds the index if needed */
     Hive = Kcb->KeyHive;
-    ChildList = &Kcb->ValueCache;
-    KeyNode = (PCM_KEY_NODE)HvGetCell(Hive, Kcb->KeyCell);
-    ChildList = (PCACHED_CHILD_LIST)&KeyNode->ValueList;
+    SearchResult = CmpGetValueListFromCache(Kcb,
+                                            &CellData,
+                                            &IndexIsCached,
+                                            &Cell);
+    if (SearchResult != SearchSuccess)
+    {
+        /* We either failed or need the exclusive lock */
+        ASSERT((SearchResult == SearchFail) || !(CmpIsKcbLockedExclusive(Kcb)));
+        ASSERT(Cell == HCELL_NIL);
+        return SearchResult;
+    }
 
-    /* Check if the child list has any entries */
-    if (ChildList->Count != 0)
+    /* Check if the value list has any entries */
+    if (Kcb->ValueCache.Count == 0)
     {
-        /* Get the value list associated to this child list */
-        SearchResult = CmpGetValueListFromCache(Kcb,
-                                                &CellData,
-                                                &IndexIsCached,
-                                                &Cell);
-        if (SearchResult != SearchSuccess)
-        {
-            /* We either failed or need the exclusive lock */
-            ASSERT((SearchResult == SearchFail) || !(CmpIsKcbLockedExclusive(Kcb)));
-            ASSERT(Cell == HCELL_NIL);
-            return SearchResult;
-        }
+        /* It doesn't, so the value can't be there */
+        ASSERT(Cell == HCELL_NIL);
+        return SearchFail;
+    }
 
-        /* The index shouldn't be cached right now */
-        if (IndexIsCached) ASSERT_VALUE_CACHE();
+    /* Check if we have a hashed index */
+    if (IndexIsCached)
+    {
+        /* Only look at the values in the bucket of this name */
+        ValueIndex = (PCM_CACHED_VALUE_INDEX)CMP_GET_CACHED_CELL(Kcb->ValueCache.ValueList);
+        HashKey = CmpComputeHashKey(0, Name, TRUE);
+        Next = ValueIndex->HashTable[HashKey & ValueIndex->HashMask];
+    }
+    else
+    {
+        /* Look at every value */
+        Next = 1;
+    }
 
-        /* Loop every value */
-        while (TRUE)
+    /* Loop the candidates, which are stored as index + 1 */
+    SearchResult = SearchFail;
+    while (Next)
+    {
+        /* Get this candidate and find the next one */
+        i = Next - 1;
+        if (ValueIndex)
         {
-            /* Check if there's any cell to release */
-            if (*CellToRelease != HCELL_NIL)
-            {
-                /* Release it now */
-                HvReleaseCell(Hive, *CellToRelease);
-                *CellToRelease = HCELL_NIL;
-            }
+            /* Follow the chain, skipping values with another hash */
+            Next = ValueIndex->HashChain[i];
+            if (ValueIndex->HashKey[i] != HashKey) continue;
+        }
+        else
+        {
+            /* Go through the list */
+            Next = ((i + 1) < Kcb->ValueCache.Count) ? (i + 2) : 0;
+        }
 
-            /* Get the key value for this index */
-            SearchResult =  CmpGetValueKeyFromCache(Kcb,
-                                                    CellData,
-                                                    i,
-                                                    CachedValue,
-                                                    Value,
-                                                    IndexIsCached,
-                                                    ValueIsCached,
-                                                    CellToRelease);
-            if (SearchResult != SearchSuccess)
-            {
-                /* We either failed or need the exclusive lock */
-                ASSERT((SearchResult == SearchFail) || !(CmpIsKcbLockedExclusive(Kcb)));
-                ASSERT(Cell == HCELL_NIL);
-                return SearchResult;
-            }
+        /* Check if there's any cell to release */
+        if (*CellToRelease != HCELL_NIL)
+        {
+            /* Release it now */
+            HvReleaseCell(Hive, *CellToRelease);
+            *CellToRelease = HCELL_NIL;
+        }
 
-            /* Check if the both the index and the value are cached */
-            if ((IndexIsCached) && (*ValueIsCached))
-            {
-                /* We don't expect this yet */
-                ASSERT_VALUE_CACHE();
-                Result = -1;
-            }
-            else
-            {
-                /* No cache, so try to compare the name. Is it compressed? */
-                KeyValue = *Value;
-                if (KeyValue->Flags & VALUE_COMP_NAME)
-                {
-                    /* It is, do a compressed name comparison */
-                    Result = CmpCompareCompressedName(Name,
-                                                      KeyValue->Name,
-                                                      KeyValue->NameLength);
-                }
-                else
-                {
-                    /* It's not compressed, so do a standard comparison */
-                    SearchName.Length = KeyValue->NameLength;
-                    SearchName.MaximumLength = SearchName.Length;
-                    SearchName.Buffer = KeyValue->Name;
-                    Result = RtlCompareUnicodeString(Name, &SearchName, TRUE);
-                }
-            }
+        /* Get the key value for this index */
+        SearchResult = CmpGetValueKeyFromCache(Kcb,
+                                               CellData,
+                                               i,
+                                               CachedValue,
+                                               Value,
+                                               IndexIsCached,
+                                               ValueIsCached,
+                                               CellToRelease);
+        if (SearchResult != SearchSuccess)
+        {
+            /* We failed, the exclusive lock can't help with that */
+            ASSERT(SearchResult == SearchFail);
+            goto Quickie;
+        }
 
-            /* Check if we found the value data */
-            if (!Result)
-            {
-                /* We have, return the index of the value and success */
-                *Index = i;
-                SearchResult = SearchSuccess;
-                goto Quickie;
-            }
+        /* Try to compare the name. Is it compressed? */
+        KeyValue = *Value;
+        if (KeyValue->Flags & VALUE_COMP_NAME)
+        {
+            /* It is, do a compressed name comparison */
+            Result = CmpCompareCompressedName(Name,
+                                              KeyValue->Name,
+                                              KeyValue->NameLength);
+        }
+        else
+        {
+            /* It's not compressed, so do a standard comparison */
+            SearchName.Length = KeyValue->NameLength;
+            SearchName.MaximumLength = SearchName.Length;
+            SearchName.Buffer = KeyValue->Name;
+            Result = RtlCompareUnicodeString(Name, &SearchName, TRUE);
+        }
 
-            /* We didn't find it, try the next entry */
-            if (++i == ChildList->Count)
-            {
-                /* The entire list was parsed, fail */
-                *Value = NULL;
-                SearchResult = SearchFail;
-                goto Quickie;
-            }
+        /* Check if we found the value data */
+        if (!Result)
+        {
+            /* We have, return the index of the value and success */
+            *Index = i;
+            SearchResult = SearchSuccess;
+            goto Quickie;
         }
+
+        /* Not this one */
+        SearchResult = SearchFail;
     }
 
-    /* We should only get here if the child list is empty */
-    ASSERT(ChildList->Count == 0);
+    /* The candidates were all parsed, fail */
+    *Value = NULL;
 
 Quickie:
+    /* Don't hand out a value cell if the search failed */
+    if ((SearchResult != SearchSuccess) && (*CellToRelease != HCELL_NIL))
+    {
+        HvReleaseCell(Hive, *CellToRelease);
+        *CellToRelease = HCELL_NIL;
+        *Value = NULL;
+    }
+
     /* Release the value list cell if required, and return search result */
     if (Cell != HCELL_NIL) HvReleaseCell(Hive, Cell);
     return SearchResult;
@@ -805,13 +908,13 @@ CmpCompareNewValueDataAgainstKCBCache(IN PCM_KEY_CONTROL_BLOCK Kcb,
 
 Quickie:
     /* Release the value cell */
-    if (ValueCellToRelease) HvReleaseCell(Kcb->KeyHive, ValueCellToRelease);
+    if (ValueCellToRelease != HCELL_NIL) HvReleaseCell(Kcb->KeyHive, ValueCellToRelease);
     
     /* Free the buffer */
     if (BufferAllocated) CmpFree(Buffer, 0);
     
     /* Free the cell */
-    if (CellToRelease) HvReleaseCell(Kcb->KeyHive, CellToRelease);
+    if (CellToRelease != HCELL_NIL) HvReleaseCell(Kcb->KeyHive, CellToRelease);
 
     /* Return the search result */
     return SearchResult;
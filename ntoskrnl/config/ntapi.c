@@ -766,15 +766,21 @@ NtFlushKey(IN HANDLE KeyHandle)
     {
         /* Fail */
         Status = STATUS_KEY_DELETED;
+        CmpReleaseKcbLock(KeyObject->KeyControlBlock);
     }
     else
     {
+        /*
+         * The flush takes the hive lock, which ranks above the KCB lock,
+         * so drop the KCB lock first. The registry lock keeps the hive.
+         */
+        CmpReleaseKcbLock(KeyObject->KeyControlBlock);
+
         /* Call the internal API */
         Status = CmFlushKey(KeyObject->KeyControlBlock, FALSE);
     }
 
-    /* Release the locks */
-    CmpReleaseKcbLock(KeyObject->KeyControlBlock);
+    /* Release the registry lock */
     CmpUnlockRegistry();
 
     /* Dereference the object and return status */
@@ -27,6 +27,12 @@ LIST_ENTRY ExPoolLookasideListHead;
 GENERAL_LOOKASIDE ExpSmallNPagedPoolLookasideLists[MAXIMUM_PROCESSORS];
 GENERAL_LOOKASIDE ExpSmallPagedPoolLookasideLists[MAXIMUM_PROCESSORS];
 
+/* Lists get no shallower than this, nor deeper than their maximum */
+#define MINIMUM_LOOKASIDE_DEPTH     4
+
+/* Lists with fewer allocations per scan than this are considered idle */
+#define LOOKASIDE_ACTIVE_ALLOCATES  75
+
 /* PRIVATE FUNCTIONS *********************************************************/
 
 VOID
@@ -123,8 +129,211 @@ ExpInitLookasideLists()
     }
 }
 
+USHORT
+NTAPI
+ExpComputeLookasideDepth(IN PGENERAL_LOOKASIDE Lookaside)
+{
+    ULONG Allocates, Misses, MissRate, Depth, MaximumDepth, Increase;
+
+    /* Get what happened since the last scan, and start the next period */
+    Allocates = Lookaside->TotalAllocates - Lookaside->LastTotalAllocates;
+    Misses = Lookaside->AllocateMisses - Lookaside->LastAllocateMisses;
+    Lookaside->LastTotalAllocates = Lookaside->TotalAllocates;
+    Lookaside->LastAllocateMisses = Lookaside->AllocateMisses;
+
+    /* Get the current depth within bounds */
+    MaximumDepth = max(Lookaside->MaximumDepth, MINIMUM_LOOKASIDE_DEPTH);
+    Depth = min(max(Lookaside->Depth, MINIMUM_LOOKASIDE_DEPTH), MaximumDepth);
+
+    if (Allocates < LOOKASIDE_ACTIVE_ALLOCATES)
+    {
+        /* Give back the memory an idle list holds quickly */
+        Depth = max(Depth - min(Depth, 10), MINIMUM_LOOKASIDE_DEPTH);
+    }
+    else
+    {
+        /* Get the miss rate in tenths of a percent */
+        MissRate = min(Misses, Allocates) * 1000 / Allocates;
+        if (MissRate < 5)
+        {
+            /* Almost every allocation hits, so shrink slowly */
+            if (Depth > MINIMUM_LOOKASIDE_DEPTH) Depth--;
+        }
+        else
+        {
+            /* Grow in proportion to the miss rate, but no more than 30 at once */
+            Increase = ((MaximumDepth - Depth) * MissRate) / 2000;
+            Depth += min(max(Increase, 1), 30);
+            if (Depth > MaximumDepth) Depth = MaximumDepth;
+        }
+    }
+
+    return (USHORT)Depth;
+}
+
+VOID
+NTAPI
+ExpScanGeneralLookasideList(IN PLIST_ENTRY ListHead,
+                            IN PKSPIN_LOCK SpinLock OPTIONAL)
+{
+    PLIST_ENTRY ListEntry;
+    PGENERAL_LOOKASIDE Lookaside;
+    KIRQL OldIrql = PASSIVE_LEVEL;
+
+    /* Lock the list if lookasides may be deleted while we walk it */
+    if (SpinLock) KeAcquireSpinLock(SpinLock, &OldIrql);
+
+    /* Retune the depth of every list on it */
+    for (ListEntry = ListHead->Flink;
+         ListEntry != ListHead;
+         ListEntry = ListEntry->Flink)
+    {
+        Lookaside = CONTAINING_RECORD(ListEntry, GENERAL_LOOKASIDE, ListEntry);
+        Lookaside->Depth = ExpComputeLookasideDepth(Lookaside);
+    }
+
+    if (SpinLock) KeReleaseSpinLock(SpinLock, OldIrql);
+}
+
+ULONG
+NTAPI
+ExpCopyLookasideInformation(IN PLIST_ENTRY ListHead,
+                            IN PKSPIN_LOCK SpinLock OPTIONAL,
+                            OUT PSYSTEM_LOOKASIDE_INFORMATION Information OPTIONAL,
+                            IN ULONG Count)
+{
+    PLIST_ENTRY ListEntry;
+    PGENERAL_LOOKASIDE Lookaside;
+    KIRQL OldIrql = PASSIVE_LEVEL;
+    ULONG i = 0;
+
+    /* Lock the list if lookasides may be deleted while we walk it */
+    if (SpinLock) KeAcquireSpinLock(SpinLock, &OldIrql);
+
+    /* Copy up to Count lists, or just count them if there is no buffer */
+    for (ListEntry = ListHead->Flink;
+         (ListEntry != ListHead) && (i < Count);
+         ListEntry = ListEntry->Flink, i++)
+    {
+        if (!Information) continue;
+
+        Lookaside = CONTAINING_RECORD(ListEntry, GENERAL_LOOKASIDE, ListEntry);
+        Information[i].CurrentDepth = Lookaside->Depth;
+        Information[i].MaximumDepth = Lookaside->MaximumDepth;
+        Information[i].TotalAllocates = Lookaside->TotalAllocates;
+        Information[i].AllocateMisses = Lookaside->AllocateMisses;
+        Information[i].TotalFrees = Lookaside->TotalFrees;
+        Information[i].FreeMisses = Lookaside->FreeMisses;
+        Information[i].Type = Lookaside->Type;
+        Information[i].Tag = Lookaside->Tag;
+        Information[i].Size = Lookaside->Size;
+    }
+
+    if (SpinLock) KeReleaseSpinLock(SpinLock, OldIrql);
+    return i;
+}
+
+NTSTATUS
+NTAPI
+ExpQueryLookasideInformation(OUT PSYSTEM_LOOKASIDE_INFORMATION Buffer,
+                             IN ULONG Size,
+                             OUT PULONG ReqSize)
+{
+    PSYSTEM_LOOKASIDE_INFORMATION Information;
+    ULONG Count, Copied;
+    NTSTATUS Status = STATUS_SUCCESS;
+
+    /* Count the lists */
+    Count = ExpCopyLookasideInformation(&ExSystemLookasideListHead,
+                                        NULL,
+                                        NULL,
+                                        MAXULONG);
+    Count += ExpCopyLookasideInformation(&ExPoolLookasideListHead,
+                                         NULL,
+                                         NULL,
+                                         MAXULONG);
+    Count += ExpCopyLookasideInformation(&ExpNonPagedLookasideListHead,
+                                         &ExpNonPagedLookasideListLock,
+                                         NULL,
+                                         MAXULONG);
+    Count += ExpCopyLookasideInformation(&ExpPagedLookasideListHead,
+                                         &ExpPagedLookasideListLock,
+                                         NULL,
+                                         MAXULONG);
+
+    /* Return as many as the caller's buffer holds, and what all would take */
+    *ReqSize = Count * sizeof(SYSTEM_LOOKASIDE_INFORMATION);
+    if (Size < *ReqSize)
+    {
+        Count = Size / sizeof(SYSTEM_LOOKASIDE_INFORMATION);
+        Status = STATUS_BUFFER_OVERFLOW;
+    }
+    if (!Count) return Status;
+
+    /* The driver lists are copied under a spinlock, so use nonpaged pool */
+    Information = ExAllocatePoolWithTag(NonPagedPool,
+                                        Count * sizeof(SYSTEM_LOOKASIDE_INFORMATION),
+                                        'looP');
+    if (!Information) return STATUS_INSUFFICIENT_RESOURCES;
+
+    /* Copy what is there now, lists may have been deleted meanwhile */
+    Copied = ExpCopyLookasideInformation(&ExSystemLookasideListHead,
+                                         NULL,
+                                         Information,
+                                         Count);
+    Copied += ExpCopyLookasideInformation(&ExPoolLookasideListHead,
+                                          NULL,
+                                          Information + Copied,
+                                          Count - Copied);
+    Copied += ExpCopyLookasideInformation(&ExpNonPagedLookasideListHead,
+                                          &ExpNonPagedLookasideListLock,
+                                          Information + Copied,
+                                          Count - Copied);
+    Copied += ExpCopyLookasideInformation(&ExpPagedLookasideListHead,
+                                          &ExpPagedLookasideListLock,
+                                          Information + Copied,
+                                          Count - Copied);
+
+    /* Return them to the caller */
+    _SEH2_TRY
+    {
+        RtlCopyMemory(Buffer,
+                      Information,
+                      Copied * sizeof(SYSTEM_LOOKASIDE_INFORMATION));
+        if (Status == STATUS_SUCCESS)
+        {
+            *ReqSize = Copied * sizeof(SYSTEM_LOOKASIDE_INFORMATION);
+        }
+    }
+    _SEH2_EXCEPT(EXCEPTION_EXECUTE_HANDLER)
+    {
+        Status = _SEH2_GetExceptionCode();
+    }
+    _SEH2_END;
+
+    ExFreePoolWithTag(Information, 'looP');
+    return Status;
+}
+
 /* PUBLIC FUNCTIONS **********************************************************/
 
+/*
+ * @implemented
+ */
+VOID
+ExAdjustLookasideDepth(VOID)
+{
+    /* The system and pool lists are never deleted */
+    ExpScanGeneralLookasideList(&ExSystemLookasideListHead, NULL);
+    ExpScanGeneralLookasideList(&ExPoolLookasideListHead, NULL);
+
+    /* Driver lists are, so they are walked under their lock */
+    ExpScanGeneralLookasideList(&ExpNonPagedLookasideListHead,
+                                &ExpNonPagedLookasideListLock);
+    ExpScanGeneralLookasideList(&ExpPagedLookasideListHead,
+                                &ExpPagedLookasideListLock);
+}
+
 /*
  * @implemented
  */
@@ -313,9 +522,9 @@ ExInitializePagedLookasideList(IN PPAGED_LOOKASIDE_LIST Lookaside,
     }
 
     /* Insert it into the list */
-    ExInterlockedInsertTailList(&ExpNonPagedLookasideListHead,
+    ExInterlockedInsertTailList(&ExpPagedLookasideListHead,
                                 &Lookaside->L.ListEntry,
-                                &ExpNonPagedLookasideListLock);
+                                &ExpPagedLookasideListLock);
 }
 
 /* EOF */
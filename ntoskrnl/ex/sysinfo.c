@@ -1732,9 +1732,10 @@ SSI_DEF(SystemCurrentTimeZoneInformation)
 /* Class 45 - Lookaside Information */
 QSI_DEF(SystemLookasideInformation)
 {
-    /* FIXME */
-    DPRINT1("NtQuerySystemInformation - SystemLookasideInformation not implemented\n");
-    return STATUS_NOT_IMPLEMENTED;
+    /* Call the lookaside list code to fill it in */
+    return ExpQueryLookasideInformation((PSYSTEM_LOOKASIDE_INFORMATION)Buffer,
+                                        Size,
+                                        ReqSize);
 }
 
 
@@ -1822,6 +1823,49 @@ QSI_DEF(SystemSessionProcessesInformation)
 }
 
 
+/* Class 98 - Device I/O Statistics */
+QSI_DEF(SystemDeviceIoStatisticsInformation)
+{
+    /* Let the I/O manager fill it in */
+    return IopQueryDeviceIoStatistics(Buffer, Size, ReqSize);
+}
+
+SSI_DEF(SystemDeviceIoStatisticsInformation)
+{
+    KPROCESSOR_MODE PreviousMode = KeGetPreviousMode();
+    ULONG Flags;
+
+    /* Check size of a buffer, it must match our expectations */
+    if (sizeof(ULONG) != Size)
+        return STATUS_INFO_LENGTH_MISMATCH;
+
+    /* Check who is calling */
+    if (PreviousMode != KernelMode)
+    {
+        /* Check access rights */
+        if (!SeSinglePrivilegeCheck(SeSystemProfilePrivilege, PreviousMode))
+        {
+            return STATUS_PRIVILEGE_NOT_HELD;
+        }
+    }
+
+    /* Capture the flags */
+    _SEH2_TRY
+    {
+        if (PreviousMode != KernelMode) ProbeForRead(Buffer, sizeof(ULONG), sizeof(ULONG));
+        Flags = *(PULONG)Buffer;
+    }
+    _SEH2_EXCEPT(ExSystemExceptionFilter())
+    {
+        _SEH2_YIELD(return _SEH2_GetExceptionCode());
+    }
+    _SEH2_END;
+
+    /* Turn the statistics on or off, or reset them */
+    return IopSetDeviceIoStatistics(Flags);
+}
+
+
 /* Query/Set Calls Table */
 typedef
 struct _QSSI_CALLS
@@ -1898,7 +1942,52 @@ CallQS [] =
     SI_QX(SystemRangeStartInformation),
     SI_QS(SystemVerifierInformation),
     SI_XS(SystemAddVerifier),
-    SI_QX(SystemSessionProcessesInformation)
+    SI_QX(SystemSessionProcessesInformation),
+    SI_XX(SystemLoadGdiDriverInSystemSpaceInformation),
+    SI_XX(SystemNumaProcessorMap),
+    SI_XX(SystemPrefetcherInformation),
+    SI_XX(SystemExtendedProcessInformation),
+    SI_XX(SystemRecommendedSharedDataAlignment),
+    SI_XX(SystemComPlusPackage),
+    SI_XX(SystemNumaAvailableMemory),
+    SI_XX(SystemProcessorPowerInformation),
+    SI_XX(SystemEmulationBasicInformation),
+    SI_XX(SystemEmulationProcessorInformation),
+    SI_XX(SystemExtendedHanfleInformation),
+    SI_XX(SystemLostDelayedWriteInformation),
+    SI_XX(SystemBigPoolInformation),
+    SI_XX(SystemSessionPoolTagInformation),
+    SI_XX(SystemSessionMappedViewInformation),
+    SI_XX(SystemHotpatchInformation),
+    SI_XX(SystemObjectSecurityMode),
+    SI_XX(SystemWatchDogTimerHandler),
+    SI_XX(SystemWatchDogTimerInformation),
+    SI_XX(SystemLogicalProcessorInformation),
+    SI_XX(SystemWow64SharedInformationObsolete),
+    SI_XX(SystemRegisterFirmwareTableInformationHandler),
+    SI_XX(SystemFirmwareTableInformation),
+    SI_XX(SystemModuleInformationEx),
+    SI_XX(SystemVerifierTriageInformation),
+    SI_XX(SystemSuperfetchInformation),
+    SI_XX(SystemMemoryListInformation),
+    SI_XX(SystemFileCacheInformationEx),
+    SI_XX(SystemThreadPriorityClientIdInformation),
+    SI_XX(SystemProcessorIdleCycleTimeInformation),
+    SI_XX(SystemVerifierCancellationInformation),
+    SI_XX(SystemProcessorPowerInformationEx),
+    SI_XX(SystemRefTraceInformation),
+    SI_XX(SystemSpecialPoolInformation),
+    SI_XX(SystemProcessIdInformation),
+    SI_XX(SystemErrorPortInformation),
+    SI_XX(SystemBootEnvironmentInformation),
+    SI_XX(SystemHypervisorInformation),
+    SI_XX(SystemVerifierInformationEx),
+    SI_XX(SystemTimeZoneInformation),
+    SI_XX(SystemImageFileExecutionOptionsInformation),
+    SI_XX(SystemCoverageInformation),
+    SI_XX(SystemPrefetchPathInformation),
+    SI_XX(SystemVerifierFaultsInformation),
+    SI_QS(SystemDeviceIoStatisticsInformation)
 };
 
 C_ASSERT(SystemBasicInformation == 0);
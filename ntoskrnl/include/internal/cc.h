@@ -101,6 +101,65 @@ typedef struct _PFSN_PREFETCHER_GLOBALS
     LONG ActivePrefetches;
 } PFSN_PREFETCHER_GLOBALS, *PPFSN_PREFETCHER_GLOBALS;
 
+//
+// Application launch prefetcher
+//
+#define PF_ENABLE_APP_LAUNCH            0x1
+#define PF_LAUNCH_TRACE_MAGIC           'TLfP'
+#define PF_LAUNCH_TRACE_VERSION         1
+#define PF_MAX_TRACE_FILES              64
+#define PF_MAX_TRACE_PAGES              8192
+#define PF_MAX_TRACE_SIZE               (1024 * 1024)
+#define PF_TRACE_PERIOD_SECONDS         10
+#define PF_MAX_PREFETCH_RUN             (64 * 1024)
+
+//
+// On-disk launch trace, kept in \SystemRoot\Prefetch. The header is followed
+// by NumFiles file records, NumPages page numbers sorted per file and the
+// NT names of the files
+//
+typedef struct _PF_LAUNCH_TRACE_FILE
+{
+    ULONG NameOffset;
+    ULONG NameLength;
+    ULONG FirstPage;
+    ULONG NumPages;
+} PF_LAUNCH_TRACE_FILE, *PPF_LAUNCH_TRACE_FILE;
+
+typedef struct _PF_LAUNCH_TRACE
+{
+    ULONG Magic;
+    ULONG Version;
+    ULONG Size;
+    ULONG NumFiles;
+    ULONG NumPages;
+    ULONG FileTableOffset;
+    ULONG PageTableOffset;
+} PF_LAUNCH_TRACE, *PPF_LAUNCH_TRACE;
+
+//
+// A launch being traced, hangs off EPROCESS->PrefetchTrace
+//
+typedef struct _PFSN_LAUNCH_TRACE
+{
+    LIST_ENTRY ActiveTracesLink;
+    PEPROCESS Process;
+    UNICODE_STRING TraceFileName;
+    KTIMER TraceTimer;
+    KDPC TraceTimerDpc;
+    KEVENT TraceTimerDone;
+    WORK_QUEUE_ITEM EndTraceWorkItem;
+    LONG EndTraceCalled;
+    KSPIN_LOCK FileTableLock;
+    ULONG NumFiles;
+    PFILE_OBJECT Files[PF_MAX_TRACE_FILES];
+    HANDLE PrefetchHandles[PF_MAX_TRACE_FILES];
+    LONG NumEntries;
+    PULONGLONG Entries;
+} PFSN_LAUNCH_TRACE, *PPFSN_LAUNCH_TRACE;
+
+extern ULONG CcPfEnablePrefetcher;
+
 typedef struct _BCB
 {
     LIST_ENTRY BcbSegmentListHead;
@@ -169,6 +228,25 @@ CcPfInitializePrefetcher(
     VOID
 );
 
+VOID
+NTAPI
+CcPfBeginAppLaunch(
+    IN PEPROCESS Process
+);
+
+VOID
+NTAPI
+CcPfProcessExitNotification(
+    IN PEPROCESS Process
+);
+
+VOID
+NTAPI
+CcPfLogPageFault(
+    IN PFILE_OBJECT FileObject,
+    IN ULONG FileOffset
+);
+
 VOID
 NTAPI
 CcMdlReadComplete2(
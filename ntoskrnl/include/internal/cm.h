@@ -72,6 +72,7 @@
 //
 #define CMP_SECURITY_HASH_LISTS                         64
 #define CMP_MAX_CALLBACKS                               100
+#define CMP_MISSING_KEY_CACHE_SIZE                      8
 
 //
 // Hashing Constants
@@ -201,7 +202,7 @@ typedef struct _CACHED_CHILD_LIST
     ULONG Count;
     union
     {
-        ULONG ValueList;
+        ULONG_PTR ValueList;
         struct _CM_KEY_CONTROL_BLOCK *RealKcb;
     };
 } CACHED_CHILD_LIST, *PCACHED_CHILD_LIST;
@@ -247,6 +248,16 @@ typedef struct _CM_NAME_CONTROL_BLOCK
     };
 } CM_NAME_CONTROL_BLOCK, *PCM_NAME_CONTROL_BLOCK;
 
+//
+// Missing Subkey Block
+//
+typedef struct _CM_MISSING_KEY_BLOCK
+{
+    ULONG Count;
+    ULONG Next;
+    PCM_NAME_CONTROL_BLOCK NameBlock[CMP_MISSING_KEY_CACHE_SIZE];
+} CM_MISSING_KEY_BLOCK, *PCM_MISSING_KEY_BLOCK;
+
 //
 // Key Control Block (KCB)
 //
@@ -296,6 +307,7 @@ typedef struct _CM_KEY_CONTROL_BLOCK
     USHORT KcbMaxValueNameLen;
     ULONG KcbMaxValueDataLen;
     ULONG InDelayClose;
+    PCM_MISSING_KEY_BLOCK MissingKeys;
 } CM_KEY_CONTROL_BLOCK, *PCM_KEY_CONTROL_BLOCK;
 
 //
@@ -429,6 +441,10 @@ typedef struct _CMHIVE
 typedef struct _CM_CACHED_VALUE_INDEX
 {
     HCELL_INDEX CellIndex;
+    ULONG HashMask;
+    PULONG HashTable;
+    PULONG HashChain;
+    PULONG HashKey;
     union
     {
         CELL_DATA CellData;
@@ -541,6 +557,18 @@ CmpInitHiveViewList(
     IN PCMHIVE Hive
 );
 
+VOID
+NTAPI
+CmpLockHiveViews(
+    IN PHHIVE RegistryHive
+);
+
+VOID
+NTAPI
+CmpUnlockHiveViews(
+    IN PHHIVE RegistryHive
+);
+
 //
 // Security Cache Functions
 //
@@ -579,6 +607,14 @@ CmpQueryKeyValueData(
     OUT PNTSTATUS Status
 );
 
+PCM_CACHED_VALUE_INDEX
+NTAPI
+CmpBuildValueIndex(
+    IN PHHIVE Hive,
+    IN PCHILD_LIST ValueList,
+    IN PCELL_DATA CellData
+);
+
 VALUE_SEARCH_RETURN_TYPE
 NTAPI
 CmpGetValueListFromCache(
@@ -829,6 +865,18 @@ CmpTestRegistryLock(
     VOID
 );
 
+VOID
+NTAPI
+CmpLockAllHivesExclusive(
+    VOID
+);
+
+VOID
+NTAPI
+CmpUnlockAllHives(
+    VOID
+);
+
 VOID
 NTAPI
 CmpLockRegistryExclusive(
@@ -877,6 +925,30 @@ CmpUnlockHiveFlusher(
     IN PCMHIVE Hive
 );
 
+BOOLEAN
+NTAPI
+CmpLockHiveShared(
+    IN PCMHIVE Hive
+);
+
+BOOLEAN
+NTAPI
+CmpLockHiveExclusive(
+    IN PCMHIVE Hive
+);
+
+BOOLEAN
+NTAPI
+CmpTestHiveLockExclusive(
+    IN PCMHIVE Hive
+);
+
+VOID
+NTAPI
+CmpUnlockHive(
+    IN PCMHIVE Hive
+);
+
 //
 // Delay Functions
 //
@@ -972,6 +1044,33 @@ CmpCleanUpSubKeyInfo(
     IN PCM_KEY_CONTROL_BLOCK Kcb
 );
 
+BOOLEAN
+NTAPI
+CmpFindMissingSubKey(
+    IN PCM_KEY_CONTROL_BLOCK Kcb,
+    IN PCUNICODE_STRING Name
+);
+
+VOID
+NTAPI
+CmpAddMissingSubKey(
+    IN PCM_KEY_CONTROL_BLOCK Kcb,
+    IN PUNICODE_STRING Name,
+    IN LONG CreateCount
+);
+
+VOID
+NTAPI
+CmpCleanUpMissingSubKeys(
+    IN PCM_KEY_CONTROL_BLOCK Kcb
+);
+
+VOID
+NTAPI
+CmpInvalidateMissingSubKeys(
+    IN PCM_KEY_CONTROL_BLOCK Kcb
+);
+
 PUNICODE_STRING
 NTAPI
 CmpConstructName(
@@ -1140,6 +1239,12 @@ CmpLazyFlush(
     VOID
 );
 
+BOOLEAN
+NTAPI
+CmpFlushHive(
+    IN PCMHIVE CmHive
+);
+
 //
 // Open/Create Routines
 //
@@ -1620,6 +1725,7 @@ extern HANDLE CmpRegistryRootHandle;
 extern BOOLEAN ExpInTextModeSetup;
 extern BOOLEAN InitIsWinPEMode;
 extern ULONG CmpHashTableSize;
+extern volatile LONG CmpSubKeyCreateCount;
 extern ULONG CmpDelayedCloseSize, CmpDelayedCloseIndex;
 extern BOOLEAN CmpNoWrite;
 extern BOOLEAN CmpForceForceFlush;
@@ -223,6 +223,14 @@ VOID
 NTAPI
 ExInitPoolLookasidePointers(VOID);
 
+NTSTATUS
+NTAPI
+ExpQueryLookasideInformation(
+    OUT PSYSTEM_LOOKASIDE_INFORMATION Buffer,
+    IN ULONG Size,
+    OUT PULONG ReqSize
+);
+
 /* Callback Functions ********************************************************/
 
 VOID
@@ -104,6 +104,14 @@
     ((PEXTENDED_DEVOBJ_EXTENSION)                       \
      (DeviceObject->DeviceObjectExtension))             \
 
+//
+// IRPs from IoAllocateIrp carry one dispatch time per stack location
+// after the stack locations, for the I/O statistics
+//
+#define IRP_ALLOCATED_TIMESTAMPS                        0x40
+#define IopIrpTimestamps(Irp)                           \
+    ((PLARGE_INTEGER)((ULONG_PTR)(Irp) + (Irp)->Size))  \
+
 //
 // Returns the internal Driver Object Extension
 //
@@ -237,6 +245,18 @@ typedef enum _IOP_TRANSFER_TYPE
     IopOtherTransfer
 } IOP_TRANSFER_TYPE, *PIOP_TRANSFER_TYPE;
 
+//
+// Per device latency statistics, allocated when I/O statistics are on and
+// the device first gets a request
+//
+typedef struct _IO_DEVICE_STATISTICS
+{
+    LIST_ENTRY StatisticsListEntry;
+    PDEVICE_OBJECT DeviceObject;
+    LONG OutstandingCount;
+    SYSTEM_IO_MAJOR_STATISTICS MajorFunction[SYSTEM_IO_MAJOR_FUNCTIONS];
+} IO_DEVICE_STATISTICS, *PIO_DEVICE_STATISTICS;
+
 //
 // Packet Types when piggybacking on the IRP Overlay
 //
@@ -903,6 +923,44 @@ IopAbortInterruptedIrp(
     IN PIRP Irp
 );
 
+//
+// I/O Statistics Routines
+//
+VOID
+FASTCALL
+IopStartIrpTiming(
+    IN PDEVICE_OBJECT DeviceObject,
+    IN PIRP Irp,
+    IN PIO_STACK_LOCATION StackPtr
+);
+
+VOID
+FASTCALL
+IopEndIrpTiming(
+    IN PIRP Irp,
+    IN PIO_STACK_LOCATION StackPtr
+);
+
+VOID
+NTAPI
+IopDeleteDeviceStatistics(
+    IN PDEVICE_OBJECT DeviceObject
+);
+
+NTSTATUS
+NTAPI
+IopQueryDeviceIoStatistics(
+    OUT PSYSTEM_DEVICE_IO_STATISTICS_INFORMATION Buffer,
+    IN ULONG Size,
+    OUT PULONG ReqSize
+);
+
+NTSTATUS
+NTAPI
+IopSetDeviceIoStatistics(
+    IN ULONG Flags
+);
+
 //
 // Shutdown routines
 //
@@ -1264,6 +1322,7 @@ extern ULONG IopNumTriageDumpDataBlocks;
 extern PVOID IopTriageDumpDataBlocks[64];
 extern PIO_BUS_TYPE_GUID_LIST PnpBusTypeGuidList;
 extern PDRIVER_OBJECT IopRootDriverObject;
+extern ULONG IopIoStatisticsEnabled;
 
 //
 // Inlined Functions
@@ -5,6 +5,9 @@
 #define TAG_BCB   ' BCB'
 #define TAG_IBCB  'BCBi'
 
+/* cc/prefetch.c */
+#define TAG_PREFETCH 'hcPC'
+
 /* formely located in include/callback.h */
 #define CALLBACK_TAG        'KBLC'
 
@@ -64,6 +67,7 @@
 #define TAG_EA              'aEoI'
 #define TAG_IO_NAME         'mNoI'
 #define TAG_REINIT          'iRoI'
+#define TAG_IO_STATISTICS   'tSoI'
 
 /* formerly located in io/work.c */
 #define TAG_IOWI 'IWOI'
@@ -56,6 +56,9 @@ IopDeleteDevice(IN PVOID ObjectBody)
     if (DeviceNode)
         IopFreeDeviceNode(DeviceNode);
 
+    /* Free the I/O statistics of the device */
+    IopDeleteDeviceStatistics(DeviceObject);
+
     /* Dereference the driver object, referenced in IoCreateDevice */
     if (DeviceObject->DriverObject)
         ObDereferenceObject(DeviceObject->DriverObject);
@@ -98,9 +98,11 @@ IopInitLookasideLists(VOID)
     PKPRCB Prcb;
     PGENERAL_LOOKASIDE CurrentList = NULL;
 
-    /* Calculate the sizes */
-    LargeIrpSize = sizeof(IRP) + (8 * sizeof(IO_STACK_LOCATION));
-    SmallIrpSize = sizeof(IRP) + sizeof(IO_STACK_LOCATION);
+    /* Calculate the sizes, including the dispatch times after the stack */
+    LargeIrpSize = sizeof(IRP) + (8 * sizeof(IO_STACK_LOCATION)) +
+                   (8 * sizeof(LARGE_INTEGER));
+    SmallIrpSize = sizeof(IRP) + sizeof(IO_STACK_LOCATION) +
+                   sizeof(LARGE_INTEGER);
     MdlSize = sizeof(MDL) + (23 * sizeof(PFN_NUMBER));
 
     /* Initialize the Lookaside List for I\O Completion */
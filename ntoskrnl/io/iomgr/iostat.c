@@ -0,0 +1,354 @@
+/*
+ * PROJECT:         Odyssey Kernel
+ * LICENSE:         GPL - See COPYING in the top level directory
+ * FILE:            ntoskrnl/io/iomgr/iostat.c
+ * PURPOSE:         Per Device I/O Latency Statistics
+ */
+
+/* INCLUDES *****************************************************************/
+
+#include <ntoskrnl.h>
+#define NDEBUG
+#include <debug.h>
+
+/* GLOBALS ******************************************************************/
+
+ULONG IopIoStatisticsEnabled;
+LIST_ENTRY IopDeviceStatisticsListHead =
+    {&IopDeviceStatisticsListHead, &IopDeviceStatisticsListHead};
+KSPIN_LOCK IopDeviceStatisticsLock;
+
+C_ASSERT(SYSTEM_IO_MAJOR_FUNCTIONS == IRP_MJ_MAXIMUM_FUNCTION + 1);
+
+/* PRIVATE FUNCTIONS ********************************************************/
+
+PIO_DEVICE_STATISTICS
+NTAPI
+IopAllocateDeviceStatistics(IN PDEVICE_OBJECT DeviceObject)
+{
+    PEXTENDED_DEVOBJ_EXTENSION DeviceExtension;
+    PIO_DEVICE_STATISTICS Statistics, Existing;
+    KIRQL OldIrql;
+
+    /* Allocate zeroed counters for the device */
+    Statistics = ExAllocatePoolWithTag(NonPagedPool,
+                                       sizeof(IO_DEVICE_STATISTICS),
+                                       TAG_IO_STATISTICS);
+    if (!Statistics) return NULL;
+    RtlZeroMemory(Statistics, sizeof(IO_DEVICE_STATISTICS));
+    Statistics->DeviceObject = DeviceObject;
+
+    /* Attach them, unless another processor got there first */
+    DeviceExtension = IoGetDevObjExtension(DeviceObject);
+    KeAcquireSpinLock(&IopDeviceStatisticsLock, &OldIrql);
+    Existing = DeviceExtension->IoStatistics;
+    if (!Existing)
+    {
+        DeviceExtension->IoStatistics = Statistics;
+        InsertTailList(&IopDeviceStatisticsListHead,
+                       &Statistics->StatisticsListEntry);
+    }
+    KeReleaseSpinLock(&IopDeviceStatisticsLock, OldIrql);
+
+    /* Use the winner's */
+    if (Existing)
+    {
+        ExFreePoolWithTag(Statistics, TAG_IO_STATISTICS);
+        return Existing;
+    }
+
+    return Statistics;
+}
+
+VOID
+NTAPI
+IopCopyStatisticsName(OUT PWCHAR Destination,
+                      IN PUNICODE_STRING Name)
+{
+    ULONG Length;
+
+    /* Copy what fits and terminate it */
+    Length = min(Name->Length / sizeof(WCHAR),
+                 RTL_FIELD_SIZE(SYSTEM_DEVICE_IO_STATISTICS, DeviceName) /
+                 sizeof(WCHAR) - 1);
+    RtlCopyMemory(Destination, Name->Buffer, Length * sizeof(WCHAR));
+    Destination[Length] = UNICODE_NULL;
+}
+
+VOID
+FASTCALL
+IopStartIrpTiming(IN PDEVICE_OBJECT DeviceObject,
+                  IN PIRP Irp,
+                  IN PIO_STACK_LOCATION StackPtr)
+{
+    PLARGE_INTEGER Timestamp;
+    PIO_DEVICE_STATISTICS Statistics;
+
+    /* Get the dispatch time of this stack location */
+    Timestamp = &IopIrpTimestamps(Irp)[StackPtr - (PIO_STACK_LOCATION)(Irp + 1)];
+
+    /*
+     * If it is still set, the device that had this stack location skipped it
+     * and hands it down. It will never see the completion, so stop counting
+     * the request as outstanding there.
+     */
+    if (Timestamp->QuadPart)
+    {
+        Statistics = IoGetDevObjExtension(StackPtr->DeviceObject)->IoStatistics;
+        InterlockedDecrement(&Statistics->MajorFunction[StackPtr->MajorFunction].OutstandingCount);
+        InterlockedDecrement(&Statistics->OutstandingCount);
+        Timestamp->QuadPart = 0;
+    }
+
+    /* Nothing else to do if statistics were turned off meanwhile */
+    if (!IopIoStatisticsEnabled) return;
+
+    /* Get the counters of the device, the first request allocates them */
+    Statistics = IoGetDevObjExtension(DeviceObject)->IoStatistics;
+    if (!Statistics)
+    {
+        Statistics = IopAllocateDeviceStatistics(DeviceObject);
+        if (!Statistics) return;
+    }
+
+    /* Count the request and remember when it went down */
+    InterlockedIncrement(&Statistics->MajorFunction[StackPtr->MajorFunction].OutstandingCount);
+    InterlockedIncrement(&Statistics->OutstandingCount);
+    *Timestamp = KeQueryPerformanceCounter(NULL);
+    if (!Timestamp->QuadPart) Timestamp->QuadPart = 1;
+}
+
+VOID
+FASTCALL
+IopEndIrpTiming(IN PIRP Irp,
+                IN PIO_STACK_LOCATION StackPtr)
+{
+    PLARGE_INTEGER Timestamp;
+    LARGE_INTEGER Now, Frequency;
+    PIO_DEVICE_STATISTICS Statistics;
+    PSYSTEM_IO_MAJOR_STATISTICS Major;
+    ULONGLONG Elapsed;
+    ULONG Latency, Maximum, Bucket;
+
+    /* Get the dispatch time of this stack location and the time now */
+    Timestamp = &IopIrpTimestamps(Irp)[StackPtr - (PIO_STACK_LOCATION)(Irp + 1)];
+    Now = KeQueryPerformanceCounter(&Frequency);
+
+    /* Get the counters of the device it was sent to */
+    Statistics = IoGetDevObjExtension(StackPtr->DeviceObject)->IoStatistics;
+    Major = &Statistics->MajorFunction[StackPtr->MajorFunction];
+
+    /* Convert the elapsed time to microseconds */
+    Elapsed = (ULONGLONG)(Now.QuadPart - Timestamp->QuadPart) * 1000000 /
+              Frequency.QuadPart;
+    Latency = (Elapsed > MAXULONG) ? MAXULONG : (ULONG)Elapsed;
+    Timestamp->QuadPart = 0;
+
+    /* Bucket n holds latencies below 2^n microseconds, the last all others */
+    Bucket = RtlFindMostSignificantBit(Latency) + 1;
+    if (Bucket >= SYSTEM_IO_LATENCY_BUCKETS) Bucket = SYSTEM_IO_LATENCY_BUCKETS - 1;
+
+    /* Account it */
+    InterlockedIncrement((PLONG)&Major->LatencyHistogram[Bucket]);
+    InterlockedIncrement((PLONG)&Major->RequestCount);
+    ExInterlockedAddLargeStatistic(&Major->TotalLatency, Latency);
+
+    /* Raise the maximum unless another completion raised it further */
+    do
+    {
+        Maximum = Major->MaximumLatency;
+        if (Latency <= Maximum) break;
+    } while (InterlockedCompareExchange((PLONG)&Major->MaximumLatency,
+                                        Latency,
+                                        Maximum) != (LONG)Maximum);
+
+    /* The request is no longer outstanding at this device */
+    InterlockedDecrement(&Major->OutstandingCount);
+    InterlockedDecrement(&Statistics->OutstandingCount);
+}
+
+VOID
+NTAPI
+IopDeleteDeviceStatistics(IN PDEVICE_OBJECT DeviceObject)
+{
+    PIO_DEVICE_STATISTICS Statistics;
+    KIRQL OldIrql;
+
+    /* Check if the device ever got timed requests */
+    Statistics = IoGetDevObjExtension(DeviceObject)->IoStatistics;
+    if (!Statistics) return;
+
+    /* Unlink and free its counters */
+    KeAcquireSpinLock(&IopDeviceStatisticsLock, &OldIrql);
+    RemoveEntryList(&Statistics->StatisticsListEntry);
+    KeReleaseSpinLock(&IopDeviceStatisticsLock, OldIrql);
+    ExFreePoolWithTag(Statistics, TAG_IO_STATISTICS);
+}
+
+NTSTATUS
+NTAPI
+IopQueryDeviceIoStatistics(OUT PSYSTEM_DEVICE_IO_STATISTICS_INFORMATION Buffer,
+                           IN ULONG Size,
+                           OUT PULONG ReqSize)
+{
+    PSYSTEM_DEVICE_IO_STATISTICS Snapshot = NULL;
+    PIO_DEVICE_STATISTICS Statistics;
+    POBJECT_NAME_INFORMATION NameInfo;
+    PDEVICE_OBJECT DeviceObject;
+    PLIST_ENTRY ListEntry;
+    ULONG Count = 0, i, ReturnLength;
+    NTSTATUS Status = STATUS_SUCCESS;
+    KIRQL OldIrql;
+    PAGED_CODE();
+
+    /* Count the devices that have statistics */
+    KeAcquireSpinLock(&IopDeviceStatisticsLock, &OldIrql);
+    for (ListEntry = IopDeviceStatisticsListHead.Flink;
+         ListEntry != &IopDeviceStatisticsListHead;
+         ListEntry = ListEntry->Flink)
+    {
+        Count++;
+    }
+    KeReleaseSpinLock(&IopDeviceStatisticsLock, OldIrql);
+
+    /* Make sure the caller's buffer holds them all */
+    *ReqSize = FIELD_OFFSET(SYSTEM_DEVICE_IO_STATISTICS_INFORMATION, Devices) +
+               Count * sizeof(SYSTEM_DEVICE_IO_STATISTICS);
+    if (Size < *ReqSize) return STATUS_INFO_LENGTH_MISMATCH;
+
+    if (Count)
+    {
+        /* Allocate the snapshot and a buffer for the device names */
+        Snapshot = ExAllocatePoolWithTag(NonPagedPool,
+                                         Count * sizeof(SYSTEM_DEVICE_IO_STATISTICS),
+                                         TAG_IO_STATISTICS);
+        if (!Snapshot) return STATUS_INSUFFICIENT_RESOURCES;
+        NameInfo = ExAllocatePoolWithTag(PagedPool, PAGE_SIZE, TAG_IO_STATISTICS);
+        if (!NameInfo)
+        {
+            ExFreePoolWithTag(Snapshot, TAG_IO_STATISTICS);
+            return STATUS_INSUFFICIENT_RESOURCES;
+        }
+
+        /*
+         * Copy the counters under the lock. Devices may have come and gone
+         * since we counted, skip those being deleted and keep the others
+         * referenced so they can be named afterwards.
+         */
+        i = 0;
+        KeAcquireSpinLock(&IopDeviceStatisticsLock, &OldIrql);
+        for (ListEntry = IopDeviceStatisticsListHead.Flink;
+             (ListEntry != &IopDeviceStatisticsListHead) && (i < Count);
+             ListEntry = ListEntry->Flink)
+        {
+            Statistics = CONTAINING_RECORD(ListEntry,
+                                           IO_DEVICE_STATISTICS,
+                                           StatisticsListEntry);
+            if (!ObReferenceObjectSafe(Statistics->DeviceObject)) continue;
+
+            Snapshot[i].DeviceObject = Statistics->DeviceObject;
+            Snapshot[i].DeviceType = Statistics->DeviceObject->DeviceType;
+            Snapshot[i].OutstandingCount = Statistics->OutstandingCount;
+            RtlCopyMemory(Snapshot[i].MajorFunction,
+                          Statistics->MajorFunction,
+                          sizeof(Statistics->MajorFunction));
+            i++;
+        }
+        KeReleaseSpinLock(&IopDeviceStatisticsLock, OldIrql);
+        Count = i;
+
+        /* Name the devices, or their driver for unnamed ones */
+        for (i = 0; i < Count; i++)
+        {
+            DeviceObject = Snapshot[i].DeviceObject;
+            Status = ObQueryNameString(DeviceObject,
+                                       NameInfo,
+                                       PAGE_SIZE,
+                                       &ReturnLength);
+            if ((NT_SUCCESS(Status)) && (NameInfo->Name.Length))
+            {
+                IopCopyStatisticsName(Snapshot[i].DeviceName, &NameInfo->Name);
+            }
+            else
+            {
+                IopCopyStatisticsName(Snapshot[i].DeviceName,
+                                      &DeviceObject->DriverObject->DriverName);
+            }
+
+            ObDereferenceObject(DeviceObject);
+        }
+
+        ExFreePoolWithTag(NameInfo, TAG_IO_STATISTICS);
+        Status = STATUS_SUCCESS;
+    }
+
+    /* Return what we found */
+    _SEH2_TRY
+    {
+        Buffer->Flags = IopIoStatisticsEnabled ? SYSTEM_IO_STATISTICS_ENABLE : 0;
+        Buffer->NumberOfDevices = Count;
+        if (Count)
+        {
+            RtlCopyMemory(Buffer->Devices,
+                          Snapshot,
+                          Count * sizeof(SYSTEM_DEVICE_IO_STATISTICS));
+        }
+        *ReqSize = FIELD_OFFSET(SYSTEM_DEVICE_IO_STATISTICS_INFORMATION, Devices) +
+                   Count * sizeof(SYSTEM_DEVICE_IO_STATISTICS);
+    }
+    _SEH2_EXCEPT(EXCEPTION_EXECUTE_HANDLER)
+    {
+        Status = _SEH2_GetExceptionCode();
+    }
+    _SEH2_END;
+
+    if (Snapshot) ExFreePoolWithTag(Snapshot, TAG_IO_STATISTICS);
+    return Status;
+}
+
+NTSTATUS
+NTAPI
+IopSetDeviceIoStatistics(IN ULONG Flags)
+{
+    PIO_DEVICE_STATISTICS Statistics;
+    PSYSTEM_IO_MAJOR_STATISTICS Major;
+    PLIST_ENTRY ListEntry;
+    ULONG i;
+    KIRQL OldIrql;
+
+    /* Check for invalid flags */
+    if (Flags & ~(SYSTEM_IO_STATISTICS_ENABLE | SYSTEM_IO_STATISTICS_RESET))
+    {
+        return STATUS_INVALID_PARAMETER;
+    }
+
+    if (Flags & SYSTEM_IO_STATISTICS_RESET)
+    {
+        /* Clear the history of every device, but not what is in flight */
+        KeAcquireSpinLock(&IopDeviceStatisticsLock, &OldIrql);
+        for (ListEntry = IopDeviceStatisticsListHead.Flink;
+             ListEntry != &IopDeviceStatisticsListHead;
+             ListEntry = ListEntry->Flink)
+        {
+            Statistics = CONTAINING_RECORD(ListEntry,
+                                           IO_DEVICE_STATISTICS,
+                                           StatisticsListEntry);
+            for (i = 0; i < SYSTEM_IO_MAJOR_FUNCTIONS; i++)
+            {
+                Major = &Statistics->MajorFunction[i];
+                Major->RequestCount = 0;
+                Major->TotalLatency.QuadPart = 0;
+                Major->MaximumLatency = 0;
+                RtlZeroMemory(Major->LatencyHistogram,
+                              sizeof(Major->LatencyHistogram));
+            }
+        }
+        KeReleaseSpinLock(&IopDeviceStatisticsLock, OldIrql);
+    }
+
+    /* Start or stop timing new requests */
+    IopIoStatisticsEnabled = (Flags & SYSTEM_IO_STATISTICS_ENABLE) ? TRUE : FALSE;
+    return STATUS_SUCCESS;
+}
+
+/* EOF */
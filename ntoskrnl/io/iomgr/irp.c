@@ -540,6 +540,7 @@ IoAllocateIrp(IN CCHAR StackSize,
 {
     PIRP Irp = NULL;
     USHORT Size = IoSizeOfIrp(StackSize);
+    CCHAR Timestamps = StackSize;
     PKPRCB Prcb;
     UCHAR Flags = 0;
     PNPAGED_LOOKASIDE_LIST List = NULL;
@@ -548,8 +549,6 @@ IoAllocateIrp(IN CCHAR StackSize,
     /* Set Charge Quota Flag */
     if (ChargeQuota) Flags |= IRP_QUOTA_CHARGED;
 
-    /* FIXME: Implement Lookaside Floats */
-
     /* Figure out which Lookaside List to use */
     if ((StackSize <= 8) && (ChargeQuota == FALSE))
     {
@@ -560,6 +559,7 @@ IoAllocateIrp(IN CCHAR StackSize,
         if (StackSize != 1)
         {
             Size = IoSizeOfIrp(8);
+            Timestamps = 8;
             ListType = LookasideLargeIrpList;
         }
 
@@ -590,19 +590,44 @@ IoAllocateIrp(IN CCHAR StackSize,
     if (!Irp)
     {
         /* Did we try lookaside and fail? */
-        if (Flags & IRP_ALLOCATED_FIXED_SIZE) List->L.AllocateMisses++;
+        if (Flags & IRP_ALLOCATED_FIXED_SIZE)
+        {
+            /* Let the balancer know */
+            List->L.AllocateMisses++;
+
+            /*
+             * The IRP may only go to a lookaside list when it is freed if this
+             * processor has float credit left. The credit goes to whichever
+             * processor frees it. Without credit, allocate it to size.
+             */
+            if (InterlockedDecrement(&Prcb->LookasideIrpFloat) >= 0)
+            {
+                Flags |= IRP_LOOKASIDE_ALLOCATION;
+            }
+            else
+            {
+                InterlockedIncrement(&Prcb->LookasideIrpFloat);
+                Flags &= ~IRP_ALLOCATED_FIXED_SIZE;
+                Size = IoSizeOfIrp(StackSize);
+                Timestamps = StackSize;
+            }
+        }
 
         /* Check if we should charge quota */
         if (ChargeQuota)
         {
             /* Irp = ExAllocatePoolWithQuotaTag(NonPagedPool, Size, TAG_IRP); */
             /* FIXME */
-            Irp = ExAllocatePoolWithTag(NonPagedPool, Size, TAG_IRP);
+            Irp = ExAllocatePoolWithTag(NonPagedPool,
+                                        Size + Timestamps * sizeof(LARGE_INTEGER),
+                                        TAG_IRP);
         }
         else
         {
             /* Allocate the IRP With no Quota charge */
-            Irp = ExAllocatePoolWithTag(NonPagedPool, Size, TAG_IRP);
+            Irp = ExAllocatePoolWithTag(NonPagedPool,
+                                        Size + Timestamps * sizeof(LARGE_INTEGER),
+                                        TAG_IRP);
         }
 
         /* Make sure it was sucessful */
@@ -614,11 +639,12 @@ IoAllocateIrp(IN CCHAR StackSize,
         Flags &= ~IRP_QUOTA_CHARGED;
     }
 
-    /* Now Initialize it */
+    /* Now Initialize it, and clear the dispatch times after it */
     IoInitializeIrp(Irp, Size, StackSize);
+    RtlZeroMemory(IopIrpTimestamps(Irp), Timestamps * sizeof(LARGE_INTEGER));
 
     /* Set the Allocation Flags */
-    Irp->AllocationFlags = Flags;
+    Irp->AllocationFlags = Flags | IRP_ALLOCATED_TIMESTAMPS;
 
     /* Return it */
     IOTRACE(IO_IRP_DEBUG,
@@ -1160,6 +1186,14 @@ IofCallDriver(IN PDEVICE_OBJECT DeviceObject,
     StackPtr = IoGetNextIrpStackLocation(Irp);
     Irp->Tail.Overlay.CurrentStackLocation = StackPtr;
 
+    /* Time the request if I/O statistics are on, or were for the last device */
+    if ((Irp->AllocationFlags & IRP_ALLOCATED_TIMESTAMPS) &&
+        ((IopIoStatisticsEnabled) ||
+         (IopIrpTimestamps(Irp)[Irp->CurrentLocation - 1].QuadPart)))
+    {
+        IopStartIrpTiming(DeviceObject, Irp, StackPtr);
+    }
+
     /* Get the Device Object */
     StackPtr->DeviceObject = DeviceObject;
 
@@ -1241,6 +1275,13 @@ IofCompleteRequest(IN PIRP Irp,
          Irp->CurrentLocation++,
          Irp->Tail.Overlay.CurrentStackLocation++)
     {
+        /* Account the time the device took if it was timed */
+        if ((Irp->AllocationFlags & IRP_ALLOCATED_TIMESTAMPS) &&
+            (IopIrpTimestamps(Irp)[StackPtr - (PIO_STACK_LOCATION)(Irp + 1)].QuadPart))
+        {
+            IopEndIrpTiming(Irp, StackPtr);
+        }
+
         /* Set Pending Returned */
         Irp->PendingReturned = StackPtr->Control & SL_PENDING_RETURNED;
 
@@ -1536,6 +1577,13 @@ IoFreeIrp(IN PIRP Irp)
         /* Get the PRCB */
         Prcb = KeGetCurrentPrcb();
 
+        /* Give back the float credit of an IRP that came from the pool */
+        if (Irp->AllocationFlags & IRP_LOOKASIDE_ALLOCATION)
+        {
+            Irp->AllocationFlags &= ~IRP_LOOKASIDE_ALLOCATION;
+            InterlockedIncrement(&Prcb->LookasideIrpFloat);
+        }
+
         /* Use the P List */
         List = (PNPAGED_LOOKASIDE_LIST)Prcb->PPLookasideList[ListType].P;
         List->L.TotalFrees++;
@@ -1810,6 +1858,14 @@ IoReuseIrp(IN OUT PIRP Irp,
     /* Reinitialize the IRP */
     IoInitializeIrp(Irp, Irp->Size, Irp->StackCount);
 
+    /* Forget any dispatch times */
+    if (AllocationFlags & IRP_ALLOCATED_TIMESTAMPS)
+    {
+        RtlZeroMemory(IopIrpTimestamps(Irp),
+                      (Irp->Size - sizeof(IRP)) / sizeof(IO_STACK_LOCATION) *
+                      sizeof(LARGE_INTEGER));
+    }
+
     /* Duplicate the data */
     Irp->IoStatus.Status = Status;
     Irp->AllocationFlags = AllocationFlags;
@@ -174,8 +174,6 @@ __security_check_cookie()
 {
 }
 
-BOOLEAN CcPfEnablePrefetcher;
-
 unsigned long __readfsdword(const unsigned long Offset)
 {
     return 0;
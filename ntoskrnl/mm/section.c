@@ -1131,6 +1131,12 @@ MiReadPage(PMEMORY_AREA MemoryArea,
 
    DPRINT("%S %x\n", FileObject->FileName.Buffer, FileOffset);
 
+   /* Remember the page for the next launch of this process */
+   if (CcPfEnablePrefetcher)
+   {
+      CcPfLogPageFault(FileObject, FileOffset);
+   }
+
    /*
     * If the file system is letting us go directly to the cache and the
     * memory area was mapped at an offset in the file which is page aligned
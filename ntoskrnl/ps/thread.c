@@ -15,7 +15,6 @@
 
 /* GLOBALS ******************************************************************/
 
-extern BOOLEAN CcPfEnablePrefetcher;
 extern ULONG MmReadClusterSize;
 POBJECT_TYPE PsThreadType = NULL;
 
@@ -63,9 +62,10 @@ PspUserThreadStartup(IN PKSTART_ROUTINE StartRoutine,
     if (!DeadThread)
     {
         /* Check if the Prefetcher is enabled */
-        if (CcPfEnablePrefetcher)
+        if (CcPfEnablePrefetcher & PF_ENABLE_APP_LAUNCH)
         {
-            /* FIXME: Prepare to prefetch this process */
+            /* Prefetch and trace the launch before the loader runs */
+            CcPfBeginAppLaunch(Thread->ThreadsProcess);
         }
 
         /* Raise to APC */
@@ -0,0 +1,144 @@
+/*
+ * Registry read scalability test.
+ *
+ * Runs 1, 2, 4 and 8 threads that query a value and enumerate the subkeys
+ * of a key in HKLM for a few seconds each, and prints the queries done per
+ * second. Readers used to take the registry lock shared on every call and
+ * now only take the lock of their hive, so the rate should scale with the
+ * thread count. With -w another thread keeps writing to a volatile key in
+ * HKCU meanwhile. Writers only own the lock of their own hive exclusive,
+ * so readers of HKLM should read about as fast as without -w.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <windows.h>
+
+#define TEST_SECONDS 5
+#define MAX_THREADS 8
+
+static const WCHAR ReadKey[] = L"SYSTEM\\CurrentControlSet\\Control";
+static const WCHAR ReadValue[] = L"SystemBootDevice";
+static const WCHAR WriteKey[] = L"Software\\TestRegRead";
+
+/* Each thread counts on a cache line of its own */
+typedef struct _THREAD_COUNT
+{
+    ULONGLONG Count;
+    UCHAR Padding[64 - sizeof(ULONGLONG)];
+} THREAD_COUNT, *PTHREAD_COUNT;
+
+static volatile LONG Stop;
+static LONG Failures;
+
+static DWORD WINAPI
+ReaderThread(LPVOID Parameter)
+{
+    PTHREAD_COUNT Count = Parameter;
+    HKEY hKey;
+    WCHAR Buffer[MAX_PATH];
+    DWORD Size, Index;
+    LONG Error;
+
+    if (RegOpenKeyExW(HKEY_LOCAL_MACHINE, ReadKey, 0, KEY_READ, &hKey) != ERROR_SUCCESS)
+    {
+        InterlockedIncrement(&Failures);
+        return 1;
+    }
+
+    while (!Stop)
+    {
+        Size = sizeof(Buffer);
+        Error = RegQueryValueExW(hKey, ReadValue, NULL, NULL, (LPBYTE)Buffer, &Size);
+        if (Error != ERROR_SUCCESS && Error != ERROR_FILE_NOT_FOUND)
+            InterlockedIncrement(&Failures);
+
+        for (Index = 0; ; Index++)
+        {
+            Size = MAX_PATH;
+            if (RegEnumKeyExW(hKey, Index, Buffer, &Size, NULL, NULL, NULL, NULL) != ERROR_SUCCESS)
+                break;
+        }
+
+        Count->Count++;
+    }
+
+    RegCloseKey(hKey);
+    return 0;
+}
+
+static DWORD WINAPI
+WriterThread(LPVOID Parameter)
+{
+    PTHREAD_COUNT Count = Parameter;
+    HKEY hKey;
+    DWORD Data = 0;
+
+    if (RegCreateKeyExW(HKEY_CURRENT_USER, WriteKey, 0, NULL, REG_OPTION_VOLATILE,
+                        KEY_WRITE, NULL, &hKey, NULL) != ERROR_SUCCESS)
+    {
+        InterlockedIncrement(&Failures);
+        return 1;
+    }
+
+    while (!Stop)
+    {
+        Data++;
+        if (RegSetValueExW(hKey, L"Counter", 0, REG_DWORD, (LPBYTE)&Data, sizeof(Data)) != ERROR_SUCCESS)
+            InterlockedIncrement(&Failures);
+        Count->Count++;
+    }
+
+    RegCloseKey(hKey);
+    RegDeleteKeyW(HKEY_CURRENT_USER, WriteKey);
+    return 0;
+}
+
+static void
+RunTest(int Readers, BOOL Writer)
+{
+    HANDLE Threads[MAX_THREADS + 1];
+    THREAD_COUNT Counts[MAX_THREADS + 1];
+    ULONGLONG Total = 0;
+    int i, n = 0;
+
+    Stop = FALSE;
+    ZeroMemory(Counts, sizeof(Counts));
+
+    for (i = 0; i < Readers; i++)
+        Threads[n++] = CreateThread(NULL, 0, ReaderThread, &Counts[i], 0, NULL);
+    if (Writer)
+        Threads[n++] = CreateThread(NULL, 0, WriterThread, &Counts[MAX_THREADS], 0, NULL);
+
+    Sleep(TEST_SECONDS * 1000);
+    Stop = TRUE;
+
+    WaitForMultipleObjects(n, Threads, TRUE, INFINITE);
+    for (i = 0; i < n; i++)
+        CloseHandle(Threads[i]);
+
+    for (i = 0; i < Readers; i++)
+        Total += Counts[i].Count;
+
+    printf("%d reader(s): %10.0f reads/s", Readers, (double)Total / TEST_SECONDS);
+    if (Writer)
+        printf(", %10.0f writes/s", (double)Counts[MAX_THREADS].Count / TEST_SECONDS);
+    printf("\n");
+}
+
+int main(int argc, char **argv)
+{
+    BOOL Writer = (argc > 1 && !strcmp(argv[1], "-w"));
+    int Readers;
+
+    for (Readers = 1; Readers <= MAX_THREADS; Readers *= 2)
+        RunTest(Readers, Writer);
+
+    if (Failures)
+    {
+        printf("%ld registry calls failed\n", Failures);
+        return 1;
+    }
+
+    return 0;
+}
@@ -1,13 +1,17 @@
 /*
  * PROJECT:         Win32 subsystem
  * LICENSE:         See COPYING in the top level directory
- * FILE:            subsystems/win32/win32k/dib/stretchblt.c
+ * FILE:            subsystems/win32/win32k/dib/alphablend.c
  * PURPOSE:         AlphaBlend implementation suitable for all bit depths
  * PROGRAMMERS:     Jérôme Gardou
  */
 
 #include <win32k.h>
 
+#ifdef _M_AMD64
+#include <emmintrin.h>
+#endif
+
 #define NDEBUG
 #include <debug.h>
 
@@ -29,6 +33,259 @@ Clamp8(ULONG val)
   return (val > 255) ? 255 : val;
 }
 
+#ifdef _M_AMD64
+/* x / 255 for every x that is a product of two bytes */
+#define DIV255_EPI16(x) \
+  _mm_srli_epi16(_mm_add_epi16(_mm_add_epi16((x), _mm_set1_epi16(1)), \
+                               _mm_srli_epi16((x), 8)), 8)
+
+static ULONG
+AlphaBlendRow32Sse2(PULONG Dst, PULONG Src, ULONG Count, BLENDFUNCTION BlendFunc)
+{
+  __m128i Zero = _mm_setzero_si128();
+  __m128i Max = _mm_set1_epi16(255);
+  __m128i Constant = _mm_set1_epi16(BlendFunc.SourceConstantAlpha);
+  __m128i SrcLo, SrcHi, DstLo, DstHi, AlphaLo, AlphaHi;
+  ULONG Done;
+
+  for (Done = 0; Done + 4 <= Count; Done += 4)
+  {
+    SrcLo = _mm_loadu_si128((__m128i *)(Src + Done));
+    DstLo = _mm_loadu_si128((__m128i *)(Dst + Done));
+    SrcHi = _mm_unpackhi_epi8(SrcLo, Zero);
+    SrcLo = _mm_unpacklo_epi8(SrcLo, Zero);
+    DstHi = _mm_unpackhi_epi8(DstLo, Zero);
+    DstLo = _mm_unpacklo_epi8(DstLo, Zero);
+
+    /* Scale all four source channels by the constant alpha */
+    SrcLo = DIV255_EPI16(_mm_mullo_epi16(SrcLo, Constant));
+    SrcHi = DIV255_EPI16(_mm_mullo_epi16(SrcHi, Constant));
+
+    if (BlendFunc.AlphaFormat & AC_SRC_ALPHA)
+    {
+      /* Spread the scaled alpha of each pixel over its channels */
+      AlphaLo = _mm_shufflehi_epi16(_mm_shufflelo_epi16(SrcLo, 0xFF), 0xFF);
+      AlphaHi = _mm_shufflehi_epi16(_mm_shufflelo_epi16(SrcHi, 0xFF), 0xFF);
+    }
+    else
+    {
+      AlphaLo = AlphaHi = Constant;
+    }
+
+    DstLo = _mm_mullo_epi16(DstLo, _mm_sub_epi16(Max, AlphaLo));
+    DstHi = _mm_mullo_epi16(DstHi, _mm_sub_epi16(Max, AlphaHi));
+    DstLo = _mm_add_epi16(DIV255_EPI16(DstLo), SrcLo);
+    DstHi = _mm_add_epi16(DIV255_EPI16(DstHi), SrcHi);
+
+    /* Saturating pack does the clamp */
+    _mm_storeu_si128((__m128i *)(Dst + Done), _mm_packus_epi16(DstLo, DstHi));
+  }
+
+  return Done;
+}
+#endif
+
+/*
+ * The row blenders below compute exactly what the generic routines do
+ * for an unscaled 32bpp source, without the per pixel DIB_GetSource,
+ * XLATEOBJ and DIB_PutPixel calls.
+ */
+static VOID
+AlphaBlendRow32(PULONG Dst, PULONG Src, ULONG Count, BLENDFUNCTION BlendFunc)
+{
+  NICEPIXEL32 DstPixel, SrcPixel;
+  UCHAR Alpha;
+  ULONG i = 0;
+
+#ifdef _M_AMD64
+  if (DibSse2Enabled)
+    i = AlphaBlendRow32Sse2(Dst, Src, Count, BlendFunc);
+#endif
+
+  for (; i < Count; i++)
+  {
+    SrcPixel.ul = Src[i];
+    SrcPixel.col.red = (SrcPixel.col.red * BlendFunc.SourceConstantAlpha) / 255;
+    SrcPixel.col.green = (SrcPixel.col.green * BlendFunc.SourceConstantAlpha) / 255;
+    SrcPixel.col.blue = (SrcPixel.col.blue * BlendFunc.SourceConstantAlpha) / 255;
+    SrcPixel.col.alpha = (SrcPixel.col.alpha * BlendFunc.SourceConstantAlpha) / 255;
+
+    Alpha = (BlendFunc.AlphaFormat & AC_SRC_ALPHA) ?
+            SrcPixel.col.alpha : BlendFunc.SourceConstantAlpha;
+
+    DstPixel.ul = Dst[i];
+    DstPixel.col.red = Clamp8((DstPixel.col.red * (255 - Alpha)) / 255 + SrcPixel.col.red);
+    DstPixel.col.green = Clamp8((DstPixel.col.green * (255 - Alpha)) / 255 + SrcPixel.col.green);
+    DstPixel.col.blue = Clamp8((DstPixel.col.blue * (255 - Alpha)) / 255 + SrcPixel.col.blue);
+    DstPixel.col.alpha = Clamp8((DstPixel.col.alpha * (255 - Alpha)) / 255 + SrcPixel.col.alpha);
+    Dst[i] = DstPixel.ul;
+  }
+}
+
+static VOID
+AlphaBlendRow24(PUCHAR Dst, PULONG Src, ULONG Count, BLENDFUNCTION BlendFunc)
+{
+  NICEPIXEL32 SrcPixel;
+  UCHAR Alpha;
+  ULONG i;
+
+  for (i = 0; i < Count; i++, Dst += 3)
+  {
+    SrcPixel.ul = Src[i];
+    SrcPixel.col.red = (SrcPixel.col.red * BlendFunc.SourceConstantAlpha) / 255;
+    SrcPixel.col.green = (SrcPixel.col.green * BlendFunc.SourceConstantAlpha) / 255;
+    SrcPixel.col.blue = (SrcPixel.col.blue * BlendFunc.SourceConstantAlpha) / 255;
+
+    Alpha = (BlendFunc.AlphaFormat & AC_SRC_ALPHA) ?
+            (SrcPixel.col.alpha * BlendFunc.SourceConstantAlpha) / 255 :
+            BlendFunc.SourceConstantAlpha;
+
+    Dst[0] = Clamp8((Dst[0] * (255 - Alpha)) / 255 + SrcPixel.col.red);
+    Dst[1] = Clamp8((Dst[1] * (255 - Alpha)) / 255 + SrcPixel.col.green);
+    Dst[2] = Clamp8((Dst[2] * (255 - Alpha)) / 255 + SrcPixel.col.blue);
+  }
+}
+
+static VOID
+AlphaBlendRow16(PUSHORT Dst, PULONG Src, ULONG Count, BLENDFUNCTION BlendFunc,
+                BOOLEAN SrcIsRGB, BOOLEAN DstIs555)
+{
+  NICEPIXEL32 DstPixel, SrcPixel;
+  UCHAR Alpha;
+  ULONG i, Color;
+
+  for (i = 0; i < Count; i++)
+  {
+    /* Blend in BGR order, which is where the destination is decoded to */
+    SrcPixel.ul = Src[i];
+    if (SrcIsRGB)
+    {
+      SrcPixel.ul = (SrcPixel.ul & 0xff00ff00) |
+                    ((SrcPixel.ul & 0x00ff0000) >> 16) |
+                    ((SrcPixel.ul & 0x000000ff) << 16);
+    }
+    SrcPixel.col.red = (SrcPixel.col.red * BlendFunc.SourceConstantAlpha) / 255;
+    SrcPixel.col.green = (SrcPixel.col.green * BlendFunc.SourceConstantAlpha) / 255;
+    SrcPixel.col.blue = (SrcPixel.col.blue * BlendFunc.SourceConstantAlpha) / 255;
+
+    Alpha = (BlendFunc.AlphaFormat & AC_SRC_ALPHA) ?
+            (SrcPixel.col.alpha * BlendFunc.SourceConstantAlpha) / 255 :
+            BlendFunc.SourceConstantAlpha;
+
+    Color = Dst[i];
+    if (DstIs555)
+    {
+      DstPixel.col.red = gajXlate5to8[Color & 0x1F];
+      DstPixel.col.green = gajXlate5to8[(Color >> 5) & 0x1F];
+      DstPixel.col.blue = gajXlate5to8[(Color >> 10) & 0x1F];
+    }
+    else
+    {
+      DstPixel.col.red = gajXlate5to8[Color & 0x1F];
+      DstPixel.col.green = gajXlate6to8[(Color >> 5) & 0x3F];
+      DstPixel.col.blue = gajXlate5to8[(Color >> 11) & 0x1F];
+    }
+
+    DstPixel.col.red = Clamp8((DstPixel.col.red * (255 - Alpha)) / 255 + SrcPixel.col.red);
+    DstPixel.col.green = Clamp8((DstPixel.col.green * (255 - Alpha)) / 255 + SrcPixel.col.green);
+    DstPixel.col.blue = Clamp8((DstPixel.col.blue * (255 - Alpha)) / 255 + SrcPixel.col.blue);
+
+    /* Same truncation as EXLATEOBJ_iXlateBGRto555/565 */
+    if (DstIs555)
+    {
+      Dst[i] = (USHORT)((DstPixel.col.red >> 3) |
+                        ((DstPixel.col.green >> 3) << 5) |
+                        ((DstPixel.col.blue >> 3) << 10));
+    }
+    else
+    {
+      Dst[i] = (USHORT)((DstPixel.col.red >> 3) |
+                        ((DstPixel.col.green >> 2) << 5) |
+                        ((DstPixel.col.blue >> 3) << 11));
+    }
+  }
+}
+
+/*
+ * Handles unscaled blends from a 32bpp source into a 16, 24 or 32bpp
+ * destination whose format the row blenders know. Returns FALSE when the
+ * caller has to take its generic path.
+ */
+BOOLEAN
+DIB_XXBPP_AlphaBlendFrom32BPP(SURFOBJ* Dest, SURFOBJ* Source, RECTL* DestRect,
+                              RECTL* SourceRect, XLATEOBJ* ColorTranslation,
+                              BLENDFUNCTION BlendFunc)
+{
+  PBYTE DstRow, SrcRow;
+  ULONG Width, Rows;
+  BOOLEAN Trivial, SrcIsRGB = FALSE, DstIs555 = FALSE;
+  EXLATEOBJ* pexlo;
+
+  if (Source->iBitmapFormat != BMF_32BPP ||
+      DestRect->right - DestRect->left != SourceRect->right - SourceRect->left ||
+      DestRect->bottom - DestRect->top != SourceRect->bottom - SourceRect->top)
+  {
+    return FALSE;
+  }
+
+  Trivial = (NULL == ColorTranslation ||
+             0 != (ColorTranslation->flXlate & XO_TRIVIAL));
+
+  switch (Dest->iBitmapFormat)
+  {
+    case BMF_32BPP:
+    case BMF_24BPP:
+      if (!Trivial)
+        return FALSE;
+      break;
+
+    case BMF_16BPP:
+      /* Only the bit layouts EXLATEOBJ converts with fixed shifts */
+      if (Trivial)
+        return FALSE;
+      pexlo = CONTAINING_RECORD(ColorTranslation, EXLATEOBJ, xlo);
+      if (pexlo->ppalSrc->flFlags & PAL_RGB)
+        SrcIsRGB = TRUE;
+      else if (!(pexlo->ppalSrc->flFlags & PAL_BGR))
+        return FALSE;
+      if (pexlo->ppalDst->flFlags & PAL_RGB16_555)
+        DstIs555 = TRUE;
+      else if (!(pexlo->ppalDst->flFlags & PAL_RGB16_565))
+        return FALSE;
+      break;
+
+    default:
+      return FALSE;
+  }
+
+  Width = DestRect->right - DestRect->left;
+  DstRow = (PBYTE)Dest->pvScan0 + DestRect->top * Dest->lDelta +
+           DestRect->left * (BitsPerFormat(Dest->iBitmapFormat) >> 3);
+  SrcRow = (PBYTE)Source->pvScan0 + SourceRect->top * Source->lDelta +
+           (SourceRect->left << 2);
+
+  for (Rows = DestRect->bottom - DestRect->top; Rows > 0; Rows--)
+  {
+    switch (Dest->iBitmapFormat)
+    {
+      case BMF_32BPP:
+        AlphaBlendRow32((PULONG)DstRow, (PULONG)SrcRow, Width, BlendFunc);
+        break;
+      case BMF_24BPP:
+        AlphaBlendRow24(DstRow, (PULONG)SrcRow, Width, BlendFunc);
+        break;
+      default:
+        AlphaBlendRow16((PUSHORT)DstRow, (PULONG)SrcRow, Width, BlendFunc,
+                        SrcIsRGB, DstIs555);
+        break;
+    }
+    DstRow += Dest->lDelta;
+    SrcRow += Source->lDelta;
+  }
+
+  return TRUE;
+}
+
 BOOLEAN
 DIB_XXBPP_AlphaBlend(SURFOBJ* Dest, SURFOBJ* Source, RECTL* DestRect,
                      RECTL* SourceRect, CLIPOBJ* ClipRegion,
@@ -70,6 +327,12 @@ DIB_XXBPP_AlphaBlend(SURFOBJ* Dest, SURFOBJ* Source, RECTL* DestRect,
     return FALSE;
   }
 
+  if (DIB_XXBPP_AlphaBlendFrom32BPP(Dest, Source, DestRect, SourceRect,
+                                    ColorTranslation, BlendFunc))
+  {
+    return TRUE;
+  }
+
   if (!ColorTranslation)
   {
     DPRINT1("ColorTranslation must not be NULL!\n");
@@ -435,6 +435,20 @@ DIB_16BPP_ColorFill(SURFOBJ* DestSurface, RECTL* DestRect, ULONG color)
     pos =(PULONG)((ULONG_PTR)pos + delta);
   }
 #else /* _M_IX86 */
+  PBYTE Row;
+
+  if (DibSse2Enabled)
+  {
+    Row = (PBYTE)DestSurface->pvScan0 + DestRect->top * DestSurface->lDelta +
+          (DestRect->left << 1);
+    color = (color & 0xffff) | (color << 16);
+    for (DestY = DestRect->top; DestY < DestRect->bottom; DestY++)
+    {
+      DIB_SSE2_FillRow(Row, color, (DestRect->right - DestRect->left) << 1);
+      Row += DestSurface->lDelta;
+    }
+    return TRUE;
+  }
 
   for (DestY = DestRect->top; DestY< DestRect->bottom; DestY++)
   {
@@ -462,6 +476,29 @@ DIB_16BPP_TransparentBlt(SURFOBJ *DestSurf, SURFOBJ *SourceSurf,
   SrcHeight = SourceRect->bottom - SourceRect->top;
   SrcWidth = SourceRect->right - SourceRect->left;
 
+  /* Unscaled copies between 16bpp surfaces can run a row at a time */
+  if (DibSse2Enabled && DstWidth == SrcWidth && DstHeight == SrcHeight &&
+      SourceSurf != DestSurf && SourceSurf->iBitmapFormat == BMF_16BPP &&
+      (NULL == ColorTranslation || 0 != (ColorTranslation->flXlate & XO_TRIVIAL)) &&
+      SourceRect->left >= 0 && SourceRect->top >= 0 &&
+      SourceRect->right <= SourceSurf->sizlBitmap.cx &&
+      SourceRect->bottom <= SourceSurf->sizlBitmap.cy)
+  {
+    PBYTE DestRow = (PBYTE)DestSurf->pvScan0 + DestRect->top * DestSurf->lDelta +
+                    (DestRect->left << 1);
+    PBYTE SourceRow = (PBYTE)SourceSurf->pvScan0 +
+                      SourceRect->top * SourceSurf->lDelta +
+                      (SourceRect->left << 1);
+
+    for (Y = DestRect->top; Y < DestRect->bottom; Y++)
+    {
+      DIB_SSE2_TransparentRow16((PUSHORT)DestRow, (PUSHORT)SourceRow, DstWidth, iTransColor);
+      DestRow += DestSurf->lDelta;
+      SourceRow += SourceSurf->lDelta;
+    }
+    return TRUE;
+  }
+
   RoundedRight = DestRect->right - ((DestRect->right - DestRect->left) & 0x1);
   DestBits = (ULONG*)((PBYTE)DestSurf->pvScan0 +
     (DestRect->left << 1) +
@@ -239,6 +239,46 @@ DIB_24BPP_BitBlt(PBLTINFO BltInfo)
    UsesSource = ROP4_USES_SOURCE(BltInfo->Rop4);
    UsesPattern = ROP4_USES_PATTERN(BltInfo->Rop4);
 
+   /* Xor whole rows when they don't alias and need no translation */
+   if (DibSse2Enabled && BltInfo->Rop4 == ROP4_SRCINVERT &&
+       BltInfo->SourceSurface->iBitmapFormat == BMF_24BPP &&
+       (NULL == BltInfo->XlateSourceToDest ||
+        0 != (BltInfo->XlateSourceToDest->flXlate & XO_TRIVIAL)) &&
+       (BltInfo->SourceSurface != BltInfo->DestSurface ||
+        BltInfo->DestRect.top != BltInfo->SourcePoint.y))
+   {
+      PBYTE SourceBits = (PBYTE)BltInfo->SourceSurface->pvScan0 +
+                         BltInfo->SourcePoint.x * 3 +
+                         BltInfo->SourcePoint.y * BltInfo->SourceSurface->lDelta;
+      LONG SourceDelta = BltInfo->SourceSurface->lDelta;
+      LONG DestDelta = BltInfo->DestSurface->lDelta;
+
+      DestBits = (PBYTE)BltInfo->DestSurface->pvScan0 +
+                 BltInfo->DestRect.left * 3 +
+                 BltInfo->DestRect.top * DestDelta;
+
+      /* Walk bottom-up when the rows of one surface could overlap */
+      if (BltInfo->SourceSurface == BltInfo->DestSurface &&
+          BltInfo->DestRect.top > BltInfo->SourcePoint.y)
+      {
+         LONG Last = BltInfo->DestRect.bottom - BltInfo->DestRect.top - 1;
+
+         SourceBits += Last * SourceDelta;
+         DestBits += Last * DestDelta;
+         SourceDelta = -SourceDelta;
+         DestDelta = -DestDelta;
+      }
+
+      for (DestY = BltInfo->DestRect.top; DestY < BltInfo->DestRect.bottom; DestY++)
+      {
+         DIB_SSE2_XorRow(DestBits, SourceBits,
+                         (BltInfo->DestRect.right - BltInfo->DestRect.left) * 3);
+         SourceBits += SourceDelta;
+         DestBits += DestDelta;
+      }
+      return TRUE;
+   }
+
    SourceY = BltInfo->SourcePoint.y;
    DestBits = (PBYTE)(
       (PBYTE)BltInfo->DestSurface->pvScan0 +
@@ -497,6 +537,12 @@ DIB_24BPP_AlphaBlend(SURFOBJ* Dest, SURFOBJ* Source, RECTL* DestRect,
       return FALSE;
    }
 
+   if (DIB_XXBPP_AlphaBlendFrom32BPP(Dest, Source, DestRect, SourceRect,
+                                     ColorTranslation, BlendFunc))
+   {
+     return TRUE;
+   }
+
    Dst = (PUCHAR)((ULONG_PTR)Dest->pvScan0 + (DestRect->top * Dest->lDelta) +
                              (DestRect->left * 3));
    SrcBpp = BitsPerFormat(Source->iBitmapFormat);
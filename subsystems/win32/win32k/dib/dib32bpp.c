@@ -297,6 +297,29 @@ DIB_32BPP_TransparentBlt(SURFOBJ *DestSurf, SURFOBJ *SourceSurf,
   SrcHeight = SourceRect->bottom - SourceRect->top;
   SrcWidth = SourceRect->right - SourceRect->left;
 
+  /* Unscaled copies between 32bpp surfaces can run a row at a time */
+  if (DibSse2Enabled && DstWidth == SrcWidth && DstHeight == SrcHeight &&
+      SourceSurf != DestSurf && SourceSurf->iBitmapFormat == BMF_32BPP &&
+      (NULL == ColorTranslation || 0 != (ColorTranslation->flXlate & XO_TRIVIAL)) &&
+      SourceRect->left >= 0 && SourceRect->top >= 0 &&
+      SourceRect->right <= SourceSurf->sizlBitmap.cx &&
+      SourceRect->bottom <= SourceSurf->sizlBitmap.cy)
+  {
+    PBYTE DestRow = (PBYTE)DestSurf->pvScan0 + DestRect->top * DestSurf->lDelta +
+                    (DestRect->left << 2);
+    PBYTE SourceRow = (PBYTE)SourceSurf->pvScan0 +
+                      SourceRect->top * SourceSurf->lDelta +
+                      (SourceRect->left << 2);
+
+    for (Y = DestRect->top; Y < DestRect->bottom; Y++)
+    {
+      DIB_SSE2_TransparentRow32((PULONG)DestRow, (PULONG)SourceRow, DstWidth, iTransColor);
+      DestRow += DestSurf->lDelta;
+      SourceRow += SourceSurf->lDelta;
+    }
+    return TRUE;
+  }
+
   DestBits = (ULONG*)((PBYTE)DestSurf->pvScan0 +
     (DestRect->left << 2) +
     DestRect->top * DestSurf->lDelta);
@@ -379,6 +402,12 @@ DIB_32BPP_AlphaBlend(SURFOBJ* Dest, SURFOBJ* Source, RECTL* DestRect,
     return FALSE;
   }
 
+  if (DIB_XXBPP_AlphaBlendFrom32BPP(Dest, Source, DestRect, SourceRect,
+                                    ColorTranslation, BlendFunc))
+  {
+    return TRUE;
+  }
+
   Dst = (PULONG)((ULONG_PTR)Dest->pvScan0 + (DestRect->top * Dest->lDelta) +
     (DestRect->left << 2));
   SrcBpp = BitsPerFormat(Source->iBitmapFormat);
@@ -31,6 +31,19 @@ BOOLEAN
 DIB_32BPP_ColorFill(SURFOBJ* DestSurface, RECTL* DestRect, ULONG color)
 {
   ULONG DestY;
+  PBYTE Row;
+
+  if (DibSse2Enabled)
+  {
+    Row = (PBYTE)DestSurface->pvScan0 + DestRect->top * DestSurface->lDelta +
+          (DestRect->left << 2);
+    for (DestY = DestRect->top; DestY < DestRect->bottom; DestY++)
+    {
+      DIB_SSE2_FillRow(Row, color, (DestRect->right - DestRect->left) << 2);
+      Row += DestSurface->lDelta;
+    }
+    return TRUE;
+  }
 
   for (DestY = DestRect->top; DestY< DestRect->bottom; DestY++)
   {
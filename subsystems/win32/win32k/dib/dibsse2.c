@@ -0,0 +1,197 @@
+/*
+ * PROJECT:         Win32 subsystem
+ * LICENSE:         See COPYING in the top level directory
+ * FILE:            subsystems/win32/win32k/dib/dibsse2.c
+ * PURPOSE:         SSE2 row kernels for the 16, 24 and 32bpp DIB functions
+ */
+
+/* tools/gendib/dibtest.c builds this file on the host */
+#ifndef DIB_HOST_TEST
+#include <win32k.h>
+#endif
+
+#ifdef _M_AMD64
+#include <emmintrin.h>
+#endif
+
+#define NDEBUG
+#include <debug.h>
+
+/*
+ * Set once at startup, the row kernels below may only be called when it is
+ * TRUE. On x86 the kernel does not preserve XMM registers across context
+ * switches nor in KeSaveFloatingPointState yet, so it stays FALSE there.
+ */
+BOOLEAN DibSse2Enabled = FALSE;
+
+VOID
+DIB_SSE2_Initialize(VOID)
+{
+#ifdef _M_AMD64
+  DibSse2Enabled = ExIsProcessorFeaturePresent(PF_XMMI64_INSTRUCTIONS_AVAILABLE);
+#endif
+  DPRINT("SSE2 DIB kernels %s\n", DibSse2Enabled ? "enabled" : "disabled");
+}
+
+/*
+ * Fills Bytes bytes at Dest with Pattern, which repeats every four bytes
+ * starting at Dest. Bytes must be a multiple of the pixel size.
+ */
+VOID
+DIB_SSE2_FillRow(PVOID Dest, ULONG Pattern, ULONG Bytes)
+{
+  PBYTE DestBytes = (PBYTE)Dest;
+
+#ifdef _M_AMD64
+  __m128i Fill = _mm_set1_epi32((int)Pattern);
+
+  while (Bytes >= 64)
+  {
+    _mm_storeu_si128((__m128i *)DestBytes, Fill);
+    _mm_storeu_si128((__m128i *)(DestBytes + 16), Fill);
+    _mm_storeu_si128((__m128i *)(DestBytes + 32), Fill);
+    _mm_storeu_si128((__m128i *)(DestBytes + 48), Fill);
+    DestBytes += 64;
+    Bytes -= 64;
+  }
+  while (Bytes >= 16)
+  {
+    _mm_storeu_si128((__m128i *)DestBytes, Fill);
+    DestBytes += 16;
+    Bytes -= 16;
+  }
+#endif
+
+  /* The pattern is still in phase since only multiples of 4 were stored */
+  while (Bytes >= sizeof(ULONG))
+  {
+    *(PULONG)DestBytes = Pattern;
+    DestBytes += sizeof(ULONG);
+    Bytes -= sizeof(ULONG);
+  }
+  if (Bytes >= sizeof(USHORT))
+  {
+    *(PUSHORT)DestBytes = (USHORT)Pattern;
+    DestBytes += sizeof(USHORT);
+    Bytes -= sizeof(USHORT);
+    Pattern >>= 16;
+  }
+  if (Bytes)
+  {
+    *DestBytes = (BYTE)Pattern;
+  }
+}
+
+/*
+ * Dest ^= Source over Bytes bytes. The rows must not overlap, which makes
+ * the result independent of the pixel size.
+ */
+VOID
+DIB_SSE2_XorRow(PVOID Dest, PVOID Source, ULONG Bytes)
+{
+  PBYTE DestBytes = (PBYTE)Dest;
+  PBYTE SourceBytes = (PBYTE)Source;
+
+#ifdef _M_AMD64
+  while (Bytes >= 32)
+  {
+    __m128i d0 = _mm_loadu_si128((__m128i *)DestBytes);
+    __m128i d1 = _mm_loadu_si128((__m128i *)(DestBytes + 16));
+    __m128i s0 = _mm_loadu_si128((__m128i *)SourceBytes);
+    __m128i s1 = _mm_loadu_si128((__m128i *)(SourceBytes + 16));
+
+    _mm_storeu_si128((__m128i *)DestBytes, _mm_xor_si128(d0, s0));
+    _mm_storeu_si128((__m128i *)(DestBytes + 16), _mm_xor_si128(d1, s1));
+    DestBytes += 32;
+    SourceBytes += 32;
+    Bytes -= 32;
+  }
+  if (Bytes >= 16)
+  {
+    __m128i d0 = _mm_loadu_si128((__m128i *)DestBytes);
+    __m128i s0 = _mm_loadu_si128((__m128i *)SourceBytes);
+
+    _mm_storeu_si128((__m128i *)DestBytes, _mm_xor_si128(d0, s0));
+    DestBytes += 16;
+    SourceBytes += 16;
+    Bytes -= 16;
+  }
+#endif
+
+  while (Bytes--)
+  {
+    *DestBytes++ ^= *SourceBytes++;
+  }
+}
+
+/*
+ * Copies Count pixels from Source to Dest, leaving every destination pixel
+ * whose source equals Key untouched. The rows must not overlap.
+ */
+VOID
+DIB_SSE2_TransparentRow32(PULONG Dest, PULONG Source, ULONG Count, ULONG Key)
+{
+#ifdef _M_AMD64
+  __m128i KeyVector = _mm_set1_epi32((int)Key);
+
+  while (Count >= 4)
+  {
+    __m128i s = _mm_loadu_si128((__m128i *)Source);
+    __m128i d = _mm_loadu_si128((__m128i *)Dest);
+    __m128i Mask = _mm_cmpeq_epi32(s, KeyVector);
+
+    _mm_storeu_si128((__m128i *)Dest,
+                     _mm_or_si128(_mm_and_si128(Mask, d),
+                                  _mm_andnot_si128(Mask, s)));
+    Dest += 4;
+    Source += 4;
+    Count -= 4;
+  }
+#endif
+
+  while (Count--)
+  {
+    if (*Source != Key)
+    {
+      *Dest = *Source;
+    }
+    Dest++;
+    Source++;
+  }
+}
+
+VOID
+DIB_SSE2_TransparentRow16(PUSHORT Dest, PUSHORT Source, ULONG Count, ULONG Key)
+{
+#ifdef _M_AMD64
+  __m128i KeyVector = _mm_set1_epi16((short)Key);
+
+  /* A key wider than a pixel never matches */
+  if (Key <= 0xFFFF)
+  {
+    while (Count >= 8)
+    {
+      __m128i s = _mm_loadu_si128((__m128i *)Source);
+      __m128i d = _mm_loadu_si128((__m128i *)Dest);
+      __m128i Mask = _mm_cmpeq_epi16(s, KeyVector);
+
+      _mm_storeu_si128((__m128i *)Dest,
+                       _mm_or_si128(_mm_and_si128(Mask, d),
+                                    _mm_andnot_si128(Mask, s)));
+      Dest += 8;
+      Source += 8;
+      Count -= 8;
+    }
+  }
+#endif
+
+  while (Count--)
+  {
+    if (*Source != Key)
+    {
+      *Dest = *Source;
+    }
+    Dest++;
+    Source++;
+  }
+}
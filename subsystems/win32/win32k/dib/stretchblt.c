@@ -13,12 +13,314 @@
 #define NDEBUG
 #include <debug.h>
 
+/*
+ * Fetches the source pixels XMap selects from one source row, translated
+ * into the destination format.
+ */
+static VOID
+StretchFetchRow(SURFOBJ *SourceSurf, LONG SourceY, PLONG XMap, ULONG Width,
+                XLATEOBJ *ColorTranslation, PULONG Colors)
+{
+  PBYTE Row = (PBYTE)SourceSurf->pvScan0 + SourceY * SourceSurf->lDelta;
+  PFN_DIB_GetPixel fnSource_GetPixel;
+  PBYTE Pixel;
+  ULONG i, Last = 0, LastColor = 0;
+
+  switch (SourceSurf->iBitmapFormat)
+  {
+  case BMF_32BPP:
+    for (i = 0; i < Width; i++)
+      Colors[i] = ((PULONG)Row)[XMap[i]];
+    break;
+  case BMF_24BPP:
+    for (i = 0; i < Width; i++)
+    {
+      Pixel = Row + XMap[i] * 3;
+      Colors[i] = Pixel[0] | (Pixel[1] << 8) | (Pixel[2] << 16);
+    }
+    break;
+  case BMF_16BPP:
+    for (i = 0; i < Width; i++)
+      Colors[i] = ((PUSHORT)Row)[XMap[i]];
+    break;
+  case BMF_8BPP:
+    for (i = 0; i < Width; i++)
+      Colors[i] = Row[XMap[i]];
+    break;
+  default:
+    fnSource_GetPixel = DibFunctionsForBitmapFormat[SourceSurf->iBitmapFormat].DIB_GetPixel;
+    for (i = 0; i < Width; i++)
+      Colors[i] = fnSource_GetPixel(SourceSurf, XMap[i], SourceY);
+    break;
+  }
+
+  if (ColorTranslation && !(ColorTranslation->flXlate & XO_TRIVIAL))
+  {
+    /* Stretched rows repeat pixels, so only translate each run once */
+    for (i = 0; i < Width; i++)
+    {
+      if (i == 0 || Colors[i] != Last)
+      {
+        Last = Colors[i];
+        LastColor = XLATEOBJ_iXlate(ColorTranslation, Last);
+      }
+      Colors[i] = LastColor;
+    }
+  }
+}
+
+/*
+ * Packs a row of destination colors in place into the destination format
+ * and returns its size. Packing never overtakes the colors still unread.
+ */
+static ULONG
+StretchPackRow(ULONG Format, PULONG Colors, ULONG Width)
+{
+  PBYTE Packed = (PBYTE)Colors;
+  ULONG i, Color;
+
+  switch (Format)
+  {
+  case BMF_24BPP:
+    for (i = 0; i < Width; i++)
+    {
+      Color = Colors[i];
+      Packed[i * 3] = (BYTE)Color;
+      Packed[i * 3 + 1] = (BYTE)(Color >> 8);
+      Packed[i * 3 + 2] = (BYTE)(Color >> 16);
+    }
+    return Width * 3;
+  case BMF_16BPP:
+    for (i = 0; i < Width; i++)
+      ((PUSHORT)Packed)[i] = (USHORT)Colors[i];
+    return Width << 1;
+  case BMF_8BPP:
+    for (i = 0; i < Width; i++)
+      Packed[i] = (BYTE)Colors[i];
+    return Width;
+  default:
+    return Width << 2;
+  }
+}
+
+/* Mixes two colors with byte channels, Weight of 256 being all of Color2 */
+static __inline ULONG
+StretchLerp(ULONG Color1, ULONG Color2, ULONG Weight)
+{
+  ULONG RedBlue, AlphaGreen;
+
+  RedBlue = ((Color1 & 0x00FF00FF) * (256 - Weight) +
+             (Color2 & 0x00FF00FF) * Weight) >> 8;
+  AlphaGreen = ((Color1 >> 8) & 0x00FF00FF) * (256 - Weight) +
+               ((Color2 >> 8) & 0x00FF00FF) * Weight;
+
+  return (RedBlue & 0x00FF00FF) | (AlphaGreen & 0xFF00FF00);
+}
+
+/*
+ * Maps destination pixel Index onto the source in 24.8 fixed point,
+ * sampling at pixel centers, and splits it into the two source pixels to
+ * mix and the weight of the second one.
+ */
+static VOID
+StretchHalftoneMap(LONG Index, LONG SrcStart, LONG SrcSize, LONG DstSize,
+                   PLONG Src1, PLONG Src2, PULONG Weight)
+{
+  LONG Position;
+
+  Position = (LONG)(((2 * (LONGLONG)Index + 1) * SrcSize * 256) /
+                    (2 * (LONGLONG)DstSize)) - 128;
+  if (Position < 0)
+    Position = 0;
+
+  *Src1 = Position >> 8;
+  *Weight = Position & 0xFF;
+  if (*Src1 >= SrcSize - 1)
+  {
+    *Src1 = SrcSize - 1;
+    *Weight = 0;
+  }
+  *Src2 = SrcStart + (*Weight ? *Src1 + 1 : *Src1);
+  *Src1 += SrcStart;
+}
+
+static VOID
+StretchHalftoneRow(SURFOBJ *SourceSurf, LONG SourceY, PLONG XMap,
+                   PLONG XMapNext, PULONG XWeight, ULONG Width,
+                   XLATEOBJ *ColorTranslation, PULONG Scratch, PULONG Row)
+{
+  ULONG i;
+
+  StretchFetchRow(SourceSurf, SourceY, XMap, Width, ColorTranslation, Row);
+  StretchFetchRow(SourceSurf, SourceY, XMapNext, Width, ColorTranslation, Scratch);
+  for (i = 0; i < Width; i++)
+  {
+    if (XWeight[i])
+      Row[i] = StretchLerp(Row[i], Scratch[i], XWeight[i]);
+  }
+}
+
+/*
+ * SRCCOPY stretching without a mask. A map of source columns is built once
+ * with a DDA and every source row is fetched and translated only once, no
+ * matter how many destination rows repeat it. HALFTONE mixes the four
+ * nearest source pixels when the destination has byte channels, every
+ * other mode picks the nearest one exactly like the generic loop below.
+ */
+static BOOLEAN
+DIB_XXBPP_StretchBltSrcCopy(SURFOBJ *DestSurf, SURFOBJ *SourceSurf,
+                            RECTL *DestRect, RECTL *SourceRect,
+                            XLATEOBJ *ColorTranslation, ULONG Mode)
+{
+  LONG DstWidth = DestRect->right - DestRect->left;
+  LONG DstHeight = DestRect->bottom - DestRect->top;
+  LONG SrcWidth = SourceRect->right - SourceRect->left;
+  LONG SrcHeight = SourceRect->bottom - SourceRect->top;
+  PSURFACE psurfDest = CONTAINING_RECORD(DestSurf, SURFACE, SurfObj);
+  PLONG XMap, XMapNext;
+  PULONG XWeight, Colors, Scratch, RowA, RowB, Swap;
+  LONG i, sx, sy, y1, y2, TagA = -1, TagB = -1, Error, DesY;
+  ULONG Weight, Bytes = 0;
+  PBYTE DestBits;
+  BOOLEAN Halftone;
+
+  switch (DestSurf->iBitmapFormat)
+  {
+  case BMF_8BPP:
+  case BMF_16BPP:
+  case BMF_24BPP:
+  case BMF_32BPP:
+    break;
+  default:
+    return FALSE;
+  }
+
+  if (SourceSurf == DestSurf ||
+      DstWidth <= 0 || DstHeight <= 0 || SrcWidth <= 0 || SrcHeight <= 0 ||
+      SourceRect->left < 0 || SourceRect->top < 0 ||
+      SourceRect->right > SourceSurf->sizlBitmap.cx ||
+      SourceRect->bottom > SourceSurf->sizlBitmap.cy)
+  {
+    return FALSE;
+  }
+
+  Halftone = (Mode == HALFTONE &&
+              (DestSurf->iBitmapFormat == BMF_24BPP ||
+               DestSurf->iBitmapFormat == BMF_32BPP) &&
+              psurfDest->ppal &&
+              (psurfDest->ppal->flFlags & (PAL_RGB | PAL_BGR)));
+
+  XMap = ExAllocatePoolWithTag(PagedPool,
+                               DstWidth * sizeof(ULONG) * (Halftone ? 7 : 2),
+                               TAG_DIB);
+  if (!XMap)
+    return FALSE;
+  Colors = (PULONG)(XMap + DstWidth);
+  DestBits = (PBYTE)DestSurf->pvScan0 + DestRect->top * DestSurf->lDelta +
+             DestRect->left * (BitsPerFormat(DestSurf->iBitmapFormat) >> 3);
+
+  if (!Halftone)
+  {
+    /* XMap[i] = left + i * SrcWidth / DstWidth, without the divisions */
+    sx = SourceRect->left;
+    Error = 0;
+    for (i = 0; i < DstWidth; i++)
+    {
+      XMap[i] = sx;
+      sx += SrcWidth / DstWidth;
+      Error += SrcWidth % DstWidth;
+      if (Error >= DstWidth)
+      {
+        Error -= DstWidth;
+        sx++;
+      }
+    }
+
+    sy = SourceRect->top;
+    Error = 0;
+    for (DesY = DestRect->top; DesY < DestRect->bottom; DesY++)
+    {
+      /* Rows repeating a source row copy the packed one again */
+      if (sy != TagA)
+      {
+        StretchFetchRow(SourceSurf, sy, XMap, DstWidth, ColorTranslation, Colors);
+        Bytes = StretchPackRow(DestSurf->iBitmapFormat, Colors, DstWidth);
+        TagA = sy;
+      }
+      RtlCopyMemory(DestBits, Colors, Bytes);
+      DestBits += DestSurf->lDelta;
+
+      sy += SrcHeight / DstHeight;
+      Error += SrcHeight % DstHeight;
+      if (Error >= DstHeight)
+      {
+        Error -= DstHeight;
+        sy++;
+      }
+    }
+
+    ExFreePoolWithTag(XMap, TAG_DIB);
+    return TRUE;
+  }
+
+  XMapNext = (PLONG)(Colors + DstWidth);
+  XWeight = (PULONG)(XMapNext + DstWidth);
+  Scratch = XWeight + DstWidth;
+  RowA = Scratch + DstWidth;
+  RowB = RowA + DstWidth;
+
+  for (i = 0; i < DstWidth; i++)
+  {
+    StretchHalftoneMap(i, SourceRect->left, SrcWidth, DstWidth,
+                       &XMap[i], &XMapNext[i], &XWeight[i]);
+  }
+
+  for (DesY = DestRect->top; DesY < DestRect->bottom; DesY++)
+  {
+    StretchHalftoneMap(DesY - DestRect->top, SourceRect->top, SrcHeight,
+                       DstHeight, &y1, &y2, &Weight);
+
+    /* Keep the two mixed source rows around, enlarging reuses them */
+    if (TagA != y1)
+    {
+      if (TagB == y1 || TagA == y2)
+      {
+        Swap = RowA; RowA = RowB; RowB = Swap;
+        i = TagA; TagA = TagB; TagB = i;
+      }
+      if (TagA != y1)
+      {
+        StretchHalftoneRow(SourceSurf, y1, XMap, XMapNext, XWeight, DstWidth,
+                           ColorTranslation, Scratch, RowA);
+        TagA = y1;
+      }
+    }
+    if (y2 != y1 && TagB != y2)
+    {
+      StretchHalftoneRow(SourceSurf, y2, XMap, XMapNext, XWeight, DstWidth,
+                         ColorTranslation, Scratch, RowB);
+      TagB = y2;
+    }
+
+    for (i = 0; i < DstWidth; i++)
+    {
+      Colors[i] = Weight ? StretchLerp(RowA[i], RowB[i], Weight) : RowA[i];
+    }
+    Bytes = StretchPackRow(DestSurf->iBitmapFormat, Colors, DstWidth);
+    RtlCopyMemory(DestBits, Colors, Bytes);
+    DestBits += DestSurf->lDelta;
+  }
+
+  ExFreePoolWithTag(XMap, TAG_DIB);
+  return TRUE;
+}
+
 BOOLEAN DIB_XXBPP_StretchBlt(SURFOBJ *DestSurf, SURFOBJ *SourceSurf, SURFOBJ *MaskSurf,
                             SURFOBJ *PatternSurface,
                             RECTL *DestRect, RECTL *SourceRect,
                             POINTL *MaskOrigin, BRUSHOBJ *Brush,
                             POINTL *BrushOrigin, XLATEOBJ *ColorTranslation,
-                            ROP4 ROP)
+                            ROP4 ROP, ULONG Mode)
 {
   LONG sx = 0;
   LONG sy = 0;
@@ -48,6 +350,13 @@ BOOLEAN DIB_XXBPP_StretchBlt(SURFOBJ *DestSurf, SURFOBJ *SourceSurf, SURFOBJ *Ma
 
   ASSERT(IS_VALID_ROP4(ROP));
 
+  if (ROP == ROP4_FROM_INDEX(R3_OPINDEX_SRCCOPY) && !MaskSurf &&
+      DIB_XXBPP_StretchBltSrcCopy(DestSurf, SourceSurf, DestRect, SourceRect,
+                                  ColorTranslation, Mode))
+  {
+    return TRUE;
+  }
+
   fnDest_GetPixel = DibFunctionsForBitmapFormat[DestSurf->iBitmapFormat].DIB_GetPixel;
   fnDest_PutPixel = DibFunctionsForBitmapFormat[DestSurf->iBitmapFormat].DIB_PutPixel;
 
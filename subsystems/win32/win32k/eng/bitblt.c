@@ -663,6 +663,64 @@ IntEngBitBlt(
 
 /**** ODYSSEY FONT RENDERING CODE *********************************************/
 
+/* checks if a format has one byte per color channel, whatever their order */
+static BOOLEAN
+IntIsByteChannelFormat(XLATEOBJ* pxloRGB2Dest)
+{
+    ULONG Red, Green, Blue;
+
+    Red = XLATEOBJ_iXlate(pxloRGB2Dest, RGB(0xff, 0, 0));
+    Green = XLATEOBJ_iXlate(pxloRGB2Dest, RGB(0, 0xff, 0));
+    Blue = XLATEOBJ_iXlate(pxloRGB2Dest, RGB(0, 0, 0xff));
+
+    return (Red | Green | Blue) == 0xffffff &&
+           (Red == 0xff || Red == 0xff00 || Red == 0xff0000) &&
+           (Green == 0xff || Green == 0xff00 || Green == 0xff0000) &&
+           (Blue == 0xff || Blue == 0xff00 || Blue == 0xff0000);
+}
+
+/* renders the alpha mask bitmap onto a 32bpp surface with byte channels.
+   Two channels are blended per multiply and no pixel depends on the one
+   before, so the inner loop is left for the compiler to vectorize */
+static VOID
+AlphaBltMask32(SURFOBJ* psoDest,
+               SURFOBJ* psoMask,
+               RECTL* prclDest,
+               POINTL* pptlMask,
+               ULONG Color)
+{
+    LONG i, j, dx, dy;
+    PULONG pulDest;
+    PBYTE pjMask;
+    ULONG Alpha, Dest, RedBlue, AlphaGreen;
+    ULONG ColorRedBlue = Color & 0x00ff00ff;
+    ULONG ColorAlphaGreen = (Color >> 8) & 0x00ff00ff;
+
+    dx = prclDest->right  - prclDest->left;
+    dy = prclDest->bottom - prclDest->top;
+
+    pulDest = (PULONG)((PBYTE)psoDest->pvScan0 + prclDest->top * psoDest->lDelta) + prclDest->left;
+    pjMask = (PBYTE)psoMask->pvScan0 + pptlMask->y * psoMask->lDelta + pptlMask->x;
+    for (j = 0; j < dy; j++)
+    {
+        for (i = 0; i < dx; i++)
+        {
+            /* Scale the coverage to 0..256, so a full one gives the brush color */
+            Alpha = pjMask[i] + (pjMask[i] >> 7);
+            Dest = pulDest[i];
+
+            RedBlue = ((ColorRedBlue * Alpha +
+                        (Dest & 0x00ff00ff) * (256 - Alpha)) >> 8) & 0x00ff00ff;
+            AlphaGreen = (ColorAlphaGreen * Alpha +
+                          ((Dest >> 8) & 0x00ff00ff) * (256 - Alpha)) & 0xff00ff00;
+
+            pulDest[i] = RedBlue | AlphaGreen;
+        }
+        pulDest = (PULONG)((PBYTE)pulDest + psoDest->lDelta);
+        pjMask += psoMask->lDelta;
+    }
+}
+
 /* renders the alpha mask bitmap */
 static BOOLEAN APIENTRY
 AlphaBltMask(SURFOBJ* psoDest,
@@ -689,6 +747,14 @@ AlphaBltMask(SURFOBJ* psoDest,
 
     if (psoMask != NULL)
     {
+        if (psoDest->iBitmapFormat == BMF_32BPP &&
+            IntIsByteChannelFormat(pxloRGB2Dest))
+        {
+            AlphaBltMask32(psoDest, psoMask, prclDest, pptlMask,
+                           pbo ? pbo->iSolidColor : 0);
+            return TRUE;
+        }
+
         BrushColor = XLATEOBJ_iXlate(pxloBrush, pbo ? pbo->iSolidColor : 0);
         r = (int)GetRValue(BrushColor);
         g = (int)GetGValue(BrushColor);
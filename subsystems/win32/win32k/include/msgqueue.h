@@ -17,11 +17,24 @@ typedef enum _QS_ROS_TYPES
     QSRosHotKey,
 }QS_ROS_TYPES,*PQS_ROS_TYPES;
 
+/* Posted messages are kept on one list per message class */
+typedef enum _MSQ_POSTED_LIST
+{
+    MsqPostedKey = 0,
+    MsqPostedMouse,
+    MsqPostedTimer,
+    MsqPostedUser,
+    MsqPostedOther,
+    MsqPostedLists
+}MSQ_POSTED_LIST,*PMSQ_POSTED_LIST;
+
 typedef struct _USER_MESSAGE
 {
   LIST_ENTRY ListEntry;
   MSG Msg;
   DWORD QS_Flags;
+  /* Post order across the posted lists of a queue */
+  ULONG Sequence;
 } USER_MESSAGE, *PUSER_MESSAGE;
 
 struct _USER_MESSAGE_QUEUE;
@@ -53,10 +66,21 @@ typedef struct _USER_MESSAGE_QUEUE
   struct _ETHREAD *Thread;
   /* Queue of messages sent to the queue. */
   LIST_ENTRY SentMessagesListHead;
-  /* Queue of messages posted to the queue. */
-  LIST_ENTRY PostedMessagesListHead;
+  /* Queues of messages posted to the queue, one per MSQ_POSTED_LIST. */
+  LIST_ENTRY PostedMessagesListHead[MsqPostedLists];
+  /* QS bits of the messages on each posted list, reset when it empties. */
+  DWORD PostedQSFlags[MsqPostedLists];
+  /* Number of messages on each posted list. */
+  ULONG PostedCount[MsqPostedLists];
+  /* Deepest the posted lists have been, and posts folded into a pending one. */
+  ULONG PostedPeak;
+  ULONG PostedCoalesced;
+  /* Sequence number of the next posted message. */
+  ULONG PostedSequence;
   /* Queue for hardware messages for the queue. */
   LIST_ENTRY HardwareMessagesListHead;
+  /* Serializes posters that only hold the user lock shared. */
+  FAST_MUTEX PostLock;
   /* True if a WM_MOUSEMOVE is pending */
   BOOLEAN MouseMoved;
   /* Current WM_MOUSEMOVE message */
@@ -147,7 +171,7 @@ NTSTATUS FASTCALL co_MsqSendMessage(PUSER_MESSAGE_QUEUE MessageQueue,
            UINT uTimeout, BOOL Block, INT HookMessage, ULONG_PTR *uResult);
 PUSER_MESSAGE FASTCALL MsqCreateMessage(LPMSG Msg);
 VOID FASTCALL MsqDestroyMessage(PUSER_MESSAGE Message);
-VOID FASTCALL MsqPostMessage(PUSER_MESSAGE_QUEUE MessageQueue, MSG* Msg, BOOLEAN HardwareMessage, DWORD MessageBits);
+BOOLEAN FASTCALL MsqPostMessage(PUSER_MESSAGE_QUEUE MessageQueue, MSG* Msg, BOOLEAN HardwareMessage, DWORD MessageBits);
 VOID FASTCALL MsqPostQuitMessage(PUSER_MESSAGE_QUEUE MessageQueue, ULONG ExitCode);
 BOOLEAN APIENTRY
 MsqPeekMessage(IN PUSER_MESSAGE_QUEUE MessageQueue,
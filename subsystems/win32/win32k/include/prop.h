@@ -1,5 +1,6 @@
 #pragma once
 
+INIT_FUNCTION NTSTATUS NTAPI InitPropImpl(VOID);
 PPROPERTY FASTCALL IntGetProp(PWND,ATOM);
 BOOL FASTCALL IntRemoveProp(PWND,ATOM);
 BOOL FASTCALL IntSetProp(PWND, ATOM, HANDLE);
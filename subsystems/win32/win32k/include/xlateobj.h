@@ -9,6 +9,9 @@
 
 struct _EXLATEOBJ;
 
+extern const BYTE gajXlate5to8[32];
+extern const BYTE gajXlate6to8[64];
+
 typedef ULONG (FASTCALL *PFN_XLATE)(struct _EXLATEOBJ *pexlo, ULONG iColor);
 
 typedef struct _EXLATEOBJ
@@ -585,6 +585,10 @@ DriverEntry(
     NT_ROF(InitKeyboardImpl());
     NT_ROF(MsqInitializeImpl());
     NT_ROF(InitTimerImpl());
+    NT_ROF(InitPropImpl());
+
+    /* Pick the DIB row kernels for this processor */
+    DIB_SSE2_Initialize();
 
     /* Initialize FreeType library */
     if (!InitFontSupport())
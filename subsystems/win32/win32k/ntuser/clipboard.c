@@ -813,7 +813,7 @@ NtUserGetPriorityClipboardFormat(UINT *paFormatPriorityList, INT cFormats)
     UINT *priorityList;
     INT ret = 0;
 
-    UserEnterExclusive();
+    UserEnterShared();
 
     _SEH2_TRY
     {
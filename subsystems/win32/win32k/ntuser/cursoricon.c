@@ -509,7 +509,7 @@ NtUserGetCursorInfo(
     DECLARE_RETURN(BOOL);
 
     TRACE("Enter NtUserGetCursorInfo\n");
-    UserEnterExclusive();
+    UserEnterShared();
 
     CurInfo = IntGetSysCursorInfo();
     CurIcon = (PCURICON_OBJECT)CurInfo->CurrentCursorObject;
@@ -706,7 +706,7 @@ NtUserGetClipCursor(
     DECLARE_RETURN(BOOL);
 
     TRACE("Enter NtUserGetClipCursor\n");
-    UserEnterExclusive();
+    UserEnterShared();
 
     if (!lpRect)
         RETURN(FALSE);
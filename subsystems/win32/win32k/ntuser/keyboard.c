@@ -383,7 +383,7 @@ NtUserGetAsyncKeyState(
    DECLARE_RETURN(SHORT);
 
    TRACE("Enter NtUserGetAsyncKeyState\n");
-   UserEnterExclusive();
+   UserEnterShared();
 
    RETURN((SHORT)UserGetAsyncKeyState(key));
 
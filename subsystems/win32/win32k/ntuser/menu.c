@@ -2517,7 +2517,7 @@ NtUserGetMenuDefaultItem(
    DECLARE_RETURN(UINT);
 
    TRACE("Enter NtUserGetMenuDefaultItem\n");
-   UserEnterExclusive();
+   UserEnterShared();
 
    if(!(Menu = UserGetMenuObject(hMenu)))
    {
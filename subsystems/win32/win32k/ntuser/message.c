@@ -1806,7 +1806,11 @@ NtUserPostMessage(HWND hWnd,
 {
     BOOL ret;
 
-    UserEnterExclusive();
+    /* Posting only locks the target queue, DDE messages are sent instead */
+    if (Msg >= WM_DDE_FIRST && Msg <= WM_DDE_LAST)
+        UserEnterExclusive();
+    else
+        UserEnterShared();
 
     ret = UserPostMessage(hWnd, Msg, wParam, lParam);
 
@@ -1823,7 +1827,7 @@ NtUserPostThreadMessage(DWORD idThread,
 {
     BOOL ret;
 
-    UserEnterExclusive();
+    UserEnterShared();
 
     ret = UserPostThreadMessage( idThread, Msg, wParam, lParam);
 
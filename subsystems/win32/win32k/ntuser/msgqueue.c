@@ -24,6 +24,18 @@ static PAGED_LOOKASIDE_LIST MessageLookasideList;
 MOUSEMOVEPOINT MouseHistoryOfMoves[64];
 INT gcur_count = 0;
 
+/*
+ * NtUserPostMessage and NtUserPostThreadMessage only take the user lock
+ * shared, so posting to a queue is serialized by its own lock. Everything
+ * that takes messages off a queue holds the user lock exclusively and so
+ * never runs alongside them.
+ */
+#define MsqLockPostQueue(Queue) \
+  ExEnterCriticalRegionAndAcquireFastMutexUnsafe(&(Queue)->PostLock)
+
+#define MsqUnlockPostQueue(Queue) \
+  ExReleaseFastMutexUnsafeAndLeaveCriticalRegion(&(Queue)->PostLock)
+
 /* FUNCTIONS *****************************************************************/
 
 INIT_FUNCTION
@@ -761,6 +773,116 @@ MsqDestroyMessage(PUSER_MESSAGE Message)
    ExFreeToPagedLookasideList(&MessageLookasideList, Message);
 }
 
+/*
+ * Posted messages are split by class so that a filtered peek, say for
+ * WM_TIMER or WM_PAINT, does not have to step over a backlog of WM_USER
+ * posts. Every message carries a sequence number so the oldest match over
+ * all lists can still be found, which keeps the retrieval order unchanged.
+ */
+static MSQ_POSTED_LIST FASTCALL
+MsqPostedListOf(UINT Message)
+{
+   if (Message >= WM_KEYFIRST && Message <= WM_KEYLAST) return MsqPostedKey;
+   if (Message >= WM_MOUSEFIRST && Message <= WM_MOUSELAST) return MsqPostedMouse;
+   if (Message == WM_TIMER || Message == WM_SYSTIMER) return MsqPostedTimer;
+   if (Message >= WM_USER) return MsqPostedUser;
+   return MsqPostedOther;
+}
+
+/* Lowest and highest message that can be found on each posted list */
+static const UINT MsqPostedRange[MsqPostedLists][2] =
+{
+   { WM_KEYFIRST, WM_KEYLAST },     /* MsqPostedKey */
+   { WM_MOUSEFIRST, WM_MOUSELAST }, /* MsqPostedMouse */
+   { WM_TIMER, WM_SYSTIMER },       /* MsqPostedTimer */
+   { WM_USER, MAXUINT },            /* MsqPostedUser */
+   { 0, WM_USER - 1 }               /* MsqPostedOther */
+};
+
+static BOOLEAN FASTCALL
+MsqPostedListMayMatch(PUSER_MESSAGE_QUEUE MessageQueue, MSQ_POSTED_LIST List,
+                      UINT MsgFilterLow, UINT MsgFilterHigh, UINT QSflags)
+{
+   if (IsListEmpty(&MessageQueue->PostedMessagesListHead[List]))
+      return FALSE;
+
+   if (MsgFilterLow == 0 && MsgFilterHigh == 0)
+      return (MessageQueue->PostedQSFlags[List] & QSflags) != 0;
+
+   return MsgFilterLow <= MsqPostedRange[List][1] &&
+          MsgFilterHigh >= MsqPostedRange[List][0];
+}
+
+static VOID FASTCALL
+MsqInsertPostedMessage(PUSER_MESSAGE_QUEUE MessageQueue, PUSER_MESSAGE Message)
+{
+   MSQ_POSTED_LIST List = MsqPostedListOf(Message->Msg.message);
+   ULONG Depth = 0;
+   ULONG i;
+
+   Message->Sequence = MessageQueue->PostedSequence++;
+   InsertTailList(&MessageQueue->PostedMessagesListHead[List],
+                  &Message->ListEntry);
+   MessageQueue->PostedQSFlags[List] |= Message->QS_Flags;
+   MessageQueue->PostedCount[List]++;
+
+   for (i = 0; i < MsqPostedLists; i++)
+      Depth += MessageQueue->PostedCount[i];
+   if (Depth > MessageQueue->PostedPeak)
+      MessageQueue->PostedPeak = Depth;
+}
+
+static VOID FASTCALL
+MsqRemovePostedMessage(PUSER_MESSAGE_QUEUE MessageQueue, PUSER_MESSAGE Message)
+{
+   MSQ_POSTED_LIST List = MsqPostedListOf(Message->Msg.message);
+
+   RemoveEntryList(&Message->ListEntry);
+   MessageQueue->PostedCount[List]--;
+   if (IsListEmpty(&MessageQueue->PostedMessagesListHead[List]))
+      MessageQueue->PostedQSFlags[List] = 0;
+
+   ClearMsgBitsMask(MessageQueue, Message->QS_Flags);
+   MsqDestroyMessage(Message);
+}
+
+/*
+ * A timer never has more than one WM_TIMER pending, so a timer that fires
+ * again before its message was read is folded into the pending one. Only
+ * messages posted by the timer code (QS_TIMER) are folded, a WM_TIMER the
+ * application posted itself is delivered like any other posted message.
+ */
+static BOOLEAN FASTCALL
+MsqCoalescePostedMessage(PUSER_MESSAGE_QUEUE MessageQueue, MSG* Msg,
+                         DWORD MessageBits)
+{
+   PLIST_ENTRY ListHead, CurrentEntry;
+   PUSER_MESSAGE CurrentMessage;
+
+   if (!(MessageBits & QS_TIMER) ||
+       (Msg->message != WM_TIMER && Msg->message != WM_SYSTIMER))
+      return FALSE;
+
+   ListHead = &MessageQueue->PostedMessagesListHead[MsqPostedTimer];
+   for (CurrentEntry = ListHead->Flink;
+        CurrentEntry != ListHead;
+        CurrentEntry = CurrentEntry->Flink)
+   {
+      CurrentMessage = CONTAINING_RECORD(CurrentEntry, USER_MESSAGE, ListEntry);
+      if ((CurrentMessage->QS_Flags & QS_TIMER) &&
+          CurrentMessage->Msg.hwnd == Msg->hwnd &&
+          CurrentMessage->Msg.message == Msg->message &&
+          CurrentMessage->Msg.wParam == Msg->wParam)
+      {
+         CurrentMessage->Msg.lParam = Msg->lParam;
+         MessageQueue->PostedCoalesced++;
+         return TRUE;
+      }
+   }
+
+   return FALSE;
+}
+
 BOOLEAN FASTCALL
 co_MsqDispatchOneSentMessage(PUSER_MESSAGE_QUEUE MessageQueue)
 {
@@ -922,6 +1044,7 @@ MsqRemoveWindowMessagesFromQueue(PVOID pWindow)
    PUSER_MESSAGE_QUEUE MessageQueue;
    PLIST_ENTRY CurrentEntry, ListHead;
    PWND Window = pWindow;
+   ULONG i;
 
    ASSERT(Window);
 
@@ -929,22 +1052,19 @@ MsqRemoveWindowMessagesFromQueue(PVOID pWindow)
    ASSERT(MessageQueue);
 
    /* remove the posted messages for this window */
-   CurrentEntry = MessageQueue->PostedMessagesListHead.Flink;
-   ListHead = &MessageQueue->PostedMessagesListHead;
-   while (CurrentEntry != ListHead)
+   for (i = 0; i < MsqPostedLists; i++)
    {
-      PostedMessage = CONTAINING_RECORD(CurrentEntry, USER_MESSAGE,
-                                        ListEntry);
-      if (PostedMessage->Msg.hwnd == Window->head.h)
-      {
-         RemoveEntryList(&PostedMessage->ListEntry);
-         ClearMsgBitsMask(MessageQueue, PostedMessage->QS_Flags);
-         MsqDestroyMessage(PostedMessage);
-         CurrentEntry = MessageQueue->PostedMessagesListHead.Flink;
-      }
-      else
+      ListHead = &MessageQueue->PostedMessagesListHead[i];
+      CurrentEntry = ListHead->Flink;
+      while (CurrentEntry != ListHead)
       {
+         PostedMessage = CONTAINING_RECORD(CurrentEntry, USER_MESSAGE,
+                                           ListEntry);
          CurrentEntry = CurrentEntry->Flink;
+         if (PostedMessage->Msg.hwnd == Window->head.h)
+         {
+            MsqRemovePostedMessage(MessageQueue, PostedMessage);
+         }
       }
    }
 
@@ -1200,7 +1320,11 @@ co_MsqSendMessage(PUSER_MESSAGE_QUEUE MessageQueue,
    return WaitStatus;
 }
 
-VOID FASTCALL
+/*
+ * Returns TRUE if a new message was queued, FALSE if it could not be
+ * allocated or was folded into one that is already pending.
+ */
+BOOLEAN FASTCALL
 MsqPostMessage(PUSER_MESSAGE_QUEUE MessageQueue, MSG* Msg, BOOLEAN HardwareMessage,
                DWORD MessageBits)
 {
@@ -1208,13 +1332,23 @@ MsqPostMessage(PUSER_MESSAGE_QUEUE MessageQueue, MSG* Msg, BOOLEAN HardwareMessa
 
    if(!(Message = MsqCreateMessage(Msg)))
    {
-      return;
+      return FALSE;
    }
 
+   Message->QS_Flags = MessageBits;
+
+   MsqLockPostQueue(MessageQueue);
+
    if(!HardwareMessage)
    {
-       InsertTailList(&MessageQueue->PostedMessagesListHead,
-                      &Message->ListEntry);
+       if (MsqCoalescePostedMessage(MessageQueue, Msg, MessageBits))
+       {
+           MsqUnlockPostQueue(MessageQueue);
+           MsqDestroyMessage(Message);
+           return FALSE;
+       }
+
+       MsqInsertPostedMessage(MessageQueue, Message);
    }
    else
    {
@@ -1224,16 +1358,20 @@ MsqPostMessage(PUSER_MESSAGE_QUEUE MessageQueue, MSG* Msg, BOOLEAN HardwareMessa
        update_input_key_state( MessageQueue, Msg );
    }
 
-   Message->QS_Flags = MessageBits;
    MsqWakeQueue(MessageQueue, MessageBits, (MessageBits & QS_TIMER ? FALSE : TRUE));
+
+   MsqUnlockPostQueue(MessageQueue);
+   return TRUE;
 }
 
 VOID FASTCALL
 MsqPostQuitMessage(PUSER_MESSAGE_QUEUE MessageQueue, ULONG ExitCode)
 {
+   MsqLockPostQueue(MessageQueue);
    MessageQueue->QuitPosted = TRUE;
    MessageQueue->QuitExitCode = ExitCode;
    MsqWakeQueue(MessageQueue, QS_POSTMESSAGE|QS_ALLPOSTMESSAGE, TRUE);
+   MsqUnlockPostQueue(MessageQueue);
 }
 
 /***********************************************************************
@@ -1719,48 +1857,56 @@ MsqPeekMessage(IN PUSER_MESSAGE_QUEUE MessageQueue,
 {
    PLIST_ENTRY CurrentEntry;
    PUSER_MESSAGE CurrentMessage;
+   PUSER_MESSAGE FoundMessage = NULL;
    PLIST_ENTRY ListHead;
+   ULONG i;
 
-   CurrentEntry = MessageQueue->PostedMessagesListHead.Flink;
-   ListHead = &MessageQueue->PostedMessagesListHead;
-
-   if (IsListEmpty(CurrentEntry)) return FALSE;
-
-   CurrentMessage = CONTAINING_RECORD(CurrentEntry, USER_MESSAGE,
-                                         ListEntry);
-   do
+   for (i = 0; i < MsqPostedLists; i++)
    {
-      if (IsListEmpty(CurrentEntry)) break;
-      if (!CurrentMessage) break;
-      CurrentEntry = CurrentEntry->Flink;
+      /* Skip the lists that cannot hold anything the filter accepts */
+      if (!MsqPostedListMayMatch(MessageQueue, i, MsgFilterLow, MsgFilterHigh, QSflags))
+         continue;
+
+      ListHead = &MessageQueue->PostedMessagesListHead[i];
+      for (CurrentEntry = ListHead->Flink;
+           CurrentEntry != ListHead;
+           CurrentEntry = CurrentEntry->Flink)
+      {
+         CurrentMessage = CONTAINING_RECORD(CurrentEntry, USER_MESSAGE,
+                                            ListEntry);
+
+         /* The rest of this list was posted after the match we have */
+         if (FoundMessage &&
+             (LONG)(CurrentMessage->Sequence - FoundMessage->Sequence) > 0)
+            break;
 /*
  MSDN:
  1: any window that belongs to the current thread, and any messages on the current thread's message queue whose hwnd value is NULL.
  2: retrieves only messages on the current thread's message queue whose hwnd value is NULL.
  3: handle to the window whose messages are to be retrieved.
  */
-      if ( ( !Window || // 1
-            ( Window == HWND_BOTTOM && CurrentMessage->Msg.hwnd == NULL ) || // 2
-            ( Window != HWND_BOTTOM && Window->head.h == CurrentMessage->Msg.hwnd ) ) && // 3
-            ( ( ( MsgFilterLow == 0 && MsgFilterHigh == 0 ) && CurrentMessage->QS_Flags & QSflags ) ||
-              ( MsgFilterLow <= CurrentMessage->Msg.message && MsgFilterHigh >= CurrentMessage->Msg.message ) ) )
-      {
-         *Message = CurrentMessage->Msg;
-
-         if (Remove)
+         if ( ( !Window || // 1
+               ( Window == HWND_BOTTOM && CurrentMessage->Msg.hwnd == NULL ) || // 2
+               ( Window != HWND_BOTTOM && Window->head.h == CurrentMessage->Msg.hwnd ) ) && // 3
+               ( ( ( MsgFilterLow == 0 && MsgFilterHigh == 0 ) && CurrentMessage->QS_Flags & QSflags ) ||
+                 ( MsgFilterLow <= CurrentMessage->Msg.message && MsgFilterHigh >= CurrentMessage->Msg.message ) ) )
          {
-             RemoveEntryList(&CurrentMessage->ListEntry);
-             ClearMsgBitsMask(MessageQueue, CurrentMessage->QS_Flags);
-             MsqDestroyMessage(CurrentMessage);
+            FoundMessage = CurrentMessage;
+            break;
          }
-         return(TRUE);
       }
-      CurrentMessage = CONTAINING_RECORD(CurrentEntry, USER_MESSAGE,
-                                         ListEntry);
    }
-   while (CurrentEntry != ListHead);
 
-   return(FALSE);
+   if (!FoundMessage)
+      return(FALSE);
+
+   *Message = FoundMessage->Msg;
+
+   if (Remove)
+   {
+      MsqRemovePostedMessage(MessageQueue, FoundMessage);
+   }
+   return(TRUE);
 }
 
 NTSTATUS FASTCALL
@@ -1801,12 +1947,17 @@ MsqInitializeMessageQueue(struct _ETHREAD *Thread, PUSER_MESSAGE_QUEUE MessageQu
 {
    LARGE_INTEGER LargeTickCount;
    NTSTATUS Status;
+   ULONG i;
 
    MessageQueue->Thread = Thread;
    MessageQueue->CaretInfo = (PTHRDCARETINFO)(MessageQueue + 1);
-   InitializeListHead(&MessageQueue->PostedMessagesListHead);
+   for (i = 0; i < MsqPostedLists; i++)
+   {
+      InitializeListHead(&MessageQueue->PostedMessagesListHead[i]);
+   }
    InitializeListHead(&MessageQueue->SentMessagesListHead);
    InitializeListHead(&MessageQueue->HardwareMessagesListHead);
+   ExInitializeFastMutex(&MessageQueue->PostLock);
    InitializeListHead(&MessageQueue->DispatchingMessagesHead);
    InitializeListHead(&MessageQueue->LocalDispatchingMessagesHead);
    MessageQueue->QuitPosted = FALSE;
@@ -1845,17 +1996,23 @@ MsqCleanupMessageQueue(PUSER_MESSAGE_QUEUE MessageQueue)
    PUSER_MESSAGE CurrentMessage;
    PUSER_SENT_MESSAGE CurrentSentMessage;
    PTHREADINFO pti;
+   ULONG i;
 
    pti = MessageQueue->Thread->Tcb.Win32Thread;
 
 
    /* cleanup posted messages */
-   while (!IsListEmpty(&MessageQueue->PostedMessagesListHead))
+   for (i = 0; i < MsqPostedLists; i++)
    {
-      CurrentEntry = RemoveHeadList(&MessageQueue->PostedMessagesListHead);
-      CurrentMessage = CONTAINING_RECORD(CurrentEntry, USER_MESSAGE,
-                                         ListEntry);
-      MsqDestroyMessage(CurrentMessage);
+      while (!IsListEmpty(&MessageQueue->PostedMessagesListHead[i]))
+      {
+         CurrentEntry = RemoveHeadList(&MessageQueue->PostedMessagesListHead[i]);
+         CurrentMessage = CONTAINING_RECORD(CurrentEntry, USER_MESSAGE,
+                                            ListEntry);
+         MsqDestroyMessage(CurrentMessage);
+      }
+      MessageQueue->PostedCount[i] = 0;
+      MessageQueue->PostedQSFlags[i] = 0;
    }
 
    /* remove the messages that have not yet been dispatched */
@@ -2143,7 +2300,7 @@ NtUserGetKeyState(INT key)
 {
    DWORD Ret;
 
-   UserEnterExclusive();
+   UserEnterShared();
 
    Ret = UserGetKeyState(key);
 
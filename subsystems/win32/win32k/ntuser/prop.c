@@ -31,6 +31,25 @@
 
 DBG_DEFAULT_CHANNEL(UserProp);
 
+/* GLOBALS *******************************************************************/
+
+/*
+ * Property lists are changed by callers that hold the user lock shared, so
+ * those changes are serialized here. It also serializes their desktop heap
+ * allocations, since the heap is not. Holding the user lock exclusively is
+ * enough to read a list.
+ */
+ERESOURCE UserPropLock;
+
+#define PropEnterShared() \
+  ExAcquireResourceSharedLite(&UserPropLock, TRUE)
+
+#define PropEnterExclusive() \
+  ExAcquireResourceExclusiveLite(&UserPropLock, TRUE)
+
+#define PropLeave() \
+  ExReleaseResourceLite(&UserPropLock)
+
 /* STATIC FUNCTIONS **********************************************************/
 
 PPROPERTY FASTCALL
@@ -52,26 +71,43 @@ IntGetProp(PWND Window, ATOM Atom)
    return(NULL);
 }
 
-BOOL FASTCALL
-IntRemoveProp(PWND Window, ATOM Atom)
+static BOOL FASTCALL
+IntRemovePropData(PWND Window, ATOM Atom, HANDLE *Data)
 {
    PPROPERTY Prop;
-   Prop = IntGetProp(Window, Atom);
+   BOOL Ret = FALSE;
 
-   if (Prop == NULL)
+   PropEnterExclusive();
+
+   Prop = IntGetProp(Window, Atom);
+   if (Prop != NULL)
    {
-      return FALSE;
+      *Data = Prop->Data;
+      RemoveEntryList(&Prop->PropListEntry);
+      UserHeapFree(Prop);
+      Window->PropListItems--;
+      Ret = TRUE;
    }
-   RemoveEntryList(&Prop->PropListEntry);
-   UserHeapFree(Prop);
-   Window->PropListItems--;
-   return TRUE;
+
+   PropLeave();
+   return Ret;
+}
+
+BOOL FASTCALL
+IntRemoveProp(PWND Window, ATOM Atom)
+{
+   HANDLE Data;
+
+   return IntRemovePropData(Window, Atom, &Data);
 }
 
 BOOL FASTCALL
 IntSetProp(PWND pWnd, ATOM Atom, HANDLE Data)
 {
    PPROPERTY Prop;
+   BOOL Ret = TRUE;
+
+   PropEnterExclusive();
 
    Prop = IntGetProp(pWnd, Atom);
 
@@ -80,7 +116,8 @@ IntSetProp(PWND pWnd, ATOM Atom, HANDLE Data)
       Prop = UserHeapAlloc(sizeof(PROPERTY));
       if (Prop == NULL)
       {
-         return FALSE;
+         Ret = FALSE;
+         goto Exit;
       }
       Prop->Atom = Atom;
       InsertTailList(&pWnd->PropListHead, &Prop->PropListEntry);
@@ -88,11 +125,22 @@ IntSetProp(PWND pWnd, ATOM Atom, HANDLE Data)
    }
 
    Prop->Data = Data;
-   return TRUE;
+
+Exit:
+   PropLeave();
+   return Ret;
 }
 
 /* FUNCTIONS *****************************************************************/
 
+INIT_FUNCTION
+NTSTATUS
+NTAPI
+InitPropImpl(VOID)
+{
+   return ExInitializeResourceLite(&UserPropLock);
+}
+
 NTSTATUS APIENTRY
 NtUserBuildPropList(HWND hWnd,
                     LPVOID Buffer,
@@ -105,6 +153,7 @@ NtUserBuildPropList(HWND hWnd,
    PROPLISTITEM listitem, *li;
    NTSTATUS Status;
    DWORD Cnt = 0;
+   BOOL Locked = FALSE;
    DECLARE_RETURN(NTSTATUS);
 
    TRACE("Enter NtUserBuildPropList\n");
@@ -115,6 +164,10 @@ NtUserBuildPropList(HWND hWnd,
       RETURN( STATUS_INVALID_HANDLE);
    }
 
+   /* Keep NtUserSetProp and NtUserRemoveProp off the list while we walk it */
+   PropEnterShared();
+   Locked = TRUE;
+
    if(Buffer)
    {
       if(!BufferSize || (BufferSize % sizeof(PROPLISTITEM) != 0))
@@ -161,6 +214,7 @@ NtUserBuildPropList(HWND hWnd,
    RETURN( STATUS_SUCCESS);
 
 CLEANUP:
+   if (Locked) PropLeave();
    TRACE("Leave NtUserBuildPropList, ret=%i\n",_ret_);
    UserLeave();
    END_CLEANUP;
@@ -170,28 +224,22 @@ HANDLE APIENTRY
 NtUserRemoveProp(HWND hWnd, ATOM Atom)
 {
    PWND Window;
-   PPROPERTY Prop;
    HANDLE Data;
    DECLARE_RETURN(HANDLE);
 
    TRACE("Enter NtUserRemoveProp\n");
-   UserEnterExclusive();
+   /* The property lock serializes the list, the window only has to stay */
+   UserEnterShared();
 
    if (!(Window = UserGetWindowObject(hWnd)))
    {
       RETURN( NULL);
    }
 
-   Prop = IntGetProp(Window, Atom);
-
-   if (Prop == NULL)
+   if (!IntRemovePropData(Window, Atom, &Data))
    {
       RETURN(NULL);
    }
-   Data = Prop->Data;
-   RemoveEntryList(&Prop->PropListEntry);
-   UserHeapFree(Prop);
-   Window->PropListItems--;
 
    RETURN(Data);
 
@@ -208,7 +256,7 @@ NtUserSetProp(HWND hWnd, ATOM Atom, HANDLE Data)
    DECLARE_RETURN(BOOL);
 
    TRACE("Enter NtUserSetProp\n");
-   UserEnterExclusive();
+   UserEnterShared();
 
    if (!(Window = UserGetWindowObject(hWnd)))
    {
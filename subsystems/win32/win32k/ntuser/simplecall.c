@@ -147,7 +147,21 @@ NtUserCallOneParam(
 
    TRACE("Enter NtUserCallOneParam\n");
 
-   UserEnterExclusive();
+   /* Routines that only read, or only post to a queue, share the lock */
+   switch(Routine)
+   {
+      case ONEPARAM_ROUTINE_POSTQUITMESSAGE:
+      case ONEPARAM_ROUTINE_GETKEYBOARDTYPE:
+      case ONEPARAM_ROUTINE_GETKEYBOARDLAYOUT:
+      case ONEPARAM_ROUTINE_ENUMCLIPBOARDFORMATS:
+      case ONEPARAM_ROUTINE_GETCURSORPOS:
+         UserEnterShared();
+         break;
+
+      default:
+         UserEnterExclusive();
+         break;
+   }
 
    switch(Routine)
    {
@@ -312,7 +326,6 @@ NtUserCallOneParam(
          RETURN (IntGetQueueStatus((DWORD)Param));
       }
       case ONEPARAM_ROUTINE_ENUMCLIPBOARDFORMATS:
-         /* FIXME: Should use UserEnterShared */
          RETURN(IntEnumClipboardFormats(Param));
 
       case ONEPARAM_ROUTINE_CSRSS_GUICHECK:
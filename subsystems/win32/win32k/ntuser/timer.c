@@ -415,9 +415,10 @@ PostTimerMessages(PWND Window)
            Msg.wParam  = (WPARAM) pTmr->nID;
            Msg.lParam  = (LPARAM) pTmr->pfn;
 
-           MsqPostMessage(ThreadQueue, &Msg, FALSE, QS_TIMER);
+           /* A WM_TIMER that is still pending takes this one in */
+           if (MsqPostMessage(ThreadQueue, &Msg, FALSE, QS_TIMER))
+              pti->cTimersReady++;
            pTmr->flags &= ~TMRF_READY;
-           pti->cTimersReady++;
            Hit = TRUE;
            // Now move this entry to the end of the list so it will not be
            // called again in the next msg loop.
@@ -2915,7 +2915,7 @@ NtUserGetAncestor(HWND hWnd, UINT Type)
    DECLARE_RETURN(HWND);
 
    TRACE("Enter NtUserGetAncestor\n");
-   UserEnterExclusive();
+   UserEnterShared();
 
    if (!(Window = UserGetWindowObject(hWnd)))
    {
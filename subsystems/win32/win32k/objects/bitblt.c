@@ -681,6 +681,7 @@ GreStretchBltMask(
                               BitmapMask ? &MaskPoint : NULL,
                               &DCDest->eboFill.BrushObject,
                               &BrushOrigin,
+                              pdcattr->jStretchBltMode,
                               ROP_TO_ROP4(ROP));
     if (UsesSource)
     {
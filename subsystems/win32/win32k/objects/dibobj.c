@@ -1104,6 +1104,7 @@ NtGdiStretchDIBitsInternal(
                                NULL,
                                &pdc->eboFill.BrushObject,
                                NULL,
+                               pdc->pdcattr->jStretchBltMode,
                                ROP_TO_ROP4(dwRop));
 
     /* Cleanup */
@@ -75,18 +75,50 @@ static LIST_ENTRY FontListHead;
 static FAST_MUTEX FontListLock;
 static BOOL RenderingEnabled = TRUE;
 
-#define MAX_FONT_CACHE 256
+/* Rendered glyphs are cached per face, in buckets hashed on the glyph
+   index and the size they were rendered at. All faces share one byte
+   budget, which is enforced by a CLOCK sweep over all cached glyphs */
+#define FONT_CACHE_BUDGET       (1024 * 1024)
+#define FONT_CACHE_FACE_BUCKETS 256
 
 typedef struct _FONT_CACHE_ENTRY
 {
     LIST_ENTRY ListEntry;
+    LIST_ENTRY BucketEntry;
+    LONG RefCount;
+    BOOLEAN Referenced;
     int GlyphIndex;
     FT_Face Face;
     FT_BitmapGlyph BitmapGlyph;
+    int Width;
     int Height;
+    FT_Render_Mode RenderMode;
+    ULONG Size;
 } FONT_CACHE_ENTRY, *PFONT_CACHE_ENTRY;
+
+typedef struct _FONT_CACHE_FACE
+{
+    LIST_ENTRY Buckets[FONT_CACHE_FACE_BUCKETS];
+} FONT_CACHE_FACE, *PFONT_CACHE_FACE;
+
+/* A glyph laid out by GreExtTextOutW, before it is composed into the
+   coverage mask of its run */
+#define GLYPH_RUN_STACK_SIZE 16
+
+typedef struct _GLYPH_RUN_ENTRY
+{
+    PFONT_CACHE_ENTRY CacheEntry;
+    RECTL GlyphRect;
+    RECTL BackRect;
+} GLYPH_RUN_ENTRY, *PGLYPH_RUN_ENTRY;
+
+/* Lookups take this shared, adding and evicting glyphs takes it exclusive */
+static ERESOURCE FontCacheLock;
 static LIST_ENTRY FontCacheListHead;
-static UINT FontCacheNumEntries;
+static ULONG FontCacheSize;
+static ULONG FontCacheNumEntries;
+static LONG FontCacheHits;
+static LONG FontCacheMisses;
 
 static PWCHAR ElfScripts[32] =   /* these are in the order of the fsCsb[0] bits */
 {
@@ -164,7 +196,9 @@ InitFontSupport(VOID)
 
     InitializeListHead(&FontListHead);
     InitializeListHead(&FontCacheListHead);
+    FontCacheSize = 0;
     FontCacheNumEntries = 0;
+    ExInitializeResourceLite(&FontCacheLock);
     ExInitializeFastMutex(&FontListLock);
     ExInitializeFastMutex(&FreeTypeLock);
 
@@ -1332,47 +1366,174 @@ ftGdiGetRasterizerCaps(LPRASTERIZER_STATUS lprs)
 }
 
 
-FT_BitmapGlyph APIENTRY
-ftGdiGlyphCacheGet(
-    FT_Face Face,
+static
+ULONG
+ftGdiGlyphCacheHash(
     INT GlyphIndex,
+    INT Width,
     INT Height)
 {
-    PLIST_ENTRY CurrentEntry;
+    return ((ULONG)GlyphIndex * 31 + (ULONG)Height * 7 + (ULONG)Width) &
+           (FONT_CACHE_FACE_BUCKETS - 1);
+}
+
+static
+VOID
+ftGdiGlyphCacheFreeEntry(
+    PFONT_CACHE_ENTRY FontEntry)
+{
+    ASSERT(FontEntry->RefCount == 0);
+
+    RemoveEntryList(&FontEntry->ListEntry);
+    RemoveEntryList(&FontEntry->BucketEntry);
+    FontCacheSize -= FontEntry->Size;
+    FontCacheNumEntries--;
+
+    FT_Done_Glyph((FT_Glyph)FontEntry->BitmapGlyph);
+    ExFreePoolWithTag(FontEntry, GDITAG_FONTCACHE);
+}
+
+/* Called by FreeType when the face the cache hangs off is destroyed */
+static
+void
+ftGdiGlyphCacheFreeFace(
+    void *Object)
+{
+    FT_Face Face = Object;
+    PFONT_CACHE_FACE CacheFace;
+    ULONG i;
+
+    ExEnterCriticalRegionAndAcquireResourceExclusive(&FontCacheLock);
+    CacheFace = Face->generic.data;
+    Face->generic.data = NULL;
+    if (CacheFace)
+    {
+        for (i = 0; i < FONT_CACHE_FACE_BUCKETS; i++)
+        {
+            while (!IsListEmpty(&CacheFace->Buckets[i]))
+            {
+                ftGdiGlyphCacheFreeEntry(CONTAINING_RECORD(CacheFace->Buckets[i].Flink,
+                                                           FONT_CACHE_ENTRY,
+                                                           BucketEntry));
+            }
+        }
+        ExFreePoolWithTag(CacheFace, GDITAG_FONTCACHE);
+    }
+    ExReleaseResourceAndLeaveCriticalRegion(&FontCacheLock);
+}
+
+/* Evicts glyphs until the cache fits the budget. The cache lock must be
+   held exclusive */
+static
+VOID
+ftGdiGlyphCacheTrim(
+    ULONG Budget)
+{
     PFONT_CACHE_ENTRY FontEntry;
+    ULONG Scanned, Count = FontCacheNumEntries;
 
-    CurrentEntry = FontCacheListHead.Flink;
-    while (CurrentEntry != &FontCacheListHead)
+    /* Glyphs in use or looked up since the last sweep get another round */
+    for (Scanned = 0; FontCacheSize > Budget && Scanned < 2 * Count; Scanned++)
     {
-        FontEntry = (PFONT_CACHE_ENTRY)CurrentEntry;
-        if (FontEntry->Face == Face &&
-                FontEntry->GlyphIndex == GlyphIndex &&
-                FontEntry->Height == Height)
-            break;
-        CurrentEntry = CurrentEntry->Flink;
+        FontEntry = CONTAINING_RECORD(FontCacheListHead.Blink,
+                                      FONT_CACHE_ENTRY,
+                                      ListEntry);
+        if (FontEntry->RefCount || FontEntry->Referenced)
+        {
+            FontEntry->Referenced = FALSE;
+            RemoveEntryList(&FontEntry->ListEntry);
+            InsertHeadList(&FontCacheListHead, &FontEntry->ListEntry);
+            continue;
+        }
+
+        ftGdiGlyphCacheFreeEntry(FontEntry);
     }
 
-    if (CurrentEntry == &FontCacheListHead)
+    DPRINT("Font cache: %lu glyphs, %lu bytes, %ld hits, %ld misses\n",
+           FontCacheNumEntries, FontCacheSize, FontCacheHits, FontCacheMisses);
+}
+
+static
+PFONT_CACHE_ENTRY
+ftGdiGlyphCacheLookup(
+    PFONT_CACHE_FACE CacheFace,
+    INT GlyphIndex,
+    INT Width,
+    INT Height,
+    FT_Render_Mode RenderMode)
+{
+    PLIST_ENTRY ListHead, CurrentEntry;
+    PFONT_CACHE_ENTRY FontEntry;
+
+    ListHead = &CacheFace->Buckets[ftGdiGlyphCacheHash(GlyphIndex, Width, Height)];
+    for (CurrentEntry = ListHead->Flink;
+         CurrentEntry != ListHead;
+         CurrentEntry = CurrentEntry->Flink)
     {
-        return NULL;
+        FontEntry = CONTAINING_RECORD(CurrentEntry, FONT_CACHE_ENTRY, BucketEntry);
+        if (FontEntry->GlyphIndex == GlyphIndex &&
+                FontEntry->Width == Width &&
+                FontEntry->Height == Height &&
+                FontEntry->RenderMode == RenderMode)
+            return FontEntry;
     }
 
-    RemoveEntryList(CurrentEntry);
-    InsertHeadList(&FontCacheListHead, CurrentEntry);
-    return FontEntry->BitmapGlyph;
+    return NULL;
 }
 
-FT_BitmapGlyph APIENTRY
+/*
+ * Looks up a rendered glyph. The entry returned is referenced and stays
+ * valid until it is passed to ftGdiGlyphCacheRelease; neither needs the
+ * FreeType lock.
+ */
+PFONT_CACHE_ENTRY APIENTRY
+ftGdiGlyphCacheGet(
+    FT_Face Face,
+    INT GlyphIndex,
+    INT Width,
+    INT Height,
+    FT_Render_Mode RenderMode)
+{
+    PFONT_CACHE_FACE CacheFace;
+    PFONT_CACHE_ENTRY FontEntry = NULL;
+
+    ExEnterCriticalRegionAndAcquireResourceShared(&FontCacheLock);
+    CacheFace = Face->generic.data;
+    if (CacheFace)
+    {
+        FontEntry = ftGdiGlyphCacheLookup(CacheFace, GlyphIndex, Width, Height, RenderMode);
+        if (FontEntry)
+        {
+            InterlockedIncrement(&FontEntry->RefCount);
+            if (!FontEntry->Referenced)
+                FontEntry->Referenced = TRUE;
+        }
+    }
+    ExReleaseResourceAndLeaveCriticalRegion(&FontCacheLock);
+
+    InterlockedIncrement(FontEntry ? &FontCacheHits : &FontCacheMisses);
+    return FontEntry;
+}
+
+/*
+ * Renders the glyph loaded into GlyphSlot and caches it. Must be called
+ * with the FreeType lock held, returns a referenced entry like
+ * ftGdiGlyphCacheGet.
+ */
+PFONT_CACHE_ENTRY APIENTRY
 ftGdiGlyphCacheSet(
     FT_Face Face,
     INT GlyphIndex,
+    INT Width,
     INT Height,
     FT_GlyphSlot GlyphSlot,
     FT_Render_Mode RenderMode)
 {
     FT_Glyph GlyphCopy;
     INT error;
-    PFONT_CACHE_ENTRY NewEntry;
+    ULONG i;
+    PFONT_CACHE_ENTRY NewEntry, FontEntry;
+    PFONT_CACHE_FACE CacheFace;
     FT_Bitmap AlignedBitmap;
     FT_BitmapGlyph BitmapGlyph;
 
@@ -1390,14 +1551,6 @@ ftGdiGlyphCacheSet(
         return NULL;
     };
 
-    NewEntry = ExAllocatePoolWithTag(PagedPool, sizeof(FONT_CACHE_ENTRY), TAG_FONT);
-    if (!NewEntry)
-    {
-        DPRINT1("Alloc failure caching glyph.\n");
-        FT_Done_Glyph(GlyphCopy);
-        return NULL;
-    }
-
     BitmapGlyph = (FT_BitmapGlyph)GlyphCopy;
     FT_Bitmap_New(&AlignedBitmap);
     if(FT_Bitmap_Convert(GlyphSlot->library, &BitmapGlyph->bitmap, &AlignedBitmap, 4))
@@ -1410,22 +1563,143 @@ ftGdiGlyphCacheSet(
     FT_Bitmap_Done(GlyphSlot->library, &BitmapGlyph->bitmap);
     BitmapGlyph->bitmap = AlignedBitmap;
 
+    NewEntry = ExAllocatePoolWithTag(PagedPool, sizeof(FONT_CACHE_ENTRY), GDITAG_FONTCACHE);
+    if (!NewEntry)
+    {
+        DPRINT1("Alloc failure caching glyph.\n");
+        FT_Done_Glyph((FT_Glyph)BitmapGlyph);
+        return NULL;
+    }
+
+    NewEntry->RefCount = 1;
+    NewEntry->Referenced = FALSE;
     NewEntry->GlyphIndex = GlyphIndex;
     NewEntry->Face = Face;
     NewEntry->BitmapGlyph = BitmapGlyph;
+    NewEntry->Width = Width;
     NewEntry->Height = Height;
+    NewEntry->RenderMode = RenderMode;
+    NewEntry->Size = sizeof(FONT_CACHE_ENTRY) +
+                     abs(BitmapGlyph->bitmap.pitch) * BitmapGlyph->bitmap.rows;
+
+    ExEnterCriticalRegionAndAcquireResourceExclusive(&FontCacheLock);
+
+    /* The first glyph of a face sets up its buckets */
+    CacheFace = Face->generic.data;
+    if (!CacheFace)
+    {
+        CacheFace = ExAllocatePoolWithTag(PagedPool, sizeof(FONT_CACHE_FACE), GDITAG_FONTCACHE);
+        if (!CacheFace)
+        {
+            ExReleaseResourceAndLeaveCriticalRegion(&FontCacheLock);
+            DPRINT1("Alloc failure caching glyph.\n");
+            FT_Done_Glyph((FT_Glyph)BitmapGlyph);
+            ExFreePoolWithTag(NewEntry, GDITAG_FONTCACHE);
+            return NULL;
+        }
+
+        for (i = 0; i < FONT_CACHE_FACE_BUCKETS; i++)
+            InitializeListHead(&CacheFace->Buckets[i]);
+        Face->generic.data = CacheFace;
+        Face->generic.finalizer = ftGdiGlyphCacheFreeFace;
+    }
+
+    /* Someone who looked it up without the FreeType lock may have beaten us */
+    FontEntry = ftGdiGlyphCacheLookup(CacheFace, GlyphIndex, Width, Height, RenderMode);
+    if (FontEntry)
+    {
+        InterlockedIncrement(&FontEntry->RefCount);
+        ExReleaseResourceAndLeaveCriticalRegion(&FontCacheLock);
+        FT_Done_Glyph((FT_Glyph)BitmapGlyph);
+        ExFreePoolWithTag(NewEntry, GDITAG_FONTCACHE);
+        return FontEntry;
+    }
 
+    InsertHeadList(&CacheFace->Buckets[ftGdiGlyphCacheHash(GlyphIndex, Width, Height)],
+                   &NewEntry->BucketEntry);
     InsertHeadList(&FontCacheListHead, &NewEntry->ListEntry);
-    if (FontCacheNumEntries++ > MAX_FONT_CACHE)
+    FontCacheSize += NewEntry->Size;
+    FontCacheNumEntries++;
+
+    if (FontCacheSize > FONT_CACHE_BUDGET)
+        ftGdiGlyphCacheTrim(FONT_CACHE_BUDGET);
+
+    ExReleaseResourceAndLeaveCriticalRegion(&FontCacheLock);
+    return NewEntry;
+}
+
+VOID APIENTRY
+ftGdiGlyphCacheRelease(
+    PFONT_CACHE_ENTRY FontEntry)
+{
+    /* The glyph stays cached, it can just be evicted again */
+    InterlockedDecrement(&FontEntry->RefCount);
+}
+
+/*
+ * Looks up a rendered glyph and renders it on a miss. Only a miss takes
+ * the FreeType lock, and since other threads may have sized the face
+ * differently in the meantime, it is sized again under the lock.
+ */
+static
+PFONT_CACHE_ENTRY
+ftGdiGlyphCacheGetOrRender(
+    FT_Face Face,
+    INT GlyphIndex,
+    INT Width,
+    INT Height,
+    INT PixelHeight,
+    FT_Render_Mode RenderMode)
+{
+    PFONT_CACHE_ENTRY CacheEntry;
+    INT error;
+
+    CacheEntry = ftGdiGlyphCacheGet(Face, GlyphIndex, Width, Height, RenderMode);
+    if (CacheEntry)
+        return CacheEntry;
+
+    IntLockFreeType;
+    error = FT_Set_Pixel_Sizes(Face, Width, PixelHeight);
+    if (!error)
+        error = FT_Load_Glyph(Face, GlyphIndex, FT_LOAD_DEFAULT);
+    if (error)
     {
-        NewEntry = (PFONT_CACHE_ENTRY)FontCacheListHead.Blink;
-        FT_Done_Glyph((FT_Glyph)NewEntry->BitmapGlyph);
-        RemoveTailList(&FontCacheListHead);
-        ExFreePool(NewEntry);
-        FontCacheNumEntries--;
+        IntUnLockFreeType;
+        DPRINT1("WARNING: Failed to load and render glyph! [index: %u]\n", GlyphIndex);
+        return NULL;
     }
 
-    return BitmapGlyph;
+    CacheEntry = ftGdiGlyphCacheSet(Face, GlyphIndex, Width, Height, Face->glyph, RenderMode);
+    IntUnLockFreeType;
+
+    if (!CacheEntry)
+        DPRINT1("Failed to render glyph! [index: %u]\n", GlyphIndex);
+    return CacheEntry;
+}
+
+/*
+ * FT_Get_Kerning with FT_KERNING_DEFAULT, except that it scales with the
+ * metrics the caller sized the face to rather than the face's current
+ * size, so it does not need the FreeType lock.
+ */
+static
+FT_Pos
+ftGdiGetKerning(
+    FT_Face Face,
+    FT_UInt LeftGlyph,
+    FT_UInt RightGlyph,
+    FT_Size_Metrics *Metrics)
+{
+    FT_Vector delta;
+
+    if (FT_Get_Kerning(Face, LeftGlyph, RightGlyph, FT_KERNING_UNSCALED, &delta))
+        return 0;
+
+    delta.x = FT_MulFix(delta.x, Metrics->x_scale);
+    if (Metrics->x_ppem < 25)
+        delta.x = FT_MulDiv(delta.x, Metrics->x_ppem, 25);
+
+    return (delta.x + 32) & -64;
 }
 
 
@@ -2110,13 +2384,14 @@ TextIntGetTextExtentPoint(PDC dc,
 {
     PFONTGDI FontGDI;
     FT_Face face;
-    FT_GlyphSlot glyph;
     FT_BitmapGlyph realglyph;
-    INT error, n, glyph_index, i, previous;
+    PFONT_CACHE_ENTRY CacheEntry;
+    INT error, n, glyph_index, i, previous, PixelHeight;
     ULONGLONG TotalWidth = 0;
     FT_CharMap charmap, found = NULL;
     BOOL use_kerning;
     FT_Render_Mode RenderMode;
+    FT_Size_Metrics Metrics;
     BOOLEAN Render;
 
     FontGDI = ObjToGDI(TextObj->Font, FONT);
@@ -2162,16 +2437,22 @@ TextIntGetTextExtentPoint(PDC dc,
     else
         RenderMode = FT_RENDER_MODE_MONO;
 
+    /* FIXME should set character height if neg */
+    PixelHeight = (TextObj->logfont.elfEnumLogfontEx.elfLogFont.lfHeight == 0 ?
+                   dc->ppdev->devinfo.lfDefaultFont.lfHeight :
+                   abs(TextObj->logfont.elfEnumLogfontEx.elfLogFont.lfHeight));
     error = FT_Set_Pixel_Sizes(face,
                                TextObj->logfont.elfEnumLogfontEx.elfLogFont.lfWidth,
-                               /* FIXME should set character height if neg */
-                               (TextObj->logfont.elfEnumLogfontEx.elfLogFont.lfHeight == 0 ?
-							   dc->ppdev->devinfo.lfDefaultFont.lfHeight : abs(TextObj->logfont.elfEnumLogfontEx.elfLogFont.lfHeight)));
+                               PixelHeight);
     if (error)
     {
         DPRINT1("Error in setting pixel sizes: %u\n", error);
     }
 
+    /* Glyphs come from the cache, FreeType is only needed to render misses */
+    Metrics = face->size->metrics;
+    IntUnLockFreeType;
+
     use_kerning = FT_HAS_KERNING(face);
     previous = 0;
 
@@ -2182,35 +2463,22 @@ TextIntGetTextExtentPoint(PDC dc,
         else
             glyph_index = FT_Get_Char_Index(face, *String);
 
-        if (!(realglyph = ftGdiGlyphCacheGet(face, glyph_index,
-                                             TextObj->logfont.elfEnumLogfontEx.elfLogFont.lfHeight)))
-        {
-            error = FT_Load_Glyph(face, glyph_index, FT_LOAD_DEFAULT);
-            if (error)
-            {
-                DPRINT1("WARNING: Failed to load and render glyph! [index: %u]\n", glyph_index);
-                break;
-            }
-
-            glyph = face->glyph;
-            realglyph = ftGdiGlyphCacheSet(face, glyph_index,
-                                           TextObj->logfont.elfEnumLogfontEx.elfLogFont.lfHeight, glyph, RenderMode);
-            if (!realglyph)
-            {
-                DPRINT1("Failed to render glyph! [index: %u]\n", glyph_index);
-                break;
-            }
-        }
+        CacheEntry = ftGdiGlyphCacheGetOrRender(face, glyph_index,
+                                                TextObj->logfont.elfEnumLogfontEx.elfLogFont.lfWidth,
+                                                TextObj->logfont.elfEnumLogfontEx.elfLogFont.lfHeight,
+                                                PixelHeight, RenderMode);
+        if (!CacheEntry)
+            break;
+        realglyph = CacheEntry->BitmapGlyph;
 
         /* retrieve kerning distance */
         if (use_kerning && previous && glyph_index)
         {
-            FT_Vector delta;
-            FT_Get_Kerning(face, previous, glyph_index, 0, &delta);
-            TotalWidth += delta.x;
+            TotalWidth += ftGdiGetKerning(face, previous, glyph_index, &Metrics);
         }
 
         TotalWidth += realglyph->root.advance.x >> 10;
+        ftGdiGlyphCacheRelease(CacheEntry);
 
         if (((TotalWidth + 32) >> 6) <= MaxExtent && NULL != Fit)
         {
@@ -2224,7 +2492,6 @@ TextIntGetTextExtentPoint(PDC dc,
         previous = glyph_index;
         String++;
     }
-    IntUnLockFreeType;
 
     Size->cx = (TotalWidth + 32) >> 6;
     Size->cy = (TextObj->logfont.elfEnumLogfontEx.elfLogFont.lfHeight == 0 ?
@@ -3103,6 +3370,97 @@ NtGdiGetFontFamilyInfo(HDC Dc,
     return Count;
 }
 
+/* Merges the coverage of a glyph into the mask of its glyph run */
+static
+VOID
+IntComposeGlyph(
+    PBYTE MaskBits,
+    LONG MaskPitch,
+    PRECTL RunRect,
+    FT_BitmapGlyph BitmapGlyph,
+    PRECTL GlyphRect)
+{
+    PBYTE Source, Dest;
+    LONG x, y, Width, Height;
+
+    Width = GlyphRect->right - GlyphRect->left;
+    Height = GlyphRect->bottom - GlyphRect->top;
+    if (Width <= 0 || Height <= 0)
+        return;
+
+    Source = BitmapGlyph->bitmap.buffer;
+    Dest = MaskBits + (GlyphRect->top - RunRect->top) * MaskPitch +
+           (GlyphRect->left - RunRect->left);
+    for (y = 0; y < Height; y++)
+    {
+        /* Glyphs may overlap, keep the higher coverage */
+        for (x = 0; x < Width; x++)
+        {
+            if (Source[x] > Dest[x])
+                Dest[x] = Source[x];
+        }
+        Source += BitmapGlyph->bitmap.pitch;
+        Dest += MaskPitch;
+    }
+}
+
+/* Paints a single glyph, for when there is no memory for a run mask */
+static
+BOOL
+IntDrawGlyph(
+    PDC dc,
+    SURFOBJ *SurfObj,
+    XLATEOBJ *XlateRGB2Dst,
+    XLATEOBJ *XlateDst2RGB,
+    FT_BitmapGlyph BitmapGlyph,
+    PRECTL GlyphRect,
+    PPOINTL BrushOrigin)
+{
+    HBITMAP HSourceGlyph;
+    SURFOBJ *SourceGlyphSurf;
+    SIZEL bitSize;
+    POINTL MaskOrigin = {0, 0};
+    RECTL DestRect = *GlyphRect;
+
+    if (DestRect.left >= DestRect.right || DestRect.top >= DestRect.bottom)
+        return TRUE;
+
+    bitSize.cx = BitmapGlyph->bitmap.width;
+    bitSize.cy = BitmapGlyph->bitmap.rows;
+    HSourceGlyph = EngCreateBitmap(bitSize, BitmapGlyph->bitmap.pitch,
+                                   BMF_8BPP, BMF_TOPDOWN,
+                                   BitmapGlyph->bitmap.buffer);
+    if ( !HSourceGlyph )
+    {
+        DPRINT1("WARNING: EngCreateBitmap() failed!\n");
+        return FALSE;
+    }
+    SourceGlyphSurf = EngLockSurface((HSURF)HSourceGlyph);
+    if ( !SourceGlyphSurf )
+    {
+        EngDeleteSurface((HSURF)HSourceGlyph);
+        DPRINT1("WARNING: EngLockSurface() failed!\n");
+        return FALSE;
+    }
+
+    MouseSafetyOnDrawStart(dc->ppdev, DestRect.left, DestRect.top, DestRect.right, DestRect.bottom);
+    IntEngMaskBlt(
+        SurfObj,
+        SourceGlyphSurf,
+        dc->rosdc.CombinedClip,
+        XlateRGB2Dst,
+        XlateDst2RGB,
+        &DestRect,
+        &MaskOrigin,
+        &dc->eboText.BrushObject,
+        BrushOrigin);
+    MouseSafetyOnDrawEnd(dc->ppdev) ;
+
+    EngUnlockSurface(SourceGlyphSurf);
+    EngDeleteSurface((HSURF)HSourceGlyph);
+    return TRUE;
+}
+
 BOOL
 APIENTRY
 GreExtTextOutW(
@@ -3126,10 +3484,11 @@ GreExtTextOutW(
     PDC_ATTR pdcattr;
     SURFOBJ *SurfObj;
     SURFACE *psurf = NULL;
-    int error, glyph_index, n, i;
+    int error, glyph_index, n, i, PixelHeight;
     FT_Face face;
-    FT_GlyphSlot glyph;
     FT_BitmapGlyph realglyph;
+    PFONT_CACHE_ENTRY CacheEntry;
+    FT_Size_Metrics Metrics;
     LONGLONG TextLeft, RealXStart;
     ULONG TextTop, previous, BackgroundLeft;
     FT_Bool use_kerning;
@@ -3149,6 +3508,12 @@ GreExtTextOutW(
     POINT Start;
     BOOL DoBreak = FALSE;
     USHORT DxShift;
+    GLYPH_RUN_ENTRY RunBuffer[GLYPH_RUN_STACK_SIZE];
+    PGLYPH_RUN_ENTRY Run = RunBuffer;
+    INT RunCount = 0;
+    RECTL RunRect;
+    PBYTE MaskBits;
+    LONG MaskPitch;
 
     // TODO: Write test-cases to exactly match real Windows in different
     // bad parameters (e.g. does Windows check the DC or the RECT first?).
@@ -3299,12 +3664,14 @@ GreExtTextOutW(
     else
         RenderMode = FT_RENDER_MODE_MONO;
 
+    /* FIXME should set character height if neg */
+    PixelHeight = (TextObj->logfont.elfEnumLogfontEx.elfLogFont.lfHeight == 0 ?
+                   dc->ppdev->devinfo.lfDefaultFont.lfHeight :
+                   abs(TextObj->logfont.elfEnumLogfontEx.elfLogFont.lfHeight));
     error = FT_Set_Pixel_Sizes(
                 face,
                 TextObj->logfont.elfEnumLogfontEx.elfLogFont.lfWidth,
-                /* FIXME should set character height if neg */
-                (TextObj->logfont.elfEnumLogfontEx.elfLogFont.lfHeight == 0 ?
-                dc->ppdev->devinfo.lfDefaultFont.lfHeight : abs(TextObj->logfont.elfEnumLogfontEx.elfLogFont.lfHeight)));
+                PixelHeight);
     if (error)
     {
         DPRINT1("Error in setting pixel sizes: %u\n", error);
@@ -3312,6 +3679,10 @@ GreExtTextOutW(
         goto fail;
     }
 
+    /* Glyphs come from the cache, FreeType is only needed to render misses */
+    Metrics = face->size->metrics;
+    IntUnLockFreeType;
+
     /*
      * Process the vertical alignment and determine the yoff.
      */
@@ -3319,9 +3690,9 @@ GreExtTextOutW(
     if (pdcattr->lTextAlign & TA_BASELINE)
         yoff = 0;
     else if (pdcattr->lTextAlign & TA_BOTTOM)
-        yoff = -face->size->metrics.descender >> 6;
+        yoff = -Metrics.descender >> 6;
     else /* TA_TOP */
-        yoff = face->size->metrics.ascender >> 6;
+        yoff = Metrics.ascender >> 6;
 
     use_kerning = FT_HAS_KERNING(face);
     previous = 0;
@@ -3358,35 +3729,23 @@ GreExtTextOutW(
             else
                 glyph_index = FT_Get_Char_Index(face, *TempText);
 
-            if (!(realglyph = ftGdiGlyphCacheGet(face, glyph_index,
-                                                 TextObj->logfont.elfEnumLogfontEx.elfLogFont.lfHeight)))
+            CacheEntry = ftGdiGlyphCacheGetOrRender(face, glyph_index,
+                                                    TextObj->logfont.elfEnumLogfontEx.elfLogFont.lfWidth,
+                                                    TextObj->logfont.elfEnumLogfontEx.elfLogFont.lfHeight,
+                                                    PixelHeight, RenderMode);
+            if (!CacheEntry)
             {
-                error = FT_Load_Glyph(face, glyph_index, FT_LOAD_DEFAULT);
-                if (error)
-                {
-                    DPRINT1("WARNING: Failed to load and render glyph! [index: %u]\n", glyph_index);
-                }
-
-                glyph = face->glyph;
-                realglyph = ftGdiGlyphCacheSet(face, glyph_index,
-                                               TextObj->logfont.elfEnumLogfontEx.elfLogFont.lfHeight, glyph, RenderMode);
-                if (!realglyph)
-                {
-                    DPRINT1("Failed to render glyph! [index: %u]\n", glyph_index);
-                    IntUnLockFreeType;
-                    goto fail;
-                }
-
+                goto fail;
             }
+            realglyph = CacheEntry->BitmapGlyph;
             /* retrieve kerning distance */
             if (use_kerning && previous && glyph_index)
             {
-                FT_Vector delta;
-                FT_Get_Kerning(face, previous, glyph_index, 0, &delta);
-                TextWidth += delta.x;
+                TextWidth += ftGdiGetKerning(face, previous, glyph_index, &Metrics);
             }
 
             TextWidth += realglyph->root.advance.x >> 10;
+            ftGdiGlyphCacheRelease(CacheEntry);
 
             previous = glyph_index;
             TempText++;
@@ -3424,8 +3783,21 @@ GreExtTextOutW(
         DC_vUpdateTextBrush(dc) ;
 
     /*
-     * The main rendering loop.
+     * The main rendering loop. The glyphs are laid out first, then their
+     * coverage is composed into one mask for the whole run and blitted at
+     * once.
      */
+    if (Count > GLYPH_RUN_STACK_SIZE)
+    {
+        Run = ExAllocatePoolWithTag(PagedPool, Count * sizeof(GLYPH_RUN_ENTRY), GDITAG_TEXT);
+        if (!Run)
+        {
+            goto fail2;
+        }
+    }
+    RunRect.left = RunRect.top = MAXLONG;
+    RunRect.right = RunRect.bottom = MINLONG;
+
     for (i = 0; i < Count; i++)
     {
         if (fuOptions & ETO_GLYPH_INDEX)
@@ -3433,36 +3805,23 @@ GreExtTextOutW(
         else
             glyph_index = FT_Get_Char_Index(face, *String);
 
-        if (!(realglyph = ftGdiGlyphCacheGet(face, glyph_index,
-                                             TextObj->logfont.elfEnumLogfontEx.elfLogFont.lfHeight)))
+        CacheEntry = ftGdiGlyphCacheGetOrRender(face,
+                                                glyph_index,
+                                                TextObj->logfont.elfEnumLogfontEx.elfLogFont.lfWidth,
+                                                TextObj->logfont.elfEnumLogfontEx.elfLogFont.lfHeight,
+                                                PixelHeight,
+                                                RenderMode);
+        if (!CacheEntry)
         {
-            error = FT_Load_Glyph(face, glyph_index, FT_LOAD_DEFAULT);
-            if (error)
-            {
-                DPRINT1("Failed to load and render glyph! [index: %u]\n", glyph_index);
-                IntUnLockFreeType;
-                goto fail2;
-            }
-            glyph = face->glyph;
-            realglyph = ftGdiGlyphCacheSet(face,
-                                           glyph_index,
-                                           TextObj->logfont.elfEnumLogfontEx.elfLogFont.lfHeight,
-                                           glyph,
-                                           RenderMode);
-            if (!realglyph)
-            {
-                DPRINT1("Failed to render glyph! [index: %u]\n", glyph_index);
-                IntUnLockFreeType;
-                goto fail2;
-            }
+            goto fail3;
         }
+        realglyph = CacheEntry->BitmapGlyph;
+        Run[RunCount++].CacheEntry = CacheEntry;
 
         /* retrieve kerning distance and move pen position */
         if (use_kerning && previous && glyph_index && NULL == Dx)
         {
-            FT_Vector delta;
-            FT_Get_Kerning(face, previous, glyph_index, 0, &delta);
-            TextLeft += delta.x;
+            TextLeft += ftGdiGetKerning(face, previous, glyph_index, &Metrics);
         }
         DPRINT("TextLeft: %d\n", TextLeft);
         DPRINT("TextTop: %d\n", TextTop);
@@ -3472,8 +3831,77 @@ GreExtTextOutW(
         {
             DestRect.left = BackgroundLeft;
             DestRect.right = (TextLeft + (realglyph->root.advance.x >> 10) + 32) >> 6;
-            DestRect.top = TextTop + yoff - ((face->size->metrics.ascender + 32) >> 6);
-            DestRect.bottom = TextTop + yoff + ((32 - face->size->metrics.descender) >> 6);
+            DestRect.top = TextTop + yoff - ((Metrics.ascender + 32) >> 6);
+            DestRect.bottom = TextTop + yoff + ((32 - Metrics.descender) >> 6);
+            Run[RunCount - 1].BackRect = DestRect;
+            BackgroundLeft = DestRect.right;
+        }
+
+        DestRect.left = ((TextLeft + 32) >> 6) + realglyph->left;
+        DestRect.right = DestRect.left + realglyph->bitmap.width;
+        DestRect.top = TextTop + yoff - realglyph->top;
+        DestRect.bottom = DestRect.top + realglyph->bitmap.rows;
+
+        if (lprc &&
+                (fuOptions & ETO_CLIPPED) &&
+                DestRect.right >= lprc->right + dc->ptlDCOrig.x)
+        {
+            // We do the check '>=' instead of '>' to possibly save an iteration
+            // through this loop, since it's breaking after the drawing is done,
+            // and x is always incremented.
+            DestRect.right = lprc->right + dc->ptlDCOrig.x;
+            DoBreak = TRUE;
+        }
+
+        Run[RunCount - 1].GlyphRect = DestRect;
+        if (DestRect.left < DestRect.right && DestRect.top < DestRect.bottom)
+        {
+            RunRect.left = min(RunRect.left, DestRect.left);
+            RunRect.top = min(RunRect.top, DestRect.top);
+            RunRect.right = max(RunRect.right, DestRect.right);
+            RunRect.bottom = max(RunRect.bottom, DestRect.bottom);
+        }
+
+        if (DoBreak)
+        {
+            break;
+        }
+
+        if (NULL == Dx)
+        {
+            TextLeft += realglyph->root.advance.x >> 10;
+             DPRINT("new TextLeft: %d\n", TextLeft);
+        }
+        else
+        {
+            TextLeft += Dx[i<<DxShift] << 6;
+             DPRINT("new TextLeft2: %d\n", TextLeft);
+        }
+
+        if (DxShift)
+        {
+            TextTop -= Dx[2 * i + 1] << 6;
+        }
+
+        previous = glyph_index;
+
+        String++;
+    }
+
+    if (fuOptions & ETO_OPAQUE)
+    {
+        for (i = 0; i < RunCount; i++)
+        {
+            /* Fill adjacent backgrounds of the same height at once */
+            DestRect = Run[i].BackRect;
+            while (i + 1 < RunCount &&
+                   Run[i + 1].BackRect.left == DestRect.right &&
+                   Run[i + 1].BackRect.top == DestRect.top &&
+                   Run[i + 1].BackRect.bottom == DestRect.bottom)
+            {
+                DestRect.right = Run[++i].BackRect.right;
+            }
+
             MouseSafetyOnDrawStart(dc->ppdev, DestRect.left, DestRect.top, DestRect.right, DestRect.bottom);
             IntEngBitBlt(
                 &psurf->SurfObj,
@@ -3488,68 +3916,75 @@ GreExtTextOutW(
                 &BrushOrigin,
                 ROP4_FROM_INDEX(R3_OPINDEX_PATCOPY));
             MouseSafetyOnDrawEnd(dc->ppdev);
-            BackgroundLeft = DestRect.right;
-
         }
+    }
 
-        DestRect.left = ((TextLeft + 32) >> 6) + realglyph->left;
-        DestRect.right = DestRect.left + realglyph->bitmap.width;
-        DestRect.top = TextTop + yoff - realglyph->top;
-        DestRect.bottom = DestRect.top + realglyph->bitmap.rows;
+    if (RunRect.left < RunRect.right)
+    {
+        bitSize.cx = RunRect.right - RunRect.left;
+        bitSize.cy = RunRect.bottom - RunRect.top;
+        MaskPitch = (bitSize.cx + 3) & ~3;
 
-        bitSize.cx = realglyph->bitmap.width;
-        bitSize.cy = realglyph->bitmap.rows;
-        MaskRect.right = realglyph->bitmap.width;
-        MaskRect.bottom = realglyph->bitmap.rows;
+        MaskBits = ExAllocatePoolWithTag(PagedPool, MaskPitch * bitSize.cy, GDITAG_TEXT);
+        if (!MaskBits)
+        {
+            /* Long runs can need a big mask, draw them glyph by glyph then */
+            DPRINT1("WARNING: Failed to allocate the glyph run mask!\n");
+            for (i = 0; i < RunCount; i++)
+            {
+                if (!IntDrawGlyph(dc,
+                                  SurfObj,
+                                  &exloRGB2Dst.xlo,
+                                  &exloDst2RGB.xlo,
+                                  Run[i].CacheEntry->BitmapGlyph,
+                                  &Run[i].GlyphRect,
+                                  &BrushOrigin))
+                {
+                    goto fail3;
+                }
+            }
+            goto done;
+        }
+        RtlZeroMemory(MaskBits, MaskPitch * bitSize.cy);
 
-        /*
-         * We should create the bitmap out of the loop at the biggest possible
-         * glyph size. Then use memset with 0 to clear it and sourcerect to
-         * limit the work of the transbitblt.
-         */
+        for (i = 0; i < RunCount; i++)
+        {
+            IntComposeGlyph(MaskBits,
+                            MaskPitch,
+                            &RunRect,
+                            Run[i].CacheEntry->BitmapGlyph,
+                            &Run[i].GlyphRect);
+        }
 
-        HSourceGlyph = EngCreateBitmap(bitSize, realglyph->bitmap.pitch,
+        HSourceGlyph = EngCreateBitmap(bitSize, MaskPitch,
                                        BMF_8BPP, BMF_TOPDOWN,
-                                       realglyph->bitmap.buffer);
+                                       MaskBits);
         if ( !HSourceGlyph )
         {
-            DPRINT1("WARNING: EngLockSurface() failed!\n");
-            // FT_Done_Glyph(realglyph);
-            IntUnLockFreeType;
-            goto fail2;
+            DPRINT1("WARNING: EngCreateBitmap() failed!\n");
+            ExFreePoolWithTag(MaskBits, GDITAG_TEXT);
+            goto fail3;
         }
         SourceGlyphSurf = EngLockSurface((HSURF)HSourceGlyph);
         if ( !SourceGlyphSurf )
         {
             EngDeleteSurface((HSURF)HSourceGlyph);
+            ExFreePoolWithTag(MaskBits, GDITAG_TEXT);
             DPRINT1("WARNING: EngLockSurface() failed!\n");
-            IntUnLockFreeType;
-            goto fail2;
+            goto fail3;
         }
 
         /*
-         * Use the font data as a mask to paint onto the DCs surface using a
-         * brush.
+         * Use the run mask to paint onto the DCs surface using a brush.
          */
-
-        if (lprc &&
-                (fuOptions & ETO_CLIPPED) &&
-                DestRect.right >= lprc->right + dc->ptlDCOrig.x)
-        {
-            // We do the check '>=' instead of '>' to possibly save an iteration
-            // through this loop, since it's breaking after the drawing is done,
-            // and x is always incremented.
-            DestRect.right = lprc->right + dc->ptlDCOrig.x;
-            DoBreak = TRUE;
-        }
-        MouseSafetyOnDrawStart(dc->ppdev, DestRect.left, DestRect.top, DestRect.right, DestRect.bottom);
+        MouseSafetyOnDrawStart(dc->ppdev, RunRect.left, RunRect.top, RunRect.right, RunRect.bottom);
         IntEngMaskBlt(
             SurfObj,
             SourceGlyphSurf,
             dc->rosdc.CombinedClip,
             &exloRGB2Dst.xlo,
             &exloDst2RGB.xlo,
-            &DestRect,
+            &RunRect,
             (PPOINTL)&MaskRect,
             &dc->eboText.BrushObject,
             &BrushOrigin);
@@ -3557,33 +3992,14 @@ GreExtTextOutW(
 
         EngUnlockSurface(SourceGlyphSurf);
         EngDeleteSurface((HSURF)HSourceGlyph);
-
-        if (DoBreak)
-        {
-            break;
-        }
-
-        if (NULL == Dx)
-        {
-            TextLeft += realglyph->root.advance.x >> 10;
-             DPRINT("new TextLeft: %d\n", TextLeft);
-        }
-        else
-        {
-            TextLeft += Dx[i<<DxShift] << 6;
-             DPRINT("new TextLeft2: %d\n", TextLeft);
-        }
-
-        if (DxShift)
-        {
-            TextTop -= Dx[2 * i + 1] << 6;
-        }
-
-        previous = glyph_index;
-
-        String++;
+        ExFreePoolWithTag(MaskBits, GDITAG_TEXT);
     }
-    IntUnLockFreeType;
+
+done:
+    for (i = 0; i < RunCount; i++)
+        ftGdiGlyphCacheRelease(Run[i].CacheEntry);
+    if (Run != RunBuffer)
+        ExFreePoolWithTag(Run, GDITAG_TEXT);
 
     DC_vFinishBlit(dc, NULL) ;
     EXLATEOBJ_vCleanup(&exloRGB2Dst);
@@ -3595,7 +4011,13 @@ good:
 
     return TRUE;
 
+fail3:
+    for (i = 0; i < RunCount; i++)
+        ftGdiGlyphCacheRelease(Run[i].CacheEntry);
+    if (Run != RunBuffer)
+        ExFreePoolWithTag(Run, GDITAG_TEXT);
 fail2:
+    DC_vFinishBlit(dc, NULL);
     EXLATEOBJ_vCleanup(&exloRGB2Dst);
     EXLATEOBJ_vCleanup(&exloDst2RGB);
 fail:
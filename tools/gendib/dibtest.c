@@ -0,0 +1,344 @@
+/*
+ * PROJECT:         Odyssey DIB code generator
+ * LICENSE:         See COPYING in the top level directory
+ * FILE:            tools/gendib/dibtest.c
+ * PURPOSE:         Checks the SSE2 DIB row kernels against plain C
+ */
+
+/*
+ * Builds win32k's dib/dibsse2.c on the host and runs every row kernel over
+ * all lengths up to a few vectors and all source and destination
+ * misalignments within a vector, comparing the result byte for byte with
+ * a straightforward C loop. Guard bytes around the rows catch stores past
+ * either end. On hosts without SSE2 only the C tails get tested.
+ *
+ * Afterwards every kernel is timed over long rows against the per-pixel
+ * loop the DIB functions run when SSE2 is not available.
+ *
+ * Returns 0 if all kernels matched.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <typedefs.h>
+
+#if defined(__x86_64__) && defined(__SSE2__) && !defined(_M_AMD64)
+#define _M_AMD64
+#endif
+
+#define DIB_HOST_TEST
+#define PF_XMMI64_INSTRUCTIONS_AVAILABLE 10
+#define ExIsProcessorFeaturePresent(Feature) TRUE
+typedef unsigned char *PBYTE;
+
+#include "../../subsystems/win32/win32k/dib/dibsse2.c"
+
+#define MAX_BYTES 130 * 4
+#define MAX_MISALIGN 16
+#define GUARD 32
+#define BUFFER_SIZE (GUARD + MAX_MISALIGN + MAX_BYTES + GUARD)
+
+#define BENCH_PIXELS 1024
+#define BENCH_ROWS 100000
+
+static BYTE Dest[BUFFER_SIZE], Expected[BUFFER_SIZE], Source[BUFFER_SIZE];
+static ULONG BenchDest[BENCH_PIXELS], BenchSource[BENCH_PIXELS];
+static ULONG Seed = 1;
+static ULONG Errors;
+
+static ULONG
+Random(VOID)
+{
+  Seed = Seed * 1103515245 + 12345;
+  return Seed >> 8;
+}
+
+static VOID
+RandomFill(PBYTE Buffer, ULONG Bytes)
+{
+  while (Bytes--)
+  {
+    *Buffer++ = (BYTE)Random();
+  }
+}
+
+/* Makes about a third of the source pixels equal to the color key */
+static VOID
+SprinkleKey(PBYTE Buffer, ULONG Count, ULONG PixelSize, ULONG Key)
+{
+  ULONG i;
+
+  for (i = 0; i < Count; i++)
+  {
+    if (Random() % 3 == 0)
+    {
+      memcpy(Buffer + i * PixelSize, &Key, PixelSize);
+    }
+  }
+}
+
+static VOID
+Compare(const char *Kernel, ULONG Length, ULONG DestOffset, ULONG SourceOffset)
+{
+  if (memcmp(Dest, Expected, BUFFER_SIZE) != 0)
+  {
+    printf("%s: mismatch with length %u, dest offset %u, source offset %u\n",
+           Kernel, (unsigned)Length, (unsigned)DestOffset, (unsigned)SourceOffset);
+    Errors++;
+  }
+}
+
+static VOID
+TestFillRow(VOID)
+{
+  ULONG Bytes, Offset, Pattern, i;
+
+  for (Bytes = 0; Bytes <= MAX_BYTES; Bytes++)
+  {
+    for (Offset = 0; Offset < MAX_MISALIGN; Offset++)
+    {
+      Pattern = Random();
+      RandomFill(Dest, BUFFER_SIZE);
+      memcpy(Expected, Dest, BUFFER_SIZE);
+      for (i = 0; i < Bytes; i++)
+      {
+        Expected[GUARD + Offset + i] = (BYTE)(Pattern >> (8 * (i % 4)));
+      }
+
+      DIB_SSE2_FillRow(Dest + GUARD + Offset, Pattern, Bytes);
+      Compare("FillRow", Bytes, Offset, 0);
+    }
+  }
+}
+
+static VOID
+TestXorRow(VOID)
+{
+  ULONG Bytes, DestOffset, SourceOffset, i;
+
+  for (Bytes = 0; Bytes <= MAX_BYTES; Bytes++)
+  {
+    for (DestOffset = 0; DestOffset < MAX_MISALIGN; DestOffset++)
+    {
+      for (SourceOffset = 0; SourceOffset < MAX_MISALIGN; SourceOffset++)
+      {
+        RandomFill(Dest, BUFFER_SIZE);
+        RandomFill(Source, BUFFER_SIZE);
+        memcpy(Expected, Dest, BUFFER_SIZE);
+        for (i = 0; i < Bytes; i++)
+        {
+          Expected[GUARD + DestOffset + i] ^= Source[GUARD + SourceOffset + i];
+        }
+
+        DIB_SSE2_XorRow(Dest + GUARD + DestOffset,
+                        Source + GUARD + SourceOffset, Bytes);
+        Compare("XorRow", Bytes, DestOffset, SourceOffset);
+      }
+    }
+  }
+}
+
+static VOID
+TestTransparentRow(ULONG PixelSize, ULONG Key)
+{
+  const char *Kernel = PixelSize == 4 ? "TransparentRow32" : "TransparentRow16";
+  ULONG Count, DestOffset, SourceOffset, i;
+  PBYTE From, To;
+
+  for (Count = 0; Count <= MAX_BYTES / PixelSize; Count++)
+  {
+    for (DestOffset = 0; DestOffset < MAX_MISALIGN; DestOffset += PixelSize)
+    {
+      for (SourceOffset = 0; SourceOffset < MAX_MISALIGN; SourceOffset += PixelSize)
+      {
+        RandomFill(Dest, BUFFER_SIZE);
+        RandomFill(Source, BUFFER_SIZE);
+        SprinkleKey(Source + GUARD + SourceOffset, Count, PixelSize, Key);
+        memcpy(Expected, Dest, BUFFER_SIZE);
+        for (i = 0; i < Count; i++)
+        {
+          From = Source + GUARD + SourceOffset + i * PixelSize;
+          To = Expected + GUARD + DestOffset + i * PixelSize;
+          if (PixelSize == 4 ? *(PULONG)From != Key : *(PUSHORT)From != Key)
+          {
+            memcpy(To, From, PixelSize);
+          }
+        }
+
+        if (PixelSize == 4)
+        {
+          DIB_SSE2_TransparentRow32((PULONG)(Dest + GUARD + DestOffset),
+                                    (PULONG)(Source + GUARD + SourceOffset),
+                                    Count, Key);
+        }
+        else
+        {
+          DIB_SSE2_TransparentRow16((PUSHORT)(Dest + GUARD + DestOffset),
+                                    (PUSHORT)(Source + GUARD + SourceOffset),
+                                    Count, Key);
+        }
+        Compare(Kernel, Count, DestOffset, SourceOffset);
+      }
+    }
+  }
+}
+
+/* The per-pixel loops of the DIB functions the kernels replace */
+
+static VOID
+ScalarFillRow32(PULONG Dest, ULONG Color, ULONG Count)
+{
+  while (Count--)
+  {
+    *Dest++ = Color;
+  }
+}
+
+static VOID
+ScalarXorRow24(PBYTE Dest, PBYTE Source, ULONG Count)
+{
+  ULONG Pixel;
+
+  while (Count--)
+  {
+    Pixel = (Dest[0] | (Dest[1] << 8) | (Dest[2] << 16)) ^
+            (Source[0] | (Source[1] << 8) | (Source[2] << 16));
+    Dest[0] = (BYTE)Pixel;
+    Dest[1] = (BYTE)(Pixel >> 8);
+    Dest[2] = (BYTE)(Pixel >> 16);
+    Dest += 3;
+    Source += 3;
+  }
+}
+
+static VOID
+ScalarTransparentRow32(PULONG Dest, PULONG Source, ULONG Count, ULONG Key)
+{
+  while (Count--)
+  {
+    if (*Source != Key)
+    {
+      *Dest = *Source;
+    }
+    Dest++;
+    Source++;
+  }
+}
+
+static VOID
+ScalarTransparentRow16(PUSHORT Dest, PUSHORT Source, ULONG Count, ULONG Key)
+{
+  while (Count--)
+  {
+    if (*Source != Key)
+    {
+      *Dest = *Source;
+    }
+    Dest++;
+    Source++;
+  }
+}
+
+static VOID
+Report(const char *Name, clock_t Kernel, clock_t Scalar)
+{
+  printf("%-16s %6.0f ms, per-pixel C %6.0f ms\n", Name,
+         Kernel * 1000.0 / CLOCKS_PER_SEC, Scalar * 1000.0 / CLOCKS_PER_SEC);
+}
+
+static VOID
+RunBenchmark(VOID)
+{
+  clock_t Start, Kernel, Scalar;
+  ULONG i;
+
+  printf("%u rows of %u pixels:\n", (unsigned)BENCH_ROWS, (unsigned)BENCH_PIXELS);
+
+  Start = clock();
+  for (i = 0; i < BENCH_ROWS; i++)
+  {
+    DIB_SSE2_FillRow(BenchDest, i, sizeof(BenchDest));
+  }
+  Kernel = clock() - Start;
+  Start = clock();
+  for (i = 0; i < BENCH_ROWS; i++)
+  {
+    ScalarFillRow32(BenchDest, i, BENCH_PIXELS);
+  }
+  Scalar = clock() - Start;
+  Report("FillRow", Kernel, Scalar);
+
+  /* 24bpp rows, so the byte count is not a multiple of the vector size */
+  RandomFill((PBYTE)BenchSource, sizeof(BenchSource));
+  Start = clock();
+  for (i = 0; i < BENCH_ROWS; i++)
+  {
+    DIB_SSE2_XorRow(BenchDest, BenchSource, (sizeof(BenchDest) / 3) * 3);
+  }
+  Kernel = clock() - Start;
+  Start = clock();
+  for (i = 0; i < BENCH_ROWS; i++)
+  {
+    ScalarXorRow24((PBYTE)BenchDest, (PBYTE)BenchSource, sizeof(BenchDest) / 3);
+  }
+  Scalar = clock() - Start;
+  Report("XorRow", Kernel, Scalar);
+
+  SprinkleKey((PBYTE)BenchSource, BENCH_PIXELS, 4, 0x00FF00FF);
+  Start = clock();
+  for (i = 0; i < BENCH_ROWS; i++)
+  {
+    DIB_SSE2_TransparentRow32(BenchDest, BenchSource, BENCH_PIXELS, 0x00FF00FF);
+  }
+  Kernel = clock() - Start;
+  Start = clock();
+  for (i = 0; i < BENCH_ROWS; i++)
+  {
+    ScalarTransparentRow32(BenchDest, BenchSource, BENCH_PIXELS, 0x00FF00FF);
+  }
+  Scalar = clock() - Start;
+  Report("TransparentRow32", Kernel, Scalar);
+
+  RandomFill((PBYTE)BenchSource, sizeof(BenchSource));
+  SprinkleKey((PBYTE)BenchSource, BENCH_PIXELS * 2, 2, 0xF81F);
+  Start = clock();
+  for (i = 0; i < BENCH_ROWS; i++)
+  {
+    DIB_SSE2_TransparentRow16((PUSHORT)BenchDest, (PUSHORT)BenchSource,
+                              BENCH_PIXELS * 2, 0xF81F);
+  }
+  Kernel = clock() - Start;
+  Start = clock();
+  for (i = 0; i < BENCH_ROWS; i++)
+  {
+    ScalarTransparentRow16((PUSHORT)BenchDest, (PUSHORT)BenchSource,
+                           BENCH_PIXELS * 2, 0xF81F);
+  }
+  Scalar = clock() - Start;
+  Report("TransparentRow16", Kernel, Scalar);
+}
+
+int main(int argc, char *argv[])
+{
+  DIB_SSE2_Initialize();
+  printf("testing the %s row kernels\n", DibSse2Enabled ? "SSE2" : "C");
+
+  TestFillRow();
+  TestXorRow();
+  TestTransparentRow(4, 0x00FF00FF);
+  TestTransparentRow(4, 0);
+  TestTransparentRow(2, 0xF81F);
+  TestTransparentRow(2, 0);
+  /* Keys wider than a 16bpp pixel never match, the kernel must copy all */
+  TestTransparentRow(2, 0x1F81F);
+
+  if (!Errors)
+  {
+    RunBenchmark();
+  }
+
+  printf("%s\n", Errors ? "FAILED" : "passed");
+  return Errors ? 1 : 0;
+}
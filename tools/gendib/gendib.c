@@ -513,6 +513,10 @@ CreateBitCase(FILE *Out, unsigned Bpp, PROPINFO RopInfo, int Flags,
               unsigned SourceBpp)
 {
   unsigned Partial;
+  int XorRows;
+
+  XorRows = (ROPCODE_SRCINVERT == RopInfo->RopCode &&
+             0 != (Flags & FLAG_TRIVIALXLATE) && Bpp == SourceBpp);
 
   MARK(Out);
   if (RopInfo->UsesSource)
@@ -553,6 +557,26 @@ CreateBitCase(FILE *Out, unsigned Bpp, PROPINFO RopInfo, int Flags,
 
   Output(Out, "for (LineIndex = 0; LineIndex < LineCount; LineIndex++)\n");
   Output(Out, "{\n");
+  if (XorRows)
+    {
+      /* Rows that do not alias can be xored bytewise, whatever the bpp */
+      Output(Out, "if (DibSse2Enabled &&\n");
+      Output(Out, "    (BltInfo->SourceSurface != BltInfo->DestSurface ||\n");
+      Output(Out, "     BltInfo->DestRect.top != BltInfo->SourcePoint.y))\n");
+      Output(Out, "{\n");
+      Output(Out, "DIB_SSE2_XorRow(DestBase, SourceBase");
+      if (Bpp <= 16)
+        {
+          Output(Out, " +\n");
+          Output(Out, "                (BltInfo->SourcePoint.x * %u & 0x3)", Bpp / 8);
+        }
+      Output(Out, ",\n");
+      Output(Out, "                %u * (BltInfo->DestRect.right -\n", Bpp / 8);
+      Output(Out, "                     BltInfo->DestRect.left));\n");
+      Output(Out, "}\n");
+      Output(Out, "else\n");
+      Output(Out, "{\n");
+    }
   if (ROPCODE_SRCCOPY != RopInfo->RopCode ||
       0 == (Flags & FLAG_TRIVIALXLATE) || Bpp != SourceBpp)
     {
@@ -672,6 +696,10 @@ CreateBitCase(FILE *Out, unsigned Bpp, PROPINFO RopInfo, int Flags,
             }
         }
     }
+  if (XorRows)
+    {
+      Output(Out, "}\n");
+    }
   if (RopInfo->UsesSource && 0 == (Flags & FLAG_FORCENOUSESSOURCE))
     {
       Output(Out, "SourceBase %c= BltInfo->SourceSurface->lDelta;\n",
@@ -925,8 +953,17 @@ CreatePrimitive(FILE *Out, unsigned Bpp, PROPINFO RopInfo)
             {
               Output(Out, "}\n");
             }
-          CreateActionBlock(Out, Bpp, RopInfo, 0);
-          MARK(Out);
+          if (ROPCODE_PATCOPY == RopInfo->RopCode)
+            {
+              /* A solid brush is a fill, which has its own fast paths */
+              Output(Out, "DIB_%uBPP_ColorFill(BltInfo->DestSurface, "
+                          "&BltInfo->DestRect, Pattern);\n", Bpp);
+            }
+          else
+            {
+              CreateActionBlock(Out, Bpp, RopInfo, 0);
+              MARK(Out);
+            }
           Output(Out, "}\n");
         }
       else
@@ -0,0 +1,421 @@
+/* COPYRIGHT:       See COPYING in the top level directory
+ * PROJECT:         Odyssey hive maker
+ * FILE:            tools/mkhive/hivetest.c
+ * PURPOSE:         Cell allocator test and benchmark
+ */
+
+/*
+ * Runs a random mix of cell allocations, reallocations and frees on an
+ * in-memory hive, checking after every batch that
+ *  - live cells still hold what was written to them,
+ *  - the cells of every bin add up to exactly the bin,
+ *  - no two free cells are adjacent, i.e. frees were coalesced,
+ *  - every free cell big enough to be tracked is on exactly one free
+ *    list, the lists are properly linked and the summary bits match.
+ * Once everything is freed again, each bin has to be a single free cell.
+ * Finally it times allocate/free pairs of typical key and value sizes.
+ *
+ * Returns 0 if all checks passed.
+ */
+
+#include <time.h>
+#include "mkhive.h"
+
+#define MAX_LIVE_CELLS 4096
+#define TEST_OPERATIONS 200000
+#define CHECK_INTERVAL 1000
+#define BENCH_OPERATIONS 2000000
+
+/* Layout of a tracked free cell, see hivecell.c */
+typedef struct _TEST_FREE_CELL
+{
+	HCELL Header;
+	HCELL_INDEX Next;
+	HCELL_INDEX Prev;
+} TEST_FREE_CELL, *PTEST_FREE_CELL;
+
+#define TEST_FREE_CELL_MIN_SIZE (sizeof(TEST_FREE_CELL) + sizeof(ULONG))
+
+typedef struct _TEST_CELL
+{
+	HCELL_INDEX Index;
+	ULONG Size;
+	UCHAR Fill;
+} TEST_CELL, *PTEST_CELL;
+
+static TEST_CELL LiveCells[MAX_LIVE_CELLS];
+static ULONG LiveCount;
+static ULONG Seed = 12345;
+static ULONG Errors;
+
+static PVOID
+NTAPI
+TestAllocate(
+	IN SIZE_T Size,
+	IN BOOLEAN Paged,
+	IN ULONG Tag)
+{
+	return (PVOID) malloc((size_t)Size);
+}
+
+static VOID
+NTAPI
+TestFree(
+	IN PVOID Ptr,
+	IN ULONG Quota)
+{
+	free(Ptr);
+}
+
+static BOOLEAN
+NTAPI
+TestFileRead(
+	IN PHHIVE RegistryHive,
+	IN ULONG FileType,
+	IN PULONG FileOffset,
+	OUT PVOID Buffer,
+	IN SIZE_T BufferLength)
+{
+	return FALSE;
+}
+
+static BOOLEAN
+NTAPI
+TestFileWrite(
+	IN PHHIVE RegistryHive,
+	IN ULONG FileType,
+	IN PULONG FileOffset,
+	IN PVOID Buffer,
+	IN SIZE_T BufferLength)
+{
+	return FALSE;
+}
+
+static BOOLEAN
+NTAPI
+TestFileSetSize(
+	IN PHHIVE RegistryHive,
+	IN ULONG FileType,
+	IN ULONG FileSize,
+	IN ULONG OldFileSize)
+{
+	return FALSE;
+}
+
+static BOOLEAN
+NTAPI
+TestFileFlush(
+	IN PHHIVE RegistryHive,
+	IN ULONG FileType,
+	PLARGE_INTEGER FileOffset,
+	ULONG Length)
+{
+	return FALSE;
+}
+
+static ULONG
+Random(ULONG Range)
+{
+	Seed = Seed * 1103515245 + 12345;
+	return (Seed >> 8) % Range;
+}
+
+/* Mostly small cells like keys and values, now and then a big one */
+static ULONG
+RandomCellSize(VOID)
+{
+	if (Random(16) == 0)
+		return 1 + Random(8000);
+	return 1 + Random(200);
+}
+
+#define Fail(...) \
+	do { printf(__VA_ARGS__); Errors++; } while (0)
+
+static VOID
+FillCell(PHHIVE Hive, PTEST_CELL Cell)
+{
+	memset(HvGetCell(Hive, Cell->Index), Cell->Fill, Cell->Size);
+}
+
+static VOID
+CheckCell(PHHIVE Hive, PTEST_CELL Cell)
+{
+	PUCHAR Data = HvGetCell(Hive, Cell->Index);
+	ULONG i;
+
+	if (Data == NULL)
+	{
+		Fail("cell %08x cannot be found\n", (unsigned)Cell->Index);
+		return;
+	}
+	if ((ULONG)HvGetCellSize(Hive, Data) < Cell->Size)
+	{
+		Fail("cell %08x is smaller than requested\n", (unsigned)Cell->Index);
+		return;
+	}
+	for (i = 0; i < Cell->Size; i++)
+	{
+		if (Data[i] != Cell->Fill)
+		{
+			Fail("cell %08x was overwritten at %u\n", (unsigned)Cell->Index, (unsigned)i);
+			return;
+		}
+	}
+}
+
+static PHCELL
+GetCellHeader(PHHIVE Hive, HCELL_INDEX Index)
+{
+	return (PHCELL)HvGetCell(Hive, Index) - 1;
+}
+
+/* Checks the bins and free lists of one storage, returns its free cell count */
+static ULONG
+CheckStorage(PHHIVE Hive, HSTORAGE_TYPE Storage)
+{
+	PDUAL Dual = &Hive->Storage[Storage];
+	ULONG BlockIndex, Offset, ListIndex, Tracked = 0, Listed = 0, FreeCount = 0;
+	BOOLEAN PreviousFree;
+	HCELL_INDEX Index, Prev;
+	PTEST_FREE_CELL FreeCell;
+	PHBIN Bin;
+	PHCELL Cell;
+	LONG Size;
+
+	BlockIndex = 0;
+	while (BlockIndex < Dual->Length)
+	{
+		Bin = (PHBIN)Dual->BlockList[BlockIndex].BinAddress;
+		if (Bin->FileOffset != BlockIndex * HV_BLOCK_SIZE)
+			Fail("bin at block %u has offset %x\n", (unsigned)BlockIndex, (unsigned)Bin->FileOffset);
+
+		PreviousFree = FALSE;
+		Offset = sizeof(HBIN);
+		while (Offset < Bin->Size)
+		{
+			Cell = (PHCELL)((ULONG_PTR)Bin + Offset);
+			Size = Cell->Size < 0 ? -Cell->Size : Cell->Size;
+			if (Size < (LONG)sizeof(HCELL) || Offset + Size > Bin->Size)
+			{
+				Fail("bad cell size %d at %x\n", (int)Cell->Size, (unsigned)(Bin->FileOffset + Offset));
+				return FreeCount;
+			}
+			if (Cell->Size > 0)
+			{
+				if (PreviousFree)
+					Fail("free cells at %x were not coalesced\n", (unsigned)(Bin->FileOffset + Offset));
+				if ((ULONG)Cell->Size >= TEST_FREE_CELL_MIN_SIZE)
+					Tracked++;
+				FreeCount++;
+			}
+			PreviousFree = (Cell->Size > 0);
+			Offset += Size;
+		}
+		if (Offset != Bin->Size)
+			Fail("cells overrun the bin at block %u\n", (unsigned)BlockIndex);
+
+		BlockIndex += Bin->Size / HV_BLOCK_SIZE;
+	}
+
+	for (ListIndex = 0; ListIndex < HFREE_DISPLAY_SIZE; ListIndex++)
+	{
+		if (!!(Dual->FreeSummary[ListIndex / 32] & (1U << (ListIndex % 32))) !=
+		    (Dual->FreeDisplay[ListIndex] != HCELL_NIL))
+			Fail("summary bit of free list %u is wrong\n", (unsigned)ListIndex);
+
+		Prev = HCELL_NIL;
+		for (Index = Dual->FreeDisplay[ListIndex]; Index != HCELL_NIL; Index = FreeCell->Next)
+		{
+			if (HvGetCellType(Index) != Storage)
+			{
+				Fail("free list %u holds cell %08x of the wrong storage\n", (unsigned)ListIndex, (unsigned)Index);
+				break;
+			}
+			FreeCell = (PTEST_FREE_CELL)GetCellHeader(Hive, Index);
+			if (FreeCell->Header.Size <= 0)
+			{
+				Fail("free list %u holds used cell %08x\n", (unsigned)ListIndex, (unsigned)Index);
+				break;
+			}
+			if (FreeCell->Prev != Prev)
+				Fail("free cell %08x has a bad back link\n", (unsigned)Index);
+			Prev = Index;
+			if (++Listed > Tracked)
+			{
+				Fail("free lists hold more cells than the bins\n");
+				return FreeCount;
+			}
+		}
+	}
+
+	if (Listed != Tracked)
+		Fail("%u free cells, but %u on free lists\n", (unsigned)Tracked, (unsigned)Listed);
+
+	return FreeCount;
+}
+
+static VOID
+CheckHive(PHHIVE Hive)
+{
+	ULONG i;
+
+	for (i = 0; i < LiveCount; i++)
+		CheckCell(Hive, &LiveCells[i]);
+	CheckStorage(Hive, Stable);
+	CheckStorage(Hive, Volatile);
+}
+
+static VOID
+RunTest(PHHIVE Hive)
+{
+	PTEST_CELL Cell;
+	HCELL_INDEX Index;
+	ULONG Operation, Choice, Bins;
+
+	for (Operation = 1; Operation <= TEST_OPERATIONS; Operation++)
+	{
+		Choice = Random(10);
+		if (LiveCount < MAX_LIVE_CELLS && (LiveCount == 0 || Choice < 5))
+		{
+			Cell = &LiveCells[LiveCount];
+			Cell->Size = RandomCellSize();
+			Cell->Index = HvAllocateCell(Hive, Cell->Size,
+			                             Random(4) ? Stable : Volatile, HCELL_NIL);
+			if (Cell->Index == HCELL_NIL)
+			{
+				Fail("allocation of %u bytes failed\n", (unsigned)Cell->Size);
+				return;
+			}
+			Cell->Fill = (UCHAR)Operation;
+			FillCell(Hive, Cell);
+			LiveCount++;
+		}
+		else if (Choice < 7)
+		{
+			/* Grow a cell, its old contents have to come along */
+			Cell = &LiveCells[Random(LiveCount)];
+			if (Cell->Size < 16000)
+			{
+				Index = HvReallocateCell(Hive, Cell->Index, Cell->Size + RandomCellSize());
+				if (Index == HCELL_NIL)
+				{
+					Fail("reallocation of %08x failed\n", (unsigned)Cell->Index);
+					return;
+				}
+				Cell->Index = Index;
+				CheckCell(Hive, Cell);
+			}
+		}
+		else
+		{
+			Choice = Random(LiveCount);
+			HvFreeCell(Hive, LiveCells[Choice].Index);
+			LiveCells[Choice] = LiveCells[--LiveCount];
+		}
+
+		if (Operation % CHECK_INTERVAL == 0)
+		{
+			CheckHive(Hive);
+			if (Errors)
+			{
+				printf("failed after %u operations\n", (unsigned)Operation);
+				return;
+			}
+		}
+	}
+
+	/* With everything freed, every bin must have coalesced into one cell */
+	while (LiveCount)
+		HvFreeCell(Hive, LiveCells[--LiveCount].Index);
+
+	Bins = 0;
+	for (Choice = Stable; Choice <= Volatile; Choice++)
+	{
+		for (Index = 0; Index < Hive->Storage[Choice].Length;
+		     Index += ((PHBIN)Hive->Storage[Choice].BlockList[Index].BinAddress)->Size / HV_BLOCK_SIZE)
+		{
+			Bins++;
+		}
+	}
+
+	/* The root key of the hive stays, its bin holds one more cell */
+	Choice = CheckStorage(Hive, Stable) + CheckStorage(Hive, Volatile);
+	if (Choice > Bins + 1)
+		Fail("%u free cells left in %u bins after freeing everything\n", (unsigned)Choice, (unsigned)Bins);
+
+	printf("%u operations, %u stable and %u volatile blocks\n",
+	       (unsigned)TEST_OPERATIONS,
+	       (unsigned)Hive->Storage[Stable].Length,
+	       (unsigned)Hive->Storage[Volatile].Length);
+}
+
+static VOID
+RunBenchmark(PHHIVE Hive)
+{
+	static HCELL_INDEX Cells[64];
+	clock_t Start, Elapsed;
+	ULONG i, Slot;
+
+	for (Slot = 0; Slot < 64; Slot++)
+		Cells[Slot] = HvAllocateCell(Hive, RandomCellSize(), Stable, HCELL_NIL);
+
+	/* Keep a working set of cells while replacing them at random */
+	Start = clock();
+	for (i = 0; i < BENCH_OPERATIONS; i++)
+	{
+		Slot = Random(64);
+		HvFreeCell(Hive, Cells[Slot]);
+		Cells[Slot] = HvAllocateCell(Hive, RandomCellSize(), Stable, HCELL_NIL);
+	}
+	Elapsed = clock() - Start;
+
+	for (Slot = 0; Slot < 64; Slot++)
+		HvFreeCell(Hive, Cells[Slot]);
+
+	printf("%u free/allocate pairs in %.0f ms, %.0f ns each\n",
+	       (unsigned)BENCH_OPERATIONS,
+	       Elapsed * 1000.0 / CLOCKS_PER_SEC,
+	       Elapsed * 1e9 / CLOCKS_PER_SEC / BENCH_OPERATIONS);
+}
+
+int main(int argc, char *argv[])
+{
+	PHHIVE Hive;
+	NTSTATUS Status;
+
+	/* HvFree releases the hive itself too */
+	Hive = TestAllocate(sizeof(HHIVE), FALSE, 0);
+	if (Hive == NULL)
+		return 1;
+	memset(Hive, 0, sizeof(HHIVE));
+	Status = HvInitialize(Hive,
+	                      HINIT_CREATE,
+	                      0,
+	                      0,
+	                      0,
+	                      TestAllocate,
+	                      TestFree,
+	                      TestFileSetSize,
+	                      TestFileWrite,
+	                      TestFileRead,
+	                      TestFileFlush,
+	                      1,
+	                      NULL);
+	if (!NT_SUCCESS(Status) || !CmCreateRootNode(Hive, L""))
+	{
+		printf("cannot create the test hive\n");
+		return 1;
+	}
+
+	RunTest(Hive);
+	if (!Errors)
+		RunBenchmark(Hive);
+	if (!Errors)
+		CheckStorage(Hive, Stable);
+
+	HvFree(Hive);
+
+	printf("%s\n", Errors ? "FAILED" : "passed");
+	return Errors ? 1 : 0;
+}